@@ -6,11 +6,23 @@ window.onerror = function (message, source, lineno, colno) {
 
 function esc(s) { return (s || "").replaceAll("&", "&amp;").replaceAll("<", "&lt;"); }
 
+// Streamed lists end with this marker instead of their closing brackets when
+// the data changed while they were sent (JSON_STREAM_ABORTED, JsonStream.h).
+const STREAM_ABORTED = "\n!aborted:";
+async function fetchText(path) {
+  for (let tries = 0; ; tries++) {
+    const r = await fetch(path, { cache: "no-store" });
+    const t = await r.text();
+    if (!t.includes(STREAM_ABORTED) || tries === 2) return { r, t };
+  }
+}
+
 async function apiGet(path) {
-  const r = await fetch(path, { cache: "no-store" });
-  const t = await r.text();
+  const { r, t } = await fetchText(path);
   if (!r.ok) throw new Error(t);
-  try { return JSON.parse(t); } catch { throw new Error("Bad JSON: " + t); }
+  let j;
+  try { j = JSON.parse(t); } catch { throw new Error("Bad JSON: " + t); }
+  return r.status === 202 ? waitJob(j.jobId) : j;
 }
 
 async function apiPost(path, obj) {
@@ -23,7 +35,20 @@ async function apiPost(path, obj) {
   let j;
   try { j = JSON.parse(t); } catch { j = { raw: t }; }
   if (!r.ok) throw new Error(j.error || t);
-  return j;
+  return r.status === 202 ? waitJob(j.jobId) : j;
+}
+
+// Blocking endpoints answer 202 {jobId}. Wake on the /wsstate job event,
+// with a slow poll as a fallback.
+const jobWaiters = new Map();
+async function waitJob(id) {
+  for (;;) {
+    await new Promise(res => { jobWaiters.set(id, res); setTimeout(res, 1000); });
+    jobWaiters.delete(id);
+    const j = await apiGet(`/api/jobs/${id}`);
+    if (j.state === "done") return j.result;
+    if (j.state === "failed") throw new Error(j.error || "job failed");
+  }
 }
 
 function setupTabs() {
@@ -48,14 +73,164 @@ function rssiLabel(rssi) {
 }
 
 async function refreshHealth() {
-  const h = await apiGet("/api/health");
+  renderHealth(await apiGet("/api/health"));
+}
+
+// ---------- State WS (snapshot + deltas, replaces health polling) ----------
+let wsState, stateDoc = null, stateVer = 0, stateUptimeAt = 0;
+function applyDelta(set, del) {
+  for (const path of del) {
+    const keys = path.split(".");
+    let o = stateDoc;
+    for (const k of keys.slice(0, -1)) if (o) o = o[k];
+    if (o && typeof o === "object") delete o[keys[keys.length - 1]];
+  }
+  for (const [path, val] of Object.entries(set)) {
+    const keys = path.split(".");
+    let o = stateDoc;
+    for (const k of keys.slice(0, -1)) o = (o[k] ??= {});
+    o[keys[keys.length - 1]] = val;
+  }
+}
+function connectStateWs() {
+  const proto = location.protocol === "https:" ? "wss" : "ws";
+  wsState = new WebSocket(`${proto}://${location.host}/wsstate`);
+  wsState.onmessage = (e) => {
+    const m = JSON.parse(e.data);
+    if (m.type === "job") {
+      if (m.state === "done" || m.state === "failed") jobWaiters.get(m.id)?.();
+      return;
+    }
+    if (m.type === "ota") {
+      otaProgress(m);
+      return;
+    }
+    if (m.type === "snapshot") {
+      stateDoc = m.state;
+      stateUptimeAt = Date.now();
+    } else if (m.type === "delta") {
+      if (!stateDoc || m.v !== stateVer + 1) {
+        wsState.send(JSON.stringify({ action: "snapshot" }));
+        return;
+      }
+      applyDelta(m.set || {}, m.del || []);
+    }
+    stateVer = m.v;
+    renderHealth(stateDoc);
+  };
+  wsState.onclose = () => { stateDoc = null; setTimeout(connectStateWs, 1000); };
+}
+// OTA progress from the device (bytes flashed, not just bytes sent).
+let otaBar = null;
+function otaProgress(m) {
+  const pct = m.total ? Math.min(100, Math.round(m.received * 100 / m.total)) : 0;
+  if (otaBar) otaBar.style.width = pct + "%";
+  let line = `${m.target}: ${m.state} ${pct}% • ${(m.received / 1024).toFixed(0)} KB received` +
+    ` • ${(m.written / 1024).toFixed(0)} KB written${m.gzip ? " (gzip)" : ""} • ${m.kBps} kB/s`;
+  if (m.sha256) line += `\nsha256 ${m.sha256}`;
+  if (m.error) line += `\nError: ${m.error}`;
+  $("otaOut").textContent = line;
+}
+// SHA-256 in plain JS for OTA images: crypto.subtle only exists on https://
+// pages, and the device is served over http://.
+const SHA256_K = new Uint32Array([
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+]);
+class Sha256 {
+  constructor() {
+    this.h = new Uint32Array([
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    ]);
+    this.w = new Uint32Array(64);
+    this.buf = new Uint8Array(64);
+    this.len = 0;   // bytes waiting in buf
+    this.total = 0; // bytes hashed so far
+  }
+  update(data) {
+    let i = 0;
+    this.total += data.length;
+    if (this.len) {
+      i = Math.min(64 - this.len, data.length);
+      this.buf.set(data.subarray(0, i), this.len);
+      this.len += i;
+      if (this.len < 64) return;
+      this.block(this.buf, 0);
+      this.len = 0;
+    }
+    for (; i + 64 <= data.length; i += 64) this.block(data, i);
+    this.buf.set(data.subarray(i), 0);
+    this.len = data.length - i;
+  }
+  block(p, o) {
+    const w = this.w;
+    for (let t = 0; t < 16; t++, o += 4) w[t] = p[o] << 24 | p[o + 1] << 16 | p[o + 2] << 8 | p[o + 3];
+    for (let t = 16; t < 64; t++) {
+      const x = w[t - 15], y = w[t - 2];
+      const s0 = (x >>> 7 | x << 25) ^ (x >>> 18 | x << 14) ^ (x >>> 3);
+      const s1 = (y >>> 17 | y << 15) ^ (y >>> 19 | y << 13) ^ (y >>> 10);
+      w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+    }
+    let [a, b, c, d, e, f, g, h] = this.h;
+    for (let t = 0; t < 64; t++) {
+      const s1 = (e >>> 6 | e << 26) ^ (e >>> 11 | e << 21) ^ (e >>> 25 | e << 7);
+      const t1 = (h + s1 + (e & f ^ ~e & g) + SHA256_K[t] + w[t]) | 0;
+      const s0 = (a >>> 2 | a << 30) ^ (a >>> 13 | a << 19) ^ (a >>> 22 | a << 10);
+      const t2 = (s0 + (a & b ^ a & c ^ b & c)) | 0;
+      h = g; g = f; f = e; e = (d + t1) | 0;
+      d = c; c = b; b = a; a = (t1 + t2) | 0;
+    }
+    const v = [a, b, c, d, e, f, g, h];
+    for (let i = 0; i < 8; i++) this.h[i] += v[i];
+  }
+  hex() {
+    const bits = this.total * 8;
+    const pad = new Uint8Array((this.len < 56 ? 64 : 128) - this.len);
+    pad[0] = 0x80;
+    const tail = new DataView(pad.buffer, pad.length - 8);
+    tail.setUint32(0, Math.floor(bits / 0x100000000));
+    tail.setUint32(4, bits >>> 0);
+    this.update(pad);
+    return Array.from(this.h, (x) => x.toString(16).padStart(8, "0")).join("");
+  }
+}
+// The digest the device checks: of the image as flashed, so a gzip file is
+// hashed after inflating (what `sha256sum firmware.bin` prints). null if the
+// browser can't inflate it.
+async function imageSha256(file) {
+  const head = new Uint8Array(await file.slice(0, 2).arrayBuffer());
+  let stream = file.stream();
+  if (head[0] === 0x1f && head[1] === 0x8b) {
+    if (typeof DecompressionStream === "undefined") return null;
+    stream = stream.pipeThrough(new DecompressionStream("gzip"));
+  }
+  const sha = new Sha256();
+  const reader = stream.getReader();
+  for (;;) {
+    const { done, value } = await reader.read();
+    if (done) return sha.hex();
+    sha.update(value);
+  }
+}
+// Uptime isn't pushed; tick it locally from the last snapshot.
+function stateUptime() {
+  return stateDoc.uptime_s + Math.floor((Date.now() - stateUptimeAt) / 1000);
+}
+
+function renderHealth(h) {
 
   const sta = h.wifi.staConnected
     ? `STA ✓ ${h.wifi.staIp} (${h.wifi.staSsid}) RSSI ${h.wifi.rssi}`
     : "STA ✗ disconnected";
 
   $("healthLine").textContent =
-    `FW ${h.fw} | ${sta} | AP ${h.wifi.apIp} (${h.wifi.apSsid || "AP SSID not set"}) | Uptime ${h.uptime_s}s | Heap ${h.heap_free}`;
+    `FW ${h.fw} | ${sta} | AP ${h.wifi.apIp} (${h.wifi.apSsid || "AP SSID not set"}) | Uptime ${h === stateDoc ? stateUptime() : h.uptime_s}s | Heap ${h.heap_free}`;
 
   // Big obvious line on the Wi-Fi page
   if (h.wifi.staConnected) {
@@ -68,6 +243,22 @@ async function refreshHealth() {
 
   $("learnEnabled").checked = !!h.learn.enabled;
   $("learnPort").value = h.learn.port;
+  if (document.activeElement !== $("learnUdpPorts"))
+    $("learnUdpPorts").value = (h.learn.udpPorts || []).join(",");
+  if (document.activeElement !== $("learnUartBaud"))
+    $("learnUartBaud").value = h.learn.uartBaud || 0;
+
+  if (h.term) {
+    if (document.activeElement !== $("termMaxSessions"))
+      $("termMaxSessions").value = h.term.maxSessions;
+    $("termSessLine").textContent = `${(h.term.sessions || []).length} open`;
+  }
+
+  if (h.bridge) {
+    $("bridgeLine").textContent = h.bridge.running
+      ? `Running :${h.bridge.port} @${h.bridge.baud} | client ${h.bridge.clientConnected ? "connected" : "none"} | to UART ${h.bridge.bytesToUart}B, from UART ${h.bridge.bytesFromUart}B`
+      : "Stopped";
+  }
 }
 
 async function loadWifiForm() {
@@ -109,8 +300,10 @@ function populateScan(res) {
     setStatus("Error rendering list: " + e.message);
   }
 
-  if (!nets.length) setStatus("No networks found (UI).\nRaw: " + JSON.stringify(res));
-  else setStatus(`Found ${nets.length} networks.\n` + (res.note || ""));
+  if (!nets.length && res.scanning) setStatus("Scanning...");
+  else if (!nets.length) setStatus("No networks found (UI).\nRaw: " + JSON.stringify(res));
+  else setStatus(`Found ${nets.length} networks.\n` +
+    (res.scanning ? "Scanning..." : (res.note || "")));
 }
 
 async function scanCached() {
@@ -123,9 +316,16 @@ async function scanCached() {
 }
 
 async function scanFresh() {
-  setStatus("Starting fresh scan (this may take 5s)...");
+  setStatus("Scanning...");
   try {
-    populateScan(await apiGet("/api/wifi/scan?fresh=1"));
+    // The scan runs in the background; show the cache while it fills in.
+    let res = await apiGet("/api/wifi/scan?fresh=1");
+    populateScan(res);
+    for (let i = 0; res.scanning && i < 30; i++) {
+      await new Promise(r => setTimeout(r, 500));
+      res = await apiGet("/api/wifi/scan");
+      populateScan(res);
+    }
   } catch (e) {
     setStatus("Fresh scan failed: " + e.message);
   }
@@ -143,7 +343,10 @@ function logLine(s) {
 function connectLogWs() {
   const proto = location.protocol === "https:" ? "wss" : "ws";
   wsLog = new WebSocket(`${proto}://${location.host}/ws`);
-  wsLog.onmessage = (e) => logLine(e.data);
+  // The first message after connecting is the firmware's recent backlog;
+  // lines arrive batched and '\n'-separated.
+  wsLog.onopen = () => { $("log").textContent = ""; };
+  wsLog.onmessage = (e) => e.data.split("\n").forEach(logLine);
   wsLog.onclose = () => setTimeout(connectLogWs, 1000);
 }
 
@@ -156,13 +359,76 @@ function termLine(html) {
   el.appendChild(div);
   el.scrollTop = el.scrollHeight;
 }
+// Byte -> "XX" / printable char, built once; rx frames are rendered here
+// instead of on the device.
+const HEX_TAB = Array.from({ length: 256 }, (_, i) => i.toString(16).toUpperCase().padStart(2, "0"));
+const ASCII_TAB = Array.from({ length: 256 }, (_, i) => (i >= 32 && i <= 126) ? String.fromCharCode(i) : ".");
+const TERM_FRAME_RX = 0x01, TERM_FRAME_HISTORY = 0x02, TERM_FRAME_HDR = 9;
+
+// Session id survives page reloads in this tab so we can reattach and get
+// the server-side scrollback replayed.
+let termOldestSeq = 0;
+let termHistoryBatch = [];
+
+function termRxHtml(bytes) {
+  const hex = new Array(bytes.length);
+  let ascii = "";
+  for (let i = 0; i < bytes.length; i++) {
+    hex[i] = HEX_TAB[bytes[i]];
+    ascii += ASCII_TAB[bytes[i]];
+  }
+  return `<span class="rx">RX</span> <span class="mono">${hex.join(" ")}</span><div class="mono small">${esc(ascii)}</div>`;
+}
+
+function termFrameSeq(u8) {
+  return new DataView(u8.buffer, u8.byteOffset + 1, 4).getUint32(0, true);
+}
+
+function termHistoryDone(msg) {
+  const el = $("termOut");
+  if (msg.replay) el.innerHTML = "";
+  const frag = document.createDocumentFragment();
+  termHistoryBatch.forEach(html => {
+    const div = document.createElement("div");
+    div.innerHTML = html;
+    frag.appendChild(div);
+  });
+  if (msg.replay) {
+    el.appendChild(frag);
+    el.scrollTop = el.scrollHeight;
+  } else {
+    el.insertBefore(frag, el.firstChild);
+  }
+  termHistoryBatch = [];
+  if (msg.count) termOldestSeq = msg.first;
+  $("btnTermOlder").disabled = !msg.count || msg.first <= msg.oldest;
+}
+
 function connectTermWs() {
   const proto = location.protocol === "https:" ? "wss" : "ws";
   wsTerm = new WebSocket(`${proto}://${location.host}/term`);
+  wsTerm.binaryType = "arraybuffer";
+  wsTerm.onopen = () => {
+    const sid = Number(sessionStorage.getItem("termSid") || 0);
+    if (sid) wsTerm.send(JSON.stringify({ action: "attach", sid }));
+  };
   wsTerm.onmessage = (e) => {
+    if (e.data instanceof ArrayBuffer) {
+      const u8 = new Uint8Array(e.data);
+      if (u8.length < TERM_FRAME_HDR) return;
+      if (u8[0] === TERM_FRAME_RX) {
+        if (!termOldestSeq) termOldestSeq = termFrameSeq(u8);
+        termLine(termRxHtml(u8.subarray(TERM_FRAME_HDR)));
+      } else if (u8[0] === TERM_FRAME_HISTORY) {
+        termHistoryBatch.push(termRxHtml(u8.subarray(TERM_FRAME_HDR)));
+      }
+      return;
+    }
     try {
       const msg = JSON.parse(e.data);
-      if (msg.type === "status") termLine(`<span class="muted">STATUS:</span> connected=${msg.connected} ${esc(msg.host || "")}:${esc(String(msg.port || ""))}`);
+      if (msg.type === "history") { termHistoryDone(msg); return; }
+      if (msg.sid) sessionStorage.setItem("termSid", String(msg.sid));
+      if (msg.type === "status") termLine(`<span class="muted">STATUS:</span> connected=${msg.connected} ${esc(msg.transport || "")} ${msg.transport === "uart" ? "@" + esc(String(msg.baud || "")) : esc(msg.host || "") + ":" + esc(String(msg.port || ""))}`);
       else if (msg.type === "rx") termLine(`<span class="rx">RX</span> <span class="mono">${esc(msg.hex)}</span><div class="mono small">${esc(msg.ascii)}</div>`);
       else if (msg.type === "tx") termLine(`<span class="tx">TX</span> ok`);
       else if (msg.type === "error") termLine(`<span class="err">ERR</span> ${esc(msg.msg)}`);
@@ -189,8 +455,8 @@ function connectProxyWs() {
   wsProxy.onmessage = (e) => {
     try {
       const msg = JSON.parse(e.data);
-      if (msg.type === "status") proxyLine(`<span class="muted">STATUS:</span> running=${msg.running} connected=${msg.connected ?? ""} listen=${msg.listenPort ?? ""} target=${esc(msg.targetHost || "")}:${msg.targetPort || ""} capToLearn=${msg.captureToLearn ?? ""}`);
-      else if (msg.type === "data") proxyLine(`<span class="mono small">${esc(msg.dir)}</span><div><span class="mono">${esc(msg.hex)}</span></div><div class="mono small">${esc(msg.ascii)}</div>`);
+      if (msg.type === "status") proxyLine(`<span class="muted">STATUS:</span> running=${msg.running} proto=${esc(msg.proto || "")} connected=${msg.connected ?? ""} listen=${msg.listenPort ?? ""} target=${esc(msg.targetHost || "")}:${msg.targetPort || ""} capToLearn=${msg.captureToLearn ?? ""}`);
+      else if (msg.type === "data") proxyLine(`<span class="mono small">${esc(msg.proto || "tcp")} ${esc(msg.dir)}</span><div><span class="mono">${esc(msg.hex)}</span></div><div class="mono small">${esc(msg.ascii)}</div>`);
       else if (msg.type === "error") proxyLine(`<span class="err">ERR</span> ${esc(msg.msg)}`);
       else proxyLine(`<span class="muted">${esc(e.data)}</span>`);
     } catch {
@@ -323,13 +589,14 @@ async function refreshCaps() {
     el.innerHTML = `
       <div class="row between">
         <div>
-          <b class="mono">${esc(c.id)}</b>
-          <div class="mono small">${esc(c.srcIp)}:${c.srcPort} (local ${c.localPort}) ${c.pinned ? "📌" : ""} ${c.repeats > 1 ? "x" + c.repeats : ""}</div>
+          <b class="mono">#${c.id}</b>
+          <div class="mono small">${esc(c.proto || "tcp")} ${esc(c.srcIp)}:${c.srcPort} (local ${c.localPort}) ${c.pinned ? "📌" : ""} ${c.repeats > 1 ? "x" + c.repeats : ""}</div>
           <div class="mono small">hint: <b>${esc(c.suffixHint || "(none)")}</b> [${esc(c.payloadType || "?")}]</div>
         </div>
         <div class="row">
-          <button class="btn tiny" data-use="${esc(c.id)}">Use</button>
-          <button class="btn tiny" data-pin="${esc(c.id)}">${c.pinned ? "Unpin" : "Pin"}</button>
+          <button class="btn tiny" data-use>Use</button>
+          <button class="btn tiny" data-pin>${c.pinned ? "Unpin" : "Pin"}</button>
+          <button class="btn tiny danger" data-del>Del</button>
         </div>
       </div>
       <div class="mono small">HEX: ${esc(c.hex)}</div>
@@ -337,7 +604,12 @@ async function refreshCaps() {
     `;
 
     el.querySelector("[data-pin]").onclick = async () => {
-      await apiPost("/api/capture/pin", { id: c.id, pin: !c.pinned });
+      await apiPost("/api/captures/pin", { ids: [c.id], pin: !c.pinned });
+      await refreshCaps();
+    };
+
+    el.querySelector("[data-del]").onclick = async () => {
+      await apiPost("/api/captures/delete", { ids: [c.id] });
       await refreshCaps();
     };
 
@@ -376,6 +648,7 @@ async function loadDevices() {
         <div class="row">
           ${d.mac ? `<button class="btn tiny" data-wake="${esc(d.mac)}">Wake</button>` : ""}
           <button class="btn tiny" data-open-term="${esc(ip)}" data-port="${esc(String(port))}" data-suf="${esc(suffix)}">Terminal</button>
+          ${tpl ? `<button class="btn tiny" data-macro>Macro</button>` : ""}
           <a class="btn tiny" href="http://${ip}/" target="_blank" rel="noopener">HTTP</a>
           <button class="btn tiny danger" data-del="${esc(d.id)}">Del</button>
         </div>
@@ -394,6 +667,9 @@ async function loadDevices() {
         }
       };
     };
+    if (el.querySelector("[data-macro]")) {
+      el.querySelector("[data-macro]").onclick = () => runMacro(d);
+    }
     el.querySelector("[data-del]").onclick = async () => {
       if (!confirm(`Delete device "${d.name}"?`)) return;
       try {
@@ -407,6 +683,24 @@ async function loadDevices() {
   });
 }
 
+async function runMacro(d) {
+  const name = prompt(`Macro to run on "${d.name}" (from template ${d.templateId}):`);
+  if (!name) return;
+  try {
+    const { runId } = await apiPost("/api/macro/run", { deviceId: d.id, macro: name });
+    setStatus(`Macro ${name}: running (#${runId})`);
+    let st;
+    do {
+      await new Promise(r => setTimeout(r, 500));
+      st = await apiGet(`/api/macro/status?id=${runId}`);
+    } while (st.state === "running");
+    const steps = (st.steps || []).map(s => `${s.i}:${s.op} ${s.ok ? "ok" : "FAIL"} ${s.ms}ms`).join(", ");
+    setStatus(`Macro ${name}: ${st.state} in ${st.totalMs}ms${st.error ? " - " + st.error : ""} [${steps}]`);
+  } catch (e) {
+    alert("Macro failed: " + e.message);
+  }
+}
+
 // ---------- Backup ----------
 function downloadText(filename, text) {
   const blob = new Blob([text], { type: "application/json" });
@@ -429,7 +723,8 @@ window.onload = async () => {
 
   await loadWifiForm();
   await refreshHealth();
-  setInterval(refreshHealth, 2000);
+  connectStateWs();
+  setInterval(() => { if (stateDoc) renderHealth(stateDoc); }, 1000);
 
   // Wi-Fi
   scanCached().catch(e => setStatus("Scan failed: " + e.message));
@@ -472,11 +767,36 @@ window.onload = async () => {
 
   // Terminal
   $("btnTermConnect").onclick = () => {
+    const transport = $("termTransport").value;
     const host = $("termHost").value.trim();
     const port = Number($("termPort").value);
-    wsTerm.send(JSON.stringify({ action: "connect", host, port }));
+    const baud = Number($("termBaud").value || 9600);
+    wsTerm.send(JSON.stringify({ action: "connect", transport, host, port, baud }));
+  };
+  $("btnTermCfg").onclick = async () => {
+    try {
+      await apiPost("/api/term/config", { maxSessions: Number($("termMaxSessions").value || 4) });
+      await refreshHealth();
+    } catch (e) {
+      $("termSessLine").textContent = "Error: " + e.message;
+    }
+  };
+  $("btnBridgeSave").onclick = async () => {
+    try {
+      await apiPost("/api/bridge", {
+        enabled: $("bridgeEnabled").checked,
+        port: Number($("bridgePort").value || 4001),
+        baud: Number($("bridgeBaud").value || 9600)
+      });
+      await refreshHealth();
+    } catch (e) {
+      $("bridgeLine").textContent = "Bridge error: " + e.message;
+    }
   };
   $("btnTermDisconnect").onclick = () => wsTerm.send(JSON.stringify({ action: "disconnect" }));
+  $("btnTermOlder").onclick = () => {
+    if (termOldestSeq) wsTerm.send(JSON.stringify({ action: "history", before: termOldestSeq, count: 32 }));
+  };
   $("btnTermSend").onclick = () => {
     const mode = $("termMode").value;
     const suffix = $("termSuffix").value;
@@ -519,7 +839,9 @@ window.onload = async () => {
     const targetHost = $("proxyTargetHost").value.trim();
     const targetPort = Number($("proxyTargetPort").value || 0);
     const captureToLearn = $("proxyCapToLearn").checked;
-    await apiPost("/api/proxy/start", { listenPort, targetHost, targetPort, captureToLearn });
+    const proto = $("proxyProto").value;
+    const targetBaud = Number($("proxyTargetBaud").value || 9600);
+    await apiPost("/api/proxy/start", { proto, listenPort, targetHost, targetPort, targetBaud, captureToLearn });
   };
   $("btnProxyStop").onclick = async () => {
     await apiPost("/api/proxy/stop", {});
@@ -527,7 +849,9 @@ window.onload = async () => {
 
   // Learn
   $("btnSaveLearner").onclick = async () => {
-    await apiPost("/api/learner", { enabled: $("learnEnabled").checked, port: Number($("learnPort").value) });
+    const udpPorts = $("learnUdpPorts").value.split(",").map(x => Number(x.trim())).filter(n => n > 0 && n < 65536);
+    const uartBaud = Number($("learnUartBaud").value || 0);
+    await apiPost("/api/learner", { enabled: $("learnEnabled").checked, port: Number($("learnPort").value), udpPorts, uartBaud });
     await refreshHealth();
     await refreshCaps();
   };
@@ -773,7 +1097,9 @@ window.onload = async () => {
 
   // Backup
   $("btnLoadCfg").onclick = async () => {
-    $("cfgText").value = await fetch("/api/config", { cache: "no-store" }).then(r => r.text());
+    const { t } = await fetchText("/api/config");
+    try { JSON.parse(t); } catch { $("cfgOut").textContent = "Config changed while loading, try again."; return; }
+    $("cfgText").value = t;
     $("cfgOut").textContent = "Loaded.";
   };
   $("btnDownloadCfg").onclick = () => downloadText("esp32-av-tool-config.json", $("cfgText").value);
@@ -792,31 +1118,51 @@ window.onload = async () => {
     document.querySelector(`.tab[data-tab="tab-update"]`).click();
   };
 
-  async function performUpdate(fileInputId, type, progId) {
+  async function performUpdate(fileInputId, type, progId, shaId) {
     const info = $(progId);
     const file = $(fileInputId).files[0];
     if (!file) {
       alert("Select a file first.");
       return;
     }
+    // The device refuses an image without its SHA-256. A digest typed in
+    // (e.g. from the release notes) is checked against the file first.
+    const given = $(shaId).value.trim().toLowerCase();
+    $("otaOut").textContent = "Computing SHA-256...";
+    let sha = await imageSha256(file).catch(() => null);
+    if (sha && given && sha !== given) {
+      $("otaOut").textContent = `The file's SHA-256 is ${sha}, not the one entered.`;
+      return;
+    }
+    sha = sha || given;
+    if (!sha) {
+      $("otaOut").textContent = "This browser can't inflate the .gz to hash it; enter the SHA-256 of the .bin.";
+      return;
+    }
+
     info.style.display = "block";
     info.firstElementChild.style.width = "0%";
+    otaBar = info.firstElementChild;
+
+    const url = "/update?type=" + type + "&sha256=" + sha;
 
-    // Generic XHR for progress
+    // Upload progress until the device's own events (via /wsstate) arrive.
     const xhr = new XMLHttpRequest();
-    xhr.open("POST", "/update?type=" + type);
+    xhr.open("POST", url);
     xhr.upload.onprogress = (e) => {
-      if (e.lengthComputable) {
+      if (e.lengthComputable && !stateDoc) {
         const pct = Math.round((e.loaded / e.total) * 100);
         info.firstElementChild.style.width = pct + "%";
       }
     };
     xhr.onload = () => {
+      let res = {};
+      try { res = JSON.parse(xhr.responseText); } catch { }
       if (xhr.status === 200) {
         info.firstElementChild.style.width = "100%";
-        $("otaOut").textContent = "Update complete. Rebooting...";
+        $("otaOut").textContent = "Update complete. Rebooting...\nsha256 " + (res.sha256 || "");
       } else {
-        $("otaOut").textContent = "Error: " + xhr.status + " " + xhr.responseText;
+        $("otaOut").textContent = "Error: " + xhr.status + " " + (res.error || xhr.responseText);
       }
     };
     xhr.onerror = () => {
@@ -828,8 +1174,8 @@ window.onload = async () => {
     xhr.send(formData);
   }
 
-  $("btnUpdateFw").onclick = () => performUpdate("fileFw", "firmware", "progFw");
-  $("btnUpdateFs").onclick = () => performUpdate("fileFs", "fs", "progFs");
+  $("btnUpdateFw").onclick = () => performUpdate("fileFw", "firmware", "progFw", "shaFw");
+  $("btnUpdateFs").onclick = () => performUpdate("fileFs", "fs", "progFs", "shaFs");
 
   $("btnRollback").onclick = async () => {
     if (!confirm("Confirm rollback to previous firmware version?")) return;
@@ -0,0 +1,121 @@
+// Just enough of the Arduino-ESP32 core to compile the portable firmware
+// sources on Linux for the native_* environments (Utils.cpp for
+// native_bench, AVDiscovery.cpp and CaptureProxy.cpp for native_sim). Not a
+// general replacement: add what a newly built source needs, with the same
+// semantics as the core.
+#ifndef HOST_ARDUINO_SHIM_H
+#define HOST_ARDUINO_SHIM_H
+
+#include <algorithm>
+#include <chrono>
+#include <ctype.h>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+using std::max;
+using std::min;
+
+class String : public std::string {
+public:
+  String() {}
+  String(const char *s) : std::string(s ? s : "") {}
+  String(const std::string &s) : std::string(s) {}
+  explicit String(char c) : std::string(1, c) {}
+  explicit String(int v) : std::string(std::to_string(v)) {}
+  explicit String(unsigned v) : std::string(std::to_string(v)) {}
+  explicit String(long v) : std::string(std::to_string(v)) {}
+  explicit String(unsigned long v) : std::string(std::to_string(v)) {}
+
+  bool reserve(size_t n) {
+    std::string::reserve(n);
+    return true;
+  }
+  int indexOf(char c, size_t from = 0) const {
+    size_t at = find(c, from);
+    return at == npos ? -1 : (int)at;
+  }
+  int indexOf(const char *s, size_t from = 0) const {
+    size_t at = find(s, from);
+    return at == npos ? -1 : (int)at;
+  }
+  int lastIndexOf(char c) const {
+    size_t at = rfind(c);
+    return at == npos ? -1 : (int)at;
+  }
+  String substring(size_t from, size_t to = npos) const {
+    if (from >= size())
+      return String();
+    return substr(from, to == npos ? npos : to - from);
+  }
+  bool startsWith(const char *p) const { return compare(0, strlen(p), p) == 0; }
+  bool endsWith(const char *p) const {
+    size_t n = strlen(p);
+    return size() >= n && compare(size() - n, n, p) == 0;
+  }
+  void trim() {
+    size_t b = 0, e = size();
+    while (b < e && isspace((unsigned char)(*this)[b]))
+      b++;
+    while (e > b && isspace((unsigned char)(*this)[e - 1]))
+      e--;
+    *this = substr(b, e - b);
+  }
+  void toLowerCase() {
+    for (char &c : *this)
+      c = (char)tolower((unsigned char)c);
+  }
+  long toInt() const { return strtol(c_str(), nullptr, 10); }
+
+  // Lets ArduinoJson's generic writer serialize into a String.
+  size_t write(uint8_t c) {
+    push_back((char)c);
+    return 1;
+  }
+  size_t write(const uint8_t *s, size_t n) {
+    append((const char *)s, n);
+    return n;
+  }
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buf, size_t len) {
+    size_t n = 0;
+    while (len-- && write(*buf++))
+      n++;
+    return n;
+  }
+  size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t print(const String &s) {
+    return write((const uint8_t *)s.c_str(), s.length());
+  }
+};
+
+inline uint32_t millis() {
+  using namespace std::chrono;
+  static const steady_clock::time_point start = steady_clock::now();
+  return (uint32_t)duration_cast<milliseconds>(steady_clock::now() - start)
+      .count();
+}
+
+inline void delay(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline uint32_t esp_random() {
+  static std::mt19937 rng(12345);
+  return rng();
+}
+
+#endif
@@ -0,0 +1,276 @@
+#include "AsyncTCP.h"
+#include "HostEventLoop.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static HostEventLoop tcpLoop("async_tcp");
+static const size_t RX_CHUNK = 1436; // one TCP_MSS pbuf, as lwIP hands over
+static const int8_t ERR_CONN = -14;
+
+static sockaddr_in sockAddr(const IPAddress &ip, uint16_t port) {
+  sockaddr_in a = {};
+  a.sin_family = AF_INET;
+  a.sin_port = htons(port);
+  a.sin_addr.s_addr = (uint32_t)ip; // both are network byte order
+  return a;
+}
+
+AsyncClient::~AsyncClient() {
+  std::lock_guard<std::mutex> lock(mu);
+  if (fd < 0)
+    return;
+  tcpLoop.remove(this, fd);
+  ::close(fd);
+  fd = -1;
+}
+
+static void registerClient(AsyncClient *c, int fd, uint32_t events) {
+  tcpLoop.add(
+      c, fd, events, [c](uint32_t e) { c->handleEvent(e); },
+      [c]() { c->handlePoll(); });
+}
+
+bool AsyncClient::connect(IPAddress ip, uint16_t port) {
+  std::lock_guard<std::mutex> lock(mu);
+  if (fd >= 0)
+    return false;
+  int s = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (s < 0)
+    return false;
+  sockaddr_in a = sockAddr(ip, port);
+  if (::connect(s, (sockaddr *)&a, sizeof(a)) < 0 && errno != EINPROGRESS) {
+    ::close(s);
+    return false;
+  }
+  fd = s;
+  connecting = true;
+  peerIp = ip;
+  peerPort = port;
+  registerClient(this, fd, EPOLLOUT | EPOLLIN | EPOLLRDHUP);
+  return true;
+}
+
+bool AsyncClient::connected() {
+  std::lock_guard<std::mutex> lock(mu);
+  return isConnected;
+}
+
+size_t AsyncClient::write(const char *data, size_t len) {
+  std::lock_guard<std::mutex> lock(mu);
+  if (fd < 0 || !isConnected)
+    return 0;
+  // Like tcp_write() with a full send buffer: what doesn't fit is refused.
+  ssize_t n = send(fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+  return n > 0 ? (size_t)n : 0;
+}
+
+void AsyncClient::close(bool) { finish(0); }
+
+void AsyncClient::setNoDelay(bool on) {
+  std::lock_guard<std::mutex> lock(mu);
+  int v = on;
+  if (fd >= 0)
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &v, sizeof(v));
+}
+
+void AsyncClient::onConnect(AcConnectHandler cb, void *arg) {
+  std::lock_guard<std::mutex> lock(mu);
+  connectCb = cb;
+  connectArg = arg;
+}
+
+void AsyncClient::onDisconnect(AcConnectHandler cb, void *arg) {
+  std::lock_guard<std::mutex> lock(mu);
+  disconnectCb = cb;
+  disconnectArg = arg;
+}
+
+void AsyncClient::onData(AcDataHandler cb, void *arg) {
+  std::lock_guard<std::mutex> lock(mu);
+  dataCb = cb;
+  dataArg = arg;
+}
+
+void AsyncClient::onError(AcErrorHandler cb, void *arg) {
+  std::lock_guard<std::mutex> lock(mu);
+  errorCb = cb;
+  errorArg = arg;
+}
+
+void AsyncClient::onPoll(AcConnectHandler cb, void *arg) {
+  std::lock_guard<std::mutex> lock(mu);
+  pollCb = cb;
+  pollArg = arg;
+}
+
+AsyncClient *AsyncClient::adopt(int s) {
+  AsyncClient *c = new AsyncClient();
+  c->fd = s;
+  c->isConnected = true;
+  c->addresses();
+  registerClient(c, s, EPOLLIN | EPOLLRDHUP);
+  return c;
+}
+
+// Caller holds mu.
+void AsyncClient::addresses() {
+  sockaddr_in a = {};
+  socklen_t len = sizeof(a);
+  if (getpeername(fd, (sockaddr *)&a, &len) == 0) {
+    peerIp = IPAddress((uint32_t)a.sin_addr.s_addr);
+    peerPort = ntohs(a.sin_port);
+  }
+  len = sizeof(a);
+  if (getsockname(fd, (sockaddr *)&a, &len) == 0)
+    ownPort = ntohs(a.sin_port);
+}
+
+// Closes the socket and reports it, error first, as AsyncTCP does. The
+// disconnect handler may delete us, so nothing touches `this` after it.
+void AsyncClient::finish(int8_t err) {
+  AcErrorHandler onErr;
+  AcConnectHandler onDisc;
+  void *errArg, *discArg;
+  {
+    std::lock_guard<std::mutex> lock(mu);
+    if (fd < 0)
+      return;
+    tcpLoop.remove(this, fd);
+    ::close(fd);
+    fd = -1;
+    isConnected = connecting = false;
+    onErr = errorCb;
+    errArg = errorArg;
+    onDisc = disconnectCb;
+    discArg = disconnectArg;
+  }
+  if (err && onErr)
+    onErr(errArg, this, err);
+  if (onDisc)
+    onDisc(discArg, this);
+}
+
+// One read per wakeup (epoll is level triggered), with the data handler
+// called last: it may close or delete the client.
+void AsyncClient::handleEvent(uint32_t events) {
+  AcConnectHandler onConn;
+  void *connArg = nullptr;
+  bool refused = false;
+  {
+    std::lock_guard<std::mutex> lock(mu);
+    if (fd < 0)
+      return;
+    if (connecting) {
+      if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+        return;
+      int err = 0;
+      socklen_t len = sizeof(err);
+      if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && !err) {
+        connecting = false;
+        isConnected = true;
+        addresses();
+        tcpLoop.modify(this, fd, EPOLLIN | EPOLLRDHUP);
+        onConn = connectCb;
+        connArg = connectArg;
+      } else {
+        refused = true;
+      }
+    }
+  }
+  if (refused) {
+    finish(ERR_CONN);
+    return;
+  }
+  if (onConn) {
+    onConn(connArg, this);
+    return;
+  }
+
+  uint8_t buf[RX_CHUNK];
+  ssize_t n;
+  int rxErr;
+  AcDataHandler onRx;
+  void *rxArg;
+  {
+    std::lock_guard<std::mutex> lock(mu);
+    if (fd < 0)
+      return;
+    n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+    rxErr = errno;
+    onRx = dataCb;
+    rxArg = dataArg;
+  }
+  if (n > 0) {
+    if (onRx)
+      onRx(rxArg, this, buf, (size_t)n);
+    return;
+  }
+  if (n < 0 && (rxErr == EAGAIN || rxErr == EWOULDBLOCK))
+    return;
+  finish(n < 0 ? ERR_CONN : 0);
+}
+
+void AsyncClient::handlePoll() {
+  AcConnectHandler cb;
+  void *arg;
+  {
+    std::lock_guard<std::mutex> lock(mu);
+    if (fd < 0 || !isConnected)
+      return;
+    cb = pollCb;
+    arg = pollArg;
+  }
+  if (cb)
+    cb(arg, this);
+}
+
+void AsyncServer::onClient(AcConnectHandler cb, void *arg) {
+  clientCb = cb;
+  clientArg = arg;
+}
+
+void AsyncServer::begin() {
+  if (fd >= 0)
+    return;
+  int s = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (s < 0)
+    return;
+  int one = 1;
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in a = sockAddr(IPAddress(), port);
+  if (bind(s, (sockaddr *)&a, sizeof(a)) < 0 || listen(s, 128) < 0) {
+    ::close(s);
+    return;
+  }
+  fd = s;
+  tcpLoop.add(this, fd, EPOLLIN, [this](uint32_t) { handleAccept(); });
+}
+
+void AsyncServer::end() {
+  if (fd < 0)
+    return;
+  tcpLoop.remove(this, fd);
+  ::close(fd);
+  fd = -1;
+}
+
+// Runs on the event thread, so each new client's handlers are installed
+// before its first event can be dispatched.
+void AsyncServer::handleAccept() {
+  for (;;) {
+    int s = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (s < 0)
+      return;
+    AsyncClient *c = AsyncClient::adopt(s);
+    if (clientCb)
+      clientCb(clientArg, c);
+    else
+      delete c;
+  }
+}
@@ -0,0 +1,89 @@
+// AsyncClient/AsyncServer over non-blocking POSIX sockets. As on the ESP32,
+// every callback runs on one event thread (the "async_tcp" task), while
+// connect/write/close may be called from any thread. close() runs the
+// disconnect callback in the caller, as AsyncTCP does. Deleting an object
+// from another thread while its callback runs is the caller's problem here
+// just as it is on the device.
+#ifndef HOST_ASYNCTCP_H
+#define HOST_ASYNCTCP_H
+
+#include "Arduino.h"
+#include "IPAddress.h"
+#include <functional>
+#include <mutex>
+
+class AsyncClient;
+
+using AcConnectHandler = std::function<void(void *, AsyncClient *)>;
+using AcDataHandler =
+    std::function<void(void *, AsyncClient *, void *data, size_t len)>;
+using AcErrorHandler = std::function<void(void *, AsyncClient *, int8_t)>;
+
+class AsyncClient {
+public:
+  AsyncClient() {}
+  ~AsyncClient();
+  AsyncClient(const AsyncClient &) = delete;
+  AsyncClient &operator=(const AsyncClient &) = delete;
+
+  bool connect(IPAddress ip, uint16_t port);
+  bool connected();
+  size_t write(const char *data, size_t len);
+  void close(bool now = false);
+  void setNoDelay(bool on);
+
+  IPAddress remoteIP() const { return peerIp; }
+  uint16_t remotePort() const { return peerPort; }
+  uint16_t localPort() const { return ownPort; }
+
+  void onConnect(AcConnectHandler cb, void *arg = nullptr);
+  void onDisconnect(AcConnectHandler cb, void *arg = nullptr);
+  void onData(AcDataHandler cb, void *arg = nullptr);
+  void onError(AcErrorHandler cb, void *arg = nullptr);
+  void onPoll(AcConnectHandler cb, void *arg = nullptr);
+
+  // Host only: adopts an accepted socket (AsyncServer does this).
+  static AsyncClient *adopt(int fd);
+  // Event thread entry points.
+  void handleEvent(uint32_t events);
+  void handlePoll();
+
+private:
+  void addresses();
+  void finish(int8_t err);
+
+  std::mutex mu; // fd and state against writers on other threads
+  int fd = -1;
+  bool isConnected = false;
+  bool connecting = false;
+  IPAddress peerIp;
+  uint16_t peerPort = 0;
+  uint16_t ownPort = 0;
+
+  AcConnectHandler connectCb, disconnectCb, pollCb;
+  AcDataHandler dataCb;
+  AcErrorHandler errorCb;
+  void *connectArg = nullptr, *disconnectArg = nullptr, *pollArg = nullptr;
+  void *dataArg = nullptr, *errorArg = nullptr;
+};
+
+class AsyncServer {
+public:
+  explicit AsyncServer(uint16_t port) : port(port) {}
+  ~AsyncServer() { end(); }
+
+  void onClient(AcConnectHandler cb, void *arg);
+  void begin();
+  void end();
+
+  // Event thread entry point.
+  void handleAccept();
+
+private:
+  uint16_t port;
+  int fd = -1;
+  AcConnectHandler clientCb;
+  void *clientArg = nullptr;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "AsyncUDP.h"
+#include "HostEventLoop.h"
+
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static HostEventLoop udpLoop("async_udp");
+static const size_t MAX_DATAGRAM = 1472; // what fits one Ethernet frame
+
+static sockaddr_in sockAddr(const IPAddress &ip, uint16_t port) {
+  sockaddr_in a = {};
+  a.sin_family = AF_INET;
+  a.sin_port = htons(port);
+  a.sin_addr.s_addr = (uint32_t)ip; // both are network byte order
+  return a;
+}
+
+// Caller holds mu.
+bool AsyncUDP::open(uint16_t port) {
+  if (fd >= 0)
+    return false;
+  int s = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (s < 0)
+    return false;
+  int one = 1;
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  setsockopt(s, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+  sockaddr_in a = sockAddr(IPAddress(), port);
+  socklen_t len = sizeof(a);
+  if (bind(s, (sockaddr *)&a, sizeof(a)) < 0 ||
+      getsockname(s, (sockaddr *)&a, &len) < 0) {
+    ::close(s);
+    return false;
+  }
+  fd = s;
+  ownPort = ntohs(a.sin_port);
+  udpLoop.add(this, fd, EPOLLIN, [this](uint32_t) { handleEvent(); });
+  return true;
+}
+
+bool AsyncUDP::listen(uint16_t port) {
+  std::lock_guard<std::mutex> lock(mu);
+  return open(port);
+}
+
+bool AsyncUDP::connect(const IPAddress &ip, uint16_t port) {
+  std::lock_guard<std::mutex> lock(mu);
+  if (!open(0))
+    return false;
+  sockaddr_in a = sockAddr(ip, port);
+  if (::connect(fd, (sockaddr *)&a, sizeof(a)) == 0)
+    return true;
+  udpLoop.remove(this, fd);
+  ::close(fd);
+  fd = -1;
+  return false;
+}
+
+void AsyncUDP::onPacket(AuPacketHandlerFunction cb) {
+  std::lock_guard<std::mutex> lock(mu);
+  packetCb = cb;
+}
+
+size_t AsyncUDP::write(const uint8_t *data, size_t len) {
+  std::lock_guard<std::mutex> lock(mu);
+  if (fd < 0)
+    return 0;
+  ssize_t n = send(fd, data, len, MSG_DONTWAIT);
+  return n > 0 ? (size_t)n : 0;
+}
+
+size_t AsyncUDP::writeTo(const uint8_t *data, size_t len, const IPAddress &ip,
+                         uint16_t port) {
+  std::lock_guard<std::mutex> lock(mu);
+  if (fd < 0)
+    return 0;
+  sockaddr_in a = sockAddr(ip, port);
+  ssize_t n = sendto(fd, data, len, MSG_DONTWAIT, (sockaddr *)&a, sizeof(a));
+  return n > 0 ? (size_t)n : 0;
+}
+
+void AsyncUDP::close() {
+  std::lock_guard<std::mutex> lock(mu);
+  if (fd < 0)
+    return;
+  udpLoop.remove(this, fd);
+  ::close(fd);
+  fd = -1;
+}
+
+// One datagram per wakeup; the handler is called last and without mu, so
+// it may write on this socket or close and delete others.
+void AsyncUDP::handleEvent() {
+  uint8_t buf[MAX_DATAGRAM];
+  sockaddr_in from = {};
+  socklen_t fromLen = sizeof(from);
+  ssize_t n;
+  uint16_t port;
+  AuPacketHandlerFunction cb;
+  {
+    std::lock_guard<std::mutex> lock(mu);
+    if (fd < 0)
+      return;
+    n = recvfrom(fd, buf, sizeof(buf), MSG_DONTWAIT, (sockaddr *)&from,
+                 &fromLen);
+    port = ownPort;
+    cb = packetCb;
+  }
+  if (n < 0 || !cb)
+    return;
+  IPAddress fromIp((uint32_t)from.sin_addr.s_addr);
+  AsyncUDPPacket packet(buf, (size_t)n, fromIp, ntohs(from.sin_port), port);
+  cb(packet);
+}
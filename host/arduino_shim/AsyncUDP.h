@@ -0,0 +1,63 @@
+// AsyncUDP over non-blocking POSIX datagram sockets. Packet callbacks run
+// on one event thread (the "async_udp" task), one datagram per call; the
+// packet and its buffer only live for the duration of the callback.
+#ifndef HOST_ASYNCUDP_H
+#define HOST_ASYNCUDP_H
+
+#include "Arduino.h"
+#include "IPAddress.h"
+#include <functional>
+#include <mutex>
+
+class AsyncUDPPacket {
+public:
+  AsyncUDPPacket(uint8_t *data, size_t len, const IPAddress &from,
+                 uint16_t fromPort, uint16_t localPort)
+      : buf(data), len(len), from(from), fromPort(fromPort),
+        ownPort(localPort) {}
+
+  uint8_t *data() { return buf; }
+  size_t length() const { return len; }
+  IPAddress remoteIP() const { return from; }
+  uint16_t remotePort() const { return fromPort; }
+  uint16_t localPort() const { return ownPort; }
+
+private:
+  uint8_t *buf;
+  size_t len;
+  IPAddress from;
+  uint16_t fromPort;
+  uint16_t ownPort;
+};
+
+using AuPacketHandlerFunction = std::function<void(AsyncUDPPacket &packet)>;
+
+class AsyncUDP {
+public:
+  AsyncUDP() {}
+  ~AsyncUDP() { close(); }
+  AsyncUDP(const AsyncUDP &) = delete;
+  AsyncUDP &operator=(const AsyncUDP &) = delete;
+
+  bool listen(uint16_t port);
+  // Binds an ephemeral port and fixes the peer for write().
+  bool connect(const IPAddress &ip, uint16_t port);
+  void onPacket(AuPacketHandlerFunction cb);
+  size_t write(const uint8_t *data, size_t len);
+  size_t writeTo(const uint8_t *data, size_t len, const IPAddress &ip,
+                 uint16_t port);
+  void close();
+
+  // Event thread entry point.
+  void handleEvent();
+
+private:
+  bool open(uint16_t port);
+
+  std::mutex mu;
+  int fd = -1;
+  uint16_t ownPort = 0;
+  AuPacketHandlerFunction packetCb;
+};
+
+#endif
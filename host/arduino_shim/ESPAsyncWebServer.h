@@ -0,0 +1,23 @@
+// Declarations only: lets headers that mention the server types compile.
+// Nothing built for the host serves HTTP or WebSockets.
+#ifndef HOST_ESPASYNCWEBSERVER_H
+#define HOST_ESPASYNCWEBSERVER_H
+
+#include "Arduino.h"
+#include "WiFi.h" // the library pulls it in, and firmware relies on that
+
+class AsyncWebServerRequest;
+
+class AsyncWebServer {
+public:
+  explicit AsyncWebServer(uint16_t port) : port(port) {}
+  uint16_t port;
+};
+
+class AsyncWebSocket {
+public:
+  explicit AsyncWebSocket(const char *url) : url(url) {}
+  const char *url;
+};
+
+#endif
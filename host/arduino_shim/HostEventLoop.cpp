@@ -0,0 +1,84 @@
+#include "HostEventLoop.h"
+#include "Arduino.h"
+
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <vector>
+
+static const uint32_t POLL_MS = 500;
+
+void HostEventLoop::add(void *owner, int fd, uint32_t events, EventFn onEvent,
+                        PollFn onPoll) {
+  std::lock_guard<std::mutex> lock(mu);
+  if (ep < 0) {
+    ep = epoll_create1(EPOLL_CLOEXEC);
+    thread = std::thread([this]() { run(); });
+    threadId = thread.get_id();
+    pthread_setname_np(thread.native_handle(), name);
+    thread.detach();
+  }
+  owners[owner] = Entry{onEvent, onPoll};
+  epoll_event ev = {};
+  ev.events = events;
+  ev.data.ptr = owner;
+  epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void HostEventLoop::modify(void *owner, int fd, uint32_t events) {
+  std::lock_guard<std::mutex> lock(mu);
+  epoll_event ev = {};
+  ev.events = events;
+  ev.data.ptr = owner;
+  epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void HostEventLoop::remove(void *owner, int fd) {
+  std::lock_guard<std::mutex> lock(mu);
+  owners.erase(owner);
+  if (ep >= 0 && fd >= 0)
+    epoll_ctl(ep, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+bool HostEventLoop::onLoopThread() const {
+  return std::this_thread::get_id() == threadId;
+}
+
+void HostEventLoop::run() {
+  epoll_event evs[64];
+  uint32_t lastPoll = millis();
+  for (;;) {
+    int n = epoll_wait(ep, evs, 64, 50);
+    for (int i = 0; i < n; i++) {
+      EventFn fn;
+      {
+        std::lock_guard<std::mutex> lock(mu);
+        auto it = owners.find(evs[i].data.ptr);
+        if (it == owners.end())
+          continue; // removed by an earlier handler in this batch
+        fn = it->second.onEvent;
+      }
+      fn(evs[i].events);
+    }
+    if (millis() - lastPoll < POLL_MS)
+      continue;
+    lastPoll = millis();
+    std::vector<void *> due;
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      for (auto &kv : owners)
+        if (kv.second.onPoll)
+          due.push_back(kv.first);
+    }
+    for (void *owner : due) {
+      PollFn fn;
+      {
+        std::lock_guard<std::mutex> lock(mu);
+        auto it = owners.find(owner);
+        if (it == owners.end())
+          continue;
+        fn = it->second.onPoll;
+      }
+      fn();
+    }
+  }
+}
@@ -0,0 +1,45 @@
+// One epoll thread standing in for an ESP32 network task (async_tcp,
+// async_udp). Owners register a socket with an event handler and, if they
+// want it, a poll handler run every 500 ms. Handlers are copied under the
+// lock and called outside it, so they may add or remove owners (including
+// themselves) and take their own locks freely.
+#ifndef HOST_EVENT_LOOP_H
+#define HOST_EVENT_LOOP_H
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+
+class HostEventLoop {
+public:
+  using EventFn = std::function<void(uint32_t events)>;
+  using PollFn = std::function<void()>;
+
+  explicit HostEventLoop(const char *name) : name(name) {}
+
+  void add(void *owner, int fd, uint32_t events, EventFn onEvent,
+           PollFn onPoll = nullptr);
+  void modify(void *owner, int fd, uint32_t events);
+  // After this returns no new call to the owner's handlers starts; one
+  // already running on the loop thread may still be in progress.
+  void remove(void *owner, int fd);
+  bool onLoopThread() const;
+
+private:
+  struct Entry {
+    EventFn onEvent;
+    PollFn onPoll;
+  };
+  void run();
+
+  const char *name;
+  std::mutex mu;
+  std::map<void *, Entry> owners;
+  int ep = -1;
+  std::thread thread;
+  std::thread::id threadId;
+};
+
+#endif
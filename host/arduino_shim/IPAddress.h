@@ -0,0 +1,43 @@
+#ifndef HOST_IPADDRESS_H
+#define HOST_IPADDRESS_H
+
+#include "Arduino.h"
+
+// Stored as on the ESP32: network byte order, so the first octet is the
+// low byte of the uint32_t conversion.
+class IPAddress {
+public:
+  IPAddress() : addr(0) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+      : addr((uint32_t)a | (uint32_t)b << 8 | (uint32_t)c << 16 |
+             (uint32_t)d << 24) {}
+  IPAddress(uint32_t raw) : addr(raw) {}
+
+  operator uint32_t() const { return addr; }
+  uint8_t operator[](int i) const { return (uint8_t)(addr >> (8 * i)); }
+  bool operator==(const IPAddress &o) const { return addr == o.addr; }
+
+  bool fromString(const char *s) {
+    unsigned v[4];
+    char tail;
+    if (sscanf(s, "%u.%u.%u.%u%c", &v[0], &v[1], &v[2], &v[3], &tail) != 4)
+      return false;
+    for (unsigned x : v)
+      if (x > 255)
+        return false;
+    *this = IPAddress(v[0], v[1], v[2], v[3]);
+    return true;
+  }
+  bool fromString(const String &s) { return fromString(s.c_str()); }
+  String toString() const {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (*this)[0], (*this)[1],
+             (*this)[2], (*this)[3]);
+    return buf;
+  }
+
+private:
+  uint32_t addr;
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef HOST_MD5BUILDER_H
+#define HOST_MD5BUILDER_H
+
+#include "Arduino.h"
+
+class MD5Builder {
+public:
+  void begin();
+  void add(const uint8_t *data, size_t len);
+  void add(const String &s) { add((const uint8_t *)s.c_str(), s.length()); }
+  void calculate();
+  String toString() const; // lowercase hex, as the core returns it
+
+private:
+  void block(const uint8_t *p);
+  uint32_t h[4];
+  uint64_t total = 0;
+  uint8_t buf[64];
+  size_t used = 0;
+  uint8_t digest[16];
+};
+
+#endif
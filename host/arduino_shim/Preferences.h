@@ -0,0 +1,41 @@
+// NVS stand-in: an in-memory key/value store per process.
+#ifndef HOST_PREFERENCES_H
+#define HOST_PREFERENCES_H
+
+#include "Arduino.h"
+#include <map>
+
+class Preferences {
+public:
+  bool begin(const char *, bool = false) { return true; }
+  void end() {}
+  bool isKey(const char *key) { return kv.count(key) != 0; }
+  bool remove(const char *key) { return kv.erase(key) != 0; }
+  String getString(const char *key, const String &def = String()) {
+    return isKey(key) ? String(kv[key]) : def;
+  }
+  size_t putString(const char *key, const String &v) {
+    kv[key] = v;
+    return v.length();
+  }
+  uint32_t getUInt(const char *key, uint32_t def = 0) {
+    return isKey(key) ? (uint32_t)strtoul(kv[key].c_str(), nullptr, 10) : def;
+  }
+  size_t putUInt(const char *key, uint32_t v) {
+    kv[key] = std::to_string(v);
+    return 4;
+  }
+  uint16_t getUShort(const char *key, uint16_t def = 0) {
+    return (uint16_t)getUInt(key, def);
+  }
+  size_t putUShort(const char *key, uint16_t v) { return putUInt(key, v) / 2; }
+  bool getBool(const char *key, bool def = false) {
+    return getUInt(key, def) != 0;
+  }
+  size_t putBool(const char *key, bool v) { return putUInt(key, v) / 4; }
+
+private:
+  std::map<std::string, std::string> kv;
+};
+
+#endif
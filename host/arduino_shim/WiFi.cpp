@@ -0,0 +1,152 @@
+#include "WiFi.h"
+#include "WiFiUdp.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+WiFiClass WiFi;
+int (*hostConnectHook)(const IPAddress &ip, uint16_t port) = nullptr;
+
+static sockaddr_in sockAddr(const IPAddress &ip, uint16_t port) {
+  sockaddr_in a = {};
+  a.sin_family = AF_INET;
+  a.sin_port = htons(port);
+  a.sin_addr.s_addr = (uint32_t)ip; // both are network byte order
+  return a;
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port, int32_t timeout) {
+  stop();
+  if (hostConnectHook) {
+    int extra = hostConnectHook(ip, port);
+    if (extra < 0) {
+      delay(timeout);
+      return 0;
+    }
+    delay(extra);
+  }
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return 0;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  sockaddr_in a = sockAddr(ip, port);
+  if (::connect(fd, (sockaddr *)&a, sizeof(a)) < 0) {
+    if (errno != EINPROGRESS) {
+      stop();
+      return 0;
+    }
+    pollfd p = {fd, POLLOUT, 0};
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (poll(&p, 1, timeout) != 1 ||
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+      stop();
+      return 0;
+    }
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return 1;
+}
+
+int WiFiClient::connect(const char *host, uint16_t port) {
+  IPAddress ip;
+  if (!ip.fromString(host))
+    return 0;
+  return connect(ip, port);
+}
+
+uint8_t WiFiClient::connected() {
+  if (fd < 0)
+    return 0;
+  char c;
+  ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+int WiFiClient::available() {
+  int n = 0;
+  if (fd < 0 || ioctl(fd, FIONREAD, &n) < 0)
+    return 0;
+  return n;
+}
+
+int WiFiClient::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t *buf, size_t len) {
+  if (fd < 0)
+    return -1;
+  ssize_t n = recv(fd, buf, len, MSG_DONTWAIT);
+  return n > 0 ? (int)n : -1;
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t len) {
+  if (fd < 0)
+    return 0;
+  ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+  return n > 0 ? (size_t)n : 0;
+}
+
+String WiFiClient::readStringUntil(char terminator) {
+  String out;
+  uint32_t t0 = millis();
+  while (fd >= 0 && millis() - t0 < timeoutMs) {
+    int c = read();
+    if (c < 0) {
+      pollfd p = {fd, POLLIN, 0};
+      poll(&p, 1, 5);
+      continue;
+    }
+    if (c == terminator)
+      break;
+    out += (char)c;
+  }
+  return out;
+}
+
+void WiFiClient::stop() {
+  if (fd >= 0)
+    close(fd);
+  fd = -1;
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port) {
+  to = ip;
+  toPort = port;
+  pending.clear();
+  return 1;
+}
+
+int WiFiUDP::endPacket() {
+  int s = socket(AF_INET, SOCK_DGRAM, 0);
+  if (s < 0)
+    return 0;
+  int one = 1;
+  setsockopt(s, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+  sockaddr_in a = sockAddr(to, toPort);
+  ssize_t n = sendto(s, pending.data(), pending.size(), 0, (sockaddr *)&a,
+                     sizeof(a));
+  close(s);
+  return n == (ssize_t)pending.size();
+}
+
+int WiFiClass::hostByName(const char *host, IPAddress &out) {
+  addrinfo hints = {}, *res = nullptr;
+  hints.ai_family = AF_INET;
+  if (getaddrinfo(host, nullptr, &hints, &res) != 0 || !res)
+    return 0;
+  out = IPAddress((uint32_t)((sockaddr_in *)res->ai_addr)->sin_addr.s_addr);
+  freeaddrinfo(res);
+  return 1;
+}
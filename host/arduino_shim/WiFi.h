@@ -0,0 +1,59 @@
+// WiFi/WiFiClient over POSIX sockets. The "station" is always connected and
+// WiFiClient reaches whatever the host can route to, so a simulator can
+// listen on 127.x.y.z addresses and stand in for a LAN.
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+
+#include "Arduino.h"
+#include "IPAddress.h"
+
+typedef enum { WL_IDLE_STATUS = 0, WL_CONNECTED = 3, WL_DISCONNECTED = 6 }
+wl_status_t;
+
+// Network model under WiFiClient::connect: returns the delay (ms) to add
+// before connecting to ip:port, or -1 if the host does not answer at all
+// (the connect then takes its whole timeout and fails, as an address with
+// no ARP reply does on the device). nullptr connects directly.
+extern int (*hostConnectHook)(const IPAddress &ip, uint16_t port);
+
+class WiFiClient : public Print {
+public:
+  WiFiClient() {}
+  ~WiFiClient() { stop(); }
+  WiFiClient(const WiFiClient &) = delete;
+  WiFiClient &operator=(const WiFiClient &) = delete;
+
+  int connect(IPAddress ip, uint16_t port, int32_t timeoutMs);
+  int connect(IPAddress ip, uint16_t port) { return connect(ip, port, 3000); }
+  int connect(const char *host, uint16_t port);
+  uint8_t connected();
+  int available();
+  int read();
+  int read(uint8_t *buf, size_t len);
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buf, size_t len) override;
+  void setTimeout(uint32_t seconds) { timeoutMs = seconds * 1000; }
+  String readStringUntil(char terminator);
+  void stop();
+
+private:
+  int fd = -1;
+  uint32_t timeoutMs = 1000;
+};
+
+class WiFiClass {
+public:
+  IPAddress localIP() const { return ip; }
+  wl_status_t status() const { return WL_CONNECTED; }
+  // 1 and the first IPv4 address on success, as the core's DNS lookup.
+  int hostByName(const char *host, IPAddress &out);
+  // Host only: the address startDisc() and friends take as "ours".
+  void hostSetLocalIP(const IPAddress &addr) { ip = addr; }
+
+private:
+  IPAddress ip = IPAddress(127, 0, 0, 1);
+};
+
+extern WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef HOST_WIFIUDP_H
+#define HOST_WIFIUDP_H
+
+#include "Arduino.h"
+#include "IPAddress.h"
+#include <vector>
+
+class WiFiUDP {
+public:
+  int beginPacket(IPAddress ip, uint16_t port);
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t *buf, size_t len) {
+    pending.insert(pending.end(), buf, buf + len);
+    return len;
+  }
+  int endPacket();
+
+private:
+  IPAddress to;
+  uint16_t toPort = 0;
+  std::vector<uint8_t> pending;
+};
+
+#endif
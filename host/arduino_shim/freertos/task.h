@@ -0,0 +1,43 @@
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+#include <chrono>
+#include <pthread.h>
+#include <thread>
+
+inline BaseType_t xTaskCreate(TaskFunction_t fn, const char *, uint32_t,
+                              void *arg, unsigned, TaskHandle_t *out) {
+  struct Start {
+    TaskFunction_t fn;
+    void *arg;
+  };
+  Start *s = new Start{fn, arg};
+  pthread_t t;
+  int rc = pthread_create(
+      &t, nullptr,
+      [](void *p) -> void * {
+        Start st = *(Start *)p;
+        delete (Start *)p;
+        st.fn(st.arg);
+        return nullptr;
+      },
+      s);
+  if (rc) {
+    delete s;
+    return pdFAIL;
+  }
+  pthread_detach(t);
+  if (out)
+    *out = (TaskHandle_t)t;
+  return pdPASS;
+}
+
+// Only self-deletion (nullptr) is supported.
+inline void vTaskDelete(TaskHandle_t) { pthread_exit(nullptr); }
+
+inline void vTaskDelay(TickType_t ticks) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+#endif
@@ -0,0 +1,16 @@
+// No ARP table on the host; every lookup misses, as for a routed address.
+#ifndef HOST_LWIP_ETHARP_H
+#define HOST_LWIP_ETHARP_H
+
+#include "netif.h"
+
+struct eth_addr {
+  uint8_t addr[6];
+};
+
+inline int etharp_find_addr(struct netif *, const ip4_addr_t *,
+                            struct eth_addr **, const ip4_addr_t **) {
+  return -1;
+}
+
+#endif
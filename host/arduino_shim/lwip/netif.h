@@ -0,0 +1,17 @@
+// No lwIP on the host: there are no interfaces to walk.
+#ifndef HOST_LWIP_NETIF_H
+#define HOST_LWIP_NETIF_H
+
+#include <stdint.h>
+
+typedef struct {
+  uint32_t addr;
+} ip4_addr_t;
+
+struct netif {
+  struct netif *next;
+};
+
+inline struct netif *netif_list = nullptr;
+
+#endif
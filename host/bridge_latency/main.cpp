@@ -0,0 +1,172 @@
+// Host-side latency check for the TCP<->UART bridge path.
+//
+// A pty pair stands in for the RS-232 port: UartTransport opens the slave end
+// exactly as the firmware opens UART2, and this harness plays the AV device
+// on the master end. The TCP side is a loopback socket wrapped in the same
+// Transport interface, linked the way SerialBridge links them.
+//
+//   pio run -e native_bridge && .pio/build/native_bridge/program [iters] [len]
+
+#include "Transport.h"
+#include "UartTransport.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Connected socket as a Transport, read from a poll() thread like the host
+// UartTransport.
+class SocketTransport : public Transport {
+public:
+  explicit SocketTransport(int fd) : fd(fd) {
+    reader = std::thread([this]() {
+      pollfd p{this->fd, POLLIN, 0};
+      uint8_t buf[1024];
+      while (!stop) {
+        if (poll(&p, 1, 20) <= 0 || !(p.revents & POLLIN))
+          continue;
+        ssize_t n = ::read(this->fd, buf, sizeof(buf));
+        if (n <= 0) {
+          emitClose();
+          return;
+        }
+        emitData(buf, (size_t)n);
+      }
+    });
+  }
+  ~SocketTransport() override { close(); }
+
+  bool connected() const override { return fd >= 0; }
+  size_t write(const uint8_t *data, size_t len) override {
+    ssize_t n = ::write(fd, data, len);
+    return n > 0 ? (size_t)n : 0;
+  }
+  void close() override {
+    stop = true;
+    if (reader.joinable())
+      reader.join();
+    if (fd >= 0)
+      ::close(fd);
+    fd = -1;
+  }
+  const char *kind() const override { return "tcp"; }
+
+private:
+  int fd;
+  std::atomic<bool> stop{false};
+  std::thread reader;
+};
+
+static uint64_t nowUs() {
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static bool readExactly(int fd, uint8_t *buf, size_t len, int timeoutMs) {
+  size_t got = 0;
+  pollfd p{fd, POLLIN, 0};
+  while (got < len) {
+    if (poll(&p, 1, timeoutMs) <= 0)
+      return false;
+    ssize_t n = ::read(fd, buf + got, len - got);
+    if (n <= 0)
+      return false;
+    got += (size_t)n;
+  }
+  return true;
+}
+
+static void report(const char *label, std::vector<uint64_t> &us) {
+  if (us.empty()) {
+    printf("%-14s no samples\n", label);
+    return;
+  }
+  std::sort(us.begin(), us.end());
+  auto pct = [&](double p) { return us[(size_t)(p * (us.size() - 1))]; };
+  printf("%-14s n=%zu p50=%lluus p90=%lluus p99=%lluus max=%lluus\n", label,
+         us.size(), (unsigned long long)pct(0.50),
+         (unsigned long long)pct(0.90), (unsigned long long)pct(0.99),
+         (unsigned long long)us.back());
+}
+
+int main(int argc, char **argv) {
+  int iters = argc > 1 ? atoi(argv[1]) : 1000;
+  size_t len = argc > 2 ? (size_t)atoi(argv[2]) : 16;
+
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) || unlockpt(master)) {
+    perror("pty");
+    return 1;
+  }
+  UartTransport uart(ptsname(master));
+  if (!uart.open(115200)) {
+    perror("uart open");
+    return 1;
+  }
+
+  int lsock = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t alen = sizeof(addr);
+  if (bind(lsock, (sockaddr *)&addr, sizeof(addr)) || listen(lsock, 1) ||
+      getsockname(lsock, (sockaddr *)&addr, &alen)) {
+    perror("listen");
+    return 1;
+  }
+  int client = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(client, (sockaddr *)&addr, sizeof(addr))) {
+    perror("connect");
+    return 1;
+  }
+  int one = 1;
+  setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  int accepted = accept(lsock, nullptr, nullptr);
+  setsockopt(accepted, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  SocketTransport tcp(accepted);
+
+  tcp.onData([&uart](const uint8_t *d, size_t n) { uart.write(d, n); });
+  uart.onData([&tcp](const uint8_t *d, size_t n) { tcp.write(d, n); });
+
+  std::vector<uint8_t> out(len), in(len);
+  for (size_t i = 0; i < len; i++)
+    out[i] = (uint8_t)('A' + i % 26);
+
+  std::vector<uint64_t> toUart, fromUart;
+  for (int i = 0; i < iters; i++) {
+    uint64_t t0 = nowUs();
+    if (::write(client, out.data(), len) != (ssize_t)len ||
+        !readExactly(master, in.data(), len, 1000))
+      break;
+    toUart.push_back(nowUs() - t0);
+
+    t0 = nowUs();
+    if (::write(master, out.data(), len) != (ssize_t)len ||
+        !readExactly(client, in.data(), len, 1000))
+      break;
+    fromUart.push_back(nowUs() - t0);
+  }
+
+  printf("bridge latency, %zu-byte payloads\n", len);
+  report("tcp->uart", toUart);
+  report("uart->tcp", fromUart);
+
+  tcp.close();
+  uart.close();
+  ::close(client);
+  ::close(lsock);
+  ::close(master);
+  return toUart.size() == (size_t)iters ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+// Host microbenchmark for the capture/proxy byte encoders in Utils.cpp.
+//
+// Runs the previous char-at-a-time String implementations (kept below as
+// the reference) against the table-driven ones on the same random
+// payloads, checks that the output is identical, and prints ns per input
+// byte for each payload size.
+//
+//   pio run -e native_bench -t exec
+//   .pio/build/native_bench/program [iters]
+
+#include "Utils.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+// ---- Reference implementations (as before the table-driven encoders) ----
+
+static String refBytesToHex(const uint8_t *data, size_t len) {
+  static const char *h = "0123456789ABCDEF";
+  String out;
+  out.reserve(len * 3);
+  for (size_t i = 0; i < len; i++) {
+    out += h[(data[i] >> 4) & 0xF];
+    out += h[data[i] & 0xF];
+    if (i + 1 < len)
+      out += ' ';
+  }
+  return out;
+}
+
+static String refBytesToAscii(const uint8_t *data, size_t len) {
+  String out;
+  out.reserve(len);
+  for (size_t i = 0; i < len; i++) {
+    char c = (char)data[i];
+    out += (c >= 32 && c <= 126) ? c : '.';
+  }
+  return out;
+}
+
+static bool refParseHexBytes(const String &hex, std::vector<uint8_t> &out) {
+  out.clear();
+  auto nib = [](char c) -> int {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return 10 + (c - 'a');
+    if (c >= 'A' && c <= 'F')
+      return 10 + (c - 'A');
+    return -1;
+  };
+  int i = 0;
+  while (i < (int)hex.length()) {
+    while (i < (int)hex.length() && hex[i] == ' ')
+      i++;
+    if (i >= (int)hex.length())
+      break;
+    if (i + 1 >= (int)hex.length())
+      return false;
+    int n1 = nib(hex[i++]);
+    int n2 = nib(hex[i++]);
+    if (n1 < 0 || n2 < 0)
+      return false;
+    out.push_back((uint8_t)((n1 << 4) | n2));
+  }
+  return true;
+}
+
+// ---- Harness ----
+
+static volatile size_t sink; // keeps results observable
+
+template <typename F> static double nsPerByte(size_t bytes, int iters, F f) {
+  using namespace std::chrono;
+  steady_clock::time_point t0 = steady_clock::now();
+  for (int i = 0; i < iters; i++)
+    f();
+  double ns = duration_cast<nanoseconds>(steady_clock::now() - t0).count();
+  return ns / ((double)bytes * iters);
+}
+
+static void report(const char *name, size_t len, double before,
+                   double after) {
+  printf("%-8s %5zu B  ref %7.2f ns/B  new %7.2f ns/B  x%.1f\n", name, len,
+         before, after, after > 0 ? before / after : 0.0);
+}
+
+// Payloads that look like traffic: mostly printable with some control and
+// high bytes, so both the fast and the fallback paths are exercised.
+static std::vector<uint8_t> payload(size_t len, unsigned seed) {
+  std::vector<uint8_t> v(len);
+  srand(seed);
+  for (size_t i = 0; i < len; i++) {
+    int r = rand() % 16;
+    v[i] = r == 0 ? (uint8_t)(rand() % 32)
+                  : r == 1 ? (uint8_t)(128 + rand() % 128)
+                           : (uint8_t)(32 + rand() % 95);
+  }
+  return v;
+}
+
+int main(int argc, char **argv) {
+  int iters = argc > 1 ? atoi(argv[1]) : 20000;
+  static const size_t SIZES[] = {8, 64, 512, 4096};
+  int failures = 0;
+
+  for (size_t len : SIZES) {
+    std::vector<uint8_t> data = payload(len, (unsigned)len);
+    const uint8_t *p = data.data();
+    int n = (int)(iters * 64 / (len + 64)) + 1;
+
+    String hexRef = refBytesToHex(p, len);
+    String asciiRef = refBytesToAscii(p, len);
+    if (bytesToHex(p, len) != hexRef || bytesToAscii(p, len) != asciiRef) {
+      printf("MISMATCH encoding %zu bytes\n", len);
+      failures++;
+    }
+    std::vector<uint8_t> a, b;
+    bool okA = refParseHexBytes(hexRef, a), okB = parseHexBytes(hexRef, b);
+    if (okA != okB || a != b) {
+      printf("MISMATCH parsing %zu bytes\n", len);
+      failures++;
+    }
+
+    report("hex", len, nsPerByte(len, n, [&]() {
+             sink = refBytesToHex(p, len).length();
+           }),
+           nsPerByte(len, n, [&]() { sink = bytesToHex(p, len).length(); }));
+
+    std::vector<char> buf(len * 3 + 1);
+    report("hex/buf", len, nsPerByte(len, n, [&]() {
+             sink = refBytesToHex(p, len).length();
+           }),
+           nsPerByte(len, n, [&]() { sink = hexEncode(p, len, buf.data()); }));
+
+    report("ascii", len, nsPerByte(len, n, [&]() {
+             sink = refBytesToAscii(p, len).length();
+           }),
+           nsPerByte(len, n, [&]() { sink = bytesToAscii(p, len).length(); }));
+
+    report("parse", len, nsPerByte(len, n, [&]() {
+             refParseHexBytes(hexRef, a);
+             sink = a.size();
+           }),
+           nsPerByte(len, n, [&]() {
+             parseHexBytes(hexRef, b);
+             sink = b.size();
+           }));
+  }
+
+  // Malformed input must be rejected the same way by both parsers (what is
+  // left in `out` after a failure is not part of the contract).
+  static const char *BAD[] = {"0", "0G", "A B", "12 3", " 1x", "", "  ", "ab"};
+  for (const char *s : BAD) {
+    std::vector<uint8_t> a, b;
+    bool okA = refParseHexBytes(s, a), okB = parseHexBytes(s, b);
+    if (okA != okB || (okA && a != b)) {
+      printf("MISMATCH parsing \"%s\"\n", s);
+      failures++;
+    }
+  }
+
+  printf(failures ? "FAILED (%d)\n" : "outputs match\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,402 @@
+#include "DeviceFarm.h"
+#include "WiFi.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const uint64_t LISTENER_TAG = 1ull << 63;
+
+struct DeviceFarm::Conn {
+  uint64_t id;
+  int fd;
+  size_t dev;
+  uint16_t port;
+  std::string in;
+};
+
+DeviceFarm *DeviceFarm::active = nullptr;
+
+const char *simKindName(SimKind k) {
+  switch (k) {
+  case SimKind::Extron:
+    return "extron";
+  case SimKind::Kramer:
+    return "kramer";
+  case SimKind::Lightware:
+    return "lightware";
+  case SimKind::PJLink:
+    return "pjlink";
+  case SimKind::SamsungMdc:
+    return "samsung-mdc";
+  default:
+    return "http";
+  }
+}
+
+const char *simKindTemplate(SimKind k) {
+  switch (k) {
+  case SimKind::Extron:
+    return "TPL_EXTRON_TELNET";
+  case SimKind::Kramer:
+    return "TPL_KRAMER_P3000";
+  case SimKind::Lightware:
+    return "TPL_LIGHTWARE_LW3";
+  case SimKind::SamsungMdc:
+    return "TPL_SAMSUNG_MDC_EXAMPLE";
+  default:
+    return "";
+  }
+}
+
+static std::vector<uint16_t> kindPorts(SimKind k) {
+  switch (k) {
+  case SimKind::Extron:
+    return {23, 80};
+  case SimKind::Kramer:
+    return {5000};
+  case SimKind::Lightware:
+    return {80, 6100};
+  case SimKind::PJLink:
+    return {80, 4352};
+  case SimKind::SamsungMdc:
+    return {1515};
+  default:
+    return {80};
+  }
+}
+
+static const char *serverHeader(SimKind k) {
+  switch (k) {
+  case SimKind::Extron:
+    return "Extron Electronics Embedded Web Server";
+  case SimKind::Lightware:
+    return "Lightware Web Server";
+  case SimKind::PJLink:
+    return "Projector-WebServer/1.0";
+  default:
+    return "lighttpd/1.4.59";
+  }
+}
+
+static uint64_t nowMs() { return millis(); }
+
+static uint32_t xorshift(uint32_t &s) {
+  s ^= s << 13;
+  s ^= s >> 17;
+  s ^= s << 5;
+  return s;
+}
+
+DeviceFarm::DeviceFarm(const FarmOptions &o) : opts(o), rng(o.seed | 1) {
+  // Rough installed-base mix: switchers and projectors dominate.
+  static const SimKind MIX[] = {
+      SimKind::Extron,     SimKind::Extron,     SimKind::Extron,
+      SimKind::Kramer,     SimKind::Kramer,     SimKind::Lightware,
+      SimKind::Lightware,  SimKind::PJLink,     SimKind::PJLink,
+      SimKind::PJLink,     SimKind::SamsungMdc, SimKind::SamsungMdc,
+      SimKind::HttpOnly};
+  uint32_t host = ntohl((uint32_t)opts.firstIp);
+  for (size_t i = 0; i < opts.devices; i++, host++) {
+    while ((host & 0xFF) == 0 || (host & 0xFF) == 255)
+      host++;
+    SimDevice d;
+    d.kind = MIX[xorshift(rng) % (sizeof(MIX) / sizeof(MIX[0]))];
+    d.ip = IPAddress(htonl(host));
+    d.ports = kindPorts(d.kind);
+    byIp[(uint32_t)d.ip] = devs.size();
+    devs.push_back(d);
+  }
+}
+
+DeviceFarm::~DeviceFarm() { stop(); }
+
+std::vector<IPAddress> DeviceFarm::subnets() const {
+  std::vector<IPAddress> out;
+  for (const SimDevice &d : devs) {
+    IPAddress net(d.ip[0], d.ip[1], d.ip[2], 0);
+    if (out.empty() || !(out.back() == net))
+      out.push_back(net);
+  }
+  return out;
+}
+
+void DeviceFarm::setOnline(size_t i, bool on) {
+  std::lock_guard<std::mutex> lock(mu);
+  devs[i].online = on;
+}
+
+int DeviceFarm::connectHook(const IPAddress &ip, uint16_t) {
+  DeviceFarm *f = active;
+  if (!f)
+    return 0;
+  std::lock_guard<std::mutex> lock(f->mu);
+  auto it = f->byIp.find((uint32_t)ip);
+  if (it != f->byIp.end())
+    return f->devs[it->second].online ? (int)f->opts.rttMs : -1;
+  // Free addresses inside the farm's subnets don't answer ARP.
+  for (const SimDevice &d : f->devs)
+    if (d.ip[0] == ip[0] && d.ip[1] == ip[1] && d.ip[2] == ip[2])
+      return -1;
+  return 0;
+}
+
+uint32_t DeviceFarm::latencyMs(SimKind k) {
+  uint32_t base;
+  switch (k) {
+  case SimKind::Extron:
+    base = 40;
+    break;
+  case SimKind::Kramer:
+    base = 15;
+    break;
+  case SimKind::Lightware:
+    base = 10;
+    break;
+  case SimKind::PJLink:
+    base = 20;
+    break;
+  case SimKind::SamsungMdc:
+    base = 5;
+    break;
+  default:
+    base = 30;
+  }
+  return base / 2 + xorshift(rng) % (base + 1);
+}
+
+bool DeviceFarm::start() {
+  size_t need = 64;
+  for (const SimDevice &d : devs)
+    need += d.ports.size();
+  rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < need * 2) {
+    rl.rlim_cur = std::min<rlim_t>(rl.rlim_max, need * 2);
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  ep = epoll_create1(0);
+  wakeFd = eventfd(0, EFD_NONBLOCK);
+  epoll_event wev = {};
+  wev.events = EPOLLIN;
+  wev.data.u64 = 0;
+  epoll_ctl(ep, EPOLL_CTL_ADD, wakeFd, &wev);
+
+  for (size_t i = 0; i < devs.size(); i++) {
+    for (uint16_t port : devs[i].ports) {
+      int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+      if (fd < 0) {
+        fprintf(stderr, "farm: socket: %s (raise ulimit -n)\n",
+                strerror(errno));
+        stop();
+        return false;
+      }
+      int one = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      sockaddr_in a = {};
+      a.sin_family = AF_INET;
+      a.sin_port = htons(port);
+      a.sin_addr.s_addr = (uint32_t)devs[i].ip;
+      if (bind(fd, (sockaddr *)&a, sizeof(a)) < 0 || listen(fd, 64) < 0) {
+        fprintf(stderr, "farm: bind %s:%u: %s\n",
+                devs[i].ip.toString().c_str(), port, strerror(errno));
+        close(fd);
+        stop();
+        return false;
+      }
+      epoll_event ev = {};
+      ev.events = EPOLLIN;
+      ev.data.u64 = LISTENER_TAG | listeners.size();
+      epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+      Listener l;
+      l.fd = fd;
+      l.dev = i;
+      l.port = port;
+      listeners.push_back(l);
+    }
+  }
+  running = true;
+  active = this;
+  hostConnectHook = connectHook;
+  loop = std::thread([this]() { run(); });
+  return true;
+}
+
+void DeviceFarm::stop() {
+  if (active == this) {
+    hostConnectHook = nullptr;
+    active = nullptr;
+  }
+  if (running) {
+    running = false;
+    uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof(one)) < 0)
+      perror("farm: wake");
+  }
+  if (loop.joinable())
+    loop.join();
+  for (auto &c : conns) {
+    close(c.second->fd);
+    delete c.second;
+  }
+  conns.clear();
+  timers.clear();
+  for (const Listener &l : listeners)
+    close(l.fd);
+  listeners.clear();
+  if (wakeFd >= 0)
+    close(wakeFd);
+  if (ep >= 0)
+    close(ep);
+  wakeFd = ep = -1;
+}
+
+void DeviceFarm::run() {
+  epoll_event evs[64];
+  while (running) {
+    int timeout = 50;
+    if (!timers.empty()) {
+      uint64_t due = timers.begin()->first, now = nowMs();
+      timeout = due <= now ? 0 : (int)std::min<uint64_t>(due - now, 50);
+    }
+    int n = epoll_wait(ep, evs, 64, timeout);
+    for (int k = 0; k < n; k++) {
+      uint64_t tag = evs[k].data.u64;
+      if (!tag)
+        continue; // wake-up
+      if (tag & LISTENER_TAG) {
+        onAccept(listeners[tag & ~LISTENER_TAG]);
+        continue;
+      }
+      auto it = conns.find(tag);
+      if (it != conns.end())
+        onReadable(it->second);
+    }
+    uint64_t now = nowMs();
+    while (!timers.empty() && timers.begin()->first <= now) {
+      Pending p = timers.begin()->second;
+      timers.erase(timers.begin());
+      auto it = conns.find(p.connId);
+      if (it == conns.end())
+        continue;
+      ssize_t w = send(it->second->fd, p.data.data(), p.data.size(),
+                       MSG_NOSIGNAL);
+      if (w > 0)
+        sent += (uint64_t)w;
+      if (p.closeAfter)
+        closeConn(it->second);
+    }
+  }
+}
+
+void DeviceFarm::onAccept(const Listener &l) {
+  for (;;) {
+    int fd = accept4(l.fd, nullptr, nullptr, SOCK_NONBLOCK);
+    if (fd < 0)
+      return;
+    accepted++;
+    Conn *c = new Conn();
+    c->id = nextConnId++;
+    c->fd = fd;
+    c->dev = l.dev;
+    c->port = l.port;
+    conns[c->id] = c;
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = c->id;
+    epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+
+    // Devices that talk first.
+    SimKind k = devs[l.dev].kind;
+    if (k == SimKind::Extron && l.port == 23)
+      reply(c,
+            "\r\n(c) Copyright 2021, Extron Electronics, IN1608 xi, V1.07, "
+            "60-1468-01\r\nThu, 01 Jan 2026 00:00:00\r\n",
+            false);
+    else if (k == SimKind::Kramer)
+      reply(c, "Welcome to Kramer Electronics, Protocol 3000\r\n", false);
+    else if (k == SimKind::PJLink && l.port == 4352)
+      reply(c, "PJLINK 0\r", false);
+  }
+}
+
+// Handles complete requests in c->in for the device behind the port.
+void DeviceFarm::onReadable(Conn *c) {
+  char buf[1024];
+  ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+  if (n <= 0) {
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+      closeConn(c);
+    return;
+  }
+  c->in.append(buf, (size_t)n);
+  SimKind k = devs[c->dev].kind;
+
+  if (c->port == 80) {
+    if (c->in.find("\r\n\r\n") == std::string::npos)
+      return;
+    std::string resp = "HTTP/1.0 200 OK\r\nServer: ";
+    resp += serverHeader(k);
+    resp += "\r\nContent-Type: text/html\r\nContent-Length: 0\r\n\r\n";
+    reply(c, resp, true);
+    c->in.clear();
+    return;
+  }
+  if (k == SimKind::SamsungMdc) {
+    c->in.clear(); // binary frames; nothing discovery reads
+    return;
+  }
+
+  size_t eol;
+  while ((eol = c->in.find('\r')) != std::string::npos) {
+    std::string line = c->in.substr(0, eol);
+    c->in.erase(0, eol + 1);
+    if (!c->in.empty() && c->in[0] == '\n')
+      c->in.erase(0, 1);
+    if (k == SimKind::Kramer) {
+      if (line == "#MODEL?")
+        reply(c, "~01@MODEL VS-88UT\r\n", false);
+      else if (!line.empty())
+        reply(c, "~01@" + line.substr(1) + " ERR 002\r\n", false);
+    } else if (k == SimKind::Lightware) {
+      if (line.compare(0, 4, "GET ") == 0)
+        reply(c, "pr " + line.substr(4) + "=MX2-8x8-HDMI20\r\n", false);
+    } else if (k == SimKind::PJLink) {
+      // "%1POWR ?" -> "%1POWR=1"; anything else is an unknown command.
+      if (line.size() >= 8 && line.compare(0, 2, "%1") == 0)
+        reply(c,
+              line.substr(0, 6) + (line.compare(2, 4, "POWR") == 0 ? "=1\r"
+                                                                 : "=ERR1\r"),
+              false);
+    } else if (k == SimKind::Extron) {
+      if (line == "Q" || line == "1Q")
+        reply(c, "1.07\r\n", false);
+    }
+  }
+}
+
+void DeviceFarm::reply(Conn *c, const std::string &data, bool closeAfter) {
+  uint32_t delayMs;
+  {
+    std::lock_guard<std::mutex> lock(mu);
+    delayMs = latencyMs(devs[c->dev].kind);
+  }
+  Pending p;
+  p.connId = c->id;
+  p.data = data;
+  p.closeAfter = closeAfter;
+  timers.insert(std::make_pair(nowMs() + delayMs, p));
+}
+
+void DeviceFarm::closeConn(Conn *c) {
+  close(c->fd); // also drops it from the epoll set
+  conns.erase(c->id);
+  delete c;
+}
@@ -0,0 +1,109 @@
+// A farm of simulated AV devices on loopback addresses for native_sim.
+//
+// Device i gets its own address (firstIp + i, skipping .0 and .255 so each
+// /24 looks like a LAN) and listens on the ports its kind exposes on real
+// hardware. One epoll thread serves every socket. Replies are delayed by a
+// per-kind response latency with +-50% jitter, and hostConnectHook adds a
+// round trip to every connect (or swallows it when the host is offline or
+// absent), so timeouts in the firmware code behave as on a LAN.
+#ifndef DEVICE_FARM_H
+#define DEVICE_FARM_H
+
+#include "IPAddress.h"
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class SimKind {
+  Extron,     // telnet 23 with a copyright banner, web server on 80
+  Kramer,     // Protocol 3000 on 5000, answers #MODEL?
+  Lightware,  // LW3 on 6100 (silent until asked), web server on 80
+  PJLink,     // projector: PJLINK 0 banner on 4352, web server on 80
+  SamsungMdc, // display: binary MDC on 1515, no banner
+  HttpOnly,   // anything else with a web page
+};
+
+const char *simKindName(SimKind k);
+// What discovery should suggest for the kind ("" when there is no template).
+const char *simKindTemplate(SimKind k);
+
+struct SimDevice {
+  SimKind kind;
+  IPAddress ip;
+  std::vector<uint16_t> ports;
+  bool online = true;
+};
+
+struct FarmOptions {
+  size_t devices = 1000;
+  IPAddress firstIp = IPAddress(127, 20, 0, 1);
+  uint32_t rttMs = 2; // added to every connect that reaches a host
+  uint32_t seed = 1;  // kind mix and jitter
+};
+
+class DeviceFarm {
+public:
+  explicit DeviceFarm(const FarmOptions &opts);
+  ~DeviceFarm();
+
+  // Binds every listener and starts serving; false (with a message on
+  // stderr) if a socket can't be set up, e.g. too few file descriptors.
+  bool start();
+  void stop();
+
+  size_t size() const { return devs.size(); }
+  const SimDevice &device(size_t i) const { return devs[i]; }
+  // Offline devices stop answering connects (as if unplugged).
+  void setOnline(size_t i, bool on);
+  // Subnets (x.y.z) the farm occupies, in order.
+  std::vector<IPAddress> subnets() const;
+
+  uint64_t connections() const { return accepted.load(); }
+  uint64_t bytesSent() const { return sent.load(); }
+
+private:
+  struct Conn;
+  struct Listener {
+    int fd;
+    size_t dev;
+    uint16_t port;
+  };
+  struct Pending {
+    uint64_t connId;
+    std::string data;
+    bool closeAfter;
+  };
+
+  static int connectHook(const IPAddress &ip, uint16_t port);
+  void run();
+  void onAccept(const Listener &l);
+  void onReadable(Conn *c);
+  void reply(Conn *c, const std::string &data, bool closeAfter);
+  void closeConn(Conn *c);
+  uint32_t latencyMs(SimKind k);
+
+  FarmOptions opts;
+  std::vector<SimDevice> devs;
+  std::map<uint32_t, size_t> byIp; // IPAddress raw -> device index
+  std::mutex mu;                   // devs[].online, rng
+
+  int ep = -1;
+  int wakeFd = -1;
+  std::vector<Listener> listeners;
+  std::map<uint64_t, Conn *> conns;
+  std::multimap<uint64_t, Pending> timers; // due (ms) -> pending reply
+  uint64_t nextConnId = 1;
+  uint32_t rng;
+  std::thread loop;
+  std::atomic<bool> running{false};
+  std::atomic<uint64_t> accepted{0};
+  std::atomic<uint64_t> sent{0};
+
+  static DeviceFarm *active; // the one hostConnectHook consults
+};
+
+#endif
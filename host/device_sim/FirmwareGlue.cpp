@@ -0,0 +1,43 @@
+#include "FirmwareGlue.h"
+#include "ConfigManager.h"
+#include "Trace.h"
+#include <mutex>
+
+std::atomic<uint32_t> simWsMessages(0);
+std::atomic<uint64_t> simWsBytes(0);
+
+AsyncWebSocket wsDisc("/wsdisc");
+AsyncWebSocket wsProxy("/wsproxy");
+
+void wsTextAll(AsyncWebSocket &, const String &s) {
+  simWsMessages++;
+  simWsBytes += s.length();
+}
+
+// Log lines are dropped: the logger task isn't part of the simulation.
+volatile LogLevel logLevel = LogLevel::Warn;
+LogSlot *logClaim() { return nullptr; }
+void logCommit(LogSlot *) {}
+
+volatile bool traceOn = false;
+TraceMark traceNow() { return TraceMark(); }
+void traceSpan(const char *, const TraceMark &) {}
+
+ConfigModel cfg;
+static std::mutex cfgMutex;
+static std::vector<String> idTable(1);
+
+CfgLock::CfgLock() { cfgMutex.lock(); }
+CfgLock::~CfgLock() { cfgMutex.unlock(); }
+
+IdRef internId(const String &s) {
+  if (!s.length())
+    return 0;
+  for (size_t i = 1; i < idTable.size(); i++)
+    if (idTable[i] == s)
+      return (IdRef)i;
+  idTable.push_back(s);
+  return (IdRef)(idTable.size() - 1);
+}
+
+const String &idStr(IdRef id) { return idTable[id < idTable.size() ? id : 0]; }
@@ -0,0 +1,13 @@
+// Definitions native_sim supplies in place of the firmware modules it does
+// not build (main.cpp, Log.cpp, Trace.cpp, ConfigManager.cpp).
+#ifndef FIRMWARE_GLUE_H
+#define FIRMWARE_GLUE_H
+
+#include <atomic>
+#include <stdint.h>
+
+// wsTextAll() calls, i.e. what the UI would have been sent.
+extern std::atomic<uint32_t> simWsMessages;
+extern std::atomic<uint64_t> simWsBytes;
+
+#endif
@@ -0,0 +1,372 @@
+#include "TrafficBench.h"
+#include "CaptureProxy.h"
+#include "FirmwareGlue.h"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <errno.h>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <set>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static const uint16_t LEARN_TCP = 25000; // clear of the farm's own ports
+static const uint16_t LEARN_UDP = 25001;
+static const uint16_t PROXY_TCP = 23001;
+static const uint16_t PROXY_UDP = 23002;
+static const size_t PROXY_BYTES = 8u << 20;
+static const uint32_t UDP_ROUNDS = 5;
+
+static sockaddr_in sockAddr(const IPAddress &ip, uint16_t port) {
+  sockaddr_in a = {};
+  a.sin_family = AF_INET;
+  a.sin_port = htons(port);
+  a.sin_addr.s_addr = (uint32_t)ip;
+  return a;
+}
+
+static const IPAddress LOOPBACK(127, 0, 0, 1);
+
+// A socket bound to `from` (a farm device's address), connected to
+// 127.0.0.1:port; -1 on failure.
+static int openFrom(int type, const IPAddress &from, uint16_t port) {
+  int fd = socket(AF_INET, type | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  sockaddr_in a = sockAddr(from, 0);
+  sockaddr_in to = sockAddr(LOOPBACK, port);
+  if (bind(fd, (sockaddr *)&a, sizeof(a)) < 0 ||
+      connect(fd, (sockaddr *)&to, sizeof(to)) < 0) {
+    close(fd);
+    return -1;
+  }
+  int one = 1;
+  if (type == SOCK_STREAM)
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+static void closeAll(std::vector<int> &fds) {
+  for (int fd : fds)
+    if (fd >= 0)
+      close(fd);
+  fds.clear();
+}
+
+static void raiseFdLimit() {
+  rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+}
+
+static uint32_t capsReceivedNow() {
+  CapsLock lock;
+  return capsReceived;
+}
+
+// Waits until capsReceived has not moved for a second; returns when it
+// last moved.
+static uint32_t waitCapsQuiet(uint32_t &count) {
+  uint32_t lastChange = millis();
+  count = capsReceivedNow();
+  while (millis() - lastChange < 1000) {
+    delay(20);
+    uint32_t now = capsReceivedNow();
+    if (now != count) {
+      count = now;
+      lastChange = millis();
+    }
+  }
+  return lastChange;
+}
+
+void runCaptureBench(DeviceFarm &farm, uint32_t rounds) {
+  size_t n = farm.size();
+  printf("== capture: %zu senders x %u rounds, tcp then udp\n", n, rounds);
+  raiseFdLimit();
+  learnEnabled = true;
+  learnPort = LEARN_TCP;
+  udpLearnPorts = {LEARN_UDP};
+  learnUartBaud = 0;
+  startLearn();
+
+  std::vector<int> tcp, udp;
+  for (size_t i = 0; i < n; i++) {
+    tcp.push_back(openFrom(SOCK_STREAM, farm.device(i).ip, LEARN_TCP));
+    udp.push_back(openFrom(SOCK_DGRAM, farm.device(i).ip, LEARN_UDP));
+    if (tcp.back() < 0 || udp.back() < 0) {
+      printf("   sender %zu: %s\n", i, strerror(errno));
+      closeAll(tcp);
+      closeAll(udp);
+      stopLearn();
+      return;
+    }
+  }
+  delay(500); // every connection accepted and attached
+
+  for (int pass = 0; pass < 2; pass++) {
+    std::vector<int> &fds = pass ? udp : tcp;
+    uint32_t rx0 = capsReceivedNow(), rep0 = capsRepeats;
+    uint32_t sent = 0, t0 = millis();
+    char msg[32];
+    for (uint32_t r = 0; r < rounds; r++) {
+      for (size_t i = 0; i < n; i++) {
+        int len = snprintf(msg, sizeof(msg), "POLL %u %zu\r\n", r, i);
+        sent += send(fds[i], msg, len, MSG_NOSIGNAL) == len;
+      }
+    }
+    uint32_t sendMs = millis() - t0;
+    uint32_t rx;
+    uint32_t ms = waitCapsQuiet(rx) - t0;
+    rx -= rx0;
+    printf("   %s  sent %u in %.2f s, captured %u in %.2f s (%.0f/s), "
+           "%s %u, repeats %u\n",
+           pass ? "udp" : "tcp", sent, sendMs / 1000.0, rx, ms / 1000.0,
+           ms ? rx * 1000.0 / ms : 0.0, pass ? "dropped" : "merged",
+           sent > rx ? sent - rx : 0, capsRepeats - rep0);
+  }
+  {
+    CapsLock lock;
+    printf("   kept %zu, evicted %u, %u B total\n", caps.size(), capsEvicted,
+           capsBytes);
+  }
+  closeAll(tcp);
+  closeAll(udp);
+  delay(500); // the learner sees every close
+  stopLearn();
+}
+
+static uint16_t boundPort(int fd) {
+  sockaddr_in a = {};
+  socklen_t len = sizeof(a);
+  getsockname(fd, (sockaddr *)&a, &len);
+  return ntohs(a.sin_port);
+}
+
+static int listenLoopback(int type) {
+  int fd = socket(AF_INET, type | SOCK_CLOEXEC, 0);
+  sockaddr_in a = sockAddr(LOOPBACK, 0);
+  if (fd < 0 || bind(fd, (sockaddr *)&a, sizeof(a)) < 0 ||
+      (type == SOCK_STREAM && listen(fd, 8) < 0))
+    return -1;
+  return fd;
+}
+
+// Echo servers standing in for the proxied device; they live until exit.
+static uint16_t startTcpEcho() {
+  int fd = listenLoopback(SOCK_STREAM);
+  if (fd < 0)
+    return 0;
+  std::thread([fd]() {
+    for (;;) {
+      int c = accept(fd, nullptr, nullptr);
+      if (c < 0)
+        continue;
+      std::thread([c]() {
+        char buf[16384];
+        ssize_t n;
+        while ((n = recv(c, buf, sizeof(buf), 0)) > 0)
+          for (ssize_t at = 0, w; at < n; at += w)
+            if ((w = send(c, buf + at, n - at, MSG_NOSIGNAL)) <= 0)
+              break;
+        close(c);
+      }).detach();
+    }
+  }).detach();
+  return boundPort(fd);
+}
+
+static std::mutex udpEchoMutex;
+static std::set<uint16_t> udpEchoSources; // one per upstream proxy socket
+
+static uint16_t startUdpEcho() {
+  int fd = listenLoopback(SOCK_DGRAM);
+  if (fd < 0)
+    return 0;
+  std::thread([fd]() {
+    char buf[2048];
+    for (;;) {
+      sockaddr_in from = {};
+      socklen_t len = sizeof(from);
+      ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, (sockaddr *)&from, &len);
+      if (n < 0)
+        continue;
+      {
+        std::lock_guard<std::mutex> lock(udpEchoMutex);
+        udpEchoSources.insert(ntohs(from.sin_port));
+      }
+      sendto(fd, buf, n, 0, (sockaddr *)&from, len);
+    }
+  }).detach();
+  return boundPort(fd);
+}
+
+static void proxyConfigure(const char *proto, uint16_t listen,
+                           uint16_t target) {
+  proxyProto = proto;
+  proxyListenPort = listen;
+  proxyTargetHost = "127.0.0.1";
+  proxyTargetPort = target;
+  proxyCaptureToLearn = false;
+  proxyStart();
+}
+
+// Reads what comes back on `fd` until nothing has for `quietMs`.
+static size_t drain(int fd, uint32_t quietMs) {
+  size_t total = 0;
+  char buf[16384];
+  pollfd p = {fd, POLLIN, 0};
+  while (poll(&p, 1, quietMs) > 0) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0)
+      break;
+    total += n;
+  }
+  return total;
+}
+
+static void runProxyTcp(uint16_t echoPort) {
+  proxyConfigure("tcp", PROXY_TCP, echoPort);
+  int fd = openFrom(SOCK_STREAM, LOOPBACK, PROXY_TCP);
+  if (!proxyRunning || fd < 0) {
+    printf("   tcp  proxy did not start\n");
+    proxyStop();
+    return;
+  }
+  // The upstream leg connects after the client does; what arrives before
+  // it is up is dropped, so probe until an echo comes back.
+  bool up = false;
+  for (int i = 0; i < 50 && !up; i++) {
+    send(fd, "probe\n", 6, MSG_NOSIGNAL);
+    up = drain(fd, 100) > 0;
+  }
+  drain(fd, 300);
+  if (!up) {
+    printf("   tcp  upstream never answered\n");
+    close(fd);
+    proxyStop();
+    return;
+  }
+
+  uint32_t msgs0 = simWsMessages;
+  uint64_t wsBytes0 = simWsBytes;
+  std::atomic<size_t> back{0};
+  std::atomic<uint32_t> lastRx{millis()};
+  std::atomic<bool> done{false};
+  std::thread reader([&]() {
+    char buf[16384];
+    pollfd p = {fd, POLLIN, 0};
+    while (!done) {
+      if (poll(&p, 1, 50) <= 0)
+        continue;
+      ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if (n <= 0)
+        break;
+      back += n;
+      lastRx = millis();
+    }
+  });
+
+  std::vector<char> chunk(4096);
+  for (size_t i = 0; i < chunk.size(); i++)
+    chunk[i] = (char)(i * 7);
+  uint32_t t0 = millis();
+  size_t sent = 0;
+  while (sent < PROXY_BYTES) {
+    ssize_t n = send(fd, chunk.data(), chunk.size(), MSG_NOSIGNAL);
+    if (n <= 0)
+      break;
+    sent += n;
+  }
+  uint32_t sendMs = millis() - t0;
+  while (millis() - lastRx < 2000)
+    delay(50);
+  done = true;
+  reader.join();
+
+  uint32_t ms = lastRx - t0;
+  printf("   tcp  sent %.1f MB in %.2f s, echoed %.1f MB in %.2f s "
+         "(%.2f MB/s), lost %zu B\n",
+         sent / 1048576.0, sendMs / 1000.0, back / 1048576.0, ms / 1000.0,
+         ms ? back / 1048.576 / ms : 0.0, sent - back);
+  printf("        ws %u msgs / %.1f MB for it\n", simWsMessages - msgs0,
+         (simWsBytes - wsBytes0) / 1048576.0);
+  close(fd);
+  delay(1000); // the client's close stops the proxy on async_tcp
+  proxyStop();
+}
+
+static void runProxyUdp(DeviceFarm &farm, uint16_t echoPort) {
+  std::vector<size_t> counts = {4, 64, 65, farm.size()};
+  for (size_t peers : counts) {
+    if (peers > farm.size())
+      continue;
+    proxyService(); // frees the sockets the last run closed
+    uint32_t refused0 = proxyUdpPeersRefused;
+    proxyConfigure("udp", PROXY_UDP, echoPort);
+    if (!proxyRunning) {
+      printf("   udp  proxy did not start\n");
+      return;
+    }
+    size_t sources0;
+    {
+      std::lock_guard<std::mutex> lock(udpEchoMutex);
+      sources0 = udpEchoSources.size();
+    }
+    std::vector<int> fds;
+    std::vector<pollfd> polls;
+    for (size_t i = 0; i < peers; i++) {
+      fds.push_back(openFrom(SOCK_DGRAM, farm.device(i).ip, PROXY_UDP));
+      polls.push_back({fds.back(), POLLIN, 0});
+    }
+
+    uint32_t sent = 0, echoed = 0, t0 = millis();
+    char msg[32];
+    for (uint32_t r = 0; r < UDP_ROUNDS; r++) {
+      for (size_t i = 0; i < peers; i++) {
+        int len = snprintf(msg, sizeof(msg), "peer %zu round %u", i, r);
+        sent += fds[i] >= 0 && send(fds[i], msg, len, 0) == len;
+      }
+      // Collect this round's echoes before the next one.
+      while (poll(polls.data(), polls.size(), 200) > 0)
+        for (pollfd &p : polls)
+          if (p.revents & POLLIN)
+            echoed += recv(p.fd, msg, sizeof(msg), MSG_DONTWAIT) > 0;
+    }
+    uint32_t ms = millis() - t0;
+    size_t upstream;
+    {
+      std::lock_guard<std::mutex> lock(udpEchoMutex);
+      upstream = udpEchoSources.size() - sources0;
+    }
+    printf("   udp  %4zu peers: sent %5u, echoed %5u (%3.0f%%), "
+           "%zu upstream sockets, %u refused, %.2f s\n",
+           peers, sent, echoed, sent ? 100.0 * echoed / sent : 0.0, upstream,
+           proxyUdpPeersRefused - refused0, ms / 1000.0);
+    closeAll(fds);
+    proxyStop();
+  }
+}
+
+void runProxyBench(DeviceFarm &farm) {
+  printf("== proxy: tcp %zu MB through one connection, udp up to %zu peers\n",
+         PROXY_BYTES >> 20, farm.size());
+  raiseFdLimit();
+  uint16_t tcpEcho = startTcpEcho(), udpEcho = startUdpEcho();
+  if (!tcpEcho || !udpEcho) {
+    printf("   echo server: %s\n", strerror(errno));
+    return;
+  }
+  runProxyTcp(tcpEcho);
+  runProxyUdp(farm, udpEcho);
+}
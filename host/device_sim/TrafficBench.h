@@ -0,0 +1,21 @@
+// Capture-ingest and proxy-throughput phases of native_sim. CaptureProxy.cpp
+// is built unchanged on the host AsyncTCP/AsyncUDP shims, so the learner and
+// proxy callbacks run on their own "async_tcp" and "async_udp" threads as
+// they do on the device.
+#ifndef TRAFFIC_BENCH_H
+#define TRAFFIC_BENCH_H
+
+#include "DeviceFarm.h"
+
+// Every farm device opens a TCP connection and a UDP socket from its own
+// address to the learner and sends `rounds` commands on each. Reports
+// captures/s and what was merged or dropped on the way in.
+void runCaptureBench(DeviceFarm &farm, uint32_t rounds);
+
+// TCP: one client streams through the proxy to an echo server and back.
+// UDP: growing numbers of client peers (up to one per farm device) send
+// through the proxy, which keeps an upstream socket for up to 64 peers and
+// refuses the rest until one goes idle.
+void runProxyBench(DeviceFarm &farm);
+
+#endif
@@ -0,0 +1,210 @@
+// Host simulation of the discovery sweep, device monitor, capture learner
+// and proxy against a farm of simulated AV devices (see DeviceFarm.h).
+// AVDiscovery.cpp and CaptureProxy.cpp are built unchanged on top of
+// host/arduino_shim; WiFiClient and the AsyncTCP/AsyncUDP shims reach the
+// farm over loopback.
+//
+//   pio run -e native_sim
+//   .pio/build/native_sim/program [devices] [rttMs] [monitorSecs] [phases]
+//
+// `phases` is a comma list of disc, mon, capture and proxy (default all).
+//
+// Reports:
+//  - discovery: wall time per /24 sweep, hosts found, and how often the
+//    suggested template matches the simulated device kind;
+//  - monitor: time for one full probe pass over every configured device,
+//    how long it takes to notice devices that go offline, and how stale the
+//    online devices' lastSeen is at the end;
+//  - capture: captures/s into the learner from every device at once over
+//    TCP and UDP, and how many were merged or dropped;
+//  - proxy: TCP throughput and loss through the proxy, and UDP echo rate as
+//    the number of client peers grows past the proxy's peer table.
+
+#include "AVDiscovery.h"
+#include "ConfigManager.h"
+#include "DeviceFarm.h"
+#include "FirmwareGlue.h"
+#include "TrafficBench.h"
+
+#include <algorithm>
+#include <map>
+#include <stdio.h>
+#include <unistd.h>
+
+static String jsonField(const String &row, const char *key) {
+  String k = String("\"") + key + "\":\"";
+  int at = row.indexOf(k.c_str());
+  if (at < 0)
+    return "";
+  int end = row.indexOf('"', at + k.length());
+  return row.substring(at + k.length(), end);
+}
+
+static uint32_t percentile(std::vector<uint32_t> v, double p) {
+  if (v.empty())
+    return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p * v.size()))];
+}
+
+static void runDiscovery(DeviceFarm &farm) {
+  printf("== discovery: %zu devices, ports probed per host: 9\n", farm.size());
+  std::map<uint32_t, size_t> byIp;
+  for (size_t i = 0; i < farm.size(); i++)
+    byIp[(uint32_t)farm.device(i).ip] = i;
+
+  std::map<SimKind, std::pair<size_t, size_t>> match; // kind -> ok, total
+  size_t found = 0;
+  uint32_t total = millis();
+  for (const IPAddress &net : farm.subnets()) {
+    WiFi.hostSetLocalIP(IPAddress(net[0], net[1], net[2], 254));
+    uint32_t scans = discScans, t0 = millis(), lastReport = t0;
+    startDisc();
+    while (discScans == scans || discRunning) {
+      delay(50);
+      if (millis() - lastReport >= 10000) {
+        lastReport = millis();
+        printf("   %u.%u.%u.x  %u/254 hosts\n", net[0], net[1], net[2],
+               discProgress);
+        fflush(stdout);
+      }
+    }
+    std::vector<String> rows;
+    {
+      DiscLock lock;
+      rows = discFound;
+    }
+    printf("   %s/24  %6.1f s  %zu found\n", net.toString().c_str(),
+           (millis() - t0) / 1000.0, rows.size());
+    for (const String &row : rows) {
+      IPAddress ip;
+      auto it = byIp.find(ip.fromString(jsonField(row, "ip")) ? (uint32_t)ip
+                                                              : 0);
+      if (it == byIp.end())
+        continue;
+      found++;
+      SimKind k = farm.device(it->second).kind;
+      match[k].second++;
+      if (jsonField(row, "suggestedTemplateId") == simKindTemplate(k))
+        match[k].first++;
+    }
+  }
+  printf("   total %.1f s, %zu/%zu hosts found\n", (millis() - total) / 1000.0,
+         found, farm.size());
+  for (auto &m : match)
+    printf("   %-12s template right %zu/%zu\n", simKindName(m.first),
+           m.second.first, m.second.second);
+}
+
+static void runMonitor(DeviceFarm &farm, uint32_t secs) {
+  printf("== monitor: %zu devices, %u s\n", farm.size(), secs);
+  {
+    CfgLock lock;
+    cfg.devices.clear();
+    for (size_t i = 0; i < farm.size(); i++) {
+      const SimDevice &s = farm.device(i);
+      DeviceCfg d;
+      d.id = internId(String("dev") + String((unsigned)i));
+      d.ip = s.ip.toString();
+      d.portHint = s.ports.back();
+      cfg.devices.push_back(d);
+    }
+  }
+  // Create every status up front so the vector never reallocates while
+  // this thread samples it.
+  devStatuses.reserve(farm.size());
+  for (size_t i = 0; i < farm.size(); i++)
+    updateDevStatus(String("dev") + String((unsigned)i), false,
+                    farm.device(i).ip.toString(), farm.device(i).ports.back());
+
+  uint32_t t0 = millis();
+  xTaskCreate(deviceMonitorTask, "devMon", 4096, nullptr, 1, nullptr);
+
+  // First pass: until every device has been seen once.
+  uint32_t firstPass = 0;
+  while (!firstPass && millis() - t0 < secs * 1000) {
+    delay(100);
+    bool all = true;
+    for (const DevStatus &s : devStatuses)
+      all = all && s.lastSeenMs >= t0;
+    if (all)
+      firstPass = millis() - t0;
+  }
+  if (firstPass)
+    printf("   first full pass %.1f s (%.1f ms per device)\n",
+           firstPass / 1000.0, (double)firstPass / farm.size());
+  else
+    printf("   first pass did not finish\n");
+
+  // Take 5% offline and time how long each takes to show as offline.
+  std::vector<size_t> down;
+  for (size_t i = 0; i < farm.size(); i += 20)
+    down.push_back(i);
+  for (size_t i : down)
+    farm.setOnline(i, false);
+  uint32_t tOff = millis();
+  std::vector<uint32_t> detect(down.size(), 0);
+  while (millis() - t0 < secs * 1000) {
+    delay(50);
+    size_t pending = 0;
+    for (size_t k = 0; k < down.size(); k++) {
+      if (!detect[k] && !devStatuses[down[k]].online)
+        detect[k] = millis() - tOff;
+      pending += !detect[k];
+    }
+    if (!pending)
+      break;
+  }
+  std::vector<uint32_t> seen;
+  for (uint32_t d : detect)
+    if (d)
+      seen.push_back(d);
+  printf("   offline detected %zu/%zu: p50 %.1f s, max %.1f s\n", seen.size(),
+         down.size(), percentile(seen, 0.5) / 1000.0,
+         percentile(seen, 1.0) / 1000.0);
+
+  std::vector<uint32_t> stale;
+  uint32_t now = millis();
+  for (size_t i = 0; i < devStatuses.size(); i++)
+    if (i % 20)
+      stale.push_back(now - devStatuses[i].lastSeenMs);
+  printf("   online staleness p50 %.1f s, p99 %.1f s, max %.1f s\n",
+         percentile(stale, 0.5) / 1000.0, percentile(stale, 0.99) / 1000.0,
+         percentile(stale, 1.0) / 1000.0);
+  printf("   tcp probes %u (%u open)\n", tcpProbes, tcpProbesOpen);
+}
+
+int main(int argc, char **argv) {
+  FarmOptions opts;
+  if (argc > 1)
+    opts.devices = strtoul(argv[1], nullptr, 10);
+  if (argc > 2)
+    opts.rttMs = strtoul(argv[2], nullptr, 10);
+  uint32_t monitorSecs = argc > 3 ? strtoul(argv[3], nullptr, 10) : 60;
+  String phases = String(",") + (argc > 4 ? argv[4] : "disc,mon,capture,proxy")
+                  + ",";
+  auto want = [&](const char *p) {
+    return phases.indexOf((String(",") + p + ",").c_str()) >= 0;
+  };
+
+  DeviceFarm farm(opts);
+  if (!farm.start())
+    return 1;
+  if (want("disc"))
+    runDiscovery(farm);
+  if (want("capture"))
+    runCaptureBench(farm, 20);
+  if (want("proxy"))
+    runProxyBench(farm);
+  // Last: the monitor task never stops.
+  if (want("mon"))
+    runMonitor(farm, monitorSecs);
+  printf("== farm: %llu connections, %llu bytes sent; ws %u msgs / %llu B\n",
+         (unsigned long long)farm.connections(),
+         (unsigned long long)farm.bytesSent(), simWsMessages.load(),
+         (unsigned long long)simWsBytes.load());
+  fflush(stdout);
+  // The monitor task and the network threads never return; leave without
+  // running static destructors under them.
+  _exit(0);
+}
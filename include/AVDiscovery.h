@@ -3,6 +3,7 @@
 
 #include "AppConfig.h"
 #include <WiFi.h>
+#include <freertos/semphr.h>
 #include <vector>
 
 
@@ -17,7 +18,16 @@ struct DevStatus {
 extern std::vector<DevStatus> devStatuses;
 extern bool discRunning;
 extern uint32_t discProgress;
-extern std::vector<String> discFound;
+extern std::vector<String> discFound; // one serialized JSON row per host
+extern uint32_t discScans;
+extern uint32_t tcpProbes; // every tcpProbe() call, monitor included
+extern uint32_t tcpProbesOpen;
+
+// discFound is appended by the scan task and read by the web server.
+struct DiscLock {
+  DiscLock();
+  ~DiscLock();
+};
 
 void updateDevStatus(const String &id, bool online, const String &ip,
                      uint16_t port);
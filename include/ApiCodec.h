@@ -0,0 +1,39 @@
+#ifndef API_CODEC_H
+#define API_CODEC_H
+
+#include "AppConfig.h"
+#include <ArduinoJson.h>
+#include <vector>
+
+// Content negotiation for the REST API. Clients that send
+// `Accept: application/msgpack` or `Accept: application/cbor` get that
+// encoding back; request bodies are decoded by their Content-Type. Anything
+// else is JSON. Error bodies stay JSON text, so check the status first.
+enum class ApiCodec : uint8_t { Json, MsgPack, Cbor };
+
+ApiCodec responseCodec(AsyncWebServerRequest *req); // from Accept
+ApiCodec requestCodec(AsyncWebServerRequest *req);  // from Content-Type
+const char *codecMime(ApiCodec c);
+
+// Encodes `doc` with the negotiated codec and sends it. The encode time is
+// reported in an X-Encode-Us header.
+void sendDoc(AsyncWebServerRequest *req, JsonVariantConst doc,
+             int code = 200);
+// {"ok":true[,"note":...]} through sendDoc(), so it follows Accept too.
+void sendOk(AsyncWebServerRequest *req, const char *note = nullptr);
+
+// Decodes a request body according to its Content-Type.
+DeserializationError parseBody(AsyncWebServerRequest *req, const uint8_t *data,
+                               size_t len, JsonDocument &doc);
+
+// Returns the encoded size; `out` may be null to only measure.
+size_t encodeDoc(ApiCodec c, JsonVariantConst doc, std::vector<uint8_t> *out);
+
+// RFC 8949 subset: definite and indefinite arrays/maps, ints, floats
+// (half/single/double), text, bool, null. Byte strings decode to hex text
+// and tags are skipped.
+size_t serializeCbor(JsonVariantConst v, std::vector<uint8_t> &out);
+DeserializationError deserializeCbor(JsonDocument &doc, const uint8_t *data,
+                                     size_t len);
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef APP_CONFIG_H
 #define APP_CONFIG_H
 
+#include "Log.h"
 #include <Arduino.h>
 #include <ESPAsyncWebServer.h>
 #include <Preferences.h>
@@ -9,19 +10,24 @@
 static const char *FW_VERSION =
     "0.5.0"; // Major update: OTA Tab, Discovery Fixes
 
+// RS-232 port (UART2 behind a MAX3232) used by the serial terminal, proxy,
+// learner and TCP<->UART bridge.
+static const int8_t AV_UART_RX_PIN = 16;
+static const int8_t AV_UART_TX_PIN = 17;
+
 // Global objects (defined in main.cpp for now, or a central location)
 extern AsyncWebServer server;
 extern AsyncWebSocket wsLog;
 extern AsyncWebSocket wsTerm;
 extern AsyncWebSocket wsProxy;
 extern AsyncWebSocket wsDisc;
+extern AsyncWebSocket wsState;
 extern Preferences prefs;
 
 extern uint32_t bootMs;
 extern bool shouldReboot;
 
 // Shared utilities
-void logAll(const String &s);
 void wsTextAll(AsyncWebSocket &ws, const String &s);
 
 #endif
@@ -0,0 +1,27 @@
+#ifndef ASSET_SERVER_H
+#define ASSET_SERVER_H
+
+#include "AppConfig.h"
+
+// Serves the web UI from the /assets.json manifest written by
+// tools/build_assets.py: gzip when the client accepts it, strong ETags with
+// 304 revalidation, and year-long immutable caching for hashed file names.
+// Returns false when the filesystem has no manifest yet; serveStatic() then
+// handles everything as before.
+//
+// Also registers per-file updates, so a UI change doesn't need a whole
+// LittleFS image (which would wipe logs and config). tools/push_assets.py
+// drives them:
+//   GET  /api/assets                           the manifest in use
+//   POST /api/assets/file?path=/name&sha256=&manifest=   raw body; written
+//        to a temp file, checked against the SHA-256, then staged as
+//        /name.new for the manifest whose SHA-256 is `manifest`
+// Uploading /assets.json last commits the update: every file it lists must
+// be staged for it or already there (409 with "missing" otherwise), the
+// staged ones are renamed into place, files only the old manifest listed
+// are removed, and the new table is served at once. Until then the device
+// serves the old UI unchanged, so a push that fails half way changes
+// nothing visible; files staged for another manifest are discarded.
+bool setupAssets();
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef BOOT_TIMING_H
+#define BOOT_TIMING_H
+
+#include "AppConfig.h"
+#include <ArduinoJson.h>
+
+// Where the time between power-on and a usable box goes. setup() marks the
+// end of each phase with bootPhase(); milestones that happen on other tasks
+// (STA associated, got an IP, first HTTP response sent) are recorded once,
+// the first time they happen. All times are ms since power-on (millis()).
+//
+// Reported in /api/health -> boot as
+//   {"phases":[{"name","atMs","ms"},...],"staConnectedMs","staIpMs",
+//    "firstHttpMs","fastConnect"}
+// with null for milestones that haven't happened yet.
+
+enum class BootEvent : uint8_t { StaConnected, StaIp, FirstHttp, Count };
+
+void bootPhase(const char *name); // name must be a literal
+void bootEvent(BootEvent e);
+void bootToJson(JsonObject out);
+
+#endif
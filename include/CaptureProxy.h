@@ -2,10 +2,12 @@
 #define CAPTURE_PROXY_H
 
 #include "AppConfig.h"
+#include <deque>
+#include <freertos/semphr.h>
 #include <vector>
 
 struct Capture {
-  String id;
+  uint32_t id = 0; // sequence number, 1 for the first capture since boot
   uint32_t ts;
   String srcIp;
   uint16_t srcPort;
@@ -18,25 +20,64 @@ struct Capture {
   String hash;
   String suffixHint;
   String payloadType; // "ascii" or "hex"
+  String proto = "tcp"; // "tcp", "udp" or "uart"
+  // Deleted through the API: payload freed, skipped everywhere, and the
+  // slot kept so ids still map to positions until it is evicted.
+  bool deleted = false;
 };
 
-extern std::vector<Capture> caps;
+// Captures are fed from both the async_tcp and async_udp tasks, so any
+// access to `caps` must hold this lock.
+struct CapsLock {
+  CapsLock();
+  ~CapsLock();
+};
+
+extern std::deque<Capture> caps;
+// Captures dropped from the front so far: caps[i] has id capsEvicted + i + 1,
+// so lookups by id are an index, and positions stay stable while a
+// response is streaming.
+extern uint32_t capsEvicted;
+// Everything passed to addCapture, including repeats folded into the last
+// capture.
+extern uint32_t capsReceived;
+extern uint32_t capsRepeats;
+extern uint32_t capsBytes;
 extern uint16_t learnPort;
 extern bool learnEnabled;
+extern std::vector<uint16_t> udpLearnPorts;
+extern uint32_t learnUartBaud;
 
 extern bool proxyRunning;
+extern String proxyProto; // "tcp" | "udp"
 extern bool proxyCaptureToLearn;
 extern uint16_t proxyListenPort;
 extern String proxyTargetHost;
 extern uint16_t proxyTargetPort;
+extern uint32_t proxyTargetBaud; // used when proxyTargetHost == "uart"
+extern uint32_t proxyConnections;
+extern uint32_t proxyBytesToTarget;
+extern uint32_t proxyBytesToClient;
+// UDP client peers turned away because the peer table was full.
+extern uint32_t proxyUdpPeersRefused;
 
 void startLearn();
 void stopLearn();
 void addCapture(const String &srcIp, uint16_t srcPort, uint16_t localPort,
-                const uint8_t *data, size_t len);
-bool getCaptureById(const String &id, Capture &out);
+                const uint8_t *data, size_t len, const char *proto = "tcp");
+// nullptr if the id was evicted, deleted or never issued. Caller holds
+// CapsLock.
+Capture *findCaptureLocked(uint32_t id);
+bool getCaptureById(uint32_t id, Capture &out);
+// Batch edits; ids that aren't found are appended to `missing`. Return
+// how many captures changed.
+size_t pinCaptures(const std::vector<uint32_t> &ids, bool pin,
+                   std::vector<uint32_t> &missing);
+size_t deleteCaptures(const std::vector<uint32_t> &ids,
+                      std::vector<uint32_t> &missing);
 
 void proxyStart();
 void proxyStop();
+void proxyService(); // from loop(): ages out idle UDP peers
 
 #endif
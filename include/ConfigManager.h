@@ -2,13 +2,81 @@
 #define CONFIG_MANAGER_H
 
 #include "AppConfig.h"
+#include <ArduinoJson.h>
+#include <freertos/semphr.h>
+#include <vector>
 
-extern String cfgJson;
+// Device and template config is held as a typed model, parsed once at boot
+// or when the whole config is replaced. JSON only appears at the API and
+// storage edges. Storage is a LittleFS snapshot plus an edit journal under
+// /cfg (see ConfigManager.cpp); the old NVS "cfg_json" blob is migrated once.
+
+// Interned id: index into a process-wide string table. 0 is the empty id.
+// Entries nothing in cfg refers to any more are dropped when devices are
+// deleted or the config is replaced, and their slots reused, so an IdRef is
+// only meaningful while CfgLock is held. The table belongs to the model, so
+// these need CfgLock too.
+using IdRef = uint32_t;
+IdRef internId(const String &s);
+IdRef findId(const String &s); // 0 if never interned
+const String &idStr(IdRef id);
+
+struct DeviceCfg {
+  IdRef id = 0;
+  String name;
+  String ip;
+  uint16_t portHint = 0;
+  String defaultSuffix;
+  String notes;
+  IdRef templateId = 0;
+  String defaultPayloadType;
+  String mac;
+  uint32_t lastSeenMs = 0;
+  String extra; // unknown keys, as a serialized object ("" if none)
+};
+
+struct TemplateCfg {
+  IdRef id = 0;
+  String name;
+  uint16_t defaultPort = 0;
+  String defaultSuffix;
+  String json; // the whole template (commands, macros, ...) as stored
+};
+
+struct ConfigModel {
+  std::vector<DeviceCfg> devices;
+  std::vector<TemplateCfg> templates;
+  String extra;         // unknown top-level keys, serialized object
+  uint32_t version = 0; // bumped on every change
+
+  // Index into devices/templates, or -1. O(1) through the IdRef tables.
+  int deviceIndex(IdRef id) const;
+  int templateIndex(IdRef id) const;
+  void reindex();
+
+  std::vector<int16_t> devByRef;
+  std::vector<int16_t> tplByRef;
+};
+
+extern ConfigModel cfg;
+
+// cfg is edited from web handlers and read by the monitor and macro tasks.
+struct CfgLock {
+  CfgLock();
+  ~CfgLock();
+};
 
 void loadCfg();
-void saveCfg();
+void saveCfg(); // full snapshot; single edits only append to the journal
 String defaultCfgJson();
 
+// Replaces the whole model (POST /api/config). False if the JSON is invalid.
+bool cfgFromJson(const char *json, size_t len);
+void deviceToJson(const DeviceCfg &d, JsonObject o);
+// Templates go in as their stored JSON text unless `parsedTemplates`, which
+// binary encoders need since they can't embed raw JSON.
+void cfgToJson(JsonDocument &doc, bool parsedTemplates = false);
+
 bool updateCfgWithDevice(const String &name, const String &ip,
                          uint16_t portHint, const String &suffixHint,
                          const String &notes, const String &templateId,
@@ -16,4 +84,14 @@ bool updateCfgWithDevice(const String &name, const String &ip,
 
 bool removeDevice(const String &id);
 
+void cfgStoreStats(JsonObject out);
+// Before a filesystem OTA overwrites the partition: waits out a running
+// compaction, then stops all store writes until reboot, or until
+// cfgStoreResume() if the update failed before writing anything. The API
+// refuses config edits meanwhile (cfgStoreSuspended), since they could not
+// be saved.
+void cfgStoreSuspend();
+void cfgStoreResume();
+bool cfgStoreSuspended();
+
 #endif
@@ -0,0 +1,29 @@
+#ifndef JOB_QUEUE_H
+#define JOB_QUEUE_H
+
+#include "AppConfig.h"
+#include <ArduinoJson.h>
+#include <functional>
+
+// Blocking work (ping, SSDP, mDNS, WiFi scan, PJLink) runs on a small pool
+// of worker tasks instead of inside the async_tcp callback. Handlers submit
+// a job and answer 202 {"jobId":n}; the result is at /api/jobs/<n> and is
+// also pushed on /wsstate as {"type":"job","id","kind","state",...}.
+//
+// Jobs of the same kind never overlap: the libraries behind them (ESP32Ping,
+// ESPmDNS results, WiFi scan list) keep global state.
+
+// Fills `result`, or sets `err` on failure.
+using JobFn = std::function<void(JsonDocument &result, String &err)>;
+
+void setupJobs();
+// Returns 0 if the queue is full.
+uint32_t jobSubmit(const char *kind, JobFn fn);
+bool jobToJson(uint32_t id, JsonObject out);
+void jobStatsToJson(JsonObject out);
+void jobListToJson(JsonArray out);
+
+// Sends 202 with the job id, or 503 if the queue is full.
+void sendJobAccepted(AsyncWebServerRequest *req, uint32_t id);
+
+#endif
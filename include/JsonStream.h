@@ -0,0 +1,58 @@
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include "AppConfig.h"
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+#include <functional>
+
+// Large list endpoints stream their rows into the socket as chunked
+// responses instead of building a JsonDocument plus a complete String, which
+// needed about twice the payload in contiguous heap. Fillers run in the
+// async_tcp task, one TCP window at a time, so a row source must take
+// whatever lock its data needs on each call.
+
+// Serializes row `i` (rows are requested in order) into `row`; returns false
+// when there are no more rows.
+using JsonRowSource = std::function<bool(size_t i, String &row)>;
+// Produces the next raw piece of the document; returns false when done.
+using JsonPartSource = std::function<bool(String &part)>;
+
+// The status line is gone by the time a source finds its data changed under
+// it, so it can't answer 409. It calls jsonStreamAbort(row or part) and
+// returns false instead: the body then ends with JSON_STREAM_ABORTED, which
+// no JSON parser accepts, rather than with a shorter document that parses.
+// Clients retry on seeing it.
+static const char JSON_STREAM_ABORTED[] = "\n!aborted: changed while sending\n";
+bool jsonStreamAbort(String &out);
+
+// Heap used by one response: free heap when the handler started minus the
+// lowest free heap seen while it ran. Approximate, since other tasks
+// allocate concurrently, but good enough to compare the two paths.
+struct HeapProbe {
+  explicit HeapProbe(const char *route);
+  void sample();
+  void record(bool streamed);
+
+  const char *route;
+  uint32_t baseFree;
+  uint32_t minFree;
+};
+
+// Sends `head` + rows joined with ',' + `tail`.
+void sendJsonRows(AsyncWebServerRequest *req, HeapProbe probe,
+                  const String &head, const String &tail, JsonRowSource rows);
+
+// Sends the pieces as they come, for documents that aren't one flat list.
+void sendJsonParts(AsyncWebServerRequest *req, HeapProbe probe,
+                   JsonPartSource parts);
+
+// Buffered path kept behind ?buffered=1 for comparison. Streaming is JSON
+// only; msgpack/CBOR clients (see ApiCodec.h) always get this path.
+void sendJsonBuffered(AsyncWebServerRequest *req, HeapProbe &probe,
+                      JsonVariantConst doc);
+
+bool wantBuffered(AsyncWebServerRequest *req);
+void heapStatsToJson(JsonArray out);
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <IPAddress.h>
+#include <atomic>
+#include <type_traits>
+
+// Leveled, deferred logging. A call such as
+//   logInfo("term", "session %u connected to %s:%u", sid, ip, port);
+// copies the format pointer and the raw arguments into a slot of a
+// lock-free multi-producer ring and returns; one logger task formats the
+// line later, prints it on Serial, pushes it to /ws and keeps the last
+// LOG_BACKLOG lines for clients that connect afterwards. Nothing on the
+// calling side touches the UART, a socket or the heap, so it is safe from
+// network callbacks and other hot paths. When the ring is full the line is
+// dropped and counted rather than blocking.
+//
+// The format and module must be string literals: only their pointers are
+// stored. Supported conversions are d i u x X o c s p f e g (flags, width
+// and precision as in printf; length modifiers are ignored because each
+// argument records its own width). `String`, `const char *` and
+// `IPAddress` arguments are copied into the slot; together the arguments
+// get LOG_ARG_BYTES, and long strings are cut to fit.
+
+enum class LogLevel : uint8_t { Debug, Info, Warn, Error };
+
+static const size_t LOG_SLOTS = 64; // power of two
+static const size_t LOG_ARG_BYTES = 96;
+static const size_t LOG_BACKLOG = 64;
+
+extern volatile LogLevel logLevel;
+
+void setupLog();
+void logSetLevel(LogLevel level);
+const char *logLevelName(LogLevel level);
+bool logLevelFromName(const String &name, LogLevel &out);
+// The backlog as one '\n'-joined message, oldest line first.
+String logBacklog();
+void logStatsToJson(JsonObject out);
+
+// ---- Producer side, used by the templates below ----
+
+struct LogSlot {
+  std::atomic<uint32_t> seq;
+  uint32_t ms;
+  const char *module;
+  const char *fmt;
+  LogLevel level;
+  uint8_t argLen;
+  uint8_t args[LOG_ARG_BYTES];
+};
+
+// Returns nullptr (and counts a drop) if the ring is full.
+LogSlot *logClaim();
+void logCommit(LogSlot *s);
+
+// Argument tags as stored in LogSlot::args.
+enum : uint8_t {
+  LOG_ARG_I32 = 'i',
+  LOG_ARG_I64 = 'I',
+  LOG_ARG_U32 = 'u',
+  LOG_ARG_U64 = 'U',
+  LOG_ARG_F64 = 'f',
+  LOG_ARG_STR = 's', // length byte, then the bytes
+  LOG_ARG_PTR = 'p',
+  LOG_ARG_IP4 = 'a',
+};
+
+class LogArgs {
+public:
+  explicit LogArgs(uint8_t *buf) : buf(buf), len(0) {}
+
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value>::type add(T v) {
+    if (std::is_signed<T>::value) {
+      if (sizeof(T) <= 4)
+        put(LOG_ARG_I32, (int32_t)v);
+      else
+        put(LOG_ARG_I64, (int64_t)v);
+    } else {
+      if (sizeof(T) <= 4)
+        put(LOG_ARG_U32, (uint32_t)v);
+      else
+        put(LOG_ARG_U64, (uint64_t)v);
+    }
+  }
+  template <typename T>
+  typename std::enable_if<std::is_enum<T>::value>::type add(T v) {
+    put(LOG_ARG_I32, (int32_t)v);
+  }
+  template <typename T>
+  typename std::enable_if<std::is_floating_point<T>::value>::type add(T v) {
+    put(LOG_ARG_F64, (double)v);
+  }
+  void add(const char *s) { addStr(s ? s : "(null)", s ? strlen(s) : 6); }
+  void add(const String &s) { addStr(s.c_str(), s.length()); }
+  void add(const IPAddress &ip) { put(LOG_ARG_IP4, (uint32_t)ip); }
+  void add(const void *p) { put(LOG_ARG_PTR, (uint32_t)(uintptr_t)p); }
+
+  uint8_t *buf;
+  size_t len;
+
+private:
+  template <typename V> void put(uint8_t tag, V v) {
+    if (len + 1 + sizeof(V) > LOG_ARG_BYTES) {
+      len = LOG_ARG_BYTES; // no room: this and later arguments print as '?'
+      return;
+    }
+    buf[len++] = tag;
+    memcpy(buf + len, &v, sizeof(V));
+    len += sizeof(V);
+  }
+  void addStr(const char *s, size_t n) {
+    if (len + 2 > LOG_ARG_BYTES) {
+      len = LOG_ARG_BYTES;
+      return;
+    }
+    size_t room = LOG_ARG_BYTES - len - 2;
+    if (n > room)
+      n = room;
+    if (n > 255)
+      n = 255;
+    buf[len++] = LOG_ARG_STR;
+    buf[len++] = (uint8_t)n;
+    memcpy(buf + len, s, n);
+    len += n;
+  }
+};
+
+inline void logPack(LogArgs &) {}
+template <typename T, typename... Rest>
+inline void logPack(LogArgs &a, const T &v, const Rest &...rest) {
+  a.add(v);
+  logPack(a, rest...);
+}
+
+template <typename... Args>
+void logMsg(LogLevel level, const char *module, const char *fmt,
+            const Args &...args) {
+  if (level < logLevel)
+    return;
+  LogSlot *s = logClaim();
+  if (!s)
+    return;
+  s->ms = millis();
+  s->module = module;
+  s->fmt = fmt;
+  s->level = level;
+  LogArgs a(s->args);
+  logPack(a, args...);
+  s->argLen = (uint8_t)a.len;
+  logCommit(s);
+}
+
+template <typename... Args>
+void logDebug(const char *module, const char *fmt, const Args &...args) {
+  logMsg(LogLevel::Debug, module, fmt, args...);
+}
+template <typename... Args>
+void logInfo(const char *module, const char *fmt, const Args &...args) {
+  logMsg(LogLevel::Info, module, fmt, args...);
+}
+template <typename... Args>
+void logWarn(const char *module, const char *fmt, const Args &...args) {
+  logMsg(LogLevel::Warn, module, fmt, args...);
+}
+template <typename... Args>
+void logError(const char *module, const char *fmt, const Args &...args) {
+  logMsg(LogLevel::Error, module, fmt, args...);
+}
+
+#endif
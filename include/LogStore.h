@@ -0,0 +1,34 @@
+#ifndef LOG_STORE_H
+#define LOG_STORE_H
+
+#include "AppConfig.h"
+#include <ArduinoJson.h>
+
+// Log lines persisted to LittleFS under /logs, so a box that misbehaved
+// overnight still has its history. The logger task only appends to a RAM
+// staging buffer (never touching flash); a low-priority task writes the
+// buffer out every 10 s, or sooner once it is half full, as one append.
+//
+// Segments are /logs/<first seq, 8 hex>.bin: a "ALG1" magic, then records
+//   u32 seq | u16 boot | u32 ms | u8 level | u8 len | len bytes "module: msg"
+// (little endian). `seq` keeps counting across reboots and `boot` comes
+// from NVS. A segment is closed once it passes 16 KB and the oldest are
+// removed beyond 4, so the store stays under ~80 KB.
+//
+// GET /api/logs?since=<seq> streams the records after `since` as
+// {"logs":[{"seq","boot","ms","level","msg"},...]}.
+
+void setupLogStore(); // after LittleFS and prefs are up
+// Called by the logger task for every line it emits.
+void logStoreAppend(uint32_t ms, LogLevel level, const char *text);
+// Writes out whatever is staged; done before a deliberate reboot.
+void logStoreFlush();
+// Stops all flushing (including the pre-reboot one) once a filesystem OTA
+// begins, so nothing is written through the old mount.
+void logStoreSuspend();
+// After a filesystem OTA that failed before writing anything.
+void logStoreResume();
+void logStoreStatsToJson(JsonObject out);
+void sendStoredLogs(AsyncWebServerRequest *req, uint32_t since);
+
+#endif
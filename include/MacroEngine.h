@@ -0,0 +1,62 @@
+#ifndef MACRO_ENGINE_H
+#define MACRO_ENGINE_H
+
+#include "AppConfig.h"
+#include <ArduinoJson.h>
+#include <vector>
+
+// Send/expect macros run on the controller so multi-step sequences don't pay
+// a browser round trip per step. Macros live in a template's "macros" array:
+//
+//   {"name":"Startup","steps":[
+//     {"op":"send","payload":"POWR1","suffix":"\\r"},
+//     {"op":"expect","match":"PWR=1","timeoutMs":8000,"onTimeout":"continue"},
+//     {"op":"branch","if":"timeout","goto":"fail"},
+//     {"op":"delay","ms":500},
+//     {"op":"send","payloadType":"hex","payload":"AA 14 01 01 21"},
+//     {"op":"expect","match":"^OK\\s*$","regex":true},
+//     {"label":"fail","op":"send","payload":"POWR?"}]}
+//
+// send:   payloadType ascii|hex, suffix defaults to the device's.
+// expect: substring (or regexSearch() pattern with "regex":true) in the
+//         device output since the last match; onTimeout abort|continue.
+// branch: jump to a step label if the last expect "matched" or hit "timeout".
+struct MacroStep {
+  String op;
+  String label;
+  std::vector<uint8_t> data; // send
+  String match;              // expect
+  bool regex = false;
+  uint32_t timeoutMs = 3000;
+  bool abortOnTimeout = true;
+  uint32_t ms = 0;          // delay
+  bool ifMatched = true;    // branch
+  String target;
+};
+
+struct MacroStepResult {
+  uint16_t index;
+  String op;
+  uint32_t ms;
+  bool ok;
+  String detail;
+};
+
+struct MacroRun {
+  uint32_t id = 0;
+  String deviceId;
+  String macro;
+  String state; // running | done | failed
+  String error;
+  uint32_t startedMs = 0;
+  uint32_t totalMs = 0;
+  std::vector<MacroStepResult> steps;
+};
+
+// Looks up the device and its template's macro, then runs it on a worker
+// task. Returns the run id, or 0 with `err` set.
+uint32_t macroStart(const String &deviceId, const String &macroName,
+                    String &err);
+bool macroRunToJson(uint32_t id, JsonObject out);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "AppConfig.h"
+
+// GET /metrics (and /api/metrics) in the Prometheus text exposition format,
+// for fleet scraping: heap and fragmentation, task stack high-water marks,
+// per-route request counts and latency histograms, and learner, proxy,
+// discovery, WebSocket, job and bridge counters.
+//
+// Route latency runs from the end of the request headers to the connection
+// closing, so it covers body upload, the handler and sending the response.
+// It is hooked through req->onDisconnect(), so handlers must not set their
+// own. WebSocket upgrades are not counted.
+
+// Must run before any other handler is added to `server`.
+void setupMetrics();
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef OTA_H
+#define OTA_H
+
+#include "AppConfig.h"
+
+// POST /update?type=firmware|fs&sha256=<hex> (multipart, one file; both
+// may also be form fields ahead of the file).
+//
+// The image may be raw or gzip (`gzip -9 firmware.bin`); gzip is inflated
+// while it streams in, through the ROM inflater and a fixed 32 KB window, so
+// nothing larger than a flash sector is ever buffered. The gzip CRC32 and
+// length are checked, and a SHA-256 of the image as written (after
+// inflating, i.e. `sha256sum firmware.bin`) is computed on the way.
+// `sha256` is required and must match before Update.end() marks the new
+// app partition bootable; otherwise the update is aborted and the running
+// firmware stays. The web UI hashes the file in the browser before
+// uploading. A filesystem image is written in place: the log store and the
+// config journal stop writing when an fs update starts, up to the reboot.
+// If it fails before any of the image was written they resume; after that
+// the filesystem needs re-uploading, and config edits get 503 until then.
+//
+// One update at a time; a second upload gets 409. Progress goes out on
+// /wsstate as {"type":"ota","state":"writing"|"done"|"failed","target",
+// "received","total","written","kBps","gzip"[,"sha256","error"]} at most
+// every 250 ms, and the POST answers with the same fields.
+void setupOta();
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef SERIAL_BRIDGE_H
+#define SERIAL_BRIDGE_H
+
+#include "AppConfig.h"
+
+// TCP<->UART serial device server: one TCP client at a time on bridgePort is
+// piped straight to the RS-232 port and back.
+extern bool bridgeRunning;
+extern uint16_t bridgePort;
+extern uint32_t bridgeBaud;
+extern uint32_t bridgeBytesToUart;
+extern uint32_t bridgeBytesFromUart;
+
+bool bridgeStart();
+void bridgeStop();
+bool bridgeClientConnected();
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include "AppConfig.h"
+#include <mbedtls/sha256.h>
+
+// Incremental SHA-256 on mbedtls (hardware backed on the ESP32), hiding
+// the function renames between mbedtls 2.x and 3.x.
+class Sha256 {
+public:
+  Sha256();
+  ~Sha256();
+  void update(const uint8_t *data, size_t len);
+  // Lowercase hex digest; the object can't be updated afterwards.
+  String finishHex();
+
+private:
+  Sha256(const Sha256 &) = delete;
+  Sha256 &operator=(const Sha256 &) = delete;
+  mbedtls_sha256_context ctx;
+};
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef STATE_CHANNEL_H
+#define STATE_CHANNEL_H
+
+#include "AppConfig.h"
+
+// /wsstate pushes the /api/health document to dashboards instead of having
+// each of them poll it. A client gets
+//   {"type":"snapshot","v":<n>,"state":{...}}
+// on connect (or after sending {"action":"snapshot"}), then
+//   {"type":"delta","v":<n>,"set":{"wifi.rssi":-61,"learn.udpPorts":[...]}}
+// with dotted paths of the leaves that changed; arrays are replaced whole.
+// Leaves that went away are listed as "del":["path",...] (applied first).
+// `v` goes up by one per message, so a client that sees a gap re-requests a
+// snapshot. The state is sampled after stateNotify() and every 2 s, once no
+// matter how many clients are attached, and not at all when none are.
+
+void setupStateChannel();
+void stateService(); // from loop()
+void stateNotify();  // something changed; sample on the next loop pass
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef TCP_TRANSPORT_H
+#define TCP_TRANSPORT_H
+
+#include "Transport.h"
+#include <AsyncTCP.h>
+
+class TcpTransport : public Transport {
+public:
+  TcpTransport();                        // outbound, call connect()
+  explicit TcpTransport(AsyncClient *c); // adopts an accepted client
+  ~TcpTransport() override;
+
+  bool connect(const IPAddress &ip, uint16_t port);
+
+  bool connected() const override;
+  size_t write(const uint8_t *data, size_t len) override;
+  void close() override;
+  const char *kind() const override { return "tcp"; }
+
+  // For owners on another task: the socket is closed from async_tcp on its
+  // next poll (~0.5 s), and onClose then fires there as for a remote close.
+  // Once onClose has run, no callback can be in flight and the transport
+  // may be deleted from any task.
+  void closeFromPoll() { closeRequested = true; }
+
+  String remoteIp() const;
+  uint16_t remotePort() const;
+  uint16_t localPort() const;
+
+private:
+  void attach();
+
+  AsyncClient *client = nullptr;
+  bool wasConnected = false;
+  volatile bool closeRequested = false;
+};
+
+#endif
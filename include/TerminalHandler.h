@@ -2,15 +2,96 @@
 #define TERMINAL_HANDLER_H
 
 #include "AppConfig.h"
+#include "Transport.h"
+#include <ArduinoJson.h>
 #include <WiFi.h>
 
-extern WiFiClient termClient;
-extern bool termConnected;
-extern String termHost;
-extern uint16_t termPort;
+// Device output reaches /term as binary WebSocket frames, one per coalescing
+// window (or per TERM_FRAME_MAX bytes), rendered as hex/ascii by the browser:
+//   [u8 type][u32 seq LE][u32 ts_ms LE][payload...]
+// type is TERM_FRAME_RX for live output and TERM_FRAME_HISTORY for records
+// replayed from scrollback; a {"type":"history"} text frame ends each batch.
+// Status and errors stay JSON text frames.
+static const uint8_t TERM_FRAME_RX = 0x01;
+static const uint8_t TERM_FRAME_HISTORY = 0x02;
+static const size_t TERM_FRAME_HDR = 9;
+static const size_t TERM_FRAME_MAX = 1024;
 
-void termSendStatus();
-void termDisconnect();
-void termPumpTask(void *pvParameters);
+static const size_t TERM_SCROLLBACK_BYTES = 8192;
+static const size_t TERM_SCROLLBACK_RECS = 128;
+
+struct TermRecord {
+  uint32_t seq;
+  uint32_t ts;
+  uint16_t off;
+  uint16_t len;
+};
+
+// Fixed-size scrollback: raw bytes in a byte ring plus a ring of records
+// (one per frame sent). The oldest records are evicted first, so memory use is
+// constant no matter how chatty the device is.
+class TermScrollback {
+public:
+  void append(uint32_t seq, uint32_t ts, const uint8_t *data, size_t len);
+  size_t count() const { return recCount; }
+  const TermRecord &at(size_t i) const; // 0 = oldest
+  void copy(const TermRecord &r, uint8_t *out) const;
+
+private:
+  uint8_t bytes[TERM_SCROLLBACK_BYTES];
+  TermRecord recs[TERM_SCROLLBACK_RECS];
+  size_t recHead = 0; // oldest record
+  size_t recCount = 0;
+  size_t byteHead = 0; // next write position
+  size_t bytesUsed = 0;
+};
+
+struct TermLatency {
+  uint32_t frames = 0;
+  uint32_t bytes = 0;
+  uint32_t lastUs = 0; // first device byte -> WS frame queued
+  uint32_t avgUs = 0;  // EWMA, 1/8 weight
+  uint32_t maxUs = 0;
+};
+
+// One terminal per /term WebSocket client: its own device link, and its rx
+// frames and status go to that client only. When the client goes away the
+// session is detached (link kept open, output still recorded) for
+// TERM_DETACH_GRACE_MS so a reconnecting browser can reattach by sid.
+struct TermSession {
+  uint32_t sid = 0;
+  uint32_t wsId = 0; // 0 = detached
+  uint32_t detachedMs = 0;
+  Transport *link = nullptr;
+  String host;
+  uint16_t port = 0;
+  uint32_t baud = 0;
+  TermLatency latency;
+
+  uint8_t frame[TERM_FRAME_HDR + TERM_FRAME_MAX];
+  size_t rxLen = 0;
+  int64_t rxFirstUs = 0;
+  uint32_t seq = 0;
+
+  TermScrollback scrollback;
+};
+
+extern uint8_t termMaxSessions;
+
+void loadTermCfg();
+void saveTermCfg();
+
+bool termOpenTcp(uint32_t wsId, const IPAddress &ip, uint16_t port);
+bool termOpenUart(uint32_t wsId, uint32_t baud);
+bool termSend(uint32_t wsId, const uint8_t *data, size_t len);
+void termCloseLink(uint32_t wsId);
+void termDetach(uint32_t wsId);
+bool termAttach(uint32_t wsId, uint32_t sid);
+void termHistory(uint32_t wsId, uint32_t beforeSeq, size_t count);
+void termService();
+void termSendStatus(uint32_t wsId);
+void termQueueStatus(uint32_t wsId); // from the WS connect handler
+size_t termSessionCount();
+void termSessionsToJson(JsonArray arr);
 
 #endif
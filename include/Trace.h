@@ -0,0 +1,56 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "AppConfig.h"
+#include <ArduinoJson.h>
+
+// Lightweight spans on the hot paths (route handlers, addCapture, proxyLog,
+// terminal flushes, discovery probes, WebSocket sends), timed with the CPU
+// cycle counter into a fixed ring of TRACE_RING entries. GET /api/trace
+// returns the ring in Chrome trace-event format (load it in
+// chrome://tracing or ui.perfetto.dev); POST /api/trace {"enabled":bool,
+// "clear":bool} switches it. Off by default. While off, a span costs one
+// load of `traceOn`, and the ring isn't allocated until it is first enabled.
+//
+// Each core has its own cycle counter, and they wrap every ~18 s at
+// 240 MHz. Enabling calibrates both against esp_timer, and each record also
+// stores the tick count, so the export maps every timestamp onto one
+// timeline even if the task moved cores mid-span. Span names must be string
+// literals (or otherwise outlive the ring).
+
+static const size_t TRACE_RING = 256;
+
+extern volatile bool traceOn;
+
+struct TraceMark {
+  uint32_t cycles = 0;
+  uint8_t core = 0;
+};
+
+TraceMark traceNow();
+// Records a span from `start` to now.
+void traceSpan(const char *name, const TraceMark &start);
+
+// Times the enclosing scope.
+struct TraceScope {
+  explicit TraceScope(const char *name) : name(name), on(traceOn) {
+    if (on)
+      start = traceNow();
+  }
+  ~TraceScope() {
+    if (on)
+      traceSpan(name, start);
+  }
+
+  const char *name;
+  bool on;
+  TraceMark start;
+};
+
+void traceEnable(bool on);
+void traceClear();
+void traceStatsToJson(JsonObject out);
+// Streams the ring as {"traceEvents":[...],"otherData":{...}}.
+void sendTrace(AsyncWebServerRequest *req);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+
+// Byte-stream link to a device (TCP socket, RS-232 port, ...). Backends are
+// event driven: data, connect and close are delivered through callbacks from
+// the backend's own context (async_tcp task, UART event task, host reader
+// thread), so handlers must not block.
+//
+// onClose only fires when the link ends on its own (remote close, error).
+// An owner calling close() or deleting the transport gets no callback.
+class Transport {
+public:
+  using DataHandler = std::function<void(const uint8_t *data, size_t len)>;
+  using ConnectHandler = std::function<void(bool ok)>;
+  using CloseHandler = std::function<void()>;
+
+  virtual ~Transport() {}
+
+  virtual bool connected() const = 0;
+  virtual size_t write(const uint8_t *data, size_t len) = 0;
+  virtual void close() = 0;
+  virtual const char *kind() const = 0; // "tcp" | "uart"
+
+  void onData(DataHandler h) { dataHandler = h; }
+  void onConnect(ConnectHandler h) { connectHandler = h; }
+  void onClose(CloseHandler h) { closeHandler = h; }
+
+protected:
+  void emitData(const uint8_t *data, size_t len) {
+    if (dataHandler)
+      dataHandler(data, len);
+  }
+  void emitConnect(bool ok) {
+    if (connectHandler)
+      connectHandler(ok);
+  }
+  // Copied first: the owner is allowed to delete us from inside the handler.
+  void emitClose() {
+    CloseHandler h = closeHandler;
+    if (h)
+      h();
+  }
+
+private:
+  DataHandler dataHandler;
+  ConnectHandler connectHandler;
+  CloseHandler closeHandler;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef UART_TRANSPORT_H
+#define UART_TRANSPORT_H
+
+#include "Transport.h"
+
+#ifdef AV_HOST_BUILD
+#include <atomic>
+#include <string>
+#include <thread>
+#else
+#include "AppConfig.h"
+#endif
+
+// RS-232 port as a Transport. On the ESP32 this is UART2 driven by the IDF
+// UART driver: the RX ISR fills the ring buffer and onReceive() fires from the
+// driver's event task on FIFO-full or RX idle, so nothing polls. The host
+// build (AV_HOST_BUILD) opens a tty/pty path instead and reads it from a
+// poll() thread, which lets the bridge be exercised on Linux.
+//
+// There is one physical port, so only one instance can be open at a time.
+class UartTransport : public Transport {
+public:
+#ifdef AV_HOST_BUILD
+  explicit UartTransport(const char *path = hostPortPath);
+  // What the firmware's `new UartTransport()` opens on the host; nullptr
+  // (the default) means there is no port and open() fails.
+  static const char *hostPortPath;
+#else
+  UartTransport(HardwareSerial &port = Serial2, int8_t rxPin = AV_UART_RX_PIN,
+                int8_t txPin = AV_UART_TX_PIN);
+#endif
+  ~UartTransport() override;
+
+  bool open(uint32_t baud);
+  uint32_t baud() const { return openBaud; }
+
+  bool connected() const override { return isOpen; }
+  size_t write(const uint8_t *data, size_t len) override;
+  void close() override;
+  const char *kind() const override { return "uart"; }
+
+  static bool busy() { return owner != nullptr; }
+
+private:
+  void drain();
+
+  bool isOpen = false;
+  uint32_t openBaud = 0;
+  static UartTransport *owner;
+
+#ifdef AV_HOST_BUILD
+  std::string path;
+  int fd = -1;
+  std::thread reader;
+  std::atomic<bool> stopReader{false};
+#else
+  HardwareSerial &port;
+  int8_t rxPin;
+  int8_t txPin;
+#endif
+};
+
+#endif
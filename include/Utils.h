@@ -4,12 +4,26 @@
 #include <Arduino.h>
 #include <vector>
 
+// "0A 1B FF" into `out`, which needs room for len * 3 chars (1 when len is
+// 0); NUL-terminated. Returns the length written.
+size_t hexEncode(const uint8_t *data, size_t len, char *out);
+// Printable bytes as-is, others as '.'; `out` needs len + 1 chars.
+size_t asciiEncode(const uint8_t *data, size_t len, char *out);
+// Append the same encodings to an existing String (e.g. a message being
+// built) without an intermediate copy.
+void appendHex(String &out, const uint8_t *data, size_t len);
+void appendAscii(String &out, const uint8_t *data, size_t len);
 String bytesToHex(const uint8_t *data, size_t len);
 String bytesToAscii(const uint8_t *data, size_t len);
 String stripTelnetIAC(const uint8_t *data, size_t len);
 String detectSuffix(const uint8_t *data, size_t len);
 String simpleHash(const String &s);
 String genId();
+// Space-separated hex pairs ("0A 1b FF") into at most `cap` bytes; returns
+// the count, or (size_t)-1 on a bad digit, an odd digit or overflow.
+size_t parseHex(const char *hex, size_t len, uint8_t *out, size_t cap);
 bool parseHexBytes(const String &hex, std::vector<uint8_t> &out);
+String expandSuffix(const String &suffix);
+bool regexSearch(const char *re, const char *text, size_t &matchEnd);
 
 #endif
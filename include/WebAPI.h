@@ -2,7 +2,10 @@
 #define WEB_API_H
 
 #include "AppConfig.h"
+#include <ArduinoJson.h>
 
 void setupRoutes();
+// The /api/health document, also the state pushed on /wsstate.
+void healthToJson(JsonDocument &doc);
 
 #endif
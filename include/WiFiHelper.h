@@ -2,7 +2,9 @@
 #define WIFI_HELPER_H
 
 #include "AppConfig.h"
+#include <ArduinoJson.h>
 #include <WiFi.h>
+#include <vector>
 
 struct WifiCfg {
   String mode = "apsta"; // ap | sta | apsta
@@ -18,8 +20,21 @@ extern WifiCfg wifiCfg;
 void loadWifi();
 void saveWifi();
 void startWiFi();
+// From loop(): falls back from a failed fast connect, caches the AP's
+// BSSID and channel once the STA has an address, and drops the BSSID pin
+// after the first disconnect.
+void wifiService();
+const char *wifiFastConnectState(); // off | trying | ok | fallback
 void wifiNoSleep();
-String doScan(bool forceFresh);
+
+// WiFi scans are asynchronous: startWifiScan() returns at once, and each
+// ARDUINO_EVENT_WIFI_SCAN_DONE merges the results per BSSID into a cache
+// whose entries age out when they stop being seen. An empty channel list
+// scans every channel; otherwise the listed channels are scanned in turn.
+bool startWifiScan(const std::vector<uint8_t> &channels); // false if busy
+bool wifiScanRunning();
+// {networks:[{ssid,bssid,rssi,chan,open,ageS}],count,scanning,ageMs,note}
+void wifiScanToJson(JsonDocument &doc);
 void bootScanTask(void *pvParameters);
 
 #endif
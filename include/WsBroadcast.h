@@ -0,0 +1,44 @@
+#ifndef WS_BROADCAST_H
+#define WS_BROADCAST_H
+
+#include "AppConfig.h"
+#include <ArduinoJson.h>
+
+// Every WebSocket send goes through a small per-client queue instead of
+// straight into AsyncWebSocket, so one slow browser can't make the library
+// buffer without bound or stall the others. What happens when a client's
+// queue is full depends on the channel:
+//
+//   DropOldest  /ws, /wsproxy   - the oldest queued message is discarded
+//   Coalesce    /wsstate        - a message replaces a queued one with the
+//                                 same key (snapshot/delta share "state"; the
+//                                 client sees the version gap and asks for a
+//                                 snapshot), otherwise drop-oldest
+//   NeverDrop   /term, /wsdisc  - nothing is discarded; a client that falls
+//                                 past the cap is disconnected instead, and a
+//                                 terminal session detaches and replays its
+//                                 scrollback on reattach
+//
+// Queues drain while the client's TCP side can take more (canSend) and on
+// every loop() pass. Per-client depth, drops and bytes are at /api/debug/ws.
+
+enum class WsPolicy : uint8_t { DropOldest, Coalesce, NeverDrop };
+
+void setupWsQueues();
+// Call from each AsyncWebSocket onEvent handler, for every event.
+void wsClientEvent(AsyncWebSocket &ws, AsyncWebSocketClient *c, AwsEventType t);
+void wsPump(); // from loop()
+// For connect handlers, which must not send directly: the text is queued
+// behind the connect event and goes out with the next send or wsPump().
+void wsQueueText(AsyncWebSocket &ws, uint32_t id, const String &s);
+
+// `key` only matters on Coalesce channels; nullptr never coalesces.
+void wsBroadcast(AsyncWebSocket &ws, const String &s,
+                 const char *key = nullptr);
+void wsSendText(AsyncWebSocket &ws, uint32_t id, const String &s);
+void wsSendBinary(AsyncWebSocket &ws, uint32_t id, const uint8_t *data,
+                  size_t len);
+
+void wsStatsToJson(JsonArray out);
+
+#endif
@@ -1,5 +1,6 @@
 #include "AVDiscovery.h"
 #include "ConfigManager.h"
+#include "Trace.h"
 #include "Utils.h"
 #include "WiFiHelper.h"
 #include <ArduinoJson.h>
@@ -13,6 +14,13 @@ bool discRunning = false;
 uint32_t discProgress = 0;
 uint32_t discStartedMs = 0;
 std::vector<String> discFound;
+uint32_t discScans = 0;
+uint32_t tcpProbes = 0;
+uint32_t tcpProbesOpen = 0;
+static SemaphoreHandle_t discMutex = xSemaphoreCreateMutex();
+
+DiscLock::DiscLock() { xSemaphoreTake(discMutex, portMAX_DELAY); }
+DiscLock::~DiscLock() { xSemaphoreGive(discMutex); }
 
 static String discSubnetBase = "";
 static uint8_t discFrom = 1;
@@ -49,14 +57,19 @@ static String getMacFromArp(const IPAddress &ip) {
 }
 
 bool tcpProbe(const IPAddress &ip, uint16_t port, uint16_t timeoutMs) {
+  TraceScope span("tcpProbe");
   WiFiClient c;
   bool ok = c.connect(ip, port, timeoutMs);
-  if (ok)
+  tcpProbes++;
+  if (ok) {
+    tcpProbesOpen++;
     c.stop();
+  }
   return ok;
 }
 
 static bool httpBanner(const IPAddress &ip, uint16_t port, String &outBanner) {
+  TraceScope span("httpBanner");
   WiFiClient c;
   if (!c.connect(ip, port, 220))
     return false;
@@ -108,6 +121,7 @@ static bool httpBanner(const IPAddress &ip, uint16_t port, String &outBanner) {
 
 static bool telnetBanner(const IPAddress &ip, uint16_t port, String &outText,
                          bool doKramerProbe) {
+  TraceScope span("telnetBanner");
   WiFiClient c;
   if (!c.connect(ip, port, 200))
     return false;
@@ -209,9 +223,13 @@ static Suggest makeSuggestion(const String &banner,
 
 static void discTask(void *) {
   discRunning = true;
+  discScans++;
   discStartedMs = millis();
   discProgress = 0;
-  discFound.clear();
+  {
+    DiscLock lock;
+    discFound.clear();
+  }
   const uint16_t timeoutMs = 120;
   for (uint16_t host = discFrom; host <= discTo; host++) {
     if (!discRunning)
@@ -268,7 +286,10 @@ static void discTask(void *) {
       row["seenMs"] = millis();
       String out;
       serializeJson(row, out);
-      discFound.push_back(out);
+      {
+        DiscLock lock;
+        discFound.push_back(out);
+      }
       wsTextAll(wsDisc, out);
     }
     discProgress++;
@@ -316,23 +337,26 @@ void updateDevStatus(const String &id, bool online, const String &ip,
 void deviceMonitorTask(void *) {
   for (;;) {
     if (WiFi.status() == WL_CONNECTED) {
-      JsonDocument doc;
-      if (!deserializeJson(doc, cfgJson)) {
-        if (doc["devices"].is<JsonArray>()) {
-          for (JsonObject d : doc["devices"].as<JsonArray>()) {
-            String id = d["id"] | "";
-            String ip = d["ip"] | "";
-            uint16_t port = d["portHint"] | 0;
-            if (!id.length() || !ip.length() || port == 0)
-              continue;
-            IPAddress ipa;
-            if (!ipa.fromString(ip))
-              continue;
-            bool ok = tcpProbe(ipa, port, 120);
-            updateDevStatus(id, ok, ip, port);
-            vTaskDelay(10 / portTICK_PERIOD_MS);
-          }
-        }
+      // Copy the probe targets out so the config isn't locked while probing.
+      struct Target {
+        String id;
+        String ip;
+        uint16_t port;
+      };
+      std::vector<Target> targets;
+      {
+        CfgLock lock;
+        for (auto &d : cfg.devices)
+          if (d.id && d.ip.length() && d.portHint)
+            targets.push_back({idStr(d.id), d.ip, d.portHint});
+      }
+      for (auto &t : targets) {
+        IPAddress ipa;
+        if (!ipa.fromString(t.ip))
+          continue;
+        bool ok = tcpProbe(ipa, t.port, 120);
+        updateDevStatus(t.id, ok, t.ip, t.port);
+        vTaskDelay(10 / portTICK_PERIOD_MS);
       }
     }
     vTaskDelay(8000 / portTICK_PERIOD_MS);
@@ -354,7 +378,7 @@ void sendWol(const String &macStr) {
   for (int i = 0; i < 16; i++)
     udp.write(mac, 6);
   udp.endPacket();
-  logAll("WoL sent to " + macStr);
+  logInfo("disc", "WoL sent to %s", macStr);
 }
 
 String pjlinkCmd(const String &ip, const String &password, const String &cmd) {
@@ -0,0 +1,380 @@
+#include "ApiCodec.h"
+#include <math.h>
+
+static bool mimeIs(const String &h, const char *mime) {
+  return h.indexOf(mime) >= 0;
+}
+
+ApiCodec responseCodec(AsyncWebServerRequest *req) {
+  if (!req->hasHeader("Accept"))
+    return ApiCodec::Json;
+  String accept = req->getHeader("Accept")->value();
+  if (mimeIs(accept, "application/msgpack") ||
+      mimeIs(accept, "application/x-msgpack"))
+    return ApiCodec::MsgPack;
+  if (mimeIs(accept, "application/cbor"))
+    return ApiCodec::Cbor;
+  return ApiCodec::Json;
+}
+
+ApiCodec requestCodec(AsyncWebServerRequest *req) {
+  String type = req->contentType();
+  if (mimeIs(type, "msgpack"))
+    return ApiCodec::MsgPack;
+  if (mimeIs(type, "application/cbor"))
+    return ApiCodec::Cbor;
+  return ApiCodec::Json;
+}
+
+const char *codecMime(ApiCodec c) {
+  switch (c) {
+  case ApiCodec::MsgPack:
+    return "application/msgpack";
+  case ApiCodec::Cbor:
+    return "application/cbor";
+  default:
+    return "application/json";
+  }
+}
+
+size_t encodeDoc(ApiCodec c, JsonVariantConst doc, std::vector<uint8_t> *out) {
+  std::vector<uint8_t> tmp;
+  std::vector<uint8_t> &buf = out ? *out : tmp;
+  buf.clear();
+  size_t n;
+  switch (c) {
+  case ApiCodec::MsgPack:
+    n = measureMsgPack(doc);
+    buf.resize(n);
+    return serializeMsgPack(doc, buf.data(), n);
+  case ApiCodec::Cbor:
+    return serializeCbor(doc, buf);
+  default:
+    n = measureJson(doc);
+    buf.resize(n + 1); // serializeJson() null-terminates
+    n = serializeJson(doc, (char *)buf.data(), n + 1);
+    buf.resize(n);
+    return n;
+  }
+}
+
+void sendDoc(AsyncWebServerRequest *req, JsonVariantConst doc, int code) {
+  ApiCodec c = responseCodec(req);
+  std::vector<uint8_t> buf;
+  uint32_t t0 = micros();
+  encodeDoc(c, doc, &buf);
+  uint32_t us = micros() - t0;
+  AsyncResponseStream *res = req->beginResponseStream(codecMime(c));
+  res->setCode(code);
+  res->addHeader("X-Encode-Us", String(us));
+  res->write(buf.data(), buf.size());
+  req->send(res);
+}
+
+void sendOk(AsyncWebServerRequest *req, const char *note) {
+  JsonDocument doc;
+  doc["ok"] = true;
+  if (note)
+    doc["note"] = note;
+  sendDoc(req, doc);
+}
+
+DeserializationError parseBody(AsyncWebServerRequest *req, const uint8_t *data,
+                               size_t len, JsonDocument &doc) {
+  switch (requestCodec(req)) {
+  case ApiCodec::MsgPack:
+    return deserializeMsgPack(doc, data, len);
+  case ApiCodec::Cbor:
+    return deserializeCbor(doc, data, len);
+  default:
+    return deserializeJson(doc, data, len);
+  }
+}
+
+// ---------- CBOR ----------
+
+static void cborHead(std::vector<uint8_t> &out, uint8_t major, uint64_t v) {
+  major <<= 5;
+  if (v < 24) {
+    out.push_back(major | v);
+  } else if (v <= 0xff) {
+    out.push_back(major | 24);
+    out.push_back(v);
+  } else if (v <= 0xffff) {
+    out.push_back(major | 25);
+    out.push_back(v >> 8);
+    out.push_back(v);
+  } else if (v <= 0xffffffffULL) {
+    out.push_back(major | 26);
+    for (int s = 24; s >= 0; s -= 8)
+      out.push_back(v >> s);
+  } else {
+    out.push_back(major | 27);
+    for (int s = 56; s >= 0; s -= 8)
+      out.push_back(v >> s);
+  }
+}
+
+static void cborText(std::vector<uint8_t> &out, const char *s, size_t n) {
+  cborHead(out, 3, n);
+  out.insert(out.end(), (const uint8_t *)s, (const uint8_t *)s + n);
+}
+
+static void cborWrite(JsonVariantConst v, std::vector<uint8_t> &out) {
+  if (v.is<JsonObjectConst>()) {
+    JsonObjectConst o = v.as<JsonObjectConst>();
+    cborHead(out, 5, o.size());
+    for (JsonPairConst kv : o) {
+      cborText(out, kv.key().c_str(), kv.key().size());
+      cborWrite(kv.value(), out);
+    }
+  } else if (v.is<JsonArrayConst>()) {
+    JsonArrayConst a = v.as<JsonArrayConst>();
+    cborHead(out, 4, a.size());
+    for (JsonVariantConst e : a)
+      cborWrite(e, out);
+  } else if (v.is<const char *>()) {
+    JsonString s = v.as<JsonString>();
+    cborText(out, s.c_str(), s.size());
+  } else if (v.is<bool>()) {
+    out.push_back(v.as<bool>() ? 0xf5 : 0xf4);
+  } else if (v.is<JsonUInt>()) {
+    cborHead(out, 0, v.as<JsonUInt>());
+  } else if (v.is<JsonInteger>()) {
+    cborHead(out, 1, (uint64_t)(-1 - (int64_t)v.as<JsonInteger>()));
+  } else if (v.is<JsonFloat>()) {
+    double d = v.as<double>();
+    float f = (float)d;
+    uint64_t bits;
+    if ((double)f == d || isnan(d)) {
+      uint32_t b;
+      memcpy(&b, &f, 4);
+      out.push_back(0xfa);
+      bits = b;
+      for (int s = 24; s >= 0; s -= 8)
+        out.push_back(bits >> s);
+    } else {
+      memcpy(&bits, &d, 8);
+      out.push_back(0xfb);
+      for (int s = 56; s >= 0; s -= 8)
+        out.push_back(bits >> s);
+    }
+  } else {
+    out.push_back(0xf6); // null
+  }
+}
+
+size_t serializeCbor(JsonVariantConst v, std::vector<uint8_t> &out) {
+  size_t start = out.size();
+  cborWrite(v, out);
+  return out.size() - start;
+}
+
+struct CborReader {
+  CborReader(const uint8_t *data, size_t len) : p(data), end(data + len) {}
+
+  const uint8_t *p;
+  const uint8_t *end;
+  DeserializationError err = DeserializationError::Ok;
+
+  bool fail(DeserializationError::Code c) {
+    if (!err)
+      err = c;
+    return false;
+  }
+  // 64-bit so a CBOR length is checked before it is narrowed to size_t.
+  bool need(uint64_t n) {
+    return n <= (uint64_t)(end - p) ||
+           fail(DeserializationError::IncompleteInput);
+  }
+  bool uint(uint8_t minor, uint64_t &v) {
+    if (minor < 24) {
+      v = minor;
+      return true;
+    }
+    if (minor > 27)
+      return fail(DeserializationError::InvalidInput);
+    size_t n = (size_t)1 << (minor - 24);
+    if (!need(n))
+      return false;
+    v = 0;
+    while (n--)
+      v = (v << 8) | *p++;
+    return true;
+  }
+};
+
+static double halfToDouble(uint16_t h) {
+  int exp = (h >> 10) & 0x1f;
+  int mant = h & 0x3ff;
+  double val;
+  if (exp == 0)
+    val = ldexp(mant, -24);
+  else if (exp != 31)
+    val = ldexp(mant + 1024, exp - 25);
+  else
+    val = mant == 0 ? INFINITY : NAN;
+  return (h & 0x8000) ? -val : val;
+}
+
+static const int CBOR_MAX_DEPTH = 16;
+
+static bool cborRead(CborReader &r, JsonVariant out, int depth);
+
+// Reads one length-prefixed text or byte string; bytes become hex.
+static bool cborString(CborReader &r, uint8_t major, uint8_t minor,
+                       String &s) {
+  uint64_t len;
+  if (minor == 31) // chunked strings aren't worth the code
+    return r.fail(DeserializationError::InvalidInput);
+  if (!r.uint(minor, len) || !r.need(len))
+    return false;
+  size_t n = (size_t)len; // fits: need() bounded it by the input
+  if (major == 3) {
+    s.concat((const char *)r.p, n);
+  } else {
+    static const char *HEX_DIGITS = "0123456789abcdef";
+    s.reserve(n * 2);
+    for (size_t i = 0; i < n; i++) {
+      s += HEX_DIGITS[r.p[i] >> 4];
+      s += HEX_DIGITS[r.p[i] & 15];
+    }
+  }
+  r.p += n;
+  return true;
+}
+
+static bool cborIsBreak(CborReader &r) {
+  if (!r.need(1))
+    return false;
+  if (*r.p == 0xff) {
+    r.p++;
+    return true;
+  }
+  return false;
+}
+
+static bool cborRead(CborReader &r, JsonVariant out, int depth) {
+  if (depth > CBOR_MAX_DEPTH)
+    return r.fail(DeserializationError::TooDeep);
+  if (!r.need(1))
+    return false;
+  uint8_t ib = *r.p++;
+  uint8_t major = ib >> 5, minor = ib & 31;
+  uint64_t n = 0;
+  bool indefinite = minor == 31 && (major == 4 || major == 5);
+
+  switch (major) {
+  case 0:
+    if (!r.uint(minor, n))
+      return false;
+    out.set((JsonUInt)n);
+    return true;
+  case 1:
+    if (!r.uint(minor, n))
+      return false;
+    out.set((JsonInteger)(-1 - (int64_t)n));
+    return true;
+  case 2:
+  case 3: {
+    String s;
+    if (!cborString(r, major, minor, s))
+      return false;
+    out.set(s);
+    return true;
+  }
+  case 4: {
+    if (!indefinite && !r.uint(minor, n))
+      return false;
+    JsonArray a = out.to<JsonArray>();
+    for (uint64_t i = 0; indefinite || i < n; i++) {
+      if (indefinite) {
+        if (cborIsBreak(r))
+          break;
+        if (r.err)
+          return false;
+      }
+      if (!cborRead(r, a.add<JsonVariant>(), depth + 1))
+        return false;
+    }
+    return true;
+  }
+  case 5: {
+    if (!indefinite && !r.uint(minor, n))
+      return false;
+    JsonObject o = out.to<JsonObject>();
+    for (uint64_t i = 0; indefinite || i < n; i++) {
+      if (indefinite) {
+        if (cborIsBreak(r))
+          break;
+        if (r.err)
+          return false;
+      }
+      if (!r.need(1))
+        return false;
+      uint8_t kb = *r.p++;
+      String key;
+      if ((kb >> 5) != 3 || !cborString(r, 3, kb & 31, key))
+        return r.fail(DeserializationError::InvalidInput);
+      if (!cborRead(r, o[key].to<JsonVariant>(), depth + 1))
+        return false;
+    }
+    return true;
+  }
+  case 6: // tag: keep the tagged item, drop the tag
+    if (!r.uint(minor, n))
+      return false;
+    return cborRead(r, out, depth + 1);
+  default:
+    break;
+  }
+
+  // Major 7: simple values and floats.
+  switch (minor) {
+  case 20:
+    out.set(false);
+    return true;
+  case 21:
+    out.set(true);
+    return true;
+  case 22:
+  case 23:
+    out.clear();
+    return true;
+  case 25:
+  case 26:
+  case 27: {
+    if (!r.uint(minor, n))
+      return false;
+    double d;
+    if (minor == 25) {
+      d = halfToDouble(n);
+    } else if (minor == 26) {
+      uint32_t b = n;
+      float f;
+      memcpy(&f, &b, 4);
+      d = f;
+    } else {
+      memcpy(&d, &n, 8);
+    }
+    out.set(d);
+    return true;
+  }
+  default:
+    return r.fail(DeserializationError::InvalidInput);
+  }
+}
+
+DeserializationError deserializeCbor(JsonDocument &doc, const uint8_t *data,
+                                     size_t len) {
+  doc.clear();
+  CborReader r(data, len);
+  if (!cborRead(r, doc.to<JsonVariant>(), 0)) {
+    if (r.err)
+      return r.err;
+    return DeserializationError::InvalidInput;
+  }
+  if (doc.overflowed())
+    return DeserializationError::NoMemory;
+  return DeserializationError::Ok;
+}
@@ -0,0 +1,386 @@
+#include "AssetServer.h"
+#include "ApiCodec.h"
+#include "Sha256.h"
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+static const char *MANIFEST = "/assets.json";
+static const char *STAGED = ".new"; // uploaded, waiting for the manifest
+static const size_t FS_RESERVE = 8192; // keep free beyond the upload
+static const uint32_t STALE_MS = 15000; // an upload idle this long is dead
+
+struct Asset {
+  String url;
+  String file;
+  String etag; // content hash, without quotes
+  String type;
+  bool immutable;
+  bool gz;
+};
+
+static std::vector<Asset> assets;
+
+static const Asset *findAsset(const String &url) {
+  for (auto &a : assets)
+    if (a.url == url)
+      return &a;
+  return nullptr;
+}
+
+class AssetHandler : public AsyncWebHandler {
+public:
+  bool canHandle(AsyncWebServerRequest *req) override {
+    if (req->method() != HTTP_GET && req->method() != HTTP_HEAD)
+      return false;
+    if (!findAsset(req->url()))
+      return false;
+    req->addInterestingHeader("Accept-Encoding");
+    req->addInterestingHeader("If-None-Match");
+    return true;
+  }
+
+  void handleRequest(AsyncWebServerRequest *req) override {
+    const Asset *a = findAsset(req->url());
+    bool gz = a->gz && req->hasHeader("Accept-Encoding") &&
+              req->getHeader("Accept-Encoding")->value().indexOf("gzip") >= 0;
+    // Strong ETags are per representation, so the gzip body gets its own.
+    String etag = "\"" + a->etag + (gz ? "-gz\"" : "\"");
+    const char *cache =
+        a->immutable ? "public, max-age=31536000, immutable" : "no-cache";
+
+    AsyncWebServerResponse *res;
+    if (req->hasHeader("If-None-Match") &&
+        req->getHeader("If-None-Match")->value().indexOf(etag) >= 0) {
+      res = req->beginResponse(304);
+    } else {
+      res = req->beginResponse(LittleFS, gz ? a->file + ".gz" : a->file,
+                               a->type);
+      if (gz)
+        res->addHeader("Content-Encoding", "gzip");
+    }
+    res->addHeader("ETag", etag);
+    res->addHeader("Cache-Control", cache);
+    res->addHeader("Vary", "Accept-Encoding");
+    req->send(res);
+  }
+};
+
+static bool loadManifest(const String &path, std::vector<Asset> &out) {
+  File f = LittleFS.open(path, "r");
+  if (!f)
+    return false;
+  JsonDocument doc;
+  DeserializationError err = deserializeJson(doc, f);
+  f.close();
+  if (err)
+    return false;
+  out.clear();
+  for (JsonObjectConst o : doc["files"].as<JsonArrayConst>()) {
+    Asset a;
+    a.url = o["url"] | "";
+    a.file = o["file"] | "";
+    a.etag = o["etag"] | "";
+    a.type = o["type"] | "application/octet-stream";
+    a.immutable = o["immutable"] | false;
+    a.gz = o["gz"] | false;
+    if (a.url.length() && a.file.length())
+      out.push_back(a);
+  }
+  return !out.empty();
+}
+
+// Every file an asset table needs on the filesystem, without duplicates
+// (index.html is listed under two URLs).
+static std::vector<String> assetFiles(const std::vector<Asset> &list) {
+  std::vector<String> files;
+  for (const Asset &a : list) {
+    files.push_back(a.file);
+    if (a.gz)
+      files.push_back(a.file + ".gz");
+  }
+  std::sort(files.begin(), files.end());
+  files.erase(std::unique(files.begin(), files.end()), files.end());
+  return files;
+}
+
+// ---------- Per-file updates ----------
+
+struct AssetUpload {
+  AsyncWebServerRequest *owner = nullptr; // upload in progress / to answer
+  bool active = false;
+  String path;
+  String tmp;
+  String expectSha;
+  String forManifest; // sha256 of the manifest a staged file belongs to
+  File f;
+  std::unique_ptr<Sha256> sha;
+  size_t bytes = 0;
+  uint32_t lastChunkMs = 0;
+  int status = 200;
+  String error;
+  String sha256;
+  size_t installed = 0;
+  std::vector<String> missing;
+  std::vector<String> removed;
+};
+
+// Only touched from the async_tcp task (body and response callbacks).
+static AssetUpload up;
+// Files staged for the manifest whose SHA-256 is stagedFor. A push for a
+// different manifest discards them first, so a half-finished push can't
+// leak old content into a later commit.
+static String stagedFor;
+static std::vector<String> staged;
+
+static bool isStaged(const String &file) {
+  return std::find(staged.begin(), staged.end(), file) != staged.end();
+}
+
+static void dropStaged() {
+  for (const String &file : staged)
+    LittleFS.remove(file + STAGED);
+  staged.clear();
+  stagedFor = "";
+}
+
+// Left over from a push a reboot interrupted.
+static void removeStrayStaged() {
+  File dir = LittleFS.open("/");
+  std::vector<String> stray;
+  for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+    String name = f.name();
+    name = name.substring(name.lastIndexOf('/') + 1);
+    if (name.endsWith(STAGED))
+      stray.push_back("/" + name);
+    f.close();
+  }
+  for (const String &path : stray)
+    LittleFS.remove(path);
+}
+
+static void uploadFail(int status, const char *why) {
+  if (up.error.length())
+    return;
+  up.status = status;
+  up.error = why;
+}
+
+// Flat names as build_assets.py stages them; LittleFS allows 31 chars.
+static bool validAssetPath(const String &p) {
+  if (p.length() < 2 || p.length() > 31 || p[0] != '/' || p[1] == '.' ||
+      p.endsWith(".tmp") || p.endsWith(STAGED))
+    return false;
+  for (size_t i = 1; i < p.length(); i++)
+    if (!isalnum((unsigned char)p[i]) && !strchr("._-", p[i]))
+      return false;
+  return true;
+}
+
+static bool uploadBegin(AsyncWebServerRequest *req) {
+  if (up.active) {
+    if (millis() - up.lastChunkMs < STALE_MS)
+      return false;
+    logWarn("assets", "abandoning a stalled upload of %s", up.path);
+    up.f.close();
+    LittleFS.remove(up.tmp);
+  }
+  up = AssetUpload();
+  up.owner = req;
+  up.active = true;
+  up.lastChunkMs = millis();
+  up.sha.reset(new Sha256());
+  if (req->hasParam("path"))
+    up.path = req->getParam("path")->value();
+  if (req->hasParam("sha256")) {
+    up.expectSha = req->getParam("sha256")->value();
+    up.expectSha.toLowerCase();
+  }
+  if (req->hasParam("manifest")) {
+    up.forManifest = req->getParam("manifest")->value();
+    up.forManifest.toLowerCase();
+  }
+  if (!validAssetPath(up.path)) {
+    uploadFail(400, "bad path");
+    return true;
+  }
+  if (up.expectSha.length() != 64) {
+    uploadFail(400, "sha256 required");
+    return true;
+  }
+  if (up.path != MANIFEST && up.forManifest.length() != 64) {
+    uploadFail(400, "manifest (its sha256) required");
+    return true;
+  }
+  size_t freeBytes = LittleFS.totalBytes() - LittleFS.usedBytes();
+  if (req->contentLength() + FS_RESERVE > freeBytes) {
+    uploadFail(507, "not enough space on the filesystem");
+    return true;
+  }
+  up.tmp = up.path + ".tmp";
+  up.f = LittleFS.open(up.tmp, "w");
+  if (!up.f)
+    uploadFail(500, "can't create temp file");
+  return true;
+}
+
+static void uploadChunk(const uint8_t *data, size_t len) {
+  up.lastChunkMs = millis();
+  if (up.error.length())
+    return;
+  up.sha->update(data, len);
+  if (up.f.write(data, len) != len)
+    uploadFail(500, "write failed");
+  up.bytes += len;
+}
+
+// The new manifest may only go live once everything it lists is either
+// staged or already in place.
+static void checkManifest(std::vector<Asset> &next) {
+  if (!loadManifest(up.tmp, next)) {
+    uploadFail(400, "bad manifest");
+    return;
+  }
+  if (stagedFor != up.sha256)
+    dropStaged();
+  for (const String &file : assetFiles(next))
+    if (!isStaged(file) && !LittleFS.exists(file))
+      up.missing.push_back(file);
+  if (!up.missing.empty())
+    uploadFail(409, "manifest lists files that aren't uploaded");
+}
+
+// Moves every staged file the new manifest lists into place. Runs on
+// async_tcp like the asset handler, so no request sees the old table with
+// some of the new files.
+static void installStaged(const std::vector<Asset> &next) {
+  for (const String &file : assetFiles(next)) {
+    if (!isStaged(file))
+      continue;
+    if (!LittleFS.rename(file + STAGED, file)) {
+      logError("assets", "can't move %s%s into place", file, STAGED);
+      uploadFail(500, "rename failed");
+      return;
+    }
+    up.installed++;
+  }
+  dropStaged(); // anything staged that the manifest doesn't list
+}
+
+static void uploadFinish() {
+  if (up.f)
+    up.f.close();
+  up.sha256 = up.sha->finishHex();
+  up.sha.reset();
+  if (!up.error.length() && up.sha256 != up.expectSha)
+    uploadFail(400, "sha256 mismatch");
+
+  // Files are only staged: index.html and the other unhashed names change
+  // content under the same URL, and going live before the manifest would
+  // serve them under the old ETags (a stale 304), or leave a mixed UI if
+  // the push failed half way.
+  bool manifest = up.path == MANIFEST;
+  std::vector<Asset> next;
+  if (!up.error.length() && manifest) {
+    checkManifest(next);
+    if (!up.error.length())
+      installStaged(next);
+  }
+  if (!up.error.length() && !manifest && stagedFor != up.forManifest) {
+    dropStaged();
+    stagedFor = up.forManifest;
+  }
+  // LittleFS renames over an existing file atomically, so a reader sees
+  // either the old or the new content, never a partial one.
+  String dest = manifest ? up.path : up.path + STAGED;
+  if (!up.error.length() && !LittleFS.rename(up.tmp, dest))
+    uploadFail(500, "rename failed");
+  if (!up.error.length() && !manifest && !isStaged(up.path))
+    staged.push_back(up.path);
+  if (up.error.length()) {
+    if (up.tmp.length())
+      LittleFS.remove(up.tmp);
+    logWarn("assets", "upload of %s failed: %s", up.path, up.error);
+  } else {
+    logInfo("assets", "%s %s (%u B)", manifest ? "updated" : "staged",
+            up.path, up.bytes);
+  }
+
+  if (manifest && !up.error.length()) {
+    std::vector<String> keep = assetFiles(next);
+    for (const String &file : assetFiles(assets))
+      if (!std::binary_search(keep.begin(), keep.end(), file) &&
+          LittleFS.remove(file))
+        up.removed.push_back(file);
+    assets.swap(next);
+    logInfo("assets", "manifest committed: %u files, %u installed, %u removed",
+            assets.size(), up.installed, up.removed.size());
+  }
+  up.active = false;
+}
+
+static void onUploadBody(AsyncWebServerRequest *req, uint8_t *data,
+                         size_t len, size_t index, size_t total) {
+  if (!index && !uploadBegin(req))
+    return;
+  if (req != up.owner || !up.active)
+    return;
+  uploadChunk(data, len);
+  if (index + len == total)
+    uploadFinish();
+}
+
+static void onUploadDone(AsyncWebServerRequest *req) {
+  if (req != up.owner) {
+    // No body callback for an empty file; anything else is a clash.
+    if (req->contentLength() || !uploadBegin(req)) {
+      req->send(409, "application/json",
+                "{\"error\":\"another upload is in progress\"}");
+      return;
+    }
+  }
+  if (up.active)
+    uploadFinish();
+  up.owner = nullptr;
+
+  JsonDocument doc;
+  doc["ok"] = !up.error.length();
+  doc["path"] = up.path;
+  doc["bytes"] = up.bytes;
+  doc["sha256"] = up.sha256;
+  if (up.path == MANIFEST)
+    doc["installed"] = up.installed;
+  if (up.error.length())
+    doc["error"] = up.error;
+  if (!up.missing.empty()) {
+    JsonArray arr = doc["missing"].to<JsonArray>();
+    for (const String &f : up.missing)
+      arr.add(f);
+  }
+  if (!up.removed.empty()) {
+    JsonArray arr = doc["removed"].to<JsonArray>();
+    for (const String &f : up.removed)
+      arr.add(f);
+  }
+  sendDoc(req, doc, up.error.length() ? up.status : 200);
+}
+
+bool setupAssets() {
+  // Added even without a manifest so it stays ahead of serveStatic() once
+  // one is pushed.
+  server.addHandler(new AssetHandler());
+
+  server.on("/api/assets", HTTP_GET, [](AsyncWebServerRequest *req) {
+    if (LittleFS.exists(MANIFEST))
+      req->send(LittleFS, MANIFEST, "application/json");
+    else
+      req->send(200, "application/json", "{\"files\":[]}");
+  });
+  server.on("/api/assets/file", HTTP_POST, onUploadDone, nullptr,
+            onUploadBody);
+
+  removeStrayStaged();
+  return loadManifest(MANIFEST, assets);
+}
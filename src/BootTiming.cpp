@@ -0,0 +1,53 @@
+#include "BootTiming.h"
+#include "WiFiHelper.h"
+#include <atomic>
+
+struct Phase {
+  const char *name;
+  uint32_t atMs;
+};
+
+static const size_t MAX_PHASES = 12;
+// Only setup() appends; readers take the count first.
+static Phase phases[MAX_PHASES];
+static std::atomic<uint8_t> phaseCount(0);
+static std::atomic<uint32_t> events[(size_t)BootEvent::Count];
+
+void bootPhase(const char *name) {
+  uint8_t n = phaseCount.load();
+  if (n >= MAX_PHASES)
+    return;
+  phases[n] = {name, millis()};
+  phaseCount.store(n + 1);
+  logDebug("boot", "%s done at %u ms", name, phases[n].atMs);
+}
+
+void bootEvent(BootEvent e) {
+  // Keep the first occurrence; millis() is never 0 once anything has run.
+  uint32_t none = 0;
+  events[(size_t)e].compare_exchange_strong(none, millis());
+}
+
+static void eventToJson(JsonObject out, const char *key, BootEvent e) {
+  uint32_t ms = events[(size_t)e].load();
+  if (ms)
+    out[key] = ms;
+  else
+    out[key] = nullptr;
+}
+
+void bootToJson(JsonObject out) {
+  JsonArray arr = out["phases"].to<JsonArray>();
+  uint32_t prev = 0;
+  for (uint8_t i = 0, n = phaseCount.load(); i < n; i++) {
+    JsonObject o = arr.add<JsonObject>();
+    o["name"] = phases[i].name;
+    o["atMs"] = phases[i].atMs;
+    o["ms"] = phases[i].atMs - prev;
+    prev = phases[i].atMs;
+  }
+  eventToJson(out, "staConnectedMs", BootEvent::StaConnected);
+  eventToJson(out, "staIpMs", BootEvent::StaIp);
+  eventToJson(out, "firstHttpMs", BootEvent::FirstHttp);
+  out["fastConnect"] = wifiFastConnectState();
+}
@@ -1,37 +1,106 @@
 #include "CaptureProxy.h"
+#include "TcpTransport.h"
+#include "Trace.h"
+#include "UartTransport.h"
 #include "Utils.h"
 #include <ArduinoJson.h>
+#include <AsyncUDP.h>
 
 
-std::vector<Capture> caps;
+std::deque<Capture> caps;
+uint32_t capsEvicted = 0;
+uint32_t capsReceived = 0;
+uint32_t capsRepeats = 0;
+uint32_t capsBytes = 0;
 static const size_t MAX_CAPS = 160;
+static SemaphoreHandle_t capsMutex = xSemaphoreCreateMutex();
+
+CapsLock::CapsLock() { xSemaphoreTake(capsMutex, portMAX_DELAY); }
+CapsLock::~CapsLock() { xSemaphoreGive(capsMutex); }
 
 uint16_t learnPort = 5000;
 bool learnEnabled = true;
 static AsyncServer *learnServer = nullptr;
 
+// e.g. 52381 (VISCA over IP), 6454 (Art-Net). Empty = UDP learner off.
+std::vector<uint16_t> udpLearnPorts;
+static std::vector<AsyncUDP *> udpLearners;
+
+uint32_t learnUartBaud = 0; // 0 = don't sniff the RS-232 port
+static UartTransport *learnUart = nullptr;
+
 bool proxyRunning = false;
+String proxyProto = "tcp";
 bool proxyCaptureToLearn = false;
 uint16_t proxyListenPort = 23001;
 String proxyTargetHost = "";
 uint16_t proxyTargetPort = 0;
+uint32_t proxyTargetBaud = 9600;
+uint32_t proxyConnections = 0;
+uint32_t proxyBytesToTarget = 0;
+uint32_t proxyBytesToClient = 0;
+uint32_t proxyUdpPeersRefused = 0;
 static AsyncServer *proxyServer = nullptr;
 
 struct ProxyPair {
-  AsyncClient *inClient = nullptr;
-  AsyncClient *outClient = nullptr;
+  TcpTransport *in = nullptr;
+  Transport *out = nullptr;
 };
 static ProxyPair proxyPair;
+// A UART target delivers on the UART event task while the pair is torn
+// down on async_tcp, so both ends are only used or deleted under this lock.
+static SemaphoreHandle_t proxyPairMutex = xSemaphoreCreateMutex();
+struct ProxyPairLock {
+  ProxyPairLock() { xSemaphoreTake(proxyPairMutex, portMAX_DELAY); }
+  ~ProxyPairLock() { xSemaphoreGive(proxyPairMutex); }
+};
+
+// UDP has no connections, so each client peer gets its own upstream socket
+// (bound to an ephemeral port) and replies are routed back by that mapping.
+// Reply callbacks name their peer by `gen` and look it up under
+// udpPeersMutex, never by pointer: the peer may be aged out or the proxy
+// stopped while a packet callback is waiting for the lock.
+struct UdpPeer {
+  IPAddress ip;
+  uint16_t port = 0;
+  uint32_t gen = 0;
+  AsyncUDP *out = nullptr;
+  uint32_t lastMs = 0;
+};
+// A full table refuses new peers rather than evicting live ones; peers
+// leave once idle (proxyService).
+static const size_t MAX_UDP_PEERS = 64;
+static const uint32_t UDP_PEER_IDLE_MS = 60 * 1000;
+// Closed sockets are freed this much later: async_udp may still hold
+// packets queued for them, and delivers those with the socket's pointer.
+static const uint32_t UDP_RETIRE_MS = 1000;
+struct RetiredUdp {
+  AsyncUDP *sock;
+  uint32_t sinceMs;
+};
+static AsyncUDP *udpProxyIn = nullptr;
+static std::vector<UdpPeer *> udpPeers;
+static std::vector<RetiredUdp> udpRetired;
+static uint32_t udpPeerGen = 0;
+static IPAddress udpProxyTargetIp;
+static SemaphoreHandle_t udpPeersMutex = xSemaphoreCreateMutex();
+
+// Caller holds udpPeersMutex.
+static void udpRetireLocked(AsyncUDP *sock) {
+  sock->close();
+  udpRetired.push_back({sock, millis()});
+}
 
 void addCapture(const String &srcIp, uint16_t srcPort, uint16_t localPort,
-                const uint8_t *data, size_t len) {
+                const uint8_t *data, size_t len, const char *proto) {
+  TraceScope span("addCapture");
   Capture c;
-  c.id = genId();
   c.ts = millis();
   c.lastTs = c.ts;
   c.srcIp = srcIp;
   c.srcPort = srcPort;
   c.localPort = localPort;
+  c.proto = proto;
   c.hex = bytesToHex(data, len);
   c.ascii = bytesToAscii(data, len);
   c.suffixHint = detectSuffix(data, len);
@@ -47,17 +116,24 @@ void addCapture(const String &srcIp, uint16_t srcPort, uint16_t localPort,
 
   c.hash = simpleHash(c.srcIp + ":" + String(c.srcPort) + "|" + c.hex);
 
+  CapsLock lock;
+  capsReceived++;
+  capsBytes += len;
   if (!caps.empty()) {
     Capture &last = caps.back();
-    if (last.hash == c.hash && (c.ts - last.lastTs) < 1500) {
+    if (!last.deleted && last.hash == c.hash && (c.ts - last.lastTs) < 1500) {
+      capsRepeats++;
       last.repeats++;
       last.lastTs = c.ts;
       return;
     }
   }
 
-  if (caps.size() >= MAX_CAPS)
-    caps.erase(caps.begin());
+  if (caps.size() >= MAX_CAPS) {
+    caps.pop_front();
+    capsEvicted++;
+  }
+  c.id = capsEvicted + caps.size() + 1;
   caps.push_back(c);
 }
 
@@ -67,6 +143,46 @@ void stopLearn() {
     delete learnServer;
     learnServer = nullptr;
   }
+  for (auto *u : udpLearners) {
+    u->close();
+    delete u;
+  }
+  udpLearners.clear();
+  delete learnUart;
+  learnUart = nullptr;
+}
+
+static void startUartLearn() {
+  if (!learnUartBaud)
+    return;
+  learnUart = new UartTransport();
+  learnUart->onData([](const uint8_t *data, size_t len) {
+    addCapture("UART", 0, 0, data, len, "uart");
+  });
+  if (!learnUart->open(learnUartBaud)) {
+    delete learnUart;
+    learnUart = nullptr;
+    logWarn("learn", "UART busy");
+    return;
+  }
+  logInfo("learn", "UART sniffing @%u", learnUartBaud);
+}
+
+static void startUdpLearn() {
+  for (auto port : udpLearnPorts) {
+    AsyncUDP *u = new AsyncUDP();
+    if (!u->listen(port)) {
+      logWarn("learn", "UDP listen failed on port %u", port);
+      delete u;
+      continue;
+    }
+    u->onPacket([](AsyncUDPPacket &packet) {
+      addCapture(packet.remoteIP().toString(), packet.remotePort(),
+                 packet.localPort(), packet.data(), packet.length(), "udp");
+    });
+    udpLearners.push_back(u);
+    logInfo("learn", "UDP listening on port %u", port);
+  }
 }
 
 void startLearn() {
@@ -77,38 +193,83 @@ void startLearn() {
   learnServer = new AsyncServer(learnPort);
   learnServer->onClient(
       [](void *, AsyncClient *client) {
-        client->onData(
-            [](void *, AsyncClient *c, void *data, size_t len) {
-              addCapture(c->remoteIP().toString(), c->remotePort(),
-                         c->localPort(), (uint8_t *)data, len);
-            },
-            nullptr);
+        TcpTransport *t = new TcpTransport(client);
+        String ip = t->remoteIp();
+        uint16_t rport = t->remotePort();
+        uint16_t lport = t->localPort();
+        t->onData([ip, rport, lport](const uint8_t *data, size_t len) {
+          addCapture(ip, rport, lport, data, len);
+        });
+        t->onClose([t]() { delete t; });
       },
       nullptr);
 
   learnServer->begin();
-  logAll("Learner TCP listening on port " + String(learnPort));
+  logInfo("learn", "TCP listening on port %u", learnPort);
+
+  startUdpLearn();
+  startUartLearn();
+}
+
+Capture *findCaptureLocked(uint32_t id) {
+  if (id <= capsEvicted || id - capsEvicted > caps.size())
+    return nullptr;
+  Capture &c = caps[id - capsEvicted - 1];
+  return c.deleted ? nullptr : &c;
+}
+
+bool getCaptureById(uint32_t id, Capture &out) {
+  CapsLock lock;
+  Capture *c = findCaptureLocked(id);
+  if (c)
+    out = *c;
+  return c != nullptr;
+}
+
+size_t pinCaptures(const std::vector<uint32_t> &ids, bool pin,
+                   std::vector<uint32_t> &missing) {
+  size_t n = 0;
+  CapsLock lock;
+  for (uint32_t id : ids) {
+    Capture *c = findCaptureLocked(id);
+    if (!c) {
+      missing.push_back(id);
+      continue;
+    }
+    n += c->pinned != pin;
+    c->pinned = pin;
+  }
+  return n;
 }
 
-bool getCaptureById(const String &id, Capture &out) {
-  for (auto &c : caps)
-    if (c.id == id) {
-      out = c;
-      return true;
+size_t deleteCaptures(const std::vector<uint32_t> &ids,
+                      std::vector<uint32_t> &missing) {
+  size_t n = 0;
+  CapsLock lock;
+  for (uint32_t id : ids) {
+    Capture *c = findCaptureLocked(id);
+    if (!c) {
+      missing.push_back(id);
+      continue;
     }
-  return false;
+    c->deleted = true;
+    c->hex = String();
+    c->ascii = String();
+    c->hash = String();
+    n++;
+  }
+  return n;
 }
 
 void proxyStop() {
   proxyRunning = false;
 
-  if (proxyPair.inClient) {
-    proxyPair.inClient->close(true);
-    proxyPair.inClient = nullptr;
-  }
-  if (proxyPair.outClient) {
-    proxyPair.outClient->close(true);
-    proxyPair.outClient = nullptr;
+  {
+    ProxyPairLock lock;
+    delete proxyPair.in;
+    proxyPair.in = nullptr;
+    delete proxyPair.out;
+    proxyPair.out = nullptr;
   }
 
   if (proxyServer) {
@@ -116,13 +277,29 @@ void proxyStop() {
     delete proxyServer;
     proxyServer = nullptr;
   }
+
+  xSemaphoreTake(udpPeersMutex, portMAX_DELAY);
+  for (auto *p : udpPeers) {
+    udpRetireLocked(p->out);
+    delete p;
+  }
+  udpPeers.clear();
+  if (udpProxyIn) {
+    udpRetireLocked(udpProxyIn);
+    udpProxyIn = nullptr;
+  }
+  xSemaphoreGive(udpPeersMutex);
+
   wsTextAll(wsProxy, R"({"type":"status","running":false})");
 }
 
-static void proxyLog(const char *dir, const uint8_t *data, size_t len) {
+static void proxyLog(const char *dir, const uint8_t *data, size_t len,
+                     const char *proto = "tcp") {
+  TraceScope span("proxyLog");
   JsonDocument d;
   d["type"] = "data";
   d["dir"] = dir;
+  d["proto"] = proto;
   d["hex"] = bytesToHex(data, len);
   d["ascii"] = bytesToAscii(data, len);
   String s;
@@ -131,113 +308,252 @@ static void proxyLog(const char *dir, const uint8_t *data, size_t len) {
 
   if (proxyCaptureToLearn) {
     String src = String("PROXY ") + String(dir);
-    addCapture(src, 0, proxyListenPort, data, len);
+    addCapture(src, 0, proxyListenPort, data, len, proto);
   }
 }
 
-void proxyStart() {
-  proxyStop();
+// Caller holds udpPeersMutex.
+static UdpPeer *udpPeerByGen(uint32_t gen) {
+  for (auto *p : udpPeers)
+    if (p->gen == gen)
+      return p;
+  return nullptr;
+}
 
-  if (!proxyTargetHost.length() || proxyTargetPort == 0 ||
-      proxyListenPort == 0) {
-    wsTextAll(wsProxy,
-              R"({"type":"error","msg":"Missing target or listen port"})");
+// Caller holds udpPeersMutex.
+static UdpPeer *udpPeerFor(const IPAddress &ip, uint16_t port) {
+  for (auto *p : udpPeers)
+    if (p->ip == ip && p->port == port)
+      return p;
+
+  if (udpPeers.size() >= MAX_UDP_PEERS) {
+    proxyUdpPeersRefused++;
+    return nullptr;
+  }
+
+  UdpPeer *p = new UdpPeer();
+  p->ip = ip;
+  p->port = port;
+  p->gen = ++udpPeerGen;
+  p->out = new AsyncUDP();
+  if (!p->out->connect(udpProxyTargetIp, proxyTargetPort)) {
+    delete p->out;
+    delete p;
+    return nullptr;
+  }
+  uint32_t gen = p->gen;
+  p->out->onPacket([gen](AsyncUDPPacket &packet) {
+    xSemaphoreTake(udpPeersMutex, portMAX_DELAY);
+    UdpPeer *peer = udpProxyIn ? udpPeerByGen(gen) : nullptr;
+    if (peer) {
+      peer->lastMs = millis();
+      udpProxyIn->writeTo(packet.data(), packet.length(), peer->ip,
+                          peer->port);
+      proxyBytesToClient += packet.length();
+    }
+    xSemaphoreGive(udpPeersMutex);
+    if (peer)
+      proxyLog("RX(target->client)", packet.data(), packet.length(), "udp");
+  });
+  udpPeers.push_back(p);
+  return p;
+}
+
+// From loop(), about once a second.
+void proxyService() {
+  xSemaphoreTake(udpPeersMutex, portMAX_DELAY);
+  uint32_t now = millis();
+  for (size_t i = udpPeers.size(); i-- > 0;) {
+    UdpPeer *p = udpPeers[i];
+    if (now - p->lastMs < UDP_PEER_IDLE_MS)
+      continue;
+    udpRetireLocked(p->out);
+    delete p;
+    udpPeers.erase(udpPeers.begin() + i);
+  }
+  for (size_t i = udpRetired.size(); i-- > 0;) {
+    if (now - udpRetired[i].sinceMs < UDP_RETIRE_MS)
+      continue;
+    delete udpRetired[i].sock;
+    udpRetired.erase(udpRetired.begin() + i);
+  }
+  xSemaphoreGive(udpPeersMutex);
+}
+
+static void udpProxyStart() {
+  IPAddress ip;
+  if (!ip.fromString(proxyTargetHost) &&
+      WiFi.hostByName(proxyTargetHost.c_str(), ip) != 1) {
+    wsTextAll(wsProxy, R"({"type":"error","msg":"DNS failed for target"})");
+    return;
+  }
+  udpProxyTargetIp = ip;
+
+  udpProxyIn = new AsyncUDP();
+  if (!udpProxyIn->listen(proxyListenPort)) {
+    wsTextAll(wsProxy, R"({"type":"error","msg":"UDP listen failed"})");
+    delete udpProxyIn;
+    udpProxyIn = nullptr;
     return;
   }
+  udpProxyIn->onPacket([](AsyncUDPPacket &packet) {
+    xSemaphoreTake(udpPeersMutex, portMAX_DELAY);
+    if (!udpProxyIn) { // proxyStop() got here first
+      xSemaphoreGive(udpPeersMutex);
+      return;
+    }
+    UdpPeer *p = udpPeerFor(packet.remoteIP(), packet.remotePort());
+    if (p) {
+      p->lastMs = millis();
+      p->out->write(packet.data(), packet.length());
+      proxyBytesToTarget += packet.length();
+    }
+    xSemaphoreGive(udpPeersMutex);
+    if (p)
+      proxyLog("TX(client->target)", packet.data(), packet.length(), "udp");
+  });
+}
+
+static void proxyTargetData(const uint8_t *data, size_t len) {
+  const char *kind;
+  {
+    ProxyPairLock lock;
+    if (!proxyPair.in || !proxyPair.out)
+      return;
+    proxyPair.in->write(data, len);
+    proxyBytesToClient += len;
+    kind = proxyPair.out->kind();
+  }
+  proxyLog("RX(target->client)", data, len, kind);
+}
+
+// Opens the proxy's upstream side: the RS-232 port when the target host is
+// "uart", otherwise a TCP connection to targetHost:targetPort.
+static Transport *proxyOpenTarget() {
+  if (proxyTargetHost == "uart") {
+    UartTransport *u = new UartTransport();
+    // Set before open(): the UART task may deliver as soon as it's open.
+    u->onData(proxyTargetData);
+    if (!u->open(proxyTargetBaud)) {
+      wsTextAll(wsProxy, R"({"type":"error","msg":"UART busy"})");
+      delete u;
+      return nullptr;
+    }
+    wsTextAll(wsProxy, R"({"type":"status","running":true,"connected":true})");
+    return u;
+  }
+
+  IPAddress ip;
+  if (!ip.fromString(proxyTargetHost)) {
+    IPAddress resolved;
+    if (WiFi.hostByName(proxyTargetHost.c_str(), resolved) != 1) {
+      wsTextAll(wsProxy, R"({"type":"error","msg":"DNS failed for target"})");
+      return nullptr;
+    }
+    ip = resolved;
+  }
+
+  TcpTransport *t = new TcpTransport();
+  t->onData(proxyTargetData);
+  t->onConnect([](bool ok) {
+    if (ok) {
+      wsTextAll(wsProxy,
+                R"({"type":"status","running":true,"connected":true})");
+      return;
+    }
+    // The close that follows tears the proxy down.
+    wsTextAll(wsProxy, R"({"type":"error","msg":"Target connect error"})");
+  });
+  if (!t->connect(ip, proxyTargetPort)) {
+    wsTextAll(wsProxy, R"({"type":"error","msg":"Target connect error"})");
+    delete t;
+    return nullptr;
+  }
+  return t;
+}
 
+static void tcpProxyStart() {
   proxyServer = new AsyncServer(proxyListenPort);
 
   proxyServer->onClient(
       [](void *, AsyncClient *inClient) {
-        if (proxyPair.inClient) {
+        {
+          ProxyPairLock lock;
+          if (proxyPair.in) {
+            inClient->close(true);
+            return;
+          }
+        }
+        Transport *out = proxyOpenTarget();
+        if (!out) {
           inClient->close(true);
           return;
         }
-        proxyPair.inClient = inClient;
-
-        proxyPair.outClient = new AsyncClient();
-        AsyncClient *out = proxyPair.outClient;
-
-        out->onConnect(
-            [](void *, AsyncClient *) {
-              wsTextAll(wsProxy,
-                        R"({"type":"status","running":true,"connected":true})");
-            },
-            nullptr);
-
-        out->onError(
-            [](void *, AsyncClient *, int8_t err) {
-              JsonDocument d;
-              d["type"] = "error";
-              d["msg"] = String("Target connect error ") + String(err);
-              String s;
-              serializeJson(d, s);
-              wsTextAll(wsProxy, s);
-              proxyStop();
-            },
-            nullptr);
-
-        out->onDisconnect(
-            [](void *, AsyncClient *) {
-              wsTextAll(
-                  wsProxy,
-                  R"({"type":"status","running":true,"connected":false})");
-              proxyStop();
-            },
-            nullptr);
-
-        out->onData(
-            [](void *, AsyncClient *, void *data, size_t len) {
-              if (!proxyPair.inClient)
-                return;
-              proxyPair.inClient->write((const char *)data, len);
-              proxyLog("RX(target->client)", (uint8_t *)data, len);
-            },
-            nullptr);
-
-        inClient->onData(
-            [](void *, AsyncClient *, void *data, size_t len) {
-              if (!proxyPair.outClient)
-                return;
-              proxyPair.outClient->write((const char *)data, len);
-              proxyLog("TX(client->target)", (uint8_t *)data, len);
-            },
-            nullptr);
-
-        inClient->onDisconnect([](void *, AsyncClient *) { proxyStop(); },
-                               nullptr);
-
-        IPAddress ip;
-        if (!ip.fromString(proxyTargetHost)) {
-          IPAddress resolved;
-          if (WiFi.hostByName(proxyTargetHost.c_str(), resolved) != 1) {
-            wsTextAll(wsProxy,
-                      R"({"type":"error","msg":"DNS failed for target"})");
-            proxyStop();
-            return;
+        TcpTransport *in = new TcpTransport(inClient);
+        proxyConnections++;
+
+        out->onClose([]() {
+          wsTextAll(wsProxy,
+                    R"({"type":"status","running":true,"connected":false})");
+          proxyStop();
+        });
+
+        in->onData([](const uint8_t *data, size_t len) {
+          const char *kind;
+          {
+            ProxyPairLock lock;
+            if (!proxyPair.out)
+              return;
+            proxyPair.out->write(data, len);
+            proxyBytesToTarget += len;
+            kind = proxyPair.out->kind();
           }
-          ip = resolved;
-        }
-
-        out->connect(ip, proxyTargetPort);
+          proxyLog("TX(client->target)", data, len, kind);
+        });
+        in->onClose([]() { proxyStop(); });
+        ProxyPairLock lock;
+        proxyPair.in = in;
+        proxyPair.out = out;
       },
       nullptr);
 
   proxyServer->begin();
+}
+
+void proxyStart() {
+  proxyStop();
+
+  bool uartTarget = proxyTargetHost == "uart";
+  if (!proxyTargetHost.length() || (proxyTargetPort == 0 && !uartTarget) ||
+      proxyListenPort == 0) {
+    wsTextAll(wsProxy,
+              R"({"type":"error","msg":"Missing target or listen port"})");
+    return;
+  }
+
+  if (proxyProto == "udp") {
+    udpProxyStart();
+    if (!udpProxyIn)
+      return;
+  } else {
+    tcpProxyStart();
+  }
   proxyRunning = true;
 
   JsonDocument st;
   st["type"] = "status";
   st["running"] = true;
   st["connected"] = false;
+  st["proto"] = proxyProto;
   st["listenPort"] = proxyListenPort;
   st["targetHost"] = proxyTargetHost;
   st["targetPort"] = proxyTargetPort;
+  st["targetBaud"] = proxyTargetBaud;
   st["captureToLearn"] = proxyCaptureToLearn;
   String s;
   serializeJson(st, s);
   wsTextAll(wsProxy, s);
 
-  logAll("Proxy listening :" + String(proxyListenPort) + " -> " +
-         proxyTargetHost + ":" + String(proxyTargetPort));
+  logInfo("proxy", "(%s) listening :%u -> %s:%u", proxyProto, proxyListenPort,
+          proxyTargetHost, proxyTargetPort);
 }
@@ -1,9 +1,90 @@
 #include "ConfigManager.h"
 #include "Utils.h"
-#include <ArduinoJson.h>
+#include <LittleFS.h>
+#include <functional>
+#include <map>
 
+ConfigModel cfg;
+static SemaphoreHandle_t cfgMutex = xSemaphoreCreateMutex();
 
-String cfgJson;
+CfgLock::CfgLock() { xSemaphoreTake(cfgMutex, portMAX_DELAY); }
+CfgLock::~CfgLock() { xSemaphoreGive(cfgMutex); }
+
+static std::vector<String> idTable{String()};
+static std::map<String, IdRef> idLookup;
+static std::vector<IdRef> idFree; // pruned slots below idTable.size()
+
+IdRef internId(const String &s) {
+  if (!s.length())
+    return 0;
+  auto it = idLookup.find(s);
+  if (it != idLookup.end())
+    return it->second;
+  IdRef ref;
+  if (idFree.size()) {
+    ref = idFree.back();
+    idFree.pop_back();
+    idTable[ref] = s;
+  } else {
+    ref = idTable.size();
+    idTable.push_back(s);
+  }
+  idLookup[s] = ref;
+  return ref;
+}
+
+// Caller holds CfgLock. Drops the ids cfg no longer refers to (deleted
+// devices, a replaced config, throwaway lookups) and reindexes. Only cfg
+// may hold IdRefs at this point: no half-built model or saved ref.
+static void pruneIds() {
+  std::vector<bool> used(idTable.size(), false);
+  used[0] = true;
+  for (auto &d : cfg.devices)
+    used[d.id] = used[d.templateId] = true;
+  for (auto &t : cfg.templates)
+    used[t.id] = true;
+  size_t size = idTable.size();
+  while (!used[size - 1])
+    size--;
+  idFree.clear();
+  for (size_t i = 1; i < idTable.size(); i++) {
+    if (used[i])
+      continue;
+    idLookup.erase(idTable[i]);
+    if (i < size) {
+      idTable[i] = String();
+      idFree.push_back(i);
+    }
+  }
+  idTable.resize(size);
+  cfg.reindex();
+}
+
+IdRef findId(const String &s) {
+  auto it = idLookup.find(s);
+  return it == idLookup.end() ? 0 : it->second;
+}
+
+const String &idStr(IdRef id) {
+  return id < idTable.size() ? idTable[id] : idTable[0];
+}
+
+int ConfigModel::deviceIndex(IdRef id) const {
+  return id && id < devByRef.size() ? devByRef[id] : -1;
+}
+
+int ConfigModel::templateIndex(IdRef id) const {
+  return id && id < tplByRef.size() ? tplByRef[id] : -1;
+}
+
+void ConfigModel::reindex() {
+  devByRef.assign(idTable.size(), -1);
+  tplByRef.assign(idTable.size(), -1);
+  for (size_t i = 0; i < devices.size(); i++)
+    devByRef[devices[i].id] = i;
+  for (size_t i = 0; i < templates.size(); i++)
+    tplByRef[templates[i].id] = i;
+}
 
 String defaultCfgJson() {
   return R"JSON({
@@ -53,62 +134,522 @@ String defaultCfgJson() {
 })JSON";
 }
 
-void loadCfg() {
-  cfgJson = prefs.getString("cfg_json", defaultCfgJson());
-  if (cfgJson.length() < 10)
-    cfgJson = defaultCfgJson();
+// Keys kept typed; anything else rides along in `extra`.
+static const char *DEVICE_KEYS[] = {
+    "id",         "name",       "ip",
+    "portHint",   "defaultSuffix", "notes",
+    "templateId", "defaultPayloadType", "mac",
+    "lastSeenMs"};
+
+static String extraKeys(JsonObjectConst o, const char *const *known,
+                        size_t nKnown) {
+  JsonDocument rest;
+  for (JsonPairConst kv : o) {
+    bool isKnown = false;
+    for (size_t i = 0; i < nKnown && !isKnown; i++)
+      isKnown = !strcmp(kv.key().c_str(), known[i]);
+    if (!isKnown)
+      rest[kv.key()] = kv.value();
+  }
+  if (rest.isNull())
+    return "";
+  String out;
+  serializeJson(rest, out);
+  return out;
 }
 
-void saveCfg() { prefs.putString("cfg_json", cfgJson); }
+static void deviceFromJson(JsonObjectConst o, DeviceCfg &d) {
+  d.id = internId(o["id"] | "");
+  d.name = o["name"] | "";
+  d.ip = o["ip"] | "";
+  d.portHint = o["portHint"] | 0;
+  d.defaultSuffix = o["defaultSuffix"] | "";
+  d.notes = o["notes"] | "";
+  d.templateId = internId(o["templateId"] | "");
+  d.defaultPayloadType = o["defaultPayloadType"] | "";
+  d.mac = o["mac"] | "";
+  d.lastSeenMs = o["lastSeenMs"] | 0;
+  d.extra = extraKeys(o, DEVICE_KEYS, sizeof(DEVICE_KEYS) / sizeof(*DEVICE_KEYS));
+}
 
-bool updateCfgWithDevice(const String &name, const String &ip,
-                         uint16_t portHint, const String &suffixHint,
-                         const String &notes, const String &templateId,
-                         const String &payloadType, const String &mac) {
+void deviceToJson(const DeviceCfg &d, JsonObject o) {
+  o["id"] = idStr(d.id);
+  o["name"] = d.name;
+  o["ip"] = d.ip;
+  o["portHint"] = d.portHint;
+  o["defaultSuffix"] = d.defaultSuffix;
+  o["notes"] = d.notes;
+  o["templateId"] = idStr(d.templateId);
+  o["defaultPayloadType"] = d.defaultPayloadType;
+  o["mac"] = d.mac;
+  o["lastSeenMs"] = d.lastSeenMs;
+  if (d.extra.length()) {
+    JsonDocument rest;
+    if (!deserializeJson(rest, d.extra))
+      for (JsonPair kv : rest.as<JsonObject>())
+        o[kv.key()] = kv.value();
+  }
+}
+
+static void templateFromJson(JsonObjectConst o, TemplateCfg &t) {
+  t.id = internId(o["id"] | "");
+  t.name = o["name"] | "";
+  t.defaultPort = o["defaultPort"] | 0;
+  t.defaultSuffix = o["defaultSuffix"] | "";
+  serializeJson(o, t.json);
+}
+
+static bool parseInto(const char *json, size_t len, ConfigModel &m) {
   JsonDocument doc;
-  if (deserializeJson(doc, cfgJson))
+  if (deserializeJson(doc, json, len) || !doc.is<JsonObject>())
     return false;
+  m.devices.clear();
+  m.templates.clear();
+  for (JsonObjectConst o : doc["devices"].as<JsonArrayConst>()) {
+    DeviceCfg d;
+    deviceFromJson(o, d);
+    m.devices.push_back(d);
+  }
+  for (JsonObjectConst o : doc["templates"].as<JsonArrayConst>()) {
+    TemplateCfg t;
+    templateFromJson(o, t);
+    m.templates.push_back(t);
+  }
+  static const char *TOP_KEYS[] = {"devices", "templates"};
+  m.extra = extraKeys(doc.as<JsonObjectConst>(), TOP_KEYS, 2);
+  m.version++;
+  m.reindex();
+  return true;
+}
 
-  if (!doc["devices"].is<JsonArray>())
-    doc["devices"] = JsonArray();
-
-  JsonArray devs = doc["devices"].as<JsonArray>();
-  JsonObject d = devs.add<JsonObject>();
-  d["id"] = genId();
-  d["name"] = name;
-  d["ip"] = ip;
-  d["portHint"] = portHint;
-  d["defaultSuffix"] = suffixHint;
-  d["notes"] = notes;
-  d["templateId"] = templateId;
-  d["defaultPayloadType"] = payloadType;
-  d["mac"] = mac;
-  d["lastSeenMs"] = millis();
+void cfgToJson(JsonDocument &doc, bool parsedTemplates) {
+  if (cfg.extra.length())
+    deserializeJson(doc, cfg.extra);
+  JsonArray devs = doc["devices"].to<JsonArray>();
+  for (auto &d : cfg.devices)
+    deviceToJson(d, devs.add<JsonObject>());
+  JsonArray tpls = doc["templates"].to<JsonArray>();
+  for (auto &t : cfg.templates) {
+    if (!parsedTemplates) {
+      tpls.add(serialized(t.json));
+      continue;
+    }
+    JsonDocument tpl;
+    deserializeJson(tpl, t.json);
+    tpls.add(tpl);
+  }
+}
 
-  String out;
-  serializeJson(doc, out);
-  cfgJson = out;
-  saveCfg();
-  return true;
+// ---------- LittleFS store ----------
+//
+// /cfg/snapshot.ndjson is the config at some version, one record per line:
+//   {"cfg":1,"extra":{...}}   header, unknown top-level keys
+//   {"tpl":{...}}             one per template
+//   {"dev":{...}}             one per device
+// /cfg/journal.ndjson holds the edits since, one line each:
+//   {"put":{...device...}} or {"del":"<device id>"}
+// Replay is idempotent (put = upsert), so a crash between installing a new
+// snapshot and dropping the journal only replays edits already applied.
+// Snapshots are written to a temp file and renamed over the old one.
+// Compaction writes a snapshot while edits go on, then keeps only the
+// journal written after it started; edits it also caught replay harmlessly.
+
+static const char *CFG_DIR = "/cfg";
+static const char *SNAP_PATH = "/cfg/snapshot.ndjson";
+static const char *SNAP_TMP = "/cfg/snapshot.tmp";
+static const char *SNAP_COMPACT = "/cfg/snapshot.compact";
+static const char *JOURNAL_PATH = "/cfg/journal.ndjson";
+static const char *JOURNAL_TMP = "/cfg/journal.tmp";
+
+static const size_t COMPACT_BYTES = 16384;
+static const uint32_t COMPACT_LINES = 128;
+static const size_t COMPACT_BATCH = 32; // devices written per CfgLock hold
+
+static size_t journalBytes = 0;
+static uint32_t journalLines = 0;
+static uint32_t snapshotGen = 0; // bumped by every full writeSnapshot()
+static size_t compactNext = 0;   // next device compactOnce() writes
+static size_t snapshotBytes = 0; // kept here so stats never touch the FS
+static bool storeSuspended = false; // the FS is being overwritten by OTA
+static bool compacting = false;
+static TaskHandle_t compactTask = nullptr;
+
+static String snapshotHeader() {
+  String line = "{\"cfg\":1,\"extra\":";
+  line += cfg.extra.length() ? cfg.extra : String("{}");
+  line += "}\n";
+  return line;
 }
 
-bool removeDevice(const String &id) {
+static String deviceLine(const char *key, const DeviceCfg &d) {
   JsonDocument doc;
-  if (deserializeJson(doc, cfgJson))
+  deviceToJson(d, doc[key].to<JsonObject>());
+  String line;
+  serializeJson(doc, line);
+  line += '\n';
+  return line;
+}
+
+static String templateLine(const TemplateCfg &t) {
+  return "{\"tpl\":" + t.json + "}\n";
+}
+
+// Reads one line at a time, so boot never holds the whole file in memory.
+static void forEachLine(const char *path,
+                        std::function<void(JsonDocument &)> fn) {
+  File f = LittleFS.open(path, "r");
+  if (!f)
+    return;
+  while (f.available()) {
+    String line = f.readStringUntil('\n');
+    if (line.length() < 2)
+      continue;
+    JsonDocument doc;
+    if (deserializeJson(doc, line))
+      continue; // torn last line after a power cut
+    fn(doc);
+  }
+  f.close();
+}
+
+// Caller holds CfgLock.
+static void applyPut(JsonObjectConst o) {
+  DeviceCfg d;
+  deviceFromJson(o, d);
+  if (d.id < cfg.devByRef.size() && cfg.devByRef[d.id] >= 0) {
+    cfg.devices[cfg.devByRef[d.id]] = d;
+    return;
+  }
+  cfg.devices.push_back(d);
+  cfg.reindex();
+}
+
+// Caller holds CfgLock. Keeps a running compaction from skipping the
+// device that slides into the erased one's place.
+static void eraseDevice(int i) {
+  cfg.devices.erase(cfg.devices.begin() + i);
+  if ((size_t)i < compactNext)
+    compactNext--;
+}
+
+static void applyDel(const String &id) {
+  int i = cfg.deviceIndex(findId(id));
+  if (i < 0)
+    return;
+  eraseDevice(i);
+  pruneIds();
+}
+
+// Caller holds CfgLock.
+static bool loadSnapshot() {
+  File sf = LittleFS.open(SNAP_PATH, "r");
+  if (!sf)
+    return false;
+  snapshotBytes = sf.size();
+  sf.close();
+  cfg.devices.clear();
+  cfg.templates.clear();
+  cfg.extra = "";
+  forEachLine(SNAP_PATH, [](JsonDocument &doc) {
+    if (doc["dev"].is<JsonObject>()) {
+      DeviceCfg d;
+      deviceFromJson(doc["dev"], d);
+      cfg.devices.push_back(d);
+    } else if (doc["tpl"].is<JsonObject>()) {
+      TemplateCfg t;
+      templateFromJson(doc["tpl"], t);
+      cfg.templates.push_back(t);
+    } else if (doc["extra"].is<JsonObject>() && doc["extra"].size()) {
+      serializeJson(doc["extra"], cfg.extra);
+    }
+  });
+  cfg.reindex();
+
+  journalBytes = 0;
+  journalLines = 0;
+  forEachLine(JOURNAL_PATH, [](JsonDocument &doc) {
+    if (doc["put"].is<JsonObject>())
+      applyPut(doc["put"]);
+    else if (doc["del"].is<const char *>())
+      applyDel(doc["del"].as<String>());
+    journalLines++;
+  });
+  File j = LittleFS.open(JOURNAL_PATH, "r");
+  if (j) {
+    journalBytes = j.size();
+    j.close();
+  }
+  pruneIds();
+  cfg.version++;
+  return true;
+}
+
+// Writes the whole model in one go. Caller holds CfgLock.
+static bool writeSnapshot() {
+  if (storeSuspended)
+    return false;
+  File f = LittleFS.open(SNAP_TMP, "w");
+  if (!f)
     return false;
-  if (!doc["devices"].is<JsonArray>())
+  bool ok = f.print(snapshotHeader()) > 0;
+  for (auto &t : cfg.templates)
+    ok = ok && f.print(templateLine(t)) > 0;
+  for (auto &d : cfg.devices)
+    ok = ok && f.print(deviceLine("dev", d)) > 0;
+  size_t bytes = f.size();
+  f.close();
+  if (!ok || !LittleFS.rename(SNAP_TMP, SNAP_PATH)) {
+    LittleFS.remove(SNAP_TMP);
+    logError("cfg", "snapshot write failed");
     return false;
+  }
+  snapshotBytes = bytes;
+  LittleFS.remove(JOURNAL_PATH);
+  journalBytes = 0;
+  journalLines = 0;
+  snapshotGen++;
+  return true;
+}
+
+// Caller holds CfgLock. Falls back to a full snapshot if the append fails.
+static void journalAppend(const String &line) {
+  if (storeSuspended)
+    return;
+  File f = LittleFS.open(JOURNAL_PATH, "a");
+  if (!f || f.print(line) != line.length()) {
+    if (f)
+      f.close();
+    writeSnapshot();
+    return;
+  }
+  f.close();
+  journalBytes += line.length();
+  journalLines++;
+  if (compactTask &&
+      (journalBytes >= COMPACT_BYTES || journalLines >= COMPACT_LINES))
+    xTaskNotifyGive(compactTask);
+}
 
-  JsonArray devs = doc["devices"].as<JsonArray>();
-  for (int i = 0; i < (int)devs.size(); i++) {
-    if (devs[i]["id"] == id) {
-      devs.remove(i);
-      String out;
-      serializeJson(doc, out);
-      cfgJson = out;
-      saveCfg();
+// Caller holds CfgLock. Drops the first `from` bytes of the journal, which
+// the new snapshot already covers.
+static bool keepJournalTail(size_t from) {
+  if (from >= journalBytes) {
+    LittleFS.remove(JOURNAL_PATH);
+    journalBytes = 0;
+    journalLines = 0;
+    return true;
+  }
+  File in = LittleFS.open(JOURNAL_PATH, "r");
+  File out = LittleFS.open(JOURNAL_TMP, "w");
+  bool ok = in && out && in.seek(from);
+  size_t bytes = 0;
+  uint32_t lines = 0;
+  uint8_t buf[256];
+  while (ok && in.available()) {
+    size_t n = in.read(buf, sizeof(buf));
+    for (size_t k = 0; k < n; k++)
+      lines += buf[k] == '\n';
+    ok = n && out.write(buf, n) == n;
+    bytes += n;
+  }
+  if (in)
+    in.close();
+  if (out)
+    out.close();
+  if (!ok || !LittleFS.rename(JOURNAL_TMP, JOURNAL_PATH)) {
+    LittleFS.remove(JOURNAL_TMP);
+    return false;
+  }
+  journalBytes = bytes;
+  journalLines = lines;
+  return true;
+}
+
+// Rewrites the snapshot from the live model a batch at a time so web
+// handlers aren't locked out for the whole write. Edits in between don't
+// stop it: new devices may or may not make it into the file, deletes move
+// the cursor back, and the journal after `journalFrom` is kept to replay
+// over the result. Only a full writeSnapshot() (config replaced) ends the
+// attempt, since that snapshot is newer anyway. Runs with `compacting` set.
+static bool compactWrite() {
+  uint32_t gen;
+  size_t journalFrom;
+  String head;
+  {
+    CfgLock lock;
+    gen = snapshotGen;
+    journalFrom = journalBytes;
+    compactNext = 0;
+    head = snapshotHeader();
+    for (auto &t : cfg.templates)
+      head += templateLine(t);
+  }
+  File f = LittleFS.open(SNAP_COMPACT, "w");
+  if (!f)
+    return false;
+  bool ok = f.print(head) == head.length();
+  while (ok) {
+    String batch;
+    {
+      CfgLock lock;
+      if (snapshotGen != gen || storeSuspended)
+        break;
+      size_t end = std::min(cfg.devices.size(), compactNext + COMPACT_BATCH);
+      for (; compactNext < end; compactNext++)
+        batch += deviceLine("dev", cfg.devices[compactNext]);
+      if (!batch.length())
+        break;
+    }
+    ok = f.print(batch) == batch.length();
+    vTaskDelay(1);
+  }
+  size_t bytes = f.size();
+  f.close();
+
+  CfgLock lock;
+  if (storeSuspended)
+    return true;
+  if (snapshotGen != gen) {
+    LittleFS.remove(SNAP_COMPACT);
+    return true;
+  }
+  // Snapshot first: with the full journal still behind it, a crash here
+  // only replays edits the snapshot already has.
+  if (!ok || !LittleFS.rename(SNAP_COMPACT, SNAP_PATH)) {
+    LittleFS.remove(SNAP_COMPACT);
+    return false;
+  }
+  snapshotBytes = bytes;
+  if (!keepJournalTail(journalFrom))
+    logWarn("cfg", "journal trim failed; it is replayed in full");
+  return true;
+}
+
+static bool compactOnce() {
+  {
+    CfgLock lock;
+    if (storeSuspended)
       return true;
+    compacting = true;
+  }
+  bool ok = compactWrite();
+  CfgLock lock;
+  compacting = false;
+  return ok;
+}
+
+void cfgStoreSuspend() {
+  for (;;) {
+    {
+      CfgLock lock;
+      storeSuspended = true;
+      if (!compacting)
+        return;
     }
+    vTaskDelay(pdMS_TO_TICKS(10)); // let compaction see it and stop
   }
-  return false;
+}
+
+void cfgStoreResume() {
+  CfgLock lock;
+  storeSuspended = false;
+}
+
+bool cfgStoreSuspended() {
+  CfgLock lock;
+  return storeSuspended;
+}
+
+static void cfgCompactTask(void *) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    for (int attempt = 0; attempt < 5 && !compactOnce(); attempt++)
+      vTaskDelay(pdMS_TO_TICKS(2000));
+  }
+}
+
+void loadCfg() {
+  LittleFS.mkdir(CFG_DIR);
+  {
+    CfgLock lock;
+    if (!loadSnapshot()) {
+      // First boot on the LittleFS store: migrate the old NVS blob once.
+      String json = prefs.getString("cfg_json", "");
+      if (json.length() < 10 ||
+          !parseInto(json.c_str(), json.length(), cfg)) {
+        String def = defaultCfgJson();
+        parseInto(def.c_str(), def.length(), cfg);
+      }
+      if (writeSnapshot() && json.length())
+        prefs.remove("cfg_json");
+    }
+  }
+  if (!compactTask)
+    xTaskCreate(cfgCompactTask, "cfgCompact", 4096, nullptr, 1, &compactTask);
+}
+
+void saveCfg() {
+  CfgLock lock;
+  writeSnapshot();
+}
+
+bool cfgFromJson(const char *json, size_t len) {
+  CfgLock lock;
+  ConfigModel next;
+  next.version = cfg.version;
+  if (!parseInto(json, len, next))
+    return false;
+  cfg = std::move(next);
+  pruneIds();
+  writeSnapshot();
+  return true;
+}
+
+bool updateCfgWithDevice(const String &name, const String &ip,
+                         uint16_t portHint, const String &suffixHint,
+                         const String &notes, const String &templateId,
+                         const String &payloadType, const String &mac) {
+  CfgLock lock;
+  DeviceCfg d;
+  d.id = internId(genId());
+  d.name = name;
+  d.ip = ip;
+  d.portHint = portHint;
+  d.defaultSuffix = suffixHint;
+  d.notes = notes;
+  d.templateId = internId(templateId);
+  d.defaultPayloadType = payloadType;
+  d.mac = mac;
+  d.lastSeenMs = millis();
+  cfg.devices.push_back(d);
+  cfg.version++;
+  cfg.reindex();
+  journalAppend(deviceLine("put", d));
+  return true;
+}
+
+bool removeDevice(const String &id) {
+  CfgLock lock;
+  int i = cfg.deviceIndex(findId(id));
+  if (i < 0)
+    return false;
+  eraseDevice(i);
+  cfg.version++;
+  pruneIds();
+  JsonDocument doc;
+  doc["del"] = id;
+  String line;
+  serializeJson(doc, line);
+  journalAppend(line + "\n");
+  return true;
+}
+
+void cfgStoreStats(JsonObject out) {
+  CfgLock lock;
+  out["devices"] = cfg.devices.size();
+  out["templates"] = cfg.templates.size();
+  out["version"] = cfg.version;
+  out["journalBytes"] = journalBytes;
+  out["journalLines"] = journalLines;
+  out["snapshotBytes"] = snapshotBytes;
 }
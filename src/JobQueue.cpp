@@ -0,0 +1,208 @@
+#include "JobQueue.h"
+#include "ApiCodec.h"
+#include <freertos/queue.h>
+#include <map>
+#include <vector>
+
+static const uint8_t WORKERS = 2;
+static const uint8_t QUEUE_DEPTH = 8;
+static const size_t KEEP_JOBS = 16; // finished jobs kept for /api/jobs
+
+struct Job {
+  uint32_t id = 0;
+  const char *kind = "";
+  const char *state = "queued"; // queued | running | done | failed
+  uint32_t submittedMs = 0;
+  uint32_t startedMs = 0;
+  uint32_t finishedMs = 0;
+  String result; // serialized JSON
+  String error;
+  JobFn fn;
+};
+
+struct KindStats {
+  uint32_t runs = 0;
+  uint32_t failures = 0;
+  uint32_t totalMs = 0;
+  uint32_t maxMs = 0;
+  uint32_t totalWaitMs = 0;
+};
+
+static Job jobs[KEEP_JOBS];
+static uint32_t nextJobId = 1;
+static QueueHandle_t jobQueue = nullptr;
+static SemaphoreHandle_t jobsMutex = xSemaphoreCreateMutex();
+static std::map<String, KindStats> kindStats;
+static std::map<String, SemaphoreHandle_t> kindLocks;
+static bool workerBusy[WORKERS];
+
+struct JobsLock {
+  JobsLock() { xSemaphoreTake(jobsMutex, portMAX_DELAY); }
+  ~JobsLock() { xSemaphoreGive(jobsMutex); }
+};
+
+static Job *jobSlot(uint32_t id) {
+  Job &j = jobs[id % KEEP_JOBS];
+  return j.id == id ? &j : nullptr;
+}
+
+static void jobEvent(const Job &j) {
+  JsonDocument doc;
+  doc["type"] = "job";
+  doc["id"] = j.id;
+  doc["kind"] = j.kind;
+  doc["state"] = j.state;
+  String out;
+  serializeJson(doc, out);
+  wsTextAll(wsState, out);
+}
+
+static void jobWorker(void *arg) {
+  bool &busy = workerBusy[(uintptr_t)arg];
+  for (;;) {
+    uint32_t id;
+    if (xQueueReceive(jobQueue, &id, portMAX_DELAY) != pdTRUE)
+      continue;
+
+    JobFn fn;
+    SemaphoreHandle_t kindLock;
+    {
+      JobsLock lock;
+      Job *j = jobSlot(id);
+      if (!j)
+        continue; // overwritten while queued
+      fn = j->fn;
+      j->fn = nullptr;
+      SemaphoreHandle_t &kl = kindLocks[j->kind];
+      if (!kl)
+        kl = xSemaphoreCreateMutex();
+      kindLock = kl;
+    }
+
+    xSemaphoreTake(kindLock, portMAX_DELAY);
+    Job snapshot;
+    {
+      JobsLock lock;
+      busy = true;
+      Job *j = jobSlot(id);
+      if (j) {
+        j->state = "running";
+        j->startedMs = millis();
+        snapshot = *j;
+      }
+    }
+    if (snapshot.id)
+      jobEvent(snapshot);
+
+    JsonDocument result;
+    String err;
+    fn(result, err);
+    xSemaphoreGive(kindLock);
+
+    JobsLock lock;
+    busy = false;
+    Job *j = jobSlot(id);
+    if (!j)
+      continue;
+    j->finishedMs = millis();
+    j->state = err.length() ? "failed" : "done";
+    j->error = err;
+    serializeJson(result, j->result);
+    KindStats &ks = kindStats[j->kind];
+    uint32_t ms = j->finishedMs - j->startedMs;
+    ks.runs++;
+    ks.failures += err.length() ? 1 : 0;
+    ks.totalMs += ms;
+    ks.totalWaitMs += j->startedMs - j->submittedMs;
+    if (ms > ks.maxMs)
+      ks.maxMs = ms;
+    jobEvent(*j);
+  }
+}
+
+void setupJobs() {
+  jobQueue = xQueueCreate(QUEUE_DEPTH, sizeof(uint32_t));
+  for (uint8_t i = 0; i < WORKERS; i++) {
+    char name[8];
+    snprintf(name, sizeof(name), "job%u", i);
+    xTaskCreate(jobWorker, name, 6144, (void *)(uintptr_t)i, 1, nullptr);
+  }
+}
+
+// The id is queued before its slot is claimed, so a full queue costs no id
+// and never evicts a finished job. Workers look the slot up under the same
+// lock, so they can't see it before it's filled.
+uint32_t jobSubmit(const char *kind, JobFn fn) {
+  JobsLock lock;
+  uint32_t id = nextJobId;
+  if (xQueueSend(jobQueue, &id, 0) != pdTRUE)
+    return 0;
+  nextJobId++;
+  Job &j = jobs[id % KEEP_JOBS];
+  j = Job();
+  j.id = id;
+  j.kind = kind;
+  j.submittedMs = millis();
+  j.fn = fn;
+  return id;
+}
+
+bool jobToJson(uint32_t id, JsonObject out) {
+  JobsLock lock;
+  Job *j = jobSlot(id);
+  if (!j)
+    return false;
+  out["id"] = j->id;
+  out["kind"] = j->kind;
+  out["state"] = j->state;
+  out["waitMs"] = j->startedMs ? j->startedMs - j->submittedMs : 0;
+  if (j->finishedMs)
+    out["runMs"] = j->finishedMs - j->startedMs;
+  if (j->error.length())
+    out["error"] = j->error;
+  if (j->result.length() && strcmp(j->result.c_str(), "null"))
+    out["result"] = serialized(j->result);
+  return true;
+}
+
+void jobListToJson(JsonArray out) {
+  JobsLock lock;
+  for (auto &j : jobs) {
+    if (!j.id)
+      continue;
+    JsonObject o = out.add<JsonObject>();
+    o["id"] = j.id;
+    o["kind"] = j.kind;
+    o["state"] = j.state;
+  }
+}
+
+void jobStatsToJson(JsonObject out) {
+  out["queued"] = jobQueue ? uxQueueMessagesWaiting(jobQueue) : 0;
+  JobsLock lock;
+  uint8_t busyWorkers = 0;
+  for (bool b : workerBusy)
+    busyWorkers += b;
+  out["busyWorkers"] = busyWorkers;
+  out["workers"] = WORKERS;
+  for (auto &kv : kindStats) {
+    JsonObject o = out["kinds"][kv.first].to<JsonObject>();
+    o["runs"] = kv.second.runs;
+    o["failures"] = kv.second.failures;
+    o["avgMs"] = kv.second.runs ? kv.second.totalMs / kv.second.runs : 0;
+    o["maxMs"] = kv.second.maxMs;
+    o["avgWaitMs"] =
+        kv.second.runs ? kv.second.totalWaitMs / kv.second.runs : 0;
+  }
+}
+
+void sendJobAccepted(AsyncWebServerRequest *req, uint32_t id) {
+  if (!id) {
+    req->send(503, "application/json", "{\"error\":\"job queue full\"}");
+    return;
+  }
+  JsonDocument doc;
+  doc["jobId"] = id;
+  doc["href"] = "/api/jobs/" + String(id);
+  sendDoc(req, doc, 202);
+}
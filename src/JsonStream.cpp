@@ -0,0 +1,135 @@
+#include "JsonStream.h"
+#include "ApiCodec.h"
+#include <memory>
+
+struct HeapStat {
+  const char *route = nullptr;
+  uint32_t streamedPeak = 0;
+  uint32_t bufferedPeak = 0;
+  uint32_t streamedCount = 0;
+  uint32_t bufferedCount = 0;
+};
+static std::vector<HeapStat> heapStats;
+
+HeapProbe::HeapProbe(const char *r)
+    : route(r), baseFree(ESP.getFreeHeap()), minFree(baseFree) {}
+
+void HeapProbe::sample() {
+  uint32_t f = ESP.getFreeHeap();
+  if (f < minFree)
+    minFree = f;
+}
+
+void HeapProbe::record(bool streamed) {
+  sample();
+  uint32_t used = baseFree > minFree ? baseFree - minFree : 0;
+  HeapStat *s = nullptr;
+  for (auto &h : heapStats)
+    if (!strcmp(h.route, route))
+      s = &h;
+  if (!s) {
+    heapStats.push_back(HeapStat());
+    heapStats.back().route = route;
+    s = &heapStats.back();
+  }
+  if (streamed) {
+    s->streamedPeak = used;
+    s->streamedCount++;
+  } else {
+    s->bufferedPeak = used;
+    s->bufferedCount++;
+  }
+}
+
+struct PartStream {
+  PartStream(HeapProbe p) : probe(p) {}
+  ~PartStream() { probe.record(true); }
+
+  HeapProbe probe;
+  JsonPartSource parts;
+  String pending;
+  size_t pendingOff = 0;
+  bool done = false;
+};
+
+void sendJsonParts(AsyncWebServerRequest *req, HeapProbe probe,
+                   JsonPartSource parts) {
+  auto st = std::make_shared<PartStream>(probe);
+  st->parts = parts;
+  AsyncWebServerResponse *res = req->beginChunkedResponse(
+      "application/json",
+      [st](uint8_t *buf, size_t maxLen, size_t) -> size_t {
+        size_t n = 0;
+        while (n < maxLen) {
+          if (st->pendingOff < st->pending.length()) {
+            size_t k = std::min(maxLen - n,
+                                st->pending.length() - st->pendingOff);
+            memcpy(buf + n, st->pending.c_str() + st->pendingOff, k);
+            st->pendingOff += k;
+            n += k;
+            continue;
+          }
+          if (st->done)
+            break;
+          st->pending = "";
+          st->pendingOff = 0;
+          st->done = !st->parts(st->pending);
+          st->probe.sample();
+        }
+        return n;
+      });
+  req->send(res);
+}
+
+bool jsonStreamAbort(String &out) {
+  out = JSON_STREAM_ABORTED;
+  return false;
+}
+
+void sendJsonRows(AsyncWebServerRequest *req, HeapProbe probe,
+                  const String &head, const String &tail, JsonRowSource rows) {
+  size_t next = 0;
+  bool started = false, finished = false;
+  sendJsonParts(req, probe,
+                [=](String &part) mutable {
+                  if (finished)
+                    return false;
+                  if (!started) {
+                    started = true;
+                    part = head;
+                    return true;
+                  }
+                  String row;
+                  if (!rows(next, row)) {
+                    part = row.length() ? row : tail; // aborted: no tail
+                    finished = true;
+                    return true;
+                  }
+                  part = next++ ? "," : "";
+                  part += row;
+                  return true;
+                });
+}
+
+void sendJsonBuffered(AsyncWebServerRequest *req, HeapProbe &probe,
+                      JsonVariantConst doc) {
+  sendDoc(req, doc);
+  probe.record(false);
+}
+
+bool wantBuffered(AsyncWebServerRequest *req) {
+  if (responseCodec(req) != ApiCodec::Json)
+    return true;
+  return req->hasParam("buffered") && req->getParam("buffered")->value() == "1";
+}
+
+void heapStatsToJson(JsonArray out) {
+  for (auto &h : heapStats) {
+    JsonObject o = out.add<JsonObject>();
+    o["route"] = h.route;
+    o["streamedPeak"] = h.streamedPeak;
+    o["streamedCount"] = h.streamedCount;
+    o["bufferedPeak"] = h.bufferedPeak;
+    o["bufferedCount"] = h.bufferedCount;
+  }
+}
@@ -0,0 +1,312 @@
+#include "Log.h"
+#include "AppConfig.h"
+#include "LogStore.h"
+#include "WsBroadcast.h"
+
+static const size_t LINE_MAX = 224;
+static const uint32_t IDLE_MS = 20;    // logger poll interval when idle
+static const size_t WS_BATCH = 1024; // lines per /ws message, roughly
+
+volatile LogLevel logLevel = LogLevel::Info;
+
+static LogSlot slots[LOG_SLOTS];
+static std::atomic<uint32_t> enqPos(0);
+static uint32_t deqPos = 0; // logger task only
+static std::atomic<uint32_t> dropped(0);
+static uint32_t droppedReported = 0;
+static uint32_t linesOut = 0;
+
+// Ready before any constructor or setup() code can log.
+static bool slotsReady = []() {
+  for (size_t i = 0; i < LOG_SLOTS; i++)
+    slots[i].seq.store(i, std::memory_order_relaxed);
+  return true;
+}();
+
+static String backlog[LOG_BACKLOG];
+static size_t backlogNext = 0;
+static SemaphoreHandle_t backlogMutex = xSemaphoreCreateMutex();
+
+struct BacklogLock {
+  BacklogLock() { xSemaphoreTake(backlogMutex, portMAX_DELAY); }
+  ~BacklogLock() { xSemaphoreGive(backlogMutex); }
+};
+
+// Bounded MPMC queue (Vyukov): a slot whose seq equals the enqueue position
+// is free; the producer bumps seq to pos+1 once filled, and the consumer
+// hands it back as pos+LOG_SLOTS.
+LogSlot *logClaim() {
+  uint32_t pos = enqPos.load(std::memory_order_relaxed);
+  for (;;) {
+    LogSlot &s = slots[pos & (LOG_SLOTS - 1)];
+    uint32_t seq = s.seq.load(std::memory_order_acquire);
+    int32_t dif = (int32_t)(seq - pos);
+    if (dif == 0) {
+      if (enqPos.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed))
+        return &s;
+    } else if (dif < 0) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    } else {
+      pos = enqPos.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void logCommit(LogSlot *s) {
+  uint32_t seq = s->seq.load(std::memory_order_relaxed);
+  s->seq.store(seq + 1, std::memory_order_release);
+}
+
+const char *logLevelName(LogLevel level) {
+  switch (level) {
+  case LogLevel::Debug:
+    return "debug";
+  case LogLevel::Info:
+    return "info";
+  case LogLevel::Warn:
+    return "warn";
+  default:
+    return "error";
+  }
+}
+
+bool logLevelFromName(const String &name, LogLevel &out) {
+  for (uint8_t l = 0; l <= (uint8_t)LogLevel::Error; l++)
+    if (name == logLevelName((LogLevel)l)) {
+      out = (LogLevel)l;
+      return true;
+    }
+  return false;
+}
+
+void logSetLevel(LogLevel level) { logLevel = level; }
+
+// Formats one conversion into out; returns the bytes written.
+static size_t formatArg(char *out, size_t cap, const char *spec, char conv,
+                        const uint8_t *&a, const uint8_t *end) {
+  if (a >= end)
+    return snprintf(out, cap, "?");
+  uint8_t tag = *a++;
+  int64_t i = 0;
+  uint64_t u = 0;
+  double f = 0;
+  char str[LOG_ARG_BYTES];
+  switch (tag) {
+  case LOG_ARG_I32: {
+    int32_t v;
+    memcpy(&v, a, 4);
+    a += 4;
+    i = v;
+    u = (uint64_t)(int64_t)v;
+    f = v;
+    snprintf(str, sizeof(str), "%ld", (long)v);
+    break;
+  }
+  case LOG_ARG_U32:
+  case LOG_ARG_PTR: {
+    uint32_t v;
+    memcpy(&v, a, 4);
+    a += 4;
+    i = v;
+    u = v;
+    f = v;
+    snprintf(str, sizeof(str), "%lu", (unsigned long)v);
+    break;
+  }
+  case LOG_ARG_I64:
+    memcpy(&i, a, 8);
+    a += 8;
+    u = (uint64_t)i;
+    f = (double)i;
+    snprintf(str, sizeof(str), "%lld", (long long)i);
+    break;
+  case LOG_ARG_U64:
+    memcpy(&u, a, 8);
+    a += 8;
+    i = (int64_t)u;
+    f = (double)u;
+    snprintf(str, sizeof(str), "%llu", (unsigned long long)u);
+    break;
+  case LOG_ARG_F64:
+    memcpy(&f, a, 8);
+    a += 8;
+    i = (int64_t)f;
+    u = (uint64_t)i;
+    snprintf(str, sizeof(str), "%g", f);
+    break;
+  case LOG_ARG_IP4: {
+    uint32_t v;
+    memcpy(&v, a, 4);
+    a += 4;
+    snprintf(str, sizeof(str), "%s", IPAddress(v).toString().c_str());
+    break;
+  }
+  case LOG_ARG_STR: {
+    size_t n = *a++;
+    memcpy(str, a, n);
+    str[n] = 0;
+    a += n;
+    break;
+  }
+  default:
+    a = end; // corrupt; stop consuming
+    return snprintf(out, cap, "?");
+  }
+
+  char fmt[24];
+  switch (conv) {
+  case 'd':
+  case 'i':
+    snprintf(fmt, sizeof(fmt), "%slld", spec);
+    return snprintf(out, cap, fmt, (long long)i);
+  case 'u':
+  case 'x':
+  case 'X':
+  case 'o':
+    snprintf(fmt, sizeof(fmt), "%sll%c", spec, conv);
+    return snprintf(out, cap, fmt, (unsigned long long)u);
+  case 'c':
+    snprintf(fmt, sizeof(fmt), "%sc", spec);
+    return snprintf(out, cap, fmt, (int)i);
+  case 'f':
+  case 'e':
+  case 'g':
+    snprintf(fmt, sizeof(fmt), "%s%c", spec, conv);
+    return snprintf(out, cap, fmt, f);
+  case 'p':
+    return snprintf(out, cap, "0x%08llx", (unsigned long long)u);
+  default: // 's' and anything unknown print the argument as text
+    snprintf(fmt, sizeof(fmt), "%ss", spec);
+    return snprintf(out, cap, fmt, str);
+  }
+}
+
+static const char LEVEL_CHARS[] = {'D', 'I', 'W', 'E'};
+
+// Writes "<secs>.<ms> <L> " and returns its length.
+static size_t formatPrefix(uint32_t ms, LogLevel level, char *out,
+                           size_t cap) {
+  int n = snprintf(out, cap, "%lu.%03lu %c ", (unsigned long)(ms / 1000),
+                   (unsigned long)(ms % 1000), LEVEL_CHARS[(uint8_t)level & 3]);
+  return n > 0 ? (size_t)n : 0;
+}
+
+// Returns where "module: message" starts in `out`.
+static size_t formatSlot(const LogSlot &s, char *out, size_t cap) {
+  size_t textAt = formatPrefix(s.ms, s.level, out, cap);
+  int n = snprintf(out + textAt, cap - textAt, "%s: ", s.module);
+  size_t len = textAt + (n > 0 ? (size_t)n : 0);
+  const uint8_t *a = s.args, *end = s.args + s.argLen;
+
+  for (const char *f = s.fmt; *f && len + 1 < cap;) {
+    if (*f != '%') {
+      out[len++] = *f++;
+      continue;
+    }
+    f++;
+    if (*f == '%') {
+      out[len++] = *f++;
+      continue;
+    }
+    char spec[12] = "%";
+    size_t k = 1;
+    while (*f && strchr("-+ #0123456789.", *f)) {
+      if (k + 1 < sizeof(spec) - 4)
+        spec[k++] = *f;
+      f++;
+    }
+    spec[k] = 0;
+    while (*f && strchr("hlLjzt", *f))
+      f++;
+    if (!*f)
+      break;
+    char conv = *f++;
+    int w = formatArg(out + len, cap - len, spec, conv, a, end);
+    if (w > 0)
+      len += (size_t)w < cap - len ? (size_t)w : cap - len - 1;
+  }
+  out[len] = 0;
+  return textAt;
+}
+
+// Consumer side; only the logger task calls this.
+static bool logPop(char *line, size_t &textAt, uint32_t &ms, LogLevel &level) {
+  LogSlot &s = slots[deqPos & (LOG_SLOTS - 1)];
+  if (s.seq.load(std::memory_order_acquire) != deqPos + 1)
+    return false;
+  textAt = formatSlot(s, line, LINE_MAX);
+  ms = s.ms;
+  level = s.level;
+  s.seq.store(deqPos + LOG_SLOTS, std::memory_order_release);
+  deqPos++;
+  return true;
+}
+
+static void emit(const char *line, size_t textAt, uint32_t ms, LogLevel level,
+                 String &batch) {
+  Serial.println(line);
+  logStoreAppend(ms, level, line + textAt);
+  linesOut++;
+  {
+    BacklogLock lock;
+    backlog[backlogNext++ % LOG_BACKLOG] = line;
+  }
+  if (batch.length())
+    batch += '\n';
+  batch += line;
+}
+
+static void logTask(void *) {
+  char line[LINE_MAX];
+  size_t textAt;
+  uint32_t ms;
+  LogLevel level;
+  String batch;
+  for (;;) {
+    bool any = false;
+    while (batch.length() < WS_BATCH && logPop(line, textAt, ms, level)) {
+      emit(line, textAt, ms, level, batch);
+      any = true;
+    }
+    uint32_t d = dropped.load(std::memory_order_relaxed);
+    if (d != droppedReported) {
+      ms = millis();
+      textAt = formatPrefix(ms, LogLevel::Warn, line, sizeof(line));
+      snprintf(line + textAt, sizeof(line) - textAt, "log: %lu lines dropped",
+               (unsigned long)(d - droppedReported));
+      droppedReported = d;
+      emit(line, textAt, ms, LogLevel::Warn, batch);
+    }
+    if (batch.length()) {
+      wsTextAll(wsLog, batch);
+      batch = "";
+    }
+    if (!any)
+      vTaskDelay(pdMS_TO_TICKS(IDLE_MS));
+  }
+}
+
+void setupLog() {
+  (void)slotsReady;
+  xTaskCreate(logTask, "log", 4096, nullptr, 1, nullptr);
+}
+
+String logBacklog() {
+  BacklogLock lock;
+  String out;
+  size_t n = backlogNext < LOG_BACKLOG ? backlogNext : LOG_BACKLOG;
+  for (size_t k = backlogNext - n; k < backlogNext; k++) {
+    if (out.length())
+      out += '\n';
+    out += backlog[k % LOG_BACKLOG];
+  }
+  return out;
+}
+
+void logStatsToJson(JsonObject out) {
+  out["level"] = logLevelName(logLevel);
+  out["dropped"] = dropped.load(std::memory_order_relaxed);
+  out["lines"] = linesOut;
+}
@@ -0,0 +1,284 @@
+#include "LogStore.h"
+#include "JsonStream.h"
+#include <LittleFS.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+static const char *LOG_DIR = "/logs";
+static const uint8_t SEG_MAGIC[4] = {'A', 'L', 'G', '1'};
+static const size_t REC_HDR = 12;
+static const size_t SEG_MAX = 16 * 1024;
+static const size_t MAX_SEGS = 4;
+static const size_t STAGE_MAX = 4 * 1024;
+static const uint32_t FLUSH_MS = 10000;
+
+// Records waiting for the next flush; seq and boot are filled in then.
+static std::vector<uint8_t> stage;
+static std::vector<uint8_t> flushing;
+static SemaphoreHandle_t stageMutex = xSemaphoreCreateMutex();
+static SemaphoreHandle_t storeMutex = xSemaphoreCreateMutex();
+static TaskHandle_t storeTask = nullptr;
+
+static std::vector<uint32_t> segs; // first seq of each segment, ascending
+static uint32_t curSegBytes = 0;
+static uint32_t nextSeq = 1;
+static uint16_t bootNo = 0;
+static uint8_t readers = 0; // open /api/logs streams; pruning waits for them
+static uint32_t stageDropped = 0;
+static uint32_t flushes = 0;
+static uint32_t bytesWritten = 0;
+static uint32_t writeErrors = 0;
+static bool suspended = false; // under storeMutex
+
+struct StageLock {
+  StageLock() { xSemaphoreTake(stageMutex, portMAX_DELAY); }
+  ~StageLock() { xSemaphoreGive(stageMutex); }
+};
+
+struct StoreLock {
+  StoreLock() { xSemaphoreTake(storeMutex, portMAX_DELAY); }
+  ~StoreLock() { xSemaphoreGive(storeMutex); }
+};
+
+static String segPath(uint32_t first) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "/logs/%08lx.bin", (unsigned long)first);
+  return buf;
+}
+
+void logStoreAppend(uint32_t ms, LogLevel level, const char *text) {
+  size_t len = strlen(text);
+  if (len > 255)
+    len = 255;
+  bool wake;
+  {
+    StageLock lock;
+    if (stage.capacity() < STAGE_MAX)
+      stage.reserve(STAGE_MAX);
+    if (stage.size() + REC_HDR + len > STAGE_MAX) {
+      stageDropped++;
+      return;
+    }
+    size_t at = stage.size();
+    stage.resize(at + REC_HDR + len);
+    uint8_t *p = &stage[at];
+    memset(p, 0, 6);
+    memcpy(p + 6, &ms, 4);
+    p[10] = (uint8_t)level;
+    p[11] = (uint8_t)len;
+    memcpy(p + REC_HDR, text, len);
+    wake = stage.size() >= STAGE_MAX / 2;
+  }
+  if (wake && storeTask)
+    xTaskNotifyGive(storeTask);
+}
+
+// Caller holds storeMutex.
+static void pruneLocked() {
+  while (segs.size() > MAX_SEGS && !readers) {
+    LittleFS.remove(segPath(segs.front()));
+    segs.erase(segs.begin());
+  }
+}
+
+void logStoreFlush() {
+  StoreLock lock;
+  if (suspended)
+    return;
+  {
+    StageLock stageLock;
+    if (stage.empty())
+      return;
+    stage.swap(flushing);
+  }
+  uint32_t first = nextSeq;
+  for (size_t off = 0; off + REC_HDR <= flushing.size();
+       off += REC_HDR + flushing[off + 11]) {
+    uint32_t seq = nextSeq++;
+    memcpy(&flushing[off], &seq, 4);
+    memcpy(&flushing[off + 4], &bootNo, 2);
+  }
+
+  bool fresh = segs.empty() || curSegBytes + flushing.size() > SEG_MAX;
+  if (fresh) {
+    segs.push_back(first);
+    curSegBytes = 0;
+  }
+  File f = LittleFS.open(segPath(segs.back()), fresh ? "w" : "a");
+  size_t want = flushing.size() + (fresh ? sizeof(SEG_MAGIC) : 0);
+  size_t wrote = 0;
+  if (f) {
+    if (fresh)
+      wrote += f.write(SEG_MAGIC, sizeof(SEG_MAGIC));
+    wrote += f.write(flushing.data(), flushing.size());
+    f.close();
+  }
+  if (wrote != want)
+    writeErrors++;
+  curSegBytes += wrote;
+  bytesWritten += wrote;
+  flushes++;
+  flushing.clear();
+  pruneLocked();
+}
+
+void logStoreSuspend() {
+  StoreLock lock; // waits for a flush in progress
+  suspended = true;
+}
+
+void logStoreResume() {
+  StoreLock lock;
+  suspended = false;
+}
+
+static void logStoreTask(void *) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(FLUSH_MS));
+    logStoreFlush();
+  }
+}
+
+// Finds where the last segment ends, so numbering continues after reboot.
+// False if it can't be read (no magic, e.g. a power cut while it was
+// created).
+static bool resumeLastSegment() {
+  File f = LittleFS.open(segPath(segs.back()), "r");
+  if (!f)
+    return false;
+  curSegBytes = f.size();
+  nextSeq = segs.back();
+  uint8_t magic[4];
+  if (f.read(magic, 4) != 4 || memcmp(magic, SEG_MAGIC, 4) != 0) {
+    f.close();
+    return false;
+  }
+  uint8_t h[REC_HDR];
+  while (f.read(h, REC_HDR) == REC_HDR) {
+    uint32_t seq;
+    memcpy(&seq, h, 4);
+    nextSeq = seq + 1;
+    if (!f.seek(h[11], SeekCur))
+      break;
+  }
+  f.close();
+  return true;
+}
+
+void setupLogStore() {
+  LittleFS.mkdir(LOG_DIR);
+  bootNo = prefs.getUShort("log_boot", 0) + 1;
+  prefs.putUShort("log_boot", bootNo);
+
+  File dir = LittleFS.open(LOG_DIR);
+  for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+    String name = f.name();
+    name = name.substring(name.lastIndexOf('/') + 1);
+    if (name.endsWith(".bin"))
+      segs.push_back(strtoul(name.c_str(), nullptr, 16));
+    f.close();
+  }
+  std::sort(segs.begin(), segs.end());
+  // An unreadable last segment is dropped rather than reused: a new one
+  // named after nextSeq would otherwise truncate it and be listed twice.
+  while (!segs.empty() && !resumeLastSegment()) {
+    logWarn("logstore", "dropping unreadable segment %s",
+            segPath(segs.back()));
+    LittleFS.remove(segPath(segs.back()));
+    segs.pop_back();
+    curSegBytes = 0;
+  }
+  {
+    StoreLock lock;
+    pruneLocked();
+  }
+  xTaskCreate(logStoreTask, "logStore", 4096, nullptr, 1, &storeTask);
+}
+
+void logStoreStatsToJson(JsonObject out) {
+  StoreLock lock;
+  out["boot"] = bootNo;
+  out["nextSeq"] = nextSeq;
+  out["segments"] = segs.size();
+  out["firstSeq"] = segs.empty() ? 0 : segs.front();
+  out["flushes"] = flushes;
+  out["bytesWritten"] = bytesWritten;
+  out["writeErrors"] = writeErrors;
+  out["stageDropped"] = stageDropped;
+}
+
+// One /api/logs stream. Holding `readers` keeps its segments from being
+// pruned until the response is gone.
+struct LogReader {
+  explicit LogReader(uint32_t since) : since(since) {
+    StoreLock lock;
+    readers++;
+    list = segs;
+    // Skip segments that end before `since`.
+    while (idx + 1 < list.size() && list[idx + 1] <= since + 1)
+      idx++;
+  }
+  ~LogReader() {
+    if (f)
+      f.close();
+    StoreLock lock;
+    readers--;
+  }
+
+  bool next(String &row) {
+    for (;;) {
+      if (!f && !open())
+        return false;
+      uint8_t h[REC_HDR];
+      char text[256];
+      if (f.read(h, REC_HDR) != REC_HDR ||
+          f.read((uint8_t *)text, h[11]) != h[11]) {
+        f.close();
+        f = File();
+        continue;
+      }
+      uint32_t seq, ms;
+      uint16_t boot;
+      memcpy(&seq, h, 4);
+      memcpy(&boot, h + 4, 2);
+      memcpy(&ms, h + 6, 4);
+      if (seq <= since)
+        continue;
+      text[h[11]] = 0;
+      JsonDocument d;
+      d["seq"] = seq;
+      d["boot"] = boot;
+      d["ms"] = ms;
+      d["level"] = logLevelName((LogLevel)(h[10] & 3));
+      d["msg"] = (const char *)text;
+      row = "";
+      serializeJson(d, row);
+      return true;
+    }
+  }
+
+  bool open() {
+    while (idx < list.size()) {
+      f = LittleFS.open(segPath(list[idx++]), "r");
+      uint8_t magic[4];
+      if (f && f.read(magic, 4) == 4 && memcmp(magic, SEG_MAGIC, 4) == 0)
+        return true;
+      if (f)
+        f.close();
+      f = File();
+    }
+    return false;
+  }
+
+  uint32_t since;
+  std::vector<uint32_t> list;
+  size_t idx = 0;
+  File f;
+};
+
+void sendStoredLogs(AsyncWebServerRequest *req, uint32_t since) {
+  std::shared_ptr<LogReader> r = std::make_shared<LogReader>(since);
+  sendJsonRows(req, HeapProbe("/api/logs"), "{\"logs\":[", "]}",
+               [r](size_t, String &row) { return r->next(row); });
+}
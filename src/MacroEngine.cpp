@@ -0,0 +1,340 @@
+#include "MacroEngine.h"
+#include "ConfigManager.h"
+#include "TcpTransport.h"
+#include "Utils.h"
+#include <WiFi.h>
+
+static const size_t MAX_RUNS = 4;        // finished runs kept for status
+static const size_t MAX_RX_BUF = 2048;   // device output awaiting a match
+static const uint32_t MAX_EXEC = 200;    // step executions, guards loops
+static const uint32_t CONNECT_MS = 3000;
+static const uint32_t RELEASE_MS = 5000; // async_tcp polls every ~0.5 s
+
+static MacroRun runs[MAX_RUNS];
+static uint32_t nextRunId = 1;
+static uint8_t activeRuns = 0;
+static SemaphoreHandle_t runsMutex = xSemaphoreCreateMutex();
+
+struct MacroJob {
+  uint32_t runId;
+  IPAddress ip;
+  uint16_t port;
+  std::vector<MacroStep> steps;
+
+  // Filled from the transport's callbacks, consumed by the runner task.
+  SemaphoreHandle_t rxMutex = xSemaphoreCreateMutex();
+  SemaphoreHandle_t signal = xSemaphoreCreateBinary();
+  String rx;
+  bool connected = false;
+  bool closed = false;
+  bool linkDone = false; // under runsMutex: onClose has finished with the job
+};
+
+static MacroRun *runSlot(uint32_t id) {
+  MacroRun &r = runs[id % MAX_RUNS];
+  return r.id == id ? &r : nullptr;
+}
+
+static void runUpdate(uint32_t id, const MacroStepResult *step,
+                      const char *state = nullptr, const String &err = "") {
+  xSemaphoreTake(runsMutex, portMAX_DELAY);
+  if (MacroRun *r = runSlot(id)) {
+    if (step)
+      r->steps.push_back(*step);
+    if (state) {
+      r->state = state;
+      r->error = err;
+      r->totalMs = millis() - r->startedMs;
+    }
+  }
+  xSemaphoreGive(runsMutex);
+}
+
+static bool parseSteps(JsonArrayConst arr, const String &defSuffix,
+                       std::vector<MacroStep> &out, String &err) {
+  for (JsonObjectConst o : arr) {
+    MacroStep st;
+    st.op = o["op"] | "";
+    st.label = o["label"] | "";
+    if (st.op == "send") {
+      String type = o["payloadType"] | "ascii";
+      String payload = o["payload"] | "";
+      if (type == "hex") {
+        if (!parseHexBytes(payload, st.data)) {
+          err = "bad hex in step " + String(out.size());
+          return false;
+        }
+      } else {
+        String s = payload + expandSuffix(o["suffix"] | defSuffix.c_str());
+        st.data.assign((const uint8_t *)s.c_str(),
+                       (const uint8_t *)s.c_str() + s.length());
+      }
+    } else if (st.op == "expect") {
+      st.match = o["match"] | "";
+      st.regex = o["regex"] | false;
+      st.timeoutMs = o["timeoutMs"] | 3000;
+      st.abortOnTimeout = String(o["onTimeout"] | "abort") != "continue";
+    } else if (st.op == "delay") {
+      st.ms = o["ms"] | 0;
+    } else if (st.op == "branch") {
+      st.ifMatched = String(o["if"] | "matched") != "timeout";
+      st.target = o["goto"] | "";
+    } else {
+      err = "unknown op '" + st.op + "' in step " + String(out.size());
+      return false;
+    }
+    out.push_back(st);
+  }
+  for (auto &st : out) {
+    if (st.op != "branch")
+      continue;
+    bool found = false;
+    for (auto &t : out)
+      found |= (t.label == st.target);
+    if (!found) {
+      err = "branch to unknown label '" + st.target + "'";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Waits for the pattern in the buffered output; consumes through the match.
+static bool waitExpect(MacroJob *job, const MacroStep &st, String &detail) {
+  uint32_t t0 = millis();
+  for (;;) {
+    xSemaphoreTake(job->rxMutex, portMAX_DELAY);
+    size_t end = 0;
+    bool hit;
+    if (st.regex) {
+      hit = regexSearch(st.match.c_str(), job->rx.c_str(), end);
+    } else {
+      int i = job->rx.indexOf(st.match);
+      hit = i >= 0;
+      end = hit ? i + st.match.length() : 0;
+    }
+    if (hit) {
+      detail = job->rx.substring(0, end);
+      job->rx.remove(0, end);
+    }
+    bool closed = job->closed;
+    xSemaphoreGive(job->rxMutex);
+
+    if (hit)
+      return true;
+    uint32_t waited = millis() - t0;
+    if (closed || waited >= st.timeoutMs) {
+      detail = closed ? "connection closed" : "timeout";
+      return false;
+    }
+    xSemaphoreTake(job->signal, pdMS_TO_TICKS(st.timeoutMs - waited));
+  }
+}
+
+static void macroTask(void *arg) {
+  MacroJob *job = static_cast<MacroJob *>(arg);
+
+  TcpTransport *link = new TcpTransport();
+  link->onConnect([job](bool ok) {
+    job->connected = ok;
+    xSemaphoreGive(job->signal);
+  });
+  link->onData([job](const uint8_t *data, size_t len) {
+    xSemaphoreTake(job->rxMutex, portMAX_DELAY);
+    job->rx.concat((const char *)data, len);
+    if (job->rx.length() > MAX_RX_BUF)
+      job->rx.remove(0, job->rx.length() - MAX_RX_BUF);
+    xSemaphoreGive(job->rxMutex);
+    xSemaphoreGive(job->signal);
+  });
+  link->onClose([job]() {
+    xSemaphoreTake(job->rxMutex, portMAX_DELAY);
+    job->closed = true;
+    xSemaphoreGive(job->rxMutex);
+    xSemaphoreGive(job->signal);
+    // Last touch of the job; runsMutex outlives it.
+    xSemaphoreTake(runsMutex, portMAX_DELAY);
+    job->linkDone = true;
+    xSemaphoreGive(runsMutex);
+  });
+
+  String err;
+  // A false return means no socket was created, so no callback will come.
+  bool started = link->connect(job->ip, job->port);
+  if (!started ||
+      xSemaphoreTake(job->signal, pdMS_TO_TICKS(CONNECT_MS)) != pdTRUE ||
+      !job->connected) {
+    err = "connect failed";
+  }
+
+  bool lastMatched = false;
+  uint32_t executed = 0;
+  for (size_t pc = 0; err.isEmpty() && pc < job->steps.size();) {
+    if (++executed > MAX_EXEC) {
+      err = "step limit reached";
+      break;
+    }
+    const MacroStep &st = job->steps[pc];
+    MacroStepResult res{(uint16_t)pc, st.op, 0, true, ""};
+    uint32_t t0 = millis();
+    size_t next = pc + 1;
+
+    if (st.op == "send") {
+      if (!link->connected() ||
+          link->write(st.data.data(), st.data.size()) != st.data.size()) {
+        res.ok = false;
+        err = "send failed";
+      }
+    } else if (st.op == "expect") {
+      res.ok = lastMatched = waitExpect(job, st, res.detail);
+      if (!res.ok && st.abortOnTimeout)
+        err = "expect '" + st.match + "' failed: " + res.detail;
+    } else if (st.op == "delay") {
+      vTaskDelay(pdMS_TO_TICKS(st.ms));
+    } else if (st.op == "branch") {
+      if (lastMatched == st.ifMatched) {
+        for (size_t i = 0; i < job->steps.size(); i++)
+          if (job->steps[i].label == st.target)
+            next = i;
+        res.detail = "-> " + st.target;
+      }
+    }
+
+    res.ms = millis() - t0;
+    runUpdate(job->runId, &res);
+    pc = next;
+  }
+
+  runUpdate(job->runId, nullptr, err.isEmpty() ? "done" : "failed", err);
+  if (err.isEmpty())
+    logInfo("macro", "run %u done", job->runId);
+  else
+    logWarn("macro", "run %u failed: %s", job->runId, err);
+
+  // The link's callbacks run on async_tcp and reference the job, so the
+  // socket is closed from there and the job is freed only after onClose.
+  bool done = !started;
+  if (started) {
+    link->closeFromPoll();
+    for (uint32_t t0 = millis(); !done && millis() - t0 < RELEASE_MS;) {
+      vTaskDelay(pdMS_TO_TICKS(20));
+      xSemaphoreTake(runsMutex, portMAX_DELAY);
+      done = job->linkDone;
+      xSemaphoreGive(runsMutex);
+    }
+  }
+  if (done) {
+    delete link;
+    vSemaphoreDelete(job->rxMutex);
+    vSemaphoreDelete(job->signal);
+    delete job;
+  } else {
+    // Never seen; leaking beats freeing under a live callback.
+    logError("macro", "run %u: link did not close, leaking it", job->runId);
+  }
+  xSemaphoreTake(runsMutex, portMAX_DELAY);
+  activeRuns--;
+  xSemaphoreGive(runsMutex);
+  vTaskDelete(nullptr);
+}
+
+uint32_t macroStart(const String &deviceId, const String &macroName,
+                    String &err) {
+  MacroJob *job = new MacroJob();
+  auto fail = [job, &err](const String &e) {
+    err = e;
+    vSemaphoreDelete(job->rxMutex);
+    vSemaphoreDelete(job->signal);
+    delete job;
+    return 0;
+  };
+
+  String ip, defSuffix;
+  {
+    CfgLock lock;
+    int di = cfg.deviceIndex(findId(deviceId));
+    if (di < 0)
+      return fail("device not found");
+    const DeviceCfg &dev = cfg.devices[di];
+    int ti = cfg.templateIndex(dev.templateId);
+    if (ti < 0)
+      return fail("device has no template");
+    const TemplateCfg &tpl = cfg.templates[ti];
+
+    // Only the one template is parsed, not the whole config.
+    JsonDocument doc;
+    deserializeJson(doc, tpl.json);
+    JsonObjectConst macro;
+    for (JsonObjectConst m : doc["macros"].as<JsonArrayConst>())
+      if (macroName == (m["name"] | ""))
+        macro = m;
+    if (macro.isNull())
+      return fail("macro not found in template '" + idStr(tpl.id) + "'");
+
+    ip = dev.ip;
+    job->port = dev.portHint ? dev.portHint : tpl.defaultPort;
+    defSuffix = dev.defaultSuffix.length() ? dev.defaultSuffix
+                                           : tpl.defaultSuffix;
+    if (!parseSteps(macro["steps"].as<JsonArrayConst>(), defSuffix,
+                    job->steps, err))
+      return fail(err);
+  }
+  if (!job->ip.fromString(ip))
+    return fail("bad device ip");
+
+  xSemaphoreTake(runsMutex, portMAX_DELAY);
+  if (activeRuns >= 2) {
+    xSemaphoreGive(runsMutex);
+    return fail("too many macros running");
+  }
+  activeRuns++;
+  job->runId = nextRunId++;
+  MacroRun &r = runs[job->runId % MAX_RUNS];
+  r = MacroRun();
+  r.id = job->runId;
+  r.deviceId = deviceId;
+  r.macro = macroName;
+  r.state = "running";
+  r.startedMs = millis();
+  xSemaphoreGive(runsMutex);
+
+  uint32_t id = job->runId;
+  if (xTaskCreate(macroTask, "macro", 6144, job, 2, nullptr) != pdPASS) {
+    xSemaphoreTake(runsMutex, portMAX_DELAY);
+    activeRuns--;
+    if (MacroRun *r = runSlot(id)) {
+      r->state = "failed";
+      r->error = "out of memory";
+    }
+    xSemaphoreGive(runsMutex);
+    return fail("out of memory for the macro task");
+  }
+  return id;
+}
+
+bool macroRunToJson(uint32_t id, JsonObject out) {
+  xSemaphoreTake(runsMutex, portMAX_DELAY);
+  MacroRun *r = runSlot(id);
+  if (r) {
+    out["id"] = r->id;
+    out["deviceId"] = r->deviceId;
+    out["macro"] = r->macro;
+    out["state"] = r->state;
+    if (r->error.length())
+      out["error"] = r->error;
+    out["totalMs"] =
+        r->state == "running" ? millis() - r->startedMs : r->totalMs;
+    JsonArray steps = out["steps"].to<JsonArray>();
+    for (auto &s : r->steps) {
+      JsonObject o = steps.add<JsonObject>();
+      o["i"] = s.index;
+      o["op"] = s.op;
+      o["ms"] = s.ms;
+      o["ok"] = s.ok;
+      if (s.detail.length())
+        o["detail"] = s.detail;
+    }
+  }
+  xSemaphoreGive(runsMutex);
+  return r != nullptr;
+}
@@ -0,0 +1,354 @@
+#include "Metrics.h"
+#include "AVDiscovery.h"
+#include "BootTiming.h"
+#include "CaptureProxy.h"
+#include "JobQueue.h"
+#include "LogStore.h"
+#include "SerialBridge.h"
+#include "Trace.h"
+#include "WsBroadcast.h"
+#include <ArduinoJson.h>
+#include <deque>
+
+// Upper bounds in milliseconds; the last bucket is +Inf.
+static const uint32_t BUCKETS_MS[] = {5, 10, 25, 50, 100, 250, 500, 1000, 2500,
+                                      5000};
+static const size_t BUCKETS = sizeof(BUCKETS_MS) / sizeof(BUCKETS_MS[0]);
+static const size_t MAX_ROUTES = 48; // beyond this, routes count as "other"
+
+// Tasks whose stack high-water mark is exported. The terminal has no task
+// of its own; its output is flushed from the esp_timer task.
+static const char *TASKS[] = {"loopTask", "async_tcp", "esp_timer", "devMon",
+                              "discTask", "job0",      "job1",      "macro",
+                              "cfgCompact"};
+
+struct RouteStats {
+  String route;
+  const char *method;
+  uint32_t count = 0;
+  uint64_t sumUs = 0;
+  uint32_t buckets[BUCKETS + 1] = {};
+};
+
+// Only touched from the async_tcp task (handler matching, request
+// disconnects and the /metrics handler itself), so no lock. A deque keeps
+// entries in place, so route names can double as trace span names.
+static std::deque<RouteStats> routes;
+
+static const char *methodName(WebRequestMethodComposite m) {
+  switch (m) {
+  case HTTP_GET:
+    return "GET";
+  case HTTP_POST:
+    return "POST";
+  case HTTP_PUT:
+    return "PUT";
+  case HTTP_DELETE:
+    return "DELETE";
+  case HTTP_HEAD:
+    return "HEAD";
+  case HTTP_OPTIONS:
+    return "OPTIONS";
+  default:
+    return "OTHER";
+  }
+}
+
+// Keeps the label set bounded: ids in paths are folded and static files
+// share one series.
+static String routeLabel(const String &url) {
+  if (url.startsWith("/api/jobs/"))
+    return "/api/jobs/:id";
+  if (!url.startsWith("/api/") && url != "/update" && url != "/metrics")
+    return "static";
+  String out = url;
+  for (size_t i = 0; i < out.length(); i++) {
+    char c = out[i];
+    if (c == '"' || c == '\\' || c < 32)
+      out.setCharAt(i, '_');
+  }
+  return out;
+}
+
+static RouteStats &routeFor(const String &route, const char *method) {
+  for (auto &r : routes)
+    if (r.method == method && r.route == route)
+      return r;
+  if (routes.size() >= MAX_ROUTES) {
+    for (auto &r : routes)
+      if (r.method == method && r.route == "other")
+        return r;
+  }
+  RouteStats r;
+  r.route = routes.size() >= MAX_ROUTES ? String("other") : route;
+  r.method = method;
+  routes.push_back(r);
+  return routes.back();
+}
+
+static void recordRequest(RouteStats &r, uint32_t us) {
+  r.count++;
+  r.sumUs += us;
+  size_t b = 0;
+  while (b < BUCKETS && us > BUCKETS_MS[b] * 1000)
+    b++;
+  r.buckets[b]++;
+}
+
+// Never handles anything; it's added first so it sees every request and
+// hooks its disconnect.
+class RouteTimer : public AsyncWebHandler {
+public:
+  bool canHandle(AsyncWebServerRequest *req) override {
+    if (req->hasHeader("Upgrade"))
+      return false;
+    RouteStats *r =
+        &routeFor(routeLabel(req->url()), methodName(req->method()));
+    uint32_t startUs = micros();
+    bool traced = traceOn;
+    TraceMark mark;
+    if (traced)
+      mark = traceNow();
+    req->onDisconnect([r, startUs, traced, mark]() {
+      recordRequest(*r, micros() - startUs);
+      bootEvent(BootEvent::FirstHttp);
+      if (traced)
+        traceSpan(r->route.c_str(), mark);
+    });
+    return false;
+  }
+};
+
+static void family(Print &o, const char *name, const char *type,
+                   const char *help) {
+  o.printf("# HELP avtool_%s %s\n# TYPE avtool_%s %s\n", name, help, name,
+           type);
+}
+
+static void writeHeap(Print &o) {
+  uint32_t freeHeap = ESP.getFreeHeap();
+  uint32_t largest = ESP.getMaxAllocHeap();
+  family(o, "heap_free_bytes", "gauge", "Free heap.");
+  o.printf("avtool_heap_free_bytes %u\n", freeHeap);
+  family(o, "heap_min_free_bytes", "gauge", "Lowest free heap since boot.");
+  o.printf("avtool_heap_min_free_bytes %u\n", ESP.getMinFreeHeap());
+  family(o, "heap_largest_free_block_bytes", "gauge",
+         "Largest block that can be allocated.");
+  o.printf("avtool_heap_largest_free_block_bytes %u\n", largest);
+  family(o, "heap_fragmentation_ratio", "gauge",
+         "1 - largest free block / free heap.");
+  o.printf("avtool_heap_fragmentation_ratio %.3f\n",
+           freeHeap ? 1.0f - (float)largest / freeHeap : 0.0f);
+  family(o, "uptime_seconds", "counter", "Seconds since boot.");
+  o.printf("avtool_uptime_seconds %u\n", (millis() - bootMs) / 1000);
+}
+
+static void writeTasks(Print &o) {
+  family(o, "task_stack_free_min_bytes", "gauge",
+         "Stack high-water mark: least free stack the task has had.");
+  for (const char *name : TASKS) {
+    TaskHandle_t h = xTaskGetHandle(name);
+    if (h)
+      o.printf("avtool_task_stack_free_min_bytes{task=\"%s\"} %u\n", name,
+               (unsigned)uxTaskGetStackHighWaterMark(h));
+  }
+  family(o, "tasks", "gauge", "FreeRTOS tasks.");
+  o.printf("avtool_tasks %u\n", (unsigned)uxTaskGetNumberOfTasks());
+}
+
+static void writeRoutes(Print &o) {
+  family(o, "http_requests_total", "counter", "HTTP requests by route.");
+  for (auto &r : routes)
+    o.printf("avtool_http_requests_total{route=\"%s\",method=\"%s\"} %u\n",
+             r.route.c_str(), r.method, r.count);
+
+  family(o, "http_request_duration_seconds", "histogram",
+         "Headers received to connection closed.");
+  for (auto &r : routes) {
+    uint32_t cum = 0;
+    for (size_t b = 0; b <= BUCKETS; b++) {
+      cum += r.buckets[b];
+      if (b < BUCKETS)
+        o.printf("avtool_http_request_duration_seconds_bucket{route=\"%s\","
+                 "method=\"%s\",le=\"%.3f\"} %u\n",
+                 r.route.c_str(), r.method, BUCKETS_MS[b] / 1000.0f, cum);
+      else
+        o.printf("avtool_http_request_duration_seconds_bucket{route=\"%s\","
+                 "method=\"%s\",le=\"+Inf\"} %u\n",
+                 r.route.c_str(), r.method, cum);
+    }
+    o.printf("avtool_http_request_duration_seconds_sum{route=\"%s\","
+             "method=\"%s\"} %.6f\n",
+             r.route.c_str(), r.method, r.sumUs / 1e6);
+    o.printf("avtool_http_request_duration_seconds_count{route=\"%s\","
+             "method=\"%s\"} %u\n",
+             r.route.c_str(), r.method, r.count);
+  }
+}
+
+static void writeSubsystems(Print &o) {
+  size_t capsNow;
+  {
+    CapsLock lock;
+    capsNow = 0;
+    for (const Capture &c : caps)
+      capsNow += !c.deleted;
+  }
+  family(o, "learn_packets_total", "counter",
+         "Packets seen by the learner and proxy capture.");
+  o.printf("avtool_learn_packets_total %u\n", capsReceived);
+  family(o, "learn_bytes_total", "counter", "Payload bytes captured.");
+  o.printf("avtool_learn_bytes_total %u\n", capsBytes);
+  family(o, "learn_repeats_total", "counter",
+         "Packets folded into the previous capture as a repeat.");
+  o.printf("avtool_learn_repeats_total %u\n", capsRepeats);
+  family(o, "learn_evicted_total", "counter",
+         "Captures dropped from the ring.");
+  o.printf("avtool_learn_evicted_total %u\n", capsEvicted);
+  family(o, "learn_captures", "gauge", "Captures held.");
+  o.printf("avtool_learn_captures %u\n", (unsigned)capsNow);
+
+  family(o, "proxy_running", "gauge", "1 while the capture proxy is up.");
+  o.printf("avtool_proxy_running %d\n", proxyRunning ? 1 : 0);
+  family(o, "proxy_connections_total", "counter",
+         "Client connections accepted by the TCP proxy.");
+  o.printf("avtool_proxy_connections_total %u\n", proxyConnections);
+  family(o, "proxy_bytes_total", "counter", "Bytes forwarded by the proxy.");
+  o.printf("avtool_proxy_bytes_total{dir=\"to_target\"} %u\n",
+           proxyBytesToTarget);
+  o.printf("avtool_proxy_bytes_total{dir=\"to_client\"} %u\n",
+           proxyBytesToClient);
+  family(o, "proxy_udp_peers_refused_total", "counter",
+         "UDP client peers refused by a full peer table.");
+  o.printf("avtool_proxy_udp_peers_refused_total %u\n", proxyUdpPeersRefused);
+
+  size_t found;
+  {
+    DiscLock lock;
+    found = discFound.size();
+  }
+  family(o, "disc_running", "gauge", "1 while a subnet scan runs.");
+  o.printf("avtool_disc_running %d\n", discRunning ? 1 : 0);
+  family(o, "disc_scans_total", "counter", "Subnet scans started.");
+  o.printf("avtool_disc_scans_total %u\n", discScans);
+  family(o, "disc_hosts_found", "gauge", "Hosts found by the last scan.");
+  o.printf("avtool_disc_hosts_found %u\n", (unsigned)found);
+  family(o, "tcp_probes_total", "counter",
+         "TCP connect probes (discovery and device monitor).");
+  o.printf("avtool_tcp_probes_total{result=\"open\"} %u\n", tcpProbesOpen);
+  o.printf("avtool_tcp_probes_total{result=\"closed\"} %u\n",
+           tcpProbes - tcpProbesOpen);
+
+  family(o, "bridge_bytes_total", "counter",
+         "Bytes through the TCP-UART bridge.");
+  o.printf("avtool_bridge_bytes_total{dir=\"to_uart\"} %u\n",
+           bridgeBytesToUart);
+  o.printf("avtool_bridge_bytes_total{dir=\"from_uart\"} %u\n",
+           bridgeBytesFromUart);
+}
+
+static void writeWs(Print &o) {
+  JsonDocument doc;
+  JsonArray chans = doc.to<JsonArray>();
+  wsStatsToJson(chans);
+  family(o, "ws_clients", "gauge", "Connected WebSocket clients.");
+  for (JsonObject c : chans)
+    o.printf("avtool_ws_clients{path=\"%s\"} %u\n", (const char *)c["path"],
+             (unsigned)c["clients"].size());
+  family(o, "ws_queue_depth", "gauge",
+         "Messages queued for WebSocket clients, summed per channel.");
+  for (JsonObject c : chans) {
+    uint32_t depth = 0;
+    for (JsonObject cl : c["clients"].as<JsonArray>())
+      depth += cl["depth"].as<uint32_t>();
+    o.printf("avtool_ws_queue_depth{path=\"%s\"} %u\n",
+             (const char *)c["path"], depth);
+  }
+  family(o, "ws_sent_bytes_total", "counter", "Bytes sent per channel.");
+  for (JsonObject c : chans)
+    o.printf("avtool_ws_sent_bytes_total{path=\"%s\"} %llu\n",
+             (const char *)c["path"],
+             (unsigned long long)c["bytesSent"].as<uint64_t>());
+  family(o, "ws_dropped_total", "counter",
+         "Messages dropped by the channel's send policy.");
+  for (JsonObject c : chans)
+    o.printf("avtool_ws_dropped_total{path=\"%s\"} %u\n",
+             (const char *)c["path"], c["drops"].as<uint32_t>());
+  family(o, "ws_coalesced_total", "counter",
+         "Messages replaced by a newer one before being sent.");
+  for (JsonObject c : chans)
+    o.printf("avtool_ws_coalesced_total{path=\"%s\"} %u\n",
+             (const char *)c["path"], c["coalesced"].as<uint32_t>());
+  family(o, "ws_kicked_total", "counter",
+         "Clients disconnected for falling too far behind.");
+  for (JsonObject c : chans)
+    o.printf("avtool_ws_kicked_total{path=\"%s\"} %u\n",
+             (const char *)c["path"], c["kicked"].as<uint32_t>());
+}
+
+static void writeLog(Print &o) {
+  JsonDocument doc;
+  JsonObject ls = doc.to<JsonObject>();
+  logStatsToJson(ls);
+  family(o, "log_lines_total", "counter", "Log lines written by the logger.");
+  o.printf("avtool_log_lines_total %u\n", ls["lines"].as<uint32_t>());
+  family(o, "log_dropped_total", "counter",
+         "Log lines dropped because the ring was full.");
+  o.printf("avtool_log_dropped_total %u\n", ls["dropped"].as<uint32_t>());
+
+  JsonDocument sdoc;
+  JsonObject ss = sdoc.to<JsonObject>();
+  logStoreStatsToJson(ss);
+  family(o, "log_store_bytes_written_total", "counter",
+         "Bytes of log records written to flash.");
+  o.printf("avtool_log_store_bytes_written_total %u\n",
+           ss["bytesWritten"].as<uint32_t>());
+  family(o, "log_store_write_errors_total", "counter",
+         "Short or failed log segment writes.");
+  o.printf("avtool_log_store_write_errors_total %u\n",
+           ss["writeErrors"].as<uint32_t>());
+  family(o, "log_store_dropped_total", "counter",
+         "Lines lost because the flash staging buffer was full.");
+  o.printf("avtool_log_store_dropped_total %u\n",
+           ss["stageDropped"].as<uint32_t>());
+  family(o, "log_store_segments", "gauge", "Log segments on flash.");
+  o.printf("avtool_log_store_segments %u\n", ss["segments"].as<uint32_t>());
+}
+
+static void writeJobs(Print &o) {
+  JsonDocument doc;
+  JsonObject js = doc.to<JsonObject>();
+  jobStatsToJson(js);
+  family(o, "jobs_queued", "gauge", "Jobs waiting for a worker.");
+  o.printf("avtool_jobs_queued %u\n", js["queued"].as<uint32_t>());
+  family(o, "jobs_busy_workers", "gauge", "Workers running a job.");
+  o.printf("avtool_jobs_busy_workers %u\n", js["busyWorkers"].as<uint32_t>());
+  family(o, "jobs_total", "counter", "Finished jobs by kind.");
+  for (JsonPair kv : js["kinds"].as<JsonObject>()) {
+    uint32_t runs = kv.value()["runs"];
+    uint32_t failures = kv.value()["failures"];
+    o.printf("avtool_jobs_total{kind=\"%s\",result=\"ok\"} %u\n",
+             kv.key().c_str(), runs - failures);
+    o.printf("avtool_jobs_total{kind=\"%s\",result=\"failed\"} %u\n",
+             kv.key().c_str(), failures);
+  }
+}
+
+static void sendMetrics(AsyncWebServerRequest *req) {
+  AsyncResponseStream *res =
+      req->beginResponseStream("text/plain; version=0.0.4");
+  writeHeap(*res);
+  writeTasks(*res);
+  writeRoutes(*res);
+  writeSubsystems(*res);
+  writeWs(*res);
+  writeJobs(*res);
+  writeLog(*res);
+  req->send(res);
+}
+
+void setupMetrics() {
+  server.addHandler(new RouteTimer());
+  server.on("/metrics", HTTP_GET, sendMetrics);
+  server.on("/api/metrics", HTTP_GET, sendMetrics);
+}
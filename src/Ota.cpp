@@ -0,0 +1,373 @@
+#include "Ota.h"
+#include "ConfigManager.h"
+#include "LogStore.h"
+#include "Sha256.h"
+#include "WsBroadcast.h"
+#include <ArduinoJson.h>
+#include <Update.h>
+#include <esp32/rom/miniz.h>
+#include <esp_rom_crc.h>
+#include <memory>
+#include <vector>
+
+static const size_t WINDOW = TINFL_LZ_DICT_SIZE; // 32 KB, a power of two
+static const size_t GZ_HDR_MAX = 1024;           // FNAME/FCOMMENT included
+static const uint32_t EVENT_MS = 250;
+static const uint32_t STALE_MS = 15000; // an upload idle this long is dead
+
+enum class Stage : uint8_t { Raw, GzHeader, GzBody, GzTrailer };
+
+struct OtaSession {
+  AsyncWebServerRequest *owner = nullptr; // upload in progress / to answer
+  bool active = false;
+  bool ok = false;
+  String error;
+  int cmd = U_FLASH;
+  Stage stage = Stage::Raw;
+  bool gzip = false;
+  std::vector<uint8_t> hdr;
+  tinfl_decompressor *inf = nullptr;
+  uint8_t *window = nullptr;
+  size_t winOfs = 0;
+  uint8_t trailer[8];
+  size_t trailerLen = 0;
+  uint32_t crc = 0;
+  size_t received = 0;
+  size_t written = 0;
+  size_t total = 0;
+  uint32_t startMs = 0;
+  uint32_t lastChunkMs = 0;
+  uint32_t lastEventMs = 0;
+  std::unique_ptr<Sha256> sha;
+  String expectSha;
+  String sha256;
+};
+
+// Only touched from the async_tcp task (upload and response callbacks).
+static OtaSession ota;
+// A failed fs update wrote part of its image over the filesystem.
+static bool fsDamaged = false;
+
+static void freeInflater() {
+  free(ota.inf);
+  free(ota.window);
+  ota.inf = nullptr;
+  ota.window = nullptr;
+  ota.hdr.clear();
+  ota.hdr.shrink_to_fit();
+}
+
+static void otaToJson(JsonDocument &doc, const char *state) {
+  doc["state"] = state;
+  doc["target"] = ota.cmd == U_SPIFFS ? "fs" : "firmware";
+  doc["received"] = ota.received;
+  doc["total"] = ota.total;
+  doc["written"] = ota.written;
+  uint32_t ms = millis() - ota.startMs;
+  doc["kBps"] = ms ? ota.received / ms : 0; // bytes per ms ~ kB/s
+  doc["gzip"] = ota.gzip;
+  if (ota.sha256.length())
+    doc["sha256"] = ota.sha256;
+  if (ota.error.length())
+    doc["error"] = ota.error;
+}
+
+static void otaEvent(const char *state) {
+  ota.lastEventMs = millis();
+  JsonDocument doc;
+  doc["type"] = "ota";
+  otaToJson(doc, state);
+  String out;
+  serializeJson(doc, out);
+  wsBroadcast(wsState, out, "ota");
+}
+
+// After a failed fs update. If nothing reached the partition, the old
+// filesystem is intact and the stores go back to writing. Otherwise they
+// stay suspended, with config edits refused, until a good image is
+// uploaded and the device reboots into it.
+static void otaReleaseStores() {
+  if (ota.cmd != U_SPIFFS || ota.ok)
+    return;
+  if (ota.written)
+    fsDamaged = true;
+  if (fsDamaged) {
+    logError("ota", "filesystem partly overwritten; upload an fs image "
+                    "again (config is read-only until then)");
+    return;
+  }
+  logStoreResume();
+  cfgStoreResume();
+  logInfo("ota", "filesystem untouched; config and log store resumed");
+}
+
+static void otaFail(const String &why) {
+  if (ota.error.length())
+    return;
+  ota.error = why;
+  logError("ota", "update failed: %s", why);
+}
+
+static void emit(const uint8_t *data, size_t len) {
+  if (ota.error.length() || !len)
+    return;
+  ota.sha->update(data, len);
+  if (ota.gzip)
+    ota.crc = esp_rom_crc32_le(ota.crc, data, len);
+  if (Update.write((uint8_t *)data, len) != len) {
+    otaFail(String("flash write: ") + Update.errorString());
+    return;
+  }
+  ota.written += len;
+}
+
+// Header length, 0 while more bytes are needed, -1 if this isn't a gzip
+// deflate stream.
+static int gzipHeaderLen(const uint8_t *p, size_t n) {
+  if (n < 10)
+    return 0;
+  if (p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || (p[3] & 0xE0))
+    return -1;
+  uint8_t flags = p[3];
+  size_t at = 10;
+  if (flags & 0x04) { // FEXTRA
+    if (n < at + 2)
+      return 0;
+    at += 2 + (p[at] | (p[at + 1] << 8));
+  }
+  for (uint8_t bit : {0x08, 0x10}) { // FNAME, FCOMMENT: zero terminated
+    if (!(flags & bit))
+      continue;
+    while (at < n && p[at])
+      at++;
+    if (at >= n)
+      return 0;
+    at++;
+  }
+  if (flags & 0x02) // FHCRC
+    at += 2;
+  return at <= n ? (int)at : 0;
+}
+
+// Inflates as much of `in` as the stream takes, writing each filled part
+// of the window out; returns the bytes consumed.
+static size_t inflateSome(const uint8_t *in, size_t len) {
+  size_t used = 0;
+  for (;;) {
+    size_t inBytes = len - used;
+    size_t outBytes = WINDOW - ota.winOfs;
+    tinfl_status st =
+        tinfl_decompress(ota.inf, in + used, &inBytes, ota.window,
+                         ota.window + ota.winOfs, &outBytes,
+                         TINFL_FLAG_HAS_MORE_INPUT);
+    used += inBytes;
+    emit(ota.window + ota.winOfs, outBytes);
+    ota.winOfs = (ota.winOfs + outBytes) & (WINDOW - 1);
+    if (st == TINFL_STATUS_DONE) {
+      ota.stage = Stage::GzTrailer;
+      return used;
+    }
+    if (st < 0) {
+      otaFail("corrupt gzip data");
+      return len;
+    }
+    if (st == TINFL_STATUS_NEEDS_MORE_INPUT)
+      return used;
+    // TINFL_STATUS_HAS_MORE_OUTPUT: the window wrapped; go round again.
+  }
+}
+
+static void feed(const uint8_t *data, size_t len) {
+  while (len && !ota.error.length()) {
+    switch (ota.stage) {
+    case Stage::Raw:
+      emit(data, len);
+      return;
+    case Stage::GzHeader: {
+      // Byte by byte: the header is a few dozen bytes, and whatever
+      // follows it goes straight to the inflater.
+      ota.hdr.push_back(*data++);
+      len--;
+      int n = gzipHeaderLen(ota.hdr.data(), ota.hdr.size());
+      if (n < 0 || (n == 0 && ota.hdr.size() >= GZ_HDR_MAX))
+        otaFail("bad gzip header");
+      else if (n > 0)
+        ota.stage = Stage::GzBody;
+      break;
+    }
+    case Stage::GzBody: {
+      size_t used = inflateSome(data, len);
+      data += used;
+      len -= used;
+      break;
+    }
+    case Stage::GzTrailer: {
+      size_t take = min(len, sizeof(ota.trailer) - ota.trailerLen);
+      if (!take) {
+        otaFail("data after gzip trailer");
+        return;
+      }
+      memcpy(ota.trailer + ota.trailerLen, data, take);
+      ota.trailerLen += take;
+      data += take;
+      len -= take;
+      break;
+    }
+    }
+  }
+}
+
+static bool isSha256Hex(const String &s) {
+  if (s.length() != 64)
+    return false;
+  for (size_t i = 0; i < 64; i++)
+    if (!isxdigit((unsigned char)s[i]))
+      return false;
+  return true;
+}
+
+static bool otaBegin(AsyncWebServerRequest *req, const uint8_t *data,
+                     size_t len) {
+  if (ota.active) {
+    if (millis() - ota.lastChunkMs < STALE_MS)
+      return false;
+    logWarn("ota", "abandoning a stalled update");
+    Update.abort();
+    freeInflater();
+    otaReleaseStores();
+  }
+
+  String type;
+  if (req->hasParam("type"))
+    type = req->getParam("type")->value();
+  else if (req->hasParam("type", true))
+    type = req->getParam("type", true)->value();
+
+  ota = OtaSession();
+  ota.owner = req;
+  ota.active = true;
+  ota.cmd = type == "fs" ? U_SPIFFS : U_FLASH;
+  ota.total = req->contentLength();
+  ota.startMs = ota.lastChunkMs = millis();
+  if (req->hasParam("sha256"))
+    ota.expectSha = req->getParam("sha256")->value();
+  else if (req->hasParam("sha256", true))
+    ota.expectSha = req->getParam("sha256", true)->value();
+  ota.expectSha.toLowerCase();
+  ota.sha.reset(new Sha256());
+  if (!isSha256Hex(ota.expectSha))
+    otaFail(ota.expectSha.length() ? "sha256 is not 64 hex digits"
+                                   : "sha256 of the image is required");
+
+  ota.gzip = len >= 2 && data[0] == 0x1f && data[1] == 0x8b;
+  if (ota.gzip && !ota.error.length()) {
+    ota.stage = Stage::GzHeader;
+    ota.inf = (tinfl_decompressor *)malloc(sizeof(tinfl_decompressor));
+    ota.window = (uint8_t *)malloc(WINDOW);
+    if (!ota.inf || !ota.window)
+      otaFail("out of memory for the inflate window");
+    else
+      tinfl_init(ota.inf);
+  }
+  if (!ota.error.length() && ota.cmd == U_SPIFFS) {
+    // The partition is rewritten under the mounted LittleFS: from here on
+    // nothing may write through the old mount, up to and including the
+    // reboot, whether or not the image turns out good.
+    logStoreSuspend();
+    cfgStoreSuspend();
+  }
+  if (!ota.error.length() && !Update.begin(UPDATE_SIZE_UNKNOWN, ota.cmd))
+    otaFail(String("begin: ") + Update.errorString());
+  logInfo("ota", "%s update started (%s, %u B)",
+          ota.cmd == U_SPIFFS ? "fs" : "firmware", ota.gzip ? "gzip" : "raw",
+          ota.total);
+  return true;
+}
+
+static void otaFinish() {
+  ota.sha256 = ota.sha->finishHex();
+  ota.sha.reset();
+
+  if (ota.gzip && !ota.error.length()) {
+    if (ota.stage != Stage::GzTrailer || ota.trailerLen != 8)
+      otaFail("gzip stream truncated");
+    else {
+      const uint8_t *t = ota.trailer;
+      uint32_t crc = t[0] | (t[1] << 8) | (t[2] << 16) | ((uint32_t)t[3] << 24);
+      uint32_t size =
+          t[4] | (t[5] << 8) | (t[6] << 16) | ((uint32_t)t[7] << 24);
+      if (crc != ota.crc || size != (uint32_t)ota.written)
+        otaFail("gzip CRC or length mismatch");
+    }
+  }
+  if (!ota.error.length() && ota.expectSha != ota.sha256)
+    otaFail("sha256 mismatch");
+
+  // Update.end(true) is what switches the boot partition, so it only runs
+  // once every check has passed.
+  if (ota.error.length())
+    Update.abort();
+  else if (!Update.end(true))
+    otaFail(String("end: ") + Update.errorString());
+
+  freeInflater();
+  ota.active = false;
+  ota.ok = !ota.error.length();
+  if (ota.ok)
+    logInfo("ota", "update ok: %u B written, sha256 %s", ota.written,
+            ota.sha256);
+  else
+    otaReleaseStores();
+  otaEvent(ota.ok ? "done" : "failed");
+}
+
+static void onUpload(AsyncWebServerRequest *req, String, size_t index,
+                     uint8_t *data, size_t len, bool final) {
+  if (!index && !otaBegin(req, data, len))
+    return;
+  if (req != ota.owner || !ota.active)
+    return;
+  ota.lastChunkMs = millis();
+  ota.received += len;
+  feed(data, len);
+  if (final)
+    otaFinish();
+  else if (millis() - ota.lastEventMs >= EVENT_MS)
+    otaEvent(ota.error.length() ? "failed" : "writing");
+}
+
+static void onUploadDone(AsyncWebServerRequest *req) {
+  if (req != ota.owner) {
+    req->send(ota.active ? 409 : 400, "application/json",
+              ota.active ? "{\"error\":\"another update is in progress\"}"
+                         : "{\"error\":\"no image uploaded\"}");
+    return;
+  }
+  if (ota.active) { // the body ended without a final chunk
+    otaFail("upload incomplete");
+    otaFinish();
+  }
+  ota.owner = nullptr;
+  shouldReboot = ota.ok;
+
+  JsonDocument doc;
+  otaToJson(doc, ota.ok ? "done" : "failed");
+  doc["ok"] = ota.ok;
+  String out;
+  serializeJson(doc, out);
+  AsyncWebServerResponse *res =
+      req->beginResponse(ota.ok ? 200 : 400, "application/json", out);
+  res->addHeader("Connection", "close");
+  req->send(res);
+}
+
+void setupOta() {
+  server.on("/update", HTTP_GET, [](AsyncWebServerRequest *request) {
+    request->send(200, "text/html",
+                  "<form method='POST' action='/update' "
+                  "enctype='multipart/form-data'>SHA-256 <input "
+                  "name='sha256' size='64'> <input type='file' "
+                  "name='update'><input type='submit' value='Update'></form>");
+  });
+  server.on("/update", HTTP_POST, onUploadDone, onUpload);
+}
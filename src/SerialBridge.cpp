@@ -0,0 +1,96 @@
+#include "SerialBridge.h"
+#include "TcpTransport.h"
+#include "UartTransport.h"
+
+bool bridgeRunning = false;
+uint16_t bridgePort = 4001;
+uint32_t bridgeBaud = 9600;
+uint32_t bridgeBytesToUart = 0;
+uint32_t bridgeBytesFromUart = 0;
+
+static AsyncServer *bridgeServer = nullptr;
+static UartTransport *bridgeUart = nullptr;
+static TcpTransport *bridgeTcp = nullptr;
+
+// bridgeUart and bridgeTcp are used from the UART event task and async_tcp;
+// every use and every delete happens under this lock. Deleting the UART
+// with it held is safe: its event task is then either outside the handler
+// or blocked on the lock, and the driver just deletes it.
+static SemaphoreHandle_t bridgeMutex = xSemaphoreCreateMutex();
+struct BridgeLock {
+  BridgeLock() { xSemaphoreTake(bridgeMutex, portMAX_DELAY); }
+  ~BridgeLock() { xSemaphoreGive(bridgeMutex); }
+};
+
+bool bridgeClientConnected() {
+  BridgeLock lock;
+  return bridgeTcp && bridgeTcp->connected();
+}
+
+void bridgeStop() {
+  bridgeRunning = false;
+  if (bridgeServer) {
+    bridgeServer->end();
+    delete bridgeServer;
+    bridgeServer = nullptr;
+  }
+  BridgeLock lock;
+  delete bridgeTcp;
+  bridgeTcp = nullptr;
+  delete bridgeUart;
+  bridgeUart = nullptr;
+}
+
+bool bridgeStart() {
+  bridgeStop();
+
+  UartTransport *uart = new UartTransport();
+  uart->onData([](const uint8_t *data, size_t len) {
+    BridgeLock lock;
+    bridgeBytesFromUart += len;
+    if (bridgeTcp)
+      bridgeTcp->write(data, len);
+  });
+  if (!uart->open(bridgeBaud)) {
+    delete uart;
+    logWarn("bridge", "UART busy");
+    return false;
+  }
+  {
+    BridgeLock lock;
+    bridgeUart = uart;
+  }
+
+  bridgeServer = new AsyncServer(bridgePort);
+  bridgeServer->setNoDelay(true);
+  bridgeServer->onClient(
+      [](void *, AsyncClient *client) {
+        BridgeLock lock;
+        if (bridgeTcp) {
+          client->close(true);
+          return;
+        }
+        bridgeTcp = new TcpTransport(client);
+        bridgeTcp->onData([](const uint8_t *data, size_t len) {
+          BridgeLock lock;
+          bridgeBytesToUart += len;
+          if (bridgeUart)
+            bridgeUart->write(data, len);
+        });
+        bridgeTcp->onClose([]() {
+          {
+            BridgeLock lock;
+            delete bridgeTcp;
+            bridgeTcp = nullptr;
+          }
+          logInfo("bridge", "client disconnected");
+        });
+        logInfo("bridge", "client %s connected", bridgeTcp->remoteIp());
+      },
+      nullptr);
+  bridgeServer->begin();
+  bridgeRunning = true;
+
+  logInfo("bridge", "TCP :%u <-> UART @%u", bridgePort, bridgeBaud);
+  return true;
+}
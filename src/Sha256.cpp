@@ -0,0 +1,32 @@
+#include "Sha256.h"
+#include <mbedtls/version.h>
+
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+#define SHA256_STARTS mbedtls_sha256_starts
+#define SHA256_UPDATE mbedtls_sha256_update
+#define SHA256_FINISH mbedtls_sha256_finish
+#else
+#define SHA256_STARTS mbedtls_sha256_starts_ret
+#define SHA256_UPDATE mbedtls_sha256_update_ret
+#define SHA256_FINISH mbedtls_sha256_finish_ret
+#endif
+
+Sha256::Sha256() {
+  mbedtls_sha256_init(&ctx);
+  SHA256_STARTS(&ctx, 0);
+}
+
+Sha256::~Sha256() { mbedtls_sha256_free(&ctx); }
+
+void Sha256::update(const uint8_t *data, size_t len) {
+  SHA256_UPDATE(&ctx, data, len);
+}
+
+String Sha256::finishHex() {
+  uint8_t digest[32];
+  SHA256_FINISH(&ctx, digest);
+  char hex[65];
+  for (size_t i = 0; i < sizeof(digest); i++)
+    snprintf(hex + i * 2, 3, "%02x", digest[i]);
+  return String(hex);
+}
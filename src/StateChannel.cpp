@@ -0,0 +1,131 @@
+#include "StateChannel.h"
+#include "WebAPI.h"
+#include "WsBroadcast.h"
+#include <ArduinoJson.h>
+#include <map>
+
+// Handlers call stateNotify() for the changes that matter; the timer only
+// picks up drift such as RSSI, so the health document isn't rebuilt twice
+// a second for nothing.
+static const uint32_t SAMPLE_MS = 2000;
+static const uint32_t HEAP_MS = 5000; // heap_free alone isn't worth a push
+
+static std::map<String, String> lastLeaves;
+static uint32_t stateVersion = 0;
+static uint32_t lastSampleMs = 0;
+static uint32_t lastHeapMs = 0;
+static volatile bool dirty = false;
+static volatile bool wantSnapshot = false;
+
+// Fields that change every sample and that the browser can derive itself.
+static bool volatileLeaf(const String &path) {
+  return path == "uptime_s" || path == "heap_free";
+}
+
+static void flatten(JsonVariantConst v, const String &path,
+                    std::map<String, String> &out) {
+  if (v.is<JsonObjectConst>()) {
+    for (JsonPairConst kv : v.as<JsonObjectConst>())
+      flatten(kv.value(),
+              path.length() ? path + "." + kv.key().c_str() : kv.key().c_str(),
+              out);
+    return;
+  }
+  String s;
+  serializeJson(v, s);
+  out[path] = s;
+}
+
+static void sendSnapshot(JsonDocument &state, AsyncWebSocketClient *to) {
+  JsonDocument msg;
+  msg["type"] = "snapshot";
+  msg["v"] = stateVersion;
+  msg["state"] = state;
+  String out;
+  serializeJson(msg, out);
+  if (to)
+    wsSendText(wsState, to->id(), out);
+  else
+    wsBroadcast(wsState, out, "state");
+}
+
+void stateNotify() { dirty = true; }
+
+void stateService() {
+  uint32_t now = millis();
+  if (!wsState.count()) {
+    lastLeaves.clear();
+    return;
+  }
+  if (!dirty && !wantSnapshot && now - lastSampleMs < SAMPLE_MS)
+    return;
+  lastSampleMs = now;
+  dirty = false;
+
+  JsonDocument state;
+  healthToJson(state);
+  std::map<String, String> leaves;
+  flatten(state, "", leaves);
+
+  // A new client (or one that lost track) gets everything; the rest keep
+  // applying deltas against the same version sequence.
+  if (wantSnapshot || lastLeaves.empty()) {
+    wantSnapshot = false;
+    stateVersion++;
+    sendSnapshot(state, nullptr);
+    lastLeaves.swap(leaves);
+    lastHeapMs = now;
+    return;
+  }
+
+  bool heapDue = now - lastHeapMs >= HEAP_MS;
+  JsonDocument msg;
+  JsonObject set = msg["set"].to<JsonObject>();
+  for (auto &kv : leaves) {
+    auto it = lastLeaves.find(kv.first);
+    if (it != lastLeaves.end() && it->second == kv.second)
+      continue;
+    if (volatileLeaf(kv.first) && !(kv.first == "heap_free" && heapDue))
+      continue;
+    set[kv.first] = serialized(kv.second);
+    lastLeaves[kv.first] = kv.second;
+  }
+  size_t gone = 0;
+  for (auto it = lastLeaves.begin(); it != lastLeaves.end();) {
+    if (leaves.count(it->first)) {
+      ++it;
+      continue;
+    }
+    msg["del"].add(it->first);
+    it = lastLeaves.erase(it);
+    gone++;
+  }
+  if (heapDue)
+    lastHeapMs = now;
+  if (set.size() == 0 && !gone)
+    return;
+  msg["type"] = "delta";
+  msg["v"] = ++stateVersion;
+  String out;
+  serializeJson(msg, out);
+  wsBroadcast(wsState, out, "state");
+}
+
+void setupStateChannel() {
+  wsState.onEvent([](AsyncWebSocket *, AsyncWebSocketClient *c,
+                     AwsEventType t, void *, uint8_t *data, size_t len) {
+    wsClientEvent(wsState, c, t);
+    if (t == WS_EVT_CONNECT) {
+      wantSnapshot = true;
+      return;
+    }
+    if (t != WS_EVT_DATA)
+      return;
+    JsonDocument doc;
+    if (deserializeJson(doc, data, len))
+      return;
+    if (String(doc["action"] | "") == "snapshot")
+      wantSnapshot = true;
+  });
+  server.addHandler(&wsState);
+}
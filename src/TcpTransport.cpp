@@ -0,0 +1,87 @@
+#include "TcpTransport.h"
+
+TcpTransport::TcpTransport() : client(new AsyncClient()) { attach(); }
+
+TcpTransport::TcpTransport(AsyncClient *c) : client(c), wasConnected(true) {
+  attach();
+}
+
+TcpTransport::~TcpTransport() { close(); }
+
+void TcpTransport::attach() {
+  client->setNoDelay(true);
+  client->onConnect(
+      [](void *arg, AsyncClient *) {
+        auto *self = static_cast<TcpTransport *>(arg);
+        self->wasConnected = true;
+        self->emitConnect(true);
+      },
+      this);
+  // AsyncTCP follows every error with a disconnect, which does the cleanup.
+  client->onError(
+      [](void *arg, AsyncClient *, int8_t) {
+        auto *self = static_cast<TcpTransport *>(arg);
+        if (!self->wasConnected)
+          self->emitConnect(false);
+      },
+      this);
+  client->onData(
+      [](void *arg, AsyncClient *, void *data, size_t len) {
+        static_cast<TcpTransport *>(arg)->emitData((const uint8_t *)data, len);
+      },
+      this);
+  client->onPoll(
+      [](void *arg, AsyncClient *c) {
+        // Runs onDisconnect below, here on async_tcp.
+        if (static_cast<TcpTransport *>(arg)->closeRequested)
+          c->close(true);
+      },
+      this);
+  client->onDisconnect(
+      [](void *arg, AsyncClient *c) {
+        auto *self = static_cast<TcpTransport *>(arg);
+        self->client = nullptr;
+        self->emitClose(); // may delete self
+        delete c;
+      },
+      this);
+}
+
+bool TcpTransport::connect(const IPAddress &ip, uint16_t port) {
+  return client && client->connect(ip, port);
+}
+
+bool TcpTransport::connected() const { return client && client->connected(); }
+
+size_t TcpTransport::write(const uint8_t *data, size_t len) {
+  // Read once: a disconnect on async_tcp clears `client` (and frees it only
+  // after the owner's close handler has run).
+  AsyncClient *c = client;
+  if (!c || !c->connected())
+    return 0;
+  return c->write((const char *)data, len);
+}
+
+void TcpTransport::close() {
+  if (!client)
+    return;
+  AsyncClient *c = client;
+  client = nullptr;
+  c->onError(nullptr, nullptr);
+  c->onPoll(nullptr, nullptr);
+  c->onDisconnect(nullptr, nullptr);
+  c->close(true);
+  delete c;
+}
+
+String TcpTransport::remoteIp() const {
+  return client ? client->remoteIP().toString() : String("");
+}
+
+uint16_t TcpTransport::remotePort() const {
+  return client ? client->remotePort() : 0;
+}
+
+uint16_t TcpTransport::localPort() const {
+  return client ? client->localPort() : 0;
+}
@@ -1,53 +1,468 @@
 #include "TerminalHandler.h"
-#include "Utils.h"
-#include <ArduinoJson.h>
+#include "TcpTransport.h"
+#include "Trace.h"
+#include "UartTransport.h"
+#include "WsBroadcast.h"
+#include <esp_timer.h>
+#include <vector>
 
 
-WiFiClient termClient;
-bool termConnected = false;
-String termHost = "";
-uint16_t termPort = 0;
+uint8_t termMaxSessions = 4;
 
-void termSendStatus() {
+// Bursts are coalesced for up to TERM_COALESCE_US after their first byte.
+// All sessions share one timer; it flushes every session with pending bytes.
+static const uint32_t TERM_COALESCE_US = 10000;
+static const uint32_t TERM_DETACH_GRACE_MS = 5 * 60 * 1000;
+static const size_t TERM_REPLAY_RECS = 32;
+
+static std::vector<TermSession *> termSessions;
+// TCP links of reaped sessions, waiting for their onClose (see termService).
+static std::vector<const Transport *> termRetired;
+static SemaphoreHandle_t termMutex = xSemaphoreCreateMutex();
+static esp_timer_handle_t termFlushTimer = nullptr;
+
+struct TermLock {
+  TermLock() { xSemaphoreTake(termMutex, portMAX_DELAY); }
+  ~TermLock() { xSemaphoreGive(termMutex); }
+};
+
+void TermScrollback::append(uint32_t seq, uint32_t ts, const uint8_t *data,
+                            size_t len) {
+  if (len > TERM_SCROLLBACK_BYTES)
+    return;
+  while (recCount && (recCount == TERM_SCROLLBACK_RECS ||
+                      bytesUsed + len > TERM_SCROLLBACK_BYTES)) {
+    bytesUsed -= recs[recHead].len;
+    recHead = (recHead + 1) % TERM_SCROLLBACK_RECS;
+    recCount--;
+  }
+  TermRecord &r = recs[(recHead + recCount) % TERM_SCROLLBACK_RECS];
+  r.seq = seq;
+  r.ts = ts;
+  r.off = (uint16_t)byteHead;
+  r.len = (uint16_t)len;
+  size_t first = min(len, TERM_SCROLLBACK_BYTES - byteHead);
+  memcpy(bytes + byteHead, data, first);
+  memcpy(bytes, data + first, len - first);
+  byteHead = (byteHead + len) % TERM_SCROLLBACK_BYTES;
+  bytesUsed += len;
+  recCount++;
+}
+
+const TermRecord &TermScrollback::at(size_t i) const {
+  return recs[(recHead + i) % TERM_SCROLLBACK_RECS];
+}
+
+void TermScrollback::copy(const TermRecord &r, uint8_t *out) const {
+  size_t first = min((size_t)r.len, TERM_SCROLLBACK_BYTES - r.off);
+  memcpy(out, bytes + r.off, first);
+  memcpy(out + first, bytes, r.len - first);
+}
+
+void loadTermCfg() {
+  termMaxSessions = prefs.getUChar("t_maxSess", termMaxSessions);
+  if (!termMaxSessions)
+    termMaxSessions = 1;
+}
+
+void saveTermCfg() { prefs.putUChar("t_maxSess", termMaxSessions); }
+
+static void putLe32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+// Caller holds termMutex.
+static TermSession *termFind(uint32_t wsId) {
+  for (auto *s : termSessions)
+    if (s->wsId == wsId)
+      return s;
+  return nullptr;
+}
+
+// Caller holds termMutex. Link callbacks run on the link's own task and may
+// race with the session being destroyed or given a new link, so they carry
+// the sid and the link they were installed on (compared, never dereferenced)
+// instead of a session pointer.
+static TermSession *termFindLink(uint32_t sid, const Transport *link) {
+  for (auto *s : termSessions)
+    if (s->sid == sid && s->link == link)
+      return s;
+  return nullptr;
+}
+
+// Caller holds termMutex. Records the pending bytes and, if the session is
+// attached, sends them to the owner.
+static void termFlushLocked(TermSession *s) {
+  if (!s->rxLen)
+    return;
+  TraceScope span("termFlush");
+  uint32_t seq = ++s->seq;
+  uint32_t ts = millis();
+  s->frame[0] = TERM_FRAME_RX;
+  putLe32(s->frame + 1, seq);
+  putLe32(s->frame + 5, ts);
+  s->scrollback.append(seq, ts, s->frame + TERM_FRAME_HDR, s->rxLen);
+  if (s->wsId)
+    wsSendBinary(wsTerm, s->wsId, s->frame, TERM_FRAME_HDR + s->rxLen);
+
+  TermLatency &l = s->latency;
+  uint32_t us = (uint32_t)(esp_timer_get_time() - s->rxFirstUs);
+  l.frames++;
+  l.bytes += s->rxLen;
+  l.lastUs = us;
+  l.avgUs = l.avgUs ? l.avgUs - l.avgUs / 8 + us / 8 : us;
+  if (us > l.maxUs)
+    l.maxUs = us;
+  s->rxLen = 0;
+}
+
+static void termFlushAll(void *) {
+  TermLock lock;
+  for (auto *s : termSessions)
+    termFlushLocked(s);
+}
+
+static void termRx(uint32_t sid, const Transport *link, const uint8_t *data,
+                   size_t len) {
+  TermLock lock;
+  TermSession *s = termFindLink(sid, link);
+  if (!s)
+    return;
+  while (len) {
+    if (!s->rxLen) {
+      s->rxFirstUs = esp_timer_get_time();
+      if (!esp_timer_is_active(termFlushTimer))
+        esp_timer_start_once(termFlushTimer, TERM_COALESCE_US);
+    }
+    size_t n = min(len, TERM_FRAME_MAX - s->rxLen);
+    memcpy(s->frame + TERM_FRAME_HDR + s->rxLen, data, n);
+    s->rxLen += n;
+    data += n;
+    len -= n;
+    if (s->rxLen == TERM_FRAME_MAX)
+      termFlushLocked(s);
+  }
+}
+
+static String termStatusJson(const TermSession *s) {
   JsonDocument d;
   d["type"] = "status";
-  d["connected"] = termClient.connected();
-  d["host"] = termHost;
-  d["port"] = termPort;
-  String s;
-  serializeJson(d, s);
-  wsTerm.textAll(s);
-}
-
-void termDisconnect() {
-  if (termClient.connected())
-    termClient.stop();
-  termConnected = false;
-  termHost = "";
-  termPort = 0;
-  termSendStatus();
-}
-
-void termPumpTask(void *) {
-  for (;;) {
-    if (termClient.connected()) {
-      while (termClient.available()) {
-        uint8_t buf[256];
-        int n = termClient.read(buf, sizeof(buf));
-        if (n > 0) {
-          JsonDocument d;
-          d["type"] = "rx";
-          d["hex"] = bytesToHex(buf, (size_t)n);
-          d["ascii"] = bytesToAscii(buf, (size_t)n);
-          String s;
-          serializeJson(d, s);
-          wsTerm.textAll(s);
-        }
+  d["connected"] = s && s->link && s->link->connected();
+  d["transport"] = (s && s->link) ? s->link->kind() : "";
+  d["host"] = s ? s->host : String("");
+  d["port"] = s ? s->port : 0;
+  if (s && s->baud)
+    d["baud"] = s->baud;
+  if (s)
+    d["sid"] = s->sid;
+  String out;
+  serializeJson(d, out);
+  return out;
+}
+
+void termSendStatus(uint32_t wsId) {
+  String st;
+  {
+    TermLock lock;
+    st = termStatusJson(termFind(wsId));
+  }
+  wsSendText(wsTerm, wsId, st);
+}
+
+// A new client has no session yet, so this needs no termMutex, which the
+// connect handler must not take (see wsQueueText).
+void termQueueStatus(uint32_t wsId) {
+  wsQueueText(wsTerm, wsId, termStatusJson(nullptr));
+}
+
+// Caller holds termMutex.
+static void termCloseLinkLocked(TermSession *s) {
+  termFlushLocked(s);
+  delete s->link;
+  s->link = nullptr;
+  s->host = "";
+  s->port = 0;
+  s->baud = 0;
+}
+
+// Caller holds termMutex.
+static void termDestroyLocked(TermSession *s) {
+  termCloseLinkLocked(s);
+  for (auto it = termSessions.begin(); it != termSessions.end(); ++it)
+    if (*it == s) {
+      termSessions.erase(it);
+      break;
+    }
+  delete s;
+}
+
+void termCloseLink(uint32_t wsId) {
+  TermLock lock;
+  TermSession *s = termFind(wsId);
+  if (s && s->link) {
+    logInfo("term", "session %u closed %s", s->sid, s->host);
+    termCloseLinkLocked(s);
+  }
+}
+
+void termDetach(uint32_t wsId) {
+  TermLock lock;
+  TermSession *s = termFind(wsId);
+  if (!s)
+    return;
+  if (!s->link && !s->scrollback.count()) {
+    termDestroyLocked(s);
+    return;
+  }
+  s->wsId = 0;
+  s->detachedMs = millis();
+}
+
+static void termError(uint32_t wsId, const char *msg) {
+  JsonDocument d;
+  d["type"] = "error";
+  d["msg"] = msg;
+  String out;
+  serializeJson(d, out);
+  wsSendText(wsTerm, wsId, out);
+}
+
+// Caller holds termMutex. Sends records with seq < beforeSeq (0 = newest),
+// at most `count` of them, oldest first, then the end-of-batch marker.
+static void termHistoryLocked(TermSession *s, uint32_t beforeSeq,
+                              size_t count, bool replay) {
+  termFlushLocked(s); // frame buffer is reused below
+  const TermScrollback &sb = s->scrollback;
+  size_t end = sb.count();
+  while (end && beforeSeq && sb.at(end - 1).seq >= beforeSeq)
+    end--;
+  size_t begin = end > count ? end - count : 0;
+
+  for (size_t i = begin; i < end; i++) {
+    const TermRecord &r = sb.at(i);
+    s->frame[0] = TERM_FRAME_HISTORY;
+    putLe32(s->frame + 1, r.seq);
+    putLe32(s->frame + 5, r.ts);
+    sb.copy(r, s->frame + TERM_FRAME_HDR);
+    wsSendBinary(wsTerm, s->wsId, s->frame, TERM_FRAME_HDR + r.len);
+  }
+
+  JsonDocument d;
+  d["type"] = "history";
+  d["replay"] = replay;
+  d["count"] = end - begin;
+  d["first"] = begin < end ? sb.at(begin).seq : 0;
+  d["oldest"] = sb.count() ? sb.at(0).seq : 0;
+  String out;
+  serializeJson(d, out);
+  wsSendText(wsTerm, s->wsId, out);
+}
+
+void termHistory(uint32_t wsId, uint32_t beforeSeq, size_t count) {
+  TermLock lock;
+  TermSession *s = termFind(wsId);
+  if (s)
+    termHistoryLocked(s, beforeSeq, min(count, TERM_REPLAY_RECS), false);
+}
+
+bool termAttach(uint32_t wsId, uint32_t sid) {
+  String st;
+  {
+    TermLock lock;
+    TermSession *target = nullptr;
+    for (auto *s : termSessions)
+      if (s->sid == sid && !s->wsId)
+        target = s;
+    if (!target)
+      return false;
+    if (TermSession *old = termFind(wsId))
+      termDestroyLocked(old);
+    target->wsId = wsId;
+    st = termStatusJson(target);
+    wsSendText(wsTerm, wsId, st);
+    termHistoryLocked(target, 0, TERM_REPLAY_RECS, true);
+  }
+  logInfo("term", "session %u reattached", sid);
+  return true;
+}
+
+// Runs on loopTask, where a TCP link can't be deleted: async_tcp may be in
+// its data handler, waiting for termMutex. The link is closed from its next
+// poll instead and deleted by termLinkClosed once onClose has run.
+void termService() {
+  TermLock lock;
+  uint32_t now = millis();
+  for (size_t i = termSessions.size(); i-- > 0;) {
+    TermSession *s = termSessions[i];
+    if (s->wsId || now - s->detachedMs <= TERM_DETACH_GRACE_MS)
+      continue;
+    if (s->link && !strcmp(s->link->kind(), "tcp")) {
+      termFlushLocked(s);
+      termRetired.push_back(s->link);
+      static_cast<TcpTransport *>(s->link)->closeFromPoll();
+      s->link = nullptr;
+    }
+    termDestroyLocked(s);
+  }
+}
+
+// The link ended on its own; the session and its scrollback stay.
+static void termLinkClosed(uint32_t sid, const Transport *link) {
+  TermLock lock;
+  TermSession *s = termFindLink(sid, link);
+  if (!s) {
+    for (auto it = termRetired.begin(); it != termRetired.end(); ++it)
+      if (*it == link) {
+        termRetired.erase(it);
+        delete link; // allowed from inside onClose
+        break;
       }
-    } else {
-      if (termConnected)
-        termDisconnect();
+    return;
+  }
+  termCloseLinkLocked(s);
+  if (s->wsId)
+    wsSendText(wsTerm, s->wsId, termStatusJson(s));
+}
+
+// Gets (or creates) the client's session and gives it a new link. Returns
+// its sid, or 0 after telling the client why when the cap is reached.
+static uint32_t termBind(uint32_t wsId, Transport *link) {
+  if (!termFlushTimer) {
+    esp_timer_create_args_t args = {};
+    args.callback = termFlushAll;
+    args.name = "termFlush";
+    esp_timer_create(&args, &termFlushTimer);
+  }
+
+  TermLock lock;
+  TermSession *s = termFind(wsId);
+  if (s) {
+    termCloseLinkLocked(s);
+  } else {
+    if (termSessions.size() >= termMaxSessions) {
+      // Make room by dropping the longest-detached session, if any.
+      TermSession *oldest = nullptr;
+      for (auto *d : termSessions)
+        if (!d->wsId && (!oldest || d->detachedMs < oldest->detachedMs))
+          oldest = d;
+      if (!oldest) {
+        termError(wsId, "Too many terminal sessions");
+        delete link;
+        return 0;
+      }
+      termDestroyLocked(oldest);
+    }
+    s = new TermSession();
+    s->sid = esp_random() | 1;
+    s->wsId = wsId;
+    termSessions.push_back(s);
+  }
+
+  // Handlers go in before the link is published or opened.
+  uint32_t sid = s->sid;
+  link->onData([sid, link](const uint8_t *data, size_t len) {
+    termRx(sid, link, data, len);
+  });
+  link->onClose([sid, link]() { termLinkClosed(sid, link); });
+  s->link = link;
+  return sid;
+}
+
+// The client attached to the session that still owns `link`, or 0.
+static uint32_t termLinkOwner(uint32_t sid, const Transport *link) {
+  TermLock lock;
+  TermSession *s = termFindLink(sid, link);
+  return s ? s->wsId : 0;
+}
+
+bool termOpenTcp(uint32_t wsId, const IPAddress &ip, uint16_t port) {
+  TcpTransport *t = new TcpTransport();
+  uint32_t sid = termBind(wsId, t);
+  if (!sid)
+    return false;
+  const Transport *link = t;
+  t->onConnect([sid, link, ip, port](bool ok) {
+    uint32_t owner = termLinkOwner(sid, link);
+    if (!ok) {
+      if (owner)
+        termError(owner, "Connect failed");
+      return;
+    }
+    if (owner)
+      termSendStatus(owner);
+    logInfo("term", "session %u connected to %s:%u", sid, ip, port);
+  });
+  {
+    TermLock lock;
+    if (TermSession *s = termFindLink(sid, t)) {
+      s->host = ip.toString();
+      s->port = port;
+    }
+  }
+  if (!t->connect(ip, port)) {
+    termCloseLink(wsId);
+    termError(wsId, "Connect failed");
+    return false;
+  }
+  return true;
+}
+
+bool termOpenUart(uint32_t wsId, uint32_t baud) {
+  UartTransport *u = new UartTransport();
+  uint32_t sid = termBind(wsId, u);
+  if (!sid)
+    return false;
+  {
+    TermLock lock;
+    if (TermSession *s = termFindLink(sid, u)) {
+      s->host = "uart";
+      s->baud = baud;
     }
-    vTaskDelay(20 / portTICK_PERIOD_MS);
+  }
+  if (!u->open(baud)) {
+    termCloseLink(wsId);
+    termError(wsId, "UART busy");
+    return false;
+  }
+  termSendStatus(wsId);
+  logInfo("term", "session %u opened UART @%u", sid, baud);
+  return true;
+}
+
+bool termSend(uint32_t wsId, const uint8_t *data, size_t len) {
+  TermLock lock;
+  TermSession *s = termFind(wsId);
+  if (!s || !s->link || !s->link->connected())
+    return false;
+  s->link->write(data, len);
+  return true;
+}
+
+size_t termSessionCount() {
+  TermLock lock;
+  return termSessions.size();
+}
+
+void termSessionsToJson(JsonArray arr) {
+  TermLock lock;
+  for (auto *s : termSessions) {
+    JsonObject o = arr.add<JsonObject>();
+    o["sid"] = s->sid;
+    o["wsId"] = s->wsId;
+    o["attached"] = s->wsId != 0;
+    o["transport"] = s->link ? s->link->kind() : "";
+    o["connected"] = s->link && s->link->connected();
+    o["host"] = s->host;
+    o["port"] = s->port;
+    o["baud"] = s->baud;
+    o["scrollbackRecs"] = s->scrollback.count();
+    o["frames"] = s->latency.frames;
+    o["bytes"] = s->latency.bytes;
+    o["latencyLastUs"] = s->latency.lastUs;
+    o["latencyAvgUs"] = s->latency.avgUs;
+    o["latencyMaxUs"] = s->latency.maxUs;
   }
 }
@@ -0,0 +1,181 @@
+#include "Trace.h"
+#include "JsonStream.h"
+#include <esp_ipc.h>
+#include <esp_timer.h>
+#include <math.h>
+#include <memory>
+#include <vector>
+
+struct TraceRecord {
+  const char *name;
+  uint32_t startCycles;
+  uint32_t endCycles;
+  uint32_t endTick; // resolves cycle counter wraps on export
+  uint32_t tid;
+  uint8_t startCore;
+  uint8_t endCore;
+  char task[10];
+};
+
+// Cycle count and esp_timer time read together on one core.
+struct CoreCalib {
+  uint32_t cycles;
+  int64_t us;
+};
+
+volatile bool traceOn = false;
+static TraceRecord *ring = nullptr; // allocated on first enable
+static uint32_t ringNext = 0;       // records written since the last clear
+static portMUX_TYPE traceMux = portMUX_INITIALIZER_UNLOCKED;
+static CoreCalib calib[portNUM_PROCESSORS];
+static uint32_t cpuMhz = 240;
+
+TraceMark traceNow() {
+  TraceMark m;
+  // Retry if the task moved cores between the two reads.
+  do {
+    m.core = xPortGetCoreID();
+    m.cycles = ESP.getCycleCount();
+  } while (m.core != xPortGetCoreID());
+  return m;
+}
+
+void traceSpan(const char *name, const TraceMark &start) {
+  TraceMark end = traceNow();
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  uint32_t tick = xTaskGetTickCount();
+  portENTER_CRITICAL(&traceMux);
+  if (ring) {
+    TraceRecord &r = ring[ringNext++ % TRACE_RING];
+    r.name = name;
+    r.startCycles = start.cycles;
+    r.endCycles = end.cycles;
+    r.endTick = tick;
+    r.tid = (uint32_t)task;
+    r.startCore = start.core;
+    r.endCore = end.core;
+    strncpy(r.task, pcTaskGetName(task), sizeof(r.task) - 1);
+    r.task[sizeof(r.task) - 1] = 0;
+  }
+  portEXIT_CRITICAL(&traceMux);
+}
+
+static void calibrateCore(void *arg) {
+  CoreCalib *c = (CoreCalib *)arg;
+  c->us = esp_timer_get_time();
+  c->cycles = ESP.getCycleCount();
+}
+
+void traceEnable(bool on) {
+  if (on && !ring) {
+    TraceRecord *r = (TraceRecord *)calloc(TRACE_RING, sizeof(TraceRecord));
+    if (!r) {
+      logError("trace", "no memory for the ring");
+      return;
+    }
+    portENTER_CRITICAL(&traceMux);
+    ring = r;
+    ringNext = 0;
+    portEXIT_CRITICAL(&traceMux);
+  }
+  if (on) {
+    cpuMhz = ESP.getCpuFreqMHz();
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+      esp_ipc_call_blocking(core, calibrateCore, &calib[core]);
+  }
+  traceOn = on;
+}
+
+void traceClear() {
+  portENTER_CRITICAL(&traceMux);
+  ringNext = 0;
+  portEXIT_CRITICAL(&traceMux);
+}
+
+void traceStatsToJson(JsonObject out) {
+  out["enabled"] = (bool)traceOn;
+  out["capacity"] = TRACE_RING;
+  out["recorded"] = ringNext;
+  out["overwritten"] = ringNext > TRACE_RING ? ringNext - TRACE_RING : 0;
+  out["cpuMhz"] = cpuMhz;
+}
+
+// Maps a cycle count onto the esp_timer timeline (µs since boot), picking
+// the counter wrap that lands closest to `nearUs`.
+static double cyclesToUs(uint8_t core, uint32_t cycles, double nearUs) {
+  const CoreCalib &c = calib[core];
+  double us = c.us + (double)(uint32_t)(cycles - c.cycles) / cpuMhz;
+  double wrapUs = 4294967296.0 / cpuMhz;
+  return us + floor((nearUs - us) / wrapUs + 0.5) * wrapUs;
+}
+
+struct TraceDump {
+  std::vector<TraceRecord> records; // oldest first
+  std::vector<size_t> threads;      // index of the first record per task
+};
+
+static bool traceRow(const TraceDump &d, size_t i, String &row) {
+  char buf[224];
+  if (i < d.threads.size()) {
+    const TraceRecord &r = d.records[d.threads[i]];
+    snprintf(buf, sizeof(buf),
+             "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+             "\"args\":{\"name\":\"%s\"}}",
+             r.tid, r.task);
+    row = buf;
+    return true;
+  }
+  i -= d.threads.size();
+  if (i >= d.records.size())
+    return false;
+  const TraceRecord &r = d.records[i];
+  double endUs = cyclesToUs(r.endCore, r.endCycles,
+                            (double)r.endTick * portTICK_PERIOD_MS * 1000);
+  double startUs = cyclesToUs(r.startCore, r.startCycles, endUs);
+  if (startUs > endUs)
+    startUs = endUs;
+  snprintf(buf, sizeof(buf),
+           "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,"
+           "\"tid\":%u,\"args\":{\"core\":%u%s}}",
+           r.name, startUs, endUs - startUs, r.tid, r.endCore,
+           r.startCore != r.endCore ? ",\"migrated\":true" : "");
+  row = buf;
+  return true;
+}
+
+void sendTrace(AsyncWebServerRequest *req) {
+  std::shared_ptr<TraceDump> d = std::make_shared<TraceDump>();
+  uint32_t total;
+  portENTER_CRITICAL(&traceMux);
+  total = ringNext;
+  portEXIT_CRITICAL(&traceMux);
+  size_t n = total < TRACE_RING ? total : TRACE_RING;
+  d->records.resize(n);
+  if (ring) {
+    // Copied record by record so writers on the other core are only held
+    // off for one memcpy at a time.
+    for (size_t k = 0; k < n; k++) {
+      portENTER_CRITICAL(&traceMux);
+      d->records[k] = ring[(total - n + k) % TRACE_RING];
+      portEXIT_CRITICAL(&traceMux);
+    }
+  }
+  for (size_t k = 0; k < n; k++) {
+    bool seen = false;
+    for (size_t t : d->threads)
+      if (d->records[t].tid == d->records[k].tid)
+        seen = true;
+    if (!seen)
+      d->threads.push_back(k);
+  }
+
+  JsonDocument other;
+  traceStatsToJson(other.to<JsonObject>());
+  String head = "{\"displayTimeUnit\":\"ns\",\"otherData\":";
+  String stats;
+  serializeJson(other, stats);
+  head += stats;
+  head += ",\"traceEvents\":[";
+  sendJsonRows(req, HeapProbe("/api/trace"), head, "]}",
+               [d](size_t i, String &row) { return traceRow(*d, i, row); });
+}
@@ -0,0 +1,126 @@
+#include "UartTransport.h"
+
+#ifdef AV_HOST_BUILD
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+UartTransport *UartTransport::owner = nullptr;
+
+#ifdef AV_HOST_BUILD
+
+const char *UartTransport::hostPortPath = nullptr;
+
+UartTransport::UartTransport(const char *path) : path(path ? path : "") {}
+
+UartTransport::~UartTransport() { close(); }
+
+bool UartTransport::open(uint32_t baud) {
+  if (owner)
+    return false;
+  fd = ::open(path.c_str(), O_RDWR | O_NOCTTY);
+  if (fd < 0)
+    return false;
+
+  // ptys ignore the line speed; raw mode is what matters.
+  termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    cfsetspeed(&tio, B115200);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+
+  owner = this;
+  isOpen = true;
+  openBaud = baud;
+  stopReader = false;
+  reader = std::thread([this]() {
+    pollfd p{fd, POLLIN, 0};
+    while (!stopReader) {
+      if (poll(&p, 1, 20) > 0 && (p.revents & POLLIN))
+        drain();
+    }
+  });
+  emitConnect(true);
+  return true;
+}
+
+void UartTransport::drain() {
+  uint8_t buf[256];
+  ssize_t n = ::read(fd, buf, sizeof(buf));
+  if (n > 0)
+    emitData(buf, (size_t)n);
+}
+
+size_t UartTransport::write(const uint8_t *data, size_t len) {
+  if (!isOpen)
+    return 0;
+  ssize_t n = ::write(fd, data, len);
+  return n > 0 ? (size_t)n : 0;
+}
+
+void UartTransport::close() {
+  if (!isOpen)
+    return;
+  stopReader = true;
+  if (reader.joinable())
+    reader.join();
+  ::close(fd);
+  fd = -1;
+  isOpen = false;
+  owner = nullptr;
+}
+
+#else
+
+UartTransport::UartTransport(HardwareSerial &port, int8_t rxPin, int8_t txPin)
+    : port(port), rxPin(rxPin), txPin(txPin) {}
+
+UartTransport::~UartTransport() { close(); }
+
+bool UartTransport::open(uint32_t baud) {
+  if (owner)
+    return false;
+  port.setRxBufferSize(2048); // must precede begin()
+  port.begin(baud, SERIAL_8N1, rxPin, txPin);
+  // Deliver as soon as the line goes idle for ~2 symbols instead of waiting
+  // for the default FIFO threshold, which keeps small replies snappy.
+  port.setRxTimeout(2);
+  port.onReceive([this]() { drain(); }, false);
+  owner = this;
+  isOpen = true;
+  openBaud = baud;
+  emitConnect(true);
+  return true;
+}
+
+void UartTransport::drain() {
+  uint8_t buf[256];
+  size_t avail;
+  while ((avail = port.available()) > 0) {
+    size_t n = port.read(buf, avail < sizeof(buf) ? avail : sizeof(buf));
+    if (!n)
+      break;
+    emitData(buf, n);
+  }
+}
+
+size_t UartTransport::write(const uint8_t *data, size_t len) {
+  if (!isOpen)
+    return 0;
+  return port.write(data, len);
+}
+
+void UartTransport::close() {
+  if (!isOpen)
+    return;
+  port.onReceive(nullptr);
+  port.end();
+  isOpen = false;
+  openBaud = 0;
+  owner = nullptr;
+}
+
+#endif
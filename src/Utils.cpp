@@ -1,26 +1,102 @@
 #include "Utils.h"
 #include <Arduino.h>
 
+// Repeats F over 256 consecutive byte values, for lookup tables built at
+// compile time (they stay in flash).
+#define REP4(F, n) F(n), F(n + 1), F(n + 2), F(n + 3)
+#define REP16(F, n) REP4(F, n), REP4(F, n + 4), REP4(F, n + 8), REP4(F, n + 12)
+#define REP64(F, n)                                                            \
+  REP16(F, n), REP16(F, n + 16), REP16(F, n + 32), REP16(F, n + 48)
+#define REP256(F) REP64(F, 0), REP64(F, 64), REP64(F, 128), REP64(F, 192)
+
+#define HEX_DIGIT(n) "0123456789ABCDEF"[(n)&15]
+#define HEX_ENTRY(n)                                                           \
+  { HEX_DIGIT((n) >> 4), HEX_DIGIT(n), ' ' }
+#define ASCII_ENTRY(n) (char)((n) >= 32 && (n) <= 126 ? (n) : '.')
+#define NIB_ENTRY(n)                                                           \
+  (int8_t)((n) >= '0' && (n) <= '9'   ? (n) - '0'                              \
+           : (n) >= 'a' && (n) <= 'f' ? (n) - 'a' + 10                         \
+           : (n) >= 'A' && (n) <= 'F' ? (n) - 'A' + 10                         \
+                                      : -1)
+
+static const char HEX3[256][3] = {REP256(HEX_ENTRY)};
+static const char ASCII_MAP[256] = {REP256(ASCII_ENTRY)};
+static const int8_t NIBBLE[256] = {REP256(NIB_ENTRY)};
+
+size_t hexEncode(const uint8_t *data, size_t len, char *out) {
+  char *o = out;
+  size_t i = 0;
+  // Four input bytes per load; each emits a 3-char "XX " entry.
+  for (; i + 4 <= len; i += 4) {
+    uint32_t w;
+    memcpy(&w, data + i, 4);
+    for (int k = 0; k < 4; k++, w >>= 8, o += 3)
+      memcpy(o, HEX3[w & 0xFF], 3);
+  }
+  for (; i < len; i++, o += 3)
+    memcpy(o, HEX3[data[i]], 3);
+  if (o > out)
+    o--; // no space after the last byte
+  *o = 0;
+  return o - out;
+}
+
+size_t asciiEncode(const uint8_t *data, size_t len, char *out) {
+  size_t i = 0;
+  // Runs of printable bytes are copied a word at a time: a word passes when
+  // no byte is below 0x20 and none is 0x7F or above.
+  for (; i + 4 <= len; i += 4) {
+    uint32_t w;
+    memcpy(&w, data + i, 4);
+    uint32_t low = (w - 0x20202020u) & ~w & 0x80808080u;
+    uint32_t high = ((w + 0x01010101u) | w) & 0x80808080u;
+    if (!(low | high)) {
+      memcpy(out + i, data + i, 4);
+      continue;
+    }
+    for (size_t k = i; k < i + 4; k++)
+      out[k] = ASCII_MAP[data[k]];
+  }
+  for (; i < len; i++)
+    out[i] = ASCII_MAP[data[i]];
+  out[len] = 0;
+  return len;
+}
+
+// Encodes through a stack buffer so the String grows once per chunk.
+static const size_t ENCODE_CHUNK = 64;
+
+void appendHex(String &out, const uint8_t *data, size_t len) {
+  char buf[ENCODE_CHUNK * 3];
+  for (size_t i = 0; i < len; i += ENCODE_CHUNK) {
+    size_t n = len - i < ENCODE_CHUNK ? len - i : ENCODE_CHUNK;
+    if (i)
+      out += ' ';
+    hexEncode(data + i, n, buf);
+    out += buf;
+  }
+}
+
+void appendAscii(String &out, const uint8_t *data, size_t len) {
+  char buf[ENCODE_CHUNK + 1];
+  for (size_t i = 0; i < len; i += ENCODE_CHUNK) {
+    size_t n = len - i < ENCODE_CHUNK ? len - i : ENCODE_CHUNK;
+    asciiEncode(data + i, n, buf);
+    out += buf;
+  }
+}
+
 String bytesToHex(const uint8_t *data, size_t len) {
-  static const char *h = "0123456789ABCDEF";
   String out;
   out.reserve(len * 3);
-  for (size_t i = 0; i < len; i++) {
-    out += h[(data[i] >> 4) & 0xF];
-    out += h[data[i] & 0xF];
-    if (i + 1 < len)
-      out += ' ';
-  }
+  appendHex(out, data, len);
   return out;
 }
 
 String bytesToAscii(const uint8_t *data, size_t len) {
   String out;
   out.reserve(len);
-  for (size_t i = 0; i < len; i++) {
-    char c = (char)data[i];
-    out += (c >= 32 && c <= 126) ? c : '.';
-  }
+  appendAscii(out, data, len);
   return out;
 }
 
@@ -82,30 +158,106 @@ String genId() {
   return String(buf);
 }
 
-bool parseHexBytes(const String &hex, std::vector<uint8_t> &out) {
-  out.clear();
-  auto nib = [](char c) -> int {
-    if (c >= '0' && c <= '9')
-      return c - '0';
-    if (c >= 'a' && c <= 'f')
-      return 10 + (c - 'a');
-    if (c >= 'A' && c <= 'F')
-      return 10 + (c - 'A');
-    return -1;
-  };
-  int i = 0;
-  while (i < (int)hex.length()) {
-    while (i < (int)hex.length() && hex[i] == ' ')
+size_t parseHex(const char *hex, size_t len, uint8_t *out, size_t cap) {
+  size_t n = 0;
+  for (size_t i = 0; i < len;) {
+    if (hex[i] == ' ') {
       i++;
-    if (i >= (int)hex.length())
-      break;
-    if (i + 1 >= (int)hex.length())
-      return false;
-    int n1 = nib(hex[i++]);
-    int n2 = nib(hex[i++]);
-    if (n1 < 0 || n2 < 0)
-      return false;
-    out.push_back((uint8_t)((n1 << 4) | n2));
+      continue;
+    }
+    if (i + 1 >= len || n >= cap)
+      return (size_t)-1;
+    int8_t hi = NIBBLE[(uint8_t)hex[i]];
+    int8_t lo = NIBBLE[(uint8_t)hex[i + 1]];
+    if ((hi | lo) < 0)
+      return (size_t)-1;
+    out[n++] = (uint8_t)((hi << 4) | lo);
+    i += 2;
+  }
+  return n;
+}
+
+bool parseHexBytes(const String &hex, std::vector<uint8_t> &out) {
+  out.resize(hex.length() / 2);
+  size_t n = parseHex(hex.c_str(), hex.length(), out.data(), out.size());
+  if (n == (size_t)-1) {
+    out.clear();
+    return false;
   }
+  out.resize(n);
   return true;
 }
+
+// "\\r" style suffix as stored in config/UI -> the actual bytes.
+String expandSuffix(const String &suffix) {
+  if (suffix == "\\r")
+    return "\r";
+  if (suffix == "\\n")
+    return "\n";
+  if (suffix == "\\r\\n")
+    return "\r\n";
+  return suffix;
+}
+
+// Small backtracking matcher for macro expects: literals, '.', \d, \s,
+// backslash escapes, the '*', '+' and '?' quantifiers, and '^' / '$' anchors.
+static size_t reAtomLen(const char *re) {
+  return (re[0] == '\\' && re[1]) ? 2 : 1;
+}
+
+static bool reAtomMatches(const char *re, char c) {
+  if (re[0] == '\\') {
+    if (re[1] == 'd')
+      return c >= '0' && c <= '9';
+    if (re[1] == 's')
+      return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    return c == re[1];
+  }
+  return re[0] == '.' || re[0] == c;
+}
+
+static const char *reMatchHere(const char *re, const char *text) {
+  if (!*re)
+    return text;
+  if (re[0] == '$' && !re[1])
+    return *text ? nullptr : text;
+
+  size_t al = reAtomLen(re);
+  char q = re[al];
+  if (q == '*' || q == '+' || q == '?') {
+    const char *rest = re + al + 1;
+    size_t maxRep = (q == '?') ? 1 : (size_t)-1;
+    size_t minRep = (q == '+') ? 1 : 0;
+    size_t n = 0;
+    while (text[n] && n < maxRep && reAtomMatches(re, text[n]))
+      n++;
+    for (;; n--) {
+      if (n < minRep)
+        return nullptr;
+      if (const char *e = reMatchHere(rest, text + n))
+        return e;
+      if (!n)
+        return nullptr;
+    }
+  }
+  if (*text && reAtomMatches(re, *text))
+    return reMatchHere(re + al, text + 1);
+  return nullptr;
+}
+
+bool regexSearch(const char *re, const char *text, size_t &matchEnd) {
+  if (re[0] == '^') {
+    const char *e = reMatchHere(re + 1, text);
+    if (e)
+      matchEnd = e - text;
+    return e != nullptr;
+  }
+  for (const char *t = text;; t++) {
+    if (const char *e = reMatchHere(re, t)) {
+      matchEnd = e - text;
+      return true;
+    }
+    if (!*t)
+      return false;
+  }
+}
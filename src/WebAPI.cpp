@@ -8,101 +8,247 @@
 
 #include "AVDiscovery.h"
 #include "CaptureProxy.h"
+#include "ApiCodec.h"
+#include "AssetServer.h"
+#include "BootTiming.h"
 #include "ConfigManager.h"
+#include "JobQueue.h"
+#include "JsonStream.h"
+#include "LogStore.h"
+#include "MacroEngine.h"
+#include "Metrics.h"
+#include "Ota.h"
+#include "SerialBridge.h"
+#include "StateChannel.h"
 #include "TerminalHandler.h"
+#include "Trace.h"
 #include "Utils.h"
 #include "WiFiHelper.h"
+#include "WsBroadcast.h"
 
 extern bool learnEnabled;
 extern uint16_t learnPort;
 
+static void captureToJson(const Capture &c, JsonObject o) {
+  o["id"] = c.id;
+  o["ts"] = c.ts;
+  o["srcIp"] = c.srcIp;
+  o["srcPort"] = c.srcPort;
+  o["localPort"] = c.localPort;
+  o["proto"] = c.proto;
+  o["hex"] = c.hex;
+  o["ascii"] = c.ascii;
+  o["pinned"] = c.pinned;
+  o["repeats"] = c.repeats;
+  o["lastTs"] = c.lastTs;
+  o["suffixHint"] = c.suffixHint;
+  o["payloadType"] = c.payloadType;
+}
+
+// Ids of a batch capture request; false unless `v` is an array of numbers.
+static bool captureIds(JsonVariantConst v, std::vector<uint32_t> &out) {
+  if (!v.is<JsonArrayConst>())
+    return false;
+  for (JsonVariantConst id : v.as<JsonArrayConst>()) {
+    if (!id.is<uint32_t>())
+      return false;
+    out.push_back(id.as<uint32_t>());
+  }
+  return true;
+}
+
+static void sendBatchResult(AsyncWebServerRequest *req, size_t changed,
+                            const std::vector<uint32_t> &missing) {
+  JsonDocument doc;
+  doc["ok"] = true;
+  doc["changed"] = changed;
+  JsonArray arr = doc["missing"].to<JsonArray>();
+  for (uint32_t id : missing)
+    arr.add(id);
+  sendDoc(req, doc);
+}
+
+// Config edits while a filesystem OTA has the store suspended could not be
+// saved, so they are refused rather than kept in RAM only.
+static bool cfgEditRefused(AsyncWebServerRequest *req) {
+  if (!cfgStoreSuspended())
+    return false;
+  req->send(503, "application/json",
+            "{\"error\":\"config store suspended by a filesystem update\"}");
+  return true;
+}
+
+void healthToJson(JsonDocument &doc) {
+  doc["fw"] = FW_VERSION;
+  doc["uptime_s"] = (millis() - bootMs) / 1000;
+  doc["heap_free"] = ESP.getFreeHeap();
+  bootToJson(doc["boot"].to<JsonObject>());
+
+  doc["wifi"]["mode"] = wifiCfg.mode;
+  doc["wifi"]["staConnected"] = (WiFi.status() == WL_CONNECTED);
+  doc["wifi"]["staIp"] = WiFi.localIP().toString();
+  doc["wifi"]["staSsid"] = (WiFi.status() == WL_CONNECTED) ? WiFi.SSID() : "";
+  doc["wifi"]["apIp"] = WiFi.softAPIP().toString();
+  doc["wifi"]["apSsid"] = wifiCfg.apSsid;
+  doc["wifi"]["rssi"] = (WiFi.status() == WL_CONNECTED) ? WiFi.RSSI() : 0;
+  doc["wifi"]["scanning"] = wifiScanRunning();
+
+  doc["learn"]["enabled"] = learnEnabled;
+  doc["learn"]["port"] = learnPort;
+  JsonArray udpPorts = doc["learn"]["udpPorts"].to<JsonArray>();
+  for (auto p : udpLearnPorts)
+    udpPorts.add(p);
+  doc["learn"]["uartBaud"] = learnUartBaud;
+
+  doc["term"]["maxSessions"] = termMaxSessions;
+  termSessionsToJson(doc["term"]["sessions"].to<JsonArray>());
+
+  doc["bridge"]["running"] = bridgeRunning;
+  doc["bridge"]["port"] = bridgePort;
+  doc["bridge"]["baud"] = bridgeBaud;
+  doc["bridge"]["clientConnected"] = bridgeClientConnected();
+  doc["bridge"]["bytesToUart"] = bridgeBytesToUart;
+  doc["bridge"]["bytesFromUart"] = bridgeBytesFromUart;
+
+  doc["proxy"]["running"] = proxyRunning;
+  doc["proxy"]["proto"] = proxyProto;
+  doc["proxy"]["listenPort"] = proxyListenPort;
+  doc["proxy"]["targetHost"] = proxyTargetHost;
+  doc["proxy"]["targetPort"] = proxyTargetPort;
+  doc["proxy"]["captureToLearn"] = proxyCaptureToLearn;
+
+  doc["disc"]["running"] = discRunning;
+  doc["disc"]["progress"] = discProgress;
+
+  cfgStoreStats(doc["cfg"].to<JsonObject>());
+  jobStatsToJson(doc["jobs"].to<JsonObject>());
+}
+
 void setupRoutes() {
+  setupMetrics();
+  if (!setupAssets())
+    logWarn("web", "no /assets.json, serving data/ files uncompressed");
   server.serveStatic("/", LittleFS, "/").setDefaultFile("index.html");
 
   server.on("/api/health", HTTP_GET, [](AsyncWebServerRequest *req) {
     JsonDocument doc;
-    doc["fw"] = FW_VERSION;
-    doc["uptime_s"] = (millis() - bootMs) / 1000;
-    doc["heap_free"] = ESP.getFreeHeap();
-
-    doc["wifi"]["mode"] = wifiCfg.mode;
-    doc["wifi"]["staConnected"] = (WiFi.status() == WL_CONNECTED);
-    doc["wifi"]["staIp"] = WiFi.localIP().toString();
-    doc["wifi"]["staSsid"] = (WiFi.status() == WL_CONNECTED) ? WiFi.SSID() : "";
-    doc["wifi"]["apIp"] = WiFi.softAPIP().toString();
-    doc["wifi"]["apSsid"] = wifiCfg.apSsid;
-    doc["wifi"]["rssi"] = (WiFi.status() == WL_CONNECTED) ? WiFi.RSSI() : 0;
-
-    doc["learn"]["enabled"] = learnEnabled;
-    doc["learn"]["port"] = learnPort;
-
-    doc["term"]["connected"] = termClient.connected();
-    doc["term"]["host"] = termHost;
-    doc["term"]["port"] = termPort;
-
-    doc["proxy"]["running"] = proxyRunning;
-    doc["proxy"]["listenPort"] = proxyListenPort;
-    doc["proxy"]["targetHost"] = proxyTargetHost;
-    doc["proxy"]["targetPort"] = proxyTargetPort;
-    doc["proxy"]["captureToLearn"] = proxyCaptureToLearn;
-
-    doc["disc"]["running"] = discRunning;
-    doc["disc"]["progress"] = discProgress;
-
-    String out;
-    serializeJson(doc, out);
-    req->send(200, "application/json", out);
+    healthToJson(doc);
+    sendDoc(req, doc);
+  });
+
+  // Per-client WebSocket send queue depth, drops and bytes sent.
+  server.on("/api/debug/ws", HTTP_GET, [](AsyncWebServerRequest *req) {
+    JsonDocument doc;
+    wsStatsToJson(doc["channels"].to<JsonArray>());
+    sendDoc(req, doc);
   });
 
-  server.on("/update", HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send(200, "text/html",
-                  "<form method='POST' action='/update' "
-                  "enctype='multipart/form-data'><input type='file' "
-                  "name='update'><input type='submit' value='Update'></form>");
+  // Persisted log records after ?since=<seq>; see LogStore.h.
+  server.on("/api/logs", HTTP_GET, [](AsyncWebServerRequest *req) {
+    uint32_t since =
+        req->hasParam("since") ? req->getParam("since")->value().toInt() : 0;
+    sendStoredLogs(req, since);
   });
 
   server.on(
-      "/update", HTTP_POST,
-      [](AsyncWebServerRequest *request) {
-        shouldReboot = !Update.hasError();
-        AsyncWebServerResponse *response = request->beginResponse(
-            200, "application/json",
-            shouldReboot ? "{\"ok\":true}" : "{\"error\":\"OTA Failed\"}");
-        response->addHeader("Connection", "close");
-        request->send(response);
-      },
-      [](AsyncWebServerRequest *request, String filename, size_t index,
-         uint8_t *data, size_t len, bool final) {
-        if (!index) {
-          int cmd = U_FLASH;
-          if (request->hasParam("type", true)) {
-            String type = request->getParam("type", true)->value();
-            if (type == "fs")
-              cmd = U_SPIFFS;
-          }
-          if (!Update.begin(UPDATE_SIZE_UNKNOWN, cmd)) {
-            Update.printError(Serial);
-          }
+      "/api/log", HTTP_POST, [](AsyncWebServerRequest *req) {}, nullptr,
+      [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
+         size_t) {
+        JsonDocument doc;
+        if (parseBody(req, data, len, doc)) {
+          req->send(400, "application/json", "{\"error\":\"bad json\"}");
+          return;
         }
-        if (!Update.hasError()) {
-          if (Update.write(data, len) != len) {
-            Update.printError(Serial);
-          }
+        LogLevel level;
+        if (!logLevelFromName(doc["level"] | "", level)) {
+          req->send(400, "application/json", "{\"error\":\"bad level\"}");
+          return;
         }
-        if (final) {
-          if (Update.end(true)) {
-            Serial.printf("Update Success: %uB\n", index + len);
-          } else {
-            Update.printError(Serial);
-          }
+        logSetLevel(level);
+        JsonDocument out;
+        logStatsToJson(out.to<JsonObject>());
+        sendDoc(req, out);
+      });
+
+  // Chrome trace-event dump of the span ring; see Trace.h.
+  server.on("/api/trace", HTTP_GET,
+            [](AsyncWebServerRequest *req) { sendTrace(req); });
+
+  server.on(
+      "/api/trace", HTTP_POST, [](AsyncWebServerRequest *req) {}, nullptr,
+      [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
+         size_t) {
+        JsonDocument doc;
+        if (parseBody(req, data, len, doc)) {
+          req->send(400, "application/json", "{\"error\":\"bad json\"}");
+          return;
         }
+        if (doc["clear"] | false)
+          traceClear();
+        if (!doc["enabled"].isNull())
+          traceEnable(doc["enabled"].as<bool>());
+        JsonDocument out;
+        traceStatsToJson(out.to<JsonObject>());
+        sendDoc(req, out);
       });
 
+  // Heap used by the last streamed vs ?buffered=1 response per list route.
+  server.on("/api/debug/heap", HTTP_GET, [](AsyncWebServerRequest *req) {
+    JsonDocument doc;
+    doc["free"] = ESP.getFreeHeap();
+    doc["minFree"] = ESP.getMinFreeHeap();
+    doc["maxAlloc"] = ESP.getMaxAllocHeap();
+    heapStatsToJson(doc["routes"].to<JsonArray>());
+    sendDoc(req, doc);
+  });
+
+  // Size and encode time of the main responses in each codec.
+  server.on("/api/debug/codecs", HTTP_GET, [](AsyncWebServerRequest *req) {
+    static const char *ROUTES[] = {"/api/health", "/api/devices",
+                                   "/api/captures", "/api/config"};
+    static const ApiCodec CODECS[] = {ApiCodec::Json, ApiCodec::MsgPack,
+                                      ApiCodec::Cbor};
+    static const char *NAMES[] = {"json", "msgpack", "cbor"};
+    JsonDocument out;
+    JsonArray arr = out["routes"].to<JsonArray>();
+    for (uint8_t r = 0; r < 4; r++) {
+      JsonDocument doc;
+      if (r == 0) {
+        healthToJson(doc);
+      } else if (r == 1) {
+        JsonArray devs = doc.to<JsonArray>();
+        CfgLock lock;
+        for (auto &d : cfg.devices)
+          deviceToJson(d, devs.add<JsonObject>());
+      } else if (r == 2) {
+        JsonArray list = doc["captures"].to<JsonArray>();
+        CapsLock lock;
+        for (int i = (int)caps.size() - 1; i >= 0; i--)
+          if (!caps[i].deleted)
+            captureToJson(caps[i], list.add<JsonObject>());
+      } else {
+        CfgLock lock;
+        cfgToJson(doc, true);
+      }
+      JsonObject row = arr.add<JsonObject>();
+      row["route"] = ROUTES[r];
+      for (uint8_t c = 0; c < 3; c++) {
+        std::vector<uint8_t> buf;
+        uint32_t t0 = micros();
+        size_t n = encodeDoc(CODECS[c], doc, &buf);
+        row[NAMES[c]]["bytes"] = n;
+        row[NAMES[c]]["us"] = micros() - t0;
+      }
+    }
+    sendDoc(req, out);
+  });
+
+  setupOta();
+
   server.on("/api/rollback", HTTP_POST, [](AsyncWebServerRequest *req) {
     if (Update.canRollBack()) {
       if (Update.rollBack()) {
-        req->send(200, "application/json",
-                  "{\"ok\":true, \"note\":\"Rolled back. Rebooting...\"}");
+        sendOk(req, "Rolled back. Rebooting...");
         shouldReboot = true;
       } else {
         req->send(500, "application/json", "{\"error\":\"Rollback failed\"}");
@@ -116,18 +262,42 @@ void setupRoutes() {
 
   wsLog.onEvent([](AsyncWebSocket *, AsyncWebSocketClient *c, AwsEventType t,
                    void *, uint8_t *, size_t) {
-    if (t == WS_EVT_CONNECT)
-      c->text("log connected");
+    wsClientEvent(wsLog, c, t);
+    if (t != WS_EVT_CONNECT)
+      return;
+    String backlog = logBacklog();
+    if (backlog.length())
+      wsQueueText(wsLog, c->id(), backlog);
+  });
+  // Both are push-only; the handlers only feed the send queues.
+  wsProxy.onEvent([](AsyncWebSocket *, AsyncWebSocketClient *c, AwsEventType t,
+                     void *, uint8_t *, size_t) {
+    wsClientEvent(wsProxy, c, t);
+  });
+  wsDisc.onEvent([](AsyncWebSocket *, AsyncWebSocketClient *c, AwsEventType t,
+                    void *, uint8_t *, size_t) {
+    wsClientEvent(wsDisc, c, t);
   });
   server.addHandler(&wsLog);
   server.addHandler(&wsTerm);
   server.addHandler(&wsProxy);
   server.addHandler(&wsDisc);
+  setupStateChannel();
 
   wsTerm.onEvent([](AsyncWebSocket *, AsyncWebSocketClient *c, AwsEventType t,
                     void *, uint8_t *data, size_t len) {
+    wsClientEvent(wsTerm, c, t);
+    if (t == WS_EVT_CONNECT) {
+      termQueueStatus(c->id());
+      return;
+    }
+    if (t == WS_EVT_DISCONNECT) {
+      termDetach(c->id());
+      return;
+    }
     if (t != WS_EVT_DATA)
       return;
+    TraceScope span("ws /term command");
 
     JsonDocument doc;
     if (deserializeJson(doc, data, len))
@@ -135,65 +305,68 @@ void setupRoutes() {
 
     String action = doc["action"] | "";
     if (action == "connect") {
+      String transport = doc["transport"] | "tcp";
+      if (transport == "uart") {
+        termOpenUart(c->id(), doc["baud"] | 9600);
+        return;
+      }
       String host = doc["host"] | "";
       uint16_t port = doc["port"] | 0;
-      termDisconnect();
+      termCloseLink(c->id());
       IPAddress ip;
       if (!ip.fromString(host)) {
         IPAddress resolved;
         if (WiFi.hostByName(host.c_str(), resolved) != 1) {
-          c->text(R"({"type":"error","msg":"DNS failed"})");
+          wsSendText(wsTerm, c->id(), R"({"type":"error","msg":"DNS failed"})");
           return;
         }
         ip = resolved;
       }
-      termClient.setTimeout(1500);
-      if (!termClient.connect(ip, port)) {
-        c->text(R"({"type":"error","msg":"Connect failed"})");
-        return;
-      }
-      termConnected = true;
-      termHost = ip.toString();
-      termPort = port;
-      termSendStatus();
-      logAll("Terminal connected to " + termHost + ":" + String(termPort));
+      termOpenTcp(c->id(), ip, port);
       return;
     }
 
     if (action == "disconnect") {
-      termDisconnect();
-      logAll("Terminal disconnected");
+      termCloseLink(c->id());
+      termSendStatus(c->id());
+      return;
+    }
+
+    if (action == "attach") {
+      if (!termAttach(c->id(), doc["sid"] | 0))
+        termSendStatus(c->id());
+      return;
+    }
+
+    if (action == "history") {
+      termHistory(c->id(), doc["before"] | 0, doc["count"] | 32);
       return;
     }
 
     if (action == "send") {
-      if (!termClient.connected()) {
-        c->text(R"({"type":"error","msg":"Not connected"})");
-        return;
-      }
       String mode = doc["mode"] | "ascii";
       String payload = doc["data"] | "";
       String suffix = doc["suffix"] | "";
       if (mode == "hex") {
         std::vector<uint8_t> bytes;
         if (!parseHexBytes(payload, bytes)) {
-          c->text(R"({"type":"error","msg":"Bad hex"})");
+          wsSendText(wsTerm, c->id(), R"({"type":"error","msg":"Bad hex"})");
+          return;
+        }
+        if (!termSend(c->id(), bytes.data(), bytes.size())) {
+          wsSendText(wsTerm, c->id(),
+                     R"({"type":"error","msg":"Not connected"})");
           return;
         }
-        termClient.write(bytes.data(), bytes.size());
       } else {
-        String out = payload;
-        if (suffix == "\\r")
-          out += "\r";
-        else if (suffix == "\\n")
-          out += "\n";
-        else if (suffix == "\\r\\n")
-          out += "\r\n";
-        else if (suffix.length())
-          out += suffix;
-        termClient.print(out);
+        String out = payload + expandSuffix(suffix);
+        if (!termSend(c->id(), (const uint8_t *)out.c_str(), out.length())) {
+          wsSendText(wsTerm, c->id(),
+                     R"({"type":"error","msg":"Not connected"})");
+          return;
+        }
       }
-      c->text(R"({"type":"tx","ok":true})");
+      wsSendText(wsTerm, c->id(), R"({"type":"tx","ok":true})");
       return;
     }
   });
@@ -201,58 +374,97 @@ void setupRoutes() {
   server.on("/api/ping", HTTP_GET, [](AsyncWebServerRequest *req) {
     String host =
         req->hasParam("host") ? req->getParam("host")->value() : "8.8.8.8";
-    bool ret = Ping.ping(host.c_str(), 1);
+    uint32_t id = jobSubmit("ping", [host](JsonDocument &doc, String &) {
+      bool ret = Ping.ping(host.c_str(), 1);
+      doc["host"] = host;
+      doc["ok"] = ret;
+      doc["avg_time_ms"] = Ping.averageTime();
+    });
+    sendJobAccepted(req, id);
+  });
+
+  // /api/jobs lists recent jobs and stats; /api/jobs/<id> is one job (the
+  // handler also matches "<uri>/..." paths).
+  server.on("/api/jobs", HTTP_GET, [](AsyncWebServerRequest *req) {
+    String url = req->url();
     JsonDocument doc;
-    doc["host"] = host;
-    doc["ok"] = ret;
-    doc["avg_time_ms"] = Ping.averageTime();
-    String out;
-    serializeJson(doc, out);
-    req->send(200, "application/json", out);
+    if (url.length() > 10) {
+      if (!jobToJson(url.substring(10).toInt(), doc.to<JsonObject>())) {
+        req->send(404, "application/json", "{\"error\":\"not found\"}");
+        return;
+      }
+    } else {
+      jobListToJson(doc["jobs"].to<JsonArray>());
+      jobStatsToJson(doc["stats"].to<JsonObject>());
+    }
+    sendDoc(req, doc);
   });
 
   server.on("/api/ssdp/scan", HTTP_GET, [](AsyncWebServerRequest *req) {
-    WiFiUDP udp;
-    udp.begin(0);
-    const char *msg =
-        "M-SEARCH * HTTP/1.1\r\nHOST: 239.255.255.250:1900\r\nMAN: "
-        "\"ssdp:discover\"\r\nMX: 1\r\nST: ssdp:all\r\n\r\n";
-    udp.beginPacket("239.255.255.250", 1900);
-    udp.write((const uint8_t *)msg, strlen(msg));
-    udp.endPacket();
-
-    uint32_t start = millis();
-    JsonDocument doc;
-    JsonArray arr = doc.to<JsonArray>();
-    while (millis() - start < 2000) {
-      int len = udp.parsePacket();
-      if (len > 0) {
-        String s;
-        while (udp.available())
-          s += (char)udp.read();
-        JsonObject o = arr.add<JsonObject>();
-        o["ip"] = udp.remoteIP().toString();
-        int locIdx = s.indexOf("LOCATION:");
-        if (locIdx < 0)
-          locIdx = s.indexOf("Location:");
-        if (locIdx >= 0) {
-          int eq = locIdx + 9;
-          int end = s.indexOf("\r", eq);
-          o["loc"] = s.substring(eq, end);
-          o["loc"].as<String>().trim();
+    uint32_t id = jobSubmit("ssdp", [](JsonDocument &doc, String &) {
+      WiFiUDP udp;
+      udp.begin(0);
+      const char *msg =
+          "M-SEARCH * HTTP/1.1\r\nHOST: 239.255.255.250:1900\r\nMAN: "
+          "\"ssdp:discover\"\r\nMX: 1\r\nST: ssdp:all\r\n\r\n";
+      udp.beginPacket("239.255.255.250", 1900);
+      udp.write((const uint8_t *)msg, strlen(msg));
+      udp.endPacket();
+
+      uint32_t start = millis();
+      JsonArray arr = doc.to<JsonArray>();
+      while (millis() - start < 2000) {
+        int len = udp.parsePacket();
+        if (len > 0) {
+          String s;
+          while (udp.available())
+            s += (char)udp.read();
+          JsonObject o = arr.add<JsonObject>();
+          o["ip"] = udp.remoteIP().toString();
+          int locIdx = s.indexOf("LOCATION:");
+          if (locIdx < 0)
+            locIdx = s.indexOf("Location:");
+          if (locIdx >= 0) {
+            int eq = locIdx + 9;
+            int end = s.indexOf("\r", eq);
+            String loc = s.substring(eq, end);
+            loc.trim();
+            o["loc"] = loc;
+          }
         }
+        delay(10);
       }
-      delay(10);
-    }
-    String out;
-    serializeJson(doc, out);
-    req->send(200, "application/json", out);
+    });
+    sendJobAccepted(req, id);
   });
 
   server.on("/api/wifi/scan", HTTP_GET, [](AsyncWebServerRequest *req) {
-    bool fresh =
-        req->hasParam("fresh") && req->getParam("fresh")->value() == "1";
-    req->send(200, "application/json", doScan(fresh));
+    // Always answers from the cache; fresh=1 starts an async scan whose
+    // progress shows up as "scanning" here and in /wsstate.
+    if (req->hasParam("fresh") && req->getParam("fresh")->value() == "1") {
+      std::vector<uint8_t> channels;
+      if (req->hasParam("channels")) {
+        String list = req->getParam("channels")->value();
+        int from = 0;
+        while (from < (int)list.length()) {
+          int comma = list.indexOf(',', from);
+          if (comma < 0)
+            comma = list.length();
+          long ch = list.substring(from, comma).toInt();
+          if (ch < 1 || ch > 14) {
+            req->send(400, "application/json",
+                      "{\"error\":\"channels must be 1-14\"}");
+            return;
+          }
+          channels.push_back((uint8_t)ch);
+          from = comma + 1;
+        }
+      }
+      startWifiScan(channels);
+    }
+    JsonDocument doc;
+    wifiScanToJson(doc);
+    sendDoc(req, doc);
   });
 
   server.on("/api/wifi", HTTP_GET, [](AsyncWebServerRequest *req) {
@@ -261,9 +473,7 @@ void setupRoutes() {
     doc["staSsid"] = wifiCfg.staSsid;
     doc["apSsid"] = wifiCfg.apSsid;
     doc["apChan"] = wifiCfg.apChan;
-    String out;
-    serializeJson(doc, out);
-    req->send(200, "application/json", out);
+    sendDoc(req, doc);
   });
 
   server.on(
@@ -271,7 +481,7 @@ void setupRoutes() {
       [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
          size_t) {
         JsonDocument doc;
-        if (deserializeJson(doc, data, len)) {
+        if (parseBody(req, data, len, doc)) {
           req->send(400, "application/json", "{\"error\":\"bad json\"}");
           return;
         }
@@ -291,8 +501,7 @@ void setupRoutes() {
         if (doc["apChan"].is<uint8_t>())
           wifiCfg.apChan = doc["apChan"].as<uint8_t>();
         saveWifi();
-        req->send(200, "application/json",
-                  "{\"ok\":true,\"note\":\"reboot required\"}");
+        sendOk(req, "reboot required");
       });
 
   server.on("/api/wifi/forget", HTTP_POST, [](AsyncWebServerRequest *req) {
@@ -302,8 +511,7 @@ void setupRoutes() {
     saveWifi();
     WiFi.disconnect(true, true);
     WiFi.mode(WIFI_AP);
-    req->send(200, "application/json",
-              "{\"ok\":true,\"note\":\"Forget OK. Rebooting...\"}");
+    sendOk(req, "Forget OK. Rebooting...");
     shouldReboot = true;
   });
 
@@ -314,7 +522,7 @@ void setupRoutes() {
       return;
     }
     startDisc();
-    req->send(200, "application/json", "{\"ok\":true}");
+    sendOk(req);
   });
 
   server.on(
@@ -323,7 +531,7 @@ void setupRoutes() {
       [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
          size_t) {
         JsonDocument doc;
-        if (deserializeJson(doc, data, len)) {
+        if (parseBody(req, data, len, doc)) {
           req->send(400, "application/json", "{\"error\":\"bad json\"}");
           return;
         }
@@ -347,22 +555,36 @@ void setupRoutes() {
         bool ok = true; // startDiscovery implementation needed
         // For now, call the one we have
         startDisc();
-        req->send(200, "application/json", "{\"ok\":true}");
+        stateNotify();
+        sendOk(req);
       });
 
   server.on("/api/discovery/results", HTTP_GET, [](AsyncWebServerRequest *req) {
-    JsonDocument doc;
-    doc["running"] = discRunning;
-    doc["progress"] = discProgress;
-    JsonArray arr = doc["results"].to<JsonArray>();
-    for (auto &line : discFound) {
-      JsonDocument row;
-      if (!deserializeJson(row, line))
-        arr.add(row.as<JsonObject>());
+    HeapProbe probe("/api/discovery/results");
+    if (wantBuffered(req)) {
+      JsonDocument doc;
+      doc["running"] = discRunning;
+      doc["progress"] = discProgress;
+      JsonArray arr = doc["results"].to<JsonArray>();
+      DiscLock lock;
+      for (auto &line : discFound) {
+        JsonDocument row;
+        if (!deserializeJson(row, line))
+          arr.add(row.as<JsonObject>());
+      }
+      sendJsonBuffered(req, probe, doc);
+      return;
     }
-    String out;
-    serializeJson(doc, out);
-    req->send(200, "application/json", out);
+    // Rows are already serialized, so they go out verbatim.
+    String head = String("{\"running\":") + (discRunning ? "true" : "false") +
+                  ",\"progress\":" + String(discProgress) + ",\"results\":[";
+    sendJsonRows(req, probe, head, "]}", [](size_t i, String &row) {
+      DiscLock lock;
+      if (i >= discFound.size())
+        return false;
+      row = discFound[i];
+      return true;
+    });
   });
 
   server.on("/api/captures", HTTP_GET, [](AsyncWebServerRequest *req) {
@@ -370,31 +592,43 @@ void setupRoutes() {
         req->hasParam("filter") ? req->getParam("filter")->value() : "";
     bool pinnedOnly =
         req->hasParam("pinned") && req->getParam("pinned")->value() == "1";
-    JsonDocument doc;
-    JsonArray arr = doc["captures"].to<JsonArray>();
-    for (int i = (int)caps.size() - 1; i >= 0; i--) {
-      const auto &c = caps[i];
-      if (pinnedOnly && !c.pinned)
-        continue;
-      if (filter.length() && c.srcIp.indexOf(filter) < 0)
-        continue;
-      JsonObject o = arr.add<JsonObject>();
-      o["id"] = c.id;
-      o["ts"] = c.ts;
-      o["srcIp"] = c.srcIp;
-      o["srcPort"] = c.srcPort;
-      o["localPort"] = c.localPort;
-      o["hex"] = c.hex;
-      o["ascii"] = c.ascii;
-      o["pinned"] = c.pinned;
-      o["repeats"] = c.repeats;
-      o["lastTs"] = c.lastTs;
-      o["suffixHint"] = c.suffixHint;
-      o["payloadType"] = c.payloadType;
+    auto keep = [filter, pinnedOnly](const Capture &c) {
+      if (c.deleted || (pinnedOnly && !c.pinned))
+        return false;
+      return !filter.length() || c.srcIp.indexOf(filter) >= 0;
+    };
+    HeapProbe probe("/api/captures");
+    if (wantBuffered(req)) {
+      JsonDocument doc;
+      JsonArray arr = doc["captures"].to<JsonArray>();
+      CapsLock lock;
+      for (int i = (int)caps.size() - 1; i >= 0; i--)
+        if (keep(caps[i]))
+          captureToJson(caps[i], arr.add<JsonObject>());
+      sendJsonBuffered(req, probe, doc);
+      return;
+    }
+    // Newest first. `next` counts in capsEvicted terms, so captures arriving
+    // mid-stream are skipped and ones evicted mid-stream end the list.
+    uint32_t next;
+    {
+      CapsLock lock;
+      next = capsEvicted + caps.size();
     }
-    String out;
-    serializeJson(doc, out);
-    req->send(200, "application/json", out);
+    sendJsonRows(req, probe, "{\"captures\":[", "]}",
+                 [keep, next](size_t, String &row) mutable {
+                   CapsLock lock;
+                   while (next > capsEvicted) {
+                     const Capture &c = caps[--next - capsEvicted];
+                     if (!keep(c))
+                       continue;
+                     JsonDocument doc;
+                     captureToJson(c, doc.to<JsonObject>());
+                     serializeJson(doc, row);
+                     return true;
+                   }
+                   return false;
+                 });
   });
 
   server.on(
@@ -402,47 +636,163 @@ void setupRoutes() {
       [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
          size_t) {
         JsonDocument doc;
-        if (deserializeJson(doc, data, len)) {
+        if (parseBody(req, data, len, doc)) {
           req->send(400, "application/json", "{\"error\":\"bad json\"}");
           return;
         }
-        String id = doc["id"] | "";
-        bool pin = doc["pin"] | true;
-        for (auto &c : caps)
-          if (c.id == id) {
-            c.pinned = pin;
-            break;
-          }
-        req->send(200, "application/json", "{\"ok\":true}");
+        std::vector<uint32_t> ids(1, doc["id"] | 0u), missing;
+        pinCaptures(ids, doc["pin"] | true, missing);
+        sendOk(req);
+      });
+
+  // Batch edits by id: {"ids":[...],"pin":bool} and {"ids":[...]}.
+  // Answer {"ok":true,"changed":n,"missing":[ids not found]}.
+  server.on(
+      "/api/captures/pin", HTTP_POST, [](AsyncWebServerRequest *req) {},
+      nullptr,
+      [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
+         size_t) {
+        JsonDocument doc;
+        std::vector<uint32_t> ids, missing;
+        if (parseBody(req, data, len, doc) || !captureIds(doc["ids"], ids)) {
+          req->send(400, "application/json", "{\"error\":\"bad json\"}");
+          return;
+        }
+        size_t n = pinCaptures(ids, doc["pin"] | true, missing);
+        sendBatchResult(req, n, missing);
+      });
+
+  server.on(
+      "/api/captures/delete", HTTP_POST, [](AsyncWebServerRequest *req) {},
+      nullptr,
+      [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
+         size_t) {
+        JsonDocument doc;
+        std::vector<uint32_t> ids, missing;
+        if (parseBody(req, data, len, doc) || !captureIds(doc["ids"], ids)) {
+          req->send(400, "application/json", "{\"error\":\"bad json\"}");
+          return;
+        }
+        size_t n = deleteCaptures(ids, missing);
+        sendBatchResult(req, n, missing);
       });
 
   server.on("/api/config", HTTP_GET, [](AsyncWebServerRequest *req) {
-    req->send(200, "application/json", cfgJson);
+    HeapProbe probe("/api/config");
+    if (wantBuffered(req)) {
+      JsonDocument doc;
+      {
+        CfgLock lock;
+        cfgToJson(doc, responseCodec(req) != ApiCodec::Json);
+      }
+      sendJsonBuffered(req, probe, doc);
+      return;
+    }
+    // One device or template per part. If the config is replaced mid-send
+    // the response ends with the abort marker rather than mixing versions.
+    uint32_t version;
+    {
+      CfgLock lock;
+      version = cfg.version;
+    }
+    size_t dev = 0, tpl = 0;
+    uint8_t phase = 0;
+    sendJsonParts(req, probe, [=](String &part) mutable {
+      CfgLock lock;
+      if (cfg.version != version)
+        return jsonStreamAbort(part);
+      switch (phase) {
+      case 0:
+        part = "{";
+        if (cfg.extra.length() > 2) // members of the serialized object
+          part += cfg.extra.substring(1, cfg.extra.length() - 1) + ",";
+        part += "\"devices\":[";
+        phase++;
+        return true;
+      case 1:
+        if (dev < cfg.devices.size()) {
+          JsonDocument doc;
+          deviceToJson(cfg.devices[dev], doc.to<JsonObject>());
+          String row;
+          serializeJson(doc, row);
+          part = dev++ ? "," : "";
+          part += row;
+          return true;
+        }
+        part = "],\"templates\":[";
+        phase++;
+        return true;
+      case 2:
+        if (tpl < cfg.templates.size()) {
+          part = tpl ? "," : "";
+          part += cfg.templates[tpl++].json;
+          return true;
+        }
+        part = "]}";
+        phase++;
+        return true;
+      default:
+        return false;
+      }
+    });
   });
 
   server.on(
       "/api/config", HTTP_POST, [](AsyncWebServerRequest *req) {}, nullptr,
       [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
          size_t) {
-        JsonDocument tmp;
-        if (deserializeJson(tmp, data, len)) {
+        if (cfgEditRefused(req))
+          return;
+        bool ok;
+        if (requestCodec(req) == ApiCodec::Json) {
+          ok = cfgFromJson((const char *)data, len);
+        } else {
+          JsonDocument doc;
+          String json;
+          ok = !parseBody(req, data, len, doc);
+          if (ok) {
+            serializeJson(doc, json);
+            ok = cfgFromJson(json.c_str(), json.length());
+          }
+        }
+        if (!ok) {
           req->send(400, "application/json", "{\"error\":\"bad json\"}");
           return;
         }
-        cfgJson = String((const char *)data).substring(0, len);
-        saveCfg();
-        req->send(200, "application/json", "{\"ok\":true}");
+        stateNotify();
+        sendOk(req);
       });
 
   server.on("/api/devices", HTTP_GET, [](AsyncWebServerRequest *req) {
-    JsonDocument doc;
-    if (deserializeJson(doc, cfgJson)) {
-      req->send(500, "application/json", "{\"error\":\"cfg parse\"}");
+    HeapProbe probe("/api/devices");
+    if (wantBuffered(req)) {
+      JsonDocument doc;
+      JsonArray arr = doc.to<JsonArray>();
+      {
+        CfgLock lock;
+        for (auto &d : cfg.devices)
+          deviceToJson(d, arr.add<JsonObject>());
+      }
+      sendJsonBuffered(req, probe, doc);
       return;
     }
-    String out;
-    serializeJson(doc["devices"], out);
-    req->send(200, "application/json", out);
+    uint32_t version;
+    {
+      CfgLock lock;
+      version = cfg.version;
+    }
+    // Aborts, never ends the list early, if the config changes mid-send.
+    sendJsonRows(req, probe, "[", "]", [version](size_t i, String &row) {
+      CfgLock lock;
+      if (cfg.version != version)
+        return jsonStreamAbort(row);
+      if (i >= cfg.devices.size())
+        return false;
+      JsonDocument doc;
+      deviceToJson(cfg.devices[i], doc.to<JsonObject>());
+      serializeJson(doc, row);
+      return true;
+    });
   });
 
   server.on("/api/devices/status", HTTP_GET, [](AsyncWebServerRequest *req) {
@@ -456,9 +806,7 @@ void setupRoutes() {
       o["ip"] = s.lastIp;
       o["port"] = s.lastPort;
     }
-    String out;
-    serializeJson(doc, out);
-    req->send(200, "application/json", out);
+    sendDoc(req, doc);
   });
 
   server.on(
@@ -466,7 +814,7 @@ void setupRoutes() {
       [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
          size_t) {
         JsonDocument d;
-        if (deserializeJson(d, data, len)) {
+        if (parseBody(req, data, len, d)) {
           req->send(400, "application/json", "{\"error\":\"bad json\"}");
           return;
         }
@@ -482,13 +830,16 @@ void setupRoutes() {
           req->send(400, "application/json", "{\"error\":\"missing ip\"}");
           return;
         }
+        if (cfgEditRefused(req))
+          return;
         if (!updateCfgWithDevice(name, ip, portHint, suffixHint, notes,
                                  templateId, payloadType, mac)) {
           req->send(500, "application/json",
                     "{\"error\":\"cfg update failed\"}");
           return;
         }
-        req->send(200, "application/json", "{\"ok\":true}");
+        stateNotify();
+        sendOk(req);
       });
 
   server.on(
@@ -497,15 +848,19 @@ void setupRoutes() {
       [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
          size_t) {
         JsonDocument doc;
-        if (deserializeJson(doc, data, len)) {
+        if (parseBody(req, data, len, doc)) {
           req->send(400, "application/json", "{\"error\":\"bad json\"}");
           return;
         }
         String id = doc["id"] | "";
-        if (removeDevice(id))
-          req->send(200, "application/json", "{\"ok\":true}");
-        else
+        if (cfgEditRefused(req))
+          return;
+        if (removeDevice(id)) {
+          stateNotify();
+          sendOk(req);
+        } else {
           req->send(404, "application/json", "{\"error\":\"not found\"}");
+        }
       });
 
   server.on(
@@ -513,7 +868,7 @@ void setupRoutes() {
       [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
          size_t) {
         JsonDocument doc;
-        if (deserializeJson(doc, data, len)) {
+        if (parseBody(req, data, len, doc)) {
           req->send(400, "application/json", "{\"error\":\"bad json\"}");
           return;
         }
@@ -525,12 +880,11 @@ void setupRoutes() {
                     "{\"error\":\"missing ip or cmd\"}");
           return;
         }
-        String resp = pjlinkCmd(ip, pass, cmd);
-        JsonDocument res;
-        res["response"] = resp;
-        String out;
-        serializeJson(res, out);
-        req->send(200, "application/json", out);
+        uint32_t id = jobSubmit("pjlink", [ip, pass, cmd](JsonDocument &res,
+                                                           String &) {
+          res["response"] = pjlinkCmd(ip, pass, cmd);
+        });
+        sendJobAccepted(req, id);
       });
 
   server.on(
@@ -538,25 +892,25 @@ void setupRoutes() {
       [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
          size_t) {
         JsonDocument doc;
-        if (deserializeJson(doc, data, len)) {
+        if (parseBody(req, data, len, doc)) {
           req->send(400, "application/json", "{\"error\":\"bad json\"}");
           return;
         }
         String service = doc["service"] | "_http";
         String proto = doc["proto"] | "tcp";
-        int n = MDNS.queryService(service.c_str(), proto.c_str());
-        JsonDocument res;
-        res["count"] = n;
-        JsonArray arr = res["results"].to<JsonArray>();
-        for (int i = 0; i < n; ++i) {
-          JsonObject o = arr.add<JsonObject>();
-          o["hostname"] = MDNS.hostname(i);
-          o["ip"] = MDNS.IP(i).toString();
-          o["port"] = MDNS.port(i);
-        }
-        String out;
-        serializeJson(res, out);
-        req->send(200, "application/json", out);
+        uint32_t id = jobSubmit("mdns", [service, proto](JsonDocument &res,
+                                                         String &) {
+          int n = MDNS.queryService(service.c_str(), proto.c_str());
+          res["count"] = n;
+          JsonArray arr = res["results"].to<JsonArray>();
+          for (int i = 0; i < n; ++i) {
+            JsonObject o = arr.add<JsonObject>();
+            o["hostname"] = MDNS.hostname(i);
+            o["ip"] = MDNS.IP(i).toString();
+            o["port"] = MDNS.port(i);
+          }
+        });
+        sendJobAccepted(req, id);
       });
 
   server.on(
@@ -564,13 +918,13 @@ void setupRoutes() {
       [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
          size_t) {
         JsonDocument doc;
-        if (deserializeJson(doc, data, len)) {
+        if (parseBody(req, data, len, doc)) {
           req->send(400, "application/json", "{\"error\":\"bad json\"}");
           return;
         }
         String mac = doc["mac"] | "";
         sendWol(mac);
-        req->send(200, "application/json", "{\"ok\":true}");
+        sendOk(req);
       });
 
   server.on(
@@ -578,34 +932,125 @@ void setupRoutes() {
       [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
          size_t) {
         JsonDocument doc;
-        if (deserializeJson(doc, data, len)) {
+        if (parseBody(req, data, len, doc)) {
           req->send(400, "application/json", "{\"error\":\"bad json\"}");
           return;
         }
+        String proto = doc["proto"] | "tcp";
+        String targetHost = doc["targetHost"] | "";
+        if (proto != "udp")
+          proto = "tcp";
+        // The UART target is only bridged to the TCP listener.
+        if (proto == "udp" && targetHost == "uart") {
+          req->send(400, "application/json",
+                    "{\"error\":\"udp proxy needs a network target\"}");
+          return;
+        }
         proxyListenPort = doc["listenPort"] | proxyListenPort;
-        proxyTargetHost = (const char *)(doc["targetHost"] | "");
+        proxyTargetHost = targetHost;
         proxyTargetPort = doc["targetPort"] | 0;
+        proxyTargetBaud = doc["targetBaud"] | proxyTargetBaud;
         proxyCaptureToLearn = doc["captureToLearn"] | false;
+        proxyProto = proto;
         proxyStart();
-        req->send(200, "application/json", "{\"ok\":true}");
+        stateNotify();
+        sendOk(req);
       });
 
   server.on("/api/proxy/stop", HTTP_POST, [](AsyncWebServerRequest *req) {
     proxyStop();
-    req->send(200, "application/json", "{\"ok\":true}");
+    stateNotify();
+    sendOk(req);
+  });
+
+  server.on(
+      "/api/term/config", HTTP_POST, [](AsyncWebServerRequest *req) {},
+      nullptr,
+      [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
+         size_t) {
+        JsonDocument doc;
+        if (parseBody(req, data, len, doc)) {
+          req->send(400, "application/json", "{\"error\":\"bad json\"}");
+          return;
+        }
+        uint8_t maxSessions = doc["maxSessions"] | termMaxSessions;
+        if (maxSessions < 1 || maxSessions > 8) {
+          req->send(400, "application/json",
+                    "{\"error\":\"maxSessions must be 1-8\"}");
+          return;
+        }
+        termMaxSessions = maxSessions;
+        saveTermCfg();
+        stateNotify();
+        sendOk(req);
+      });
+
+  server.on(
+      "/api/bridge", HTTP_POST, [](AsyncWebServerRequest *req) {}, nullptr,
+      [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
+         size_t) {
+        JsonDocument doc;
+        if (parseBody(req, data, len, doc)) {
+          req->send(400, "application/json", "{\"error\":\"bad json\"}");
+          return;
+        }
+        bridgePort = doc["port"] | bridgePort;
+        bridgeBaud = doc["baud"] | bridgeBaud;
+        if (!(doc["enabled"] | false)) {
+          bridgeStop();
+          stateNotify();
+          sendOk(req);
+          return;
+        }
+        if (!bridgeStart()) {
+          req->send(409, "application/json", "{\"error\":\"UART busy\"}");
+          return;
+        }
+        stateNotify();
+        sendOk(req);
+      });
+
+  server.on(
+      "/api/macro/run", HTTP_POST, [](AsyncWebServerRequest *req) {},
+      nullptr,
+      [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
+         size_t) {
+        JsonDocument doc;
+        if (parseBody(req, data, len, doc)) {
+          req->send(400, "application/json", "{\"error\":\"bad json\"}");
+          return;
+        }
+        String err;
+        uint32_t id = macroStart(doc["deviceId"] | "", doc["macro"] | "", err);
+        JsonDocument res;
+        if (!id)
+          res["error"] = err;
+        else
+          res["runId"] = id;
+        sendDoc(req, res, id ? 200 : 400);
+      });
+
+  server.on("/api/macro/status", HTTP_GET, [](AsyncWebServerRequest *req) {
+    uint32_t id =
+        req->hasParam("id") ? req->getParam("id")->value().toInt() : 0;
+    JsonDocument doc;
+    if (!macroRunToJson(id, doc.to<JsonObject>())) {
+      req->send(404, "application/json", "{\"error\":\"not found\"}");
+      return;
+    }
+    sendDoc(req, doc);
   });
 
   server.on("/api/reboot", HTTP_POST, [](AsyncWebServerRequest *req) {
-    req->send(200, "application/json", "{\"ok\":true}");
-    delay(200);
-    ESP.restart();
+    sendOk(req);
+    shouldReboot = true; // loop() restarts once the reply is out
   });
   server.on(
       "/api/learner", HTTP_POST, [](AsyncWebServerRequest *req) {}, nullptr,
       [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t,
          size_t) {
         JsonDocument doc;
-        if (deserializeJson(doc, data, len)) {
+        if (parseBody(req, data, len, doc)) {
           req->send(400, "application/json", "{\"error\":\"bad json\"}");
           return;
         }
@@ -613,39 +1058,36 @@ void setupRoutes() {
           learnEnabled = doc["enabled"];
         if (doc.containsKey("port"))
           learnPort = doc["port"];
+        if (doc.containsKey("uartBaud"))
+          learnUartBaud = doc["uartBaud"];
+        if (doc["udpPorts"].is<JsonArray>()) {
+          udpLearnPorts.clear();
+          for (JsonVariant v : doc["udpPorts"].as<JsonArray>()) {
+            uint16_t p = v.as<uint16_t>();
+            if (p > 0)
+              udpLearnPorts.push_back(p);
+          }
+        }
 
-        // If enabling, we might want to ensure the server is restarted or
-        // relevant logic applied, but for now just updating globals as
-        // requested.
-        req->send(200, "application/json", "{\"ok\":true}");
+        startLearn();
+        stateNotify();
+        sendOk(req);
       });
 
   server.on("/api/capture/get", HTTP_GET, [](AsyncWebServerRequest *req) {
-    String id = req->hasParam("id") ? req->getParam("id")->value() : "";
+    uint32_t id =
+        req->hasParam("id") ? req->getParam("id")->value().toInt() : 0;
     JsonDocument doc;
     bool found = false;
-    for (const auto &c : caps) {
-      if (c.id == id) {
-        doc["id"] = c.id;
-        doc["ts"] = c.ts;
-        doc["srcIp"] = c.srcIp;
-        doc["srcPort"] = c.srcPort;
-        doc["localPort"] = c.localPort;
-        doc["hex"] = c.hex;
-        doc["ascii"] = c.ascii;
-        doc["pinned"] = c.pinned;
-        doc["repeats"] = c.repeats;
-        doc["lastTs"] = c.lastTs;
-        doc["suffixHint"] = c.suffixHint;
-        doc["payloadType"] = c.payloadType;
+    {
+      CapsLock lock;
+      if (const Capture *c = findCaptureLocked(id)) {
+        captureToJson(*c, doc.to<JsonObject>());
         found = true;
-        break;
       }
     }
     if (found) {
-      String out;
-      serializeJson(doc, out);
-      req->send(200, "application/json", out);
+      sendDoc(req, doc);
     } else {
       req->send(404, "application/json", "{\"error\":\"not found\"}");
     }
@@ -654,6 +1096,7 @@ void setupRoutes() {
   server.on("/api/discovery/stop", HTTP_POST, [](AsyncWebServerRequest *req) {
     discRunning = false;
     // We might want to give it a moment or rely on the loop checking the flag
-    req->send(200, "application/json", "{\"ok\":true}");
+    stateNotify();
+    sendOk(req);
   });
 }
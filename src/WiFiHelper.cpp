@@ -1,11 +1,53 @@
 #include "WiFiHelper.h"
-#include <ArduinoJson.h>
+#include "BootTiming.h"
+#include "StateChannel.h"
+#include <algorithm>
 #include <esp_wifi.h>
 
 WifiCfg wifiCfg;
-static String lastScanJson =
-    R"({"networks":[],"count":0,"note":"No scan yet"})";
-static uint32_t lastScanMs = 0;
+
+struct ScanEntry {
+  uint8_t bssid[6];
+  String ssid;
+  int8_t rssi;
+  uint8_t chan;
+  bool open;
+  uint32_t seenMs;
+};
+
+static const size_t SCAN_CACHE_MAX = 48;
+static const uint32_t SCAN_MAX_AGE_MS = 120000; // unseen this long: gone
+static const uint32_t SCAN_MS_PER_CHAN = 300;
+
+static SemaphoreHandle_t scanMutex = xSemaphoreCreateMutex();
+struct ScanLock {
+  ScanLock() { xSemaphoreTake(scanMutex, portMAX_DELAY); }
+  ~ScanLock() { xSemaphoreGive(scanMutex); }
+};
+
+// All guarded by ScanLock.
+static std::vector<ScanEntry> scanCache;
+static std::vector<uint8_t> scanQueue; // channels left, last first; 0 = all
+static bool scanning = false;
+static bool scanSwitchedMode = false; // went AP -> AP+STA for this scan
+static uint32_t scanDoneMs = 0;
+static uint16_t scanSeen = 0; // BSSIDs reported by the current scan
+static String scanNote = "No scan yet";
+
+// Fast connect: the BSSID and channel of the last association, so boot can
+// join directly instead of scanning every channel first. Only used for the
+// SSID they were learned on; a failed attempt falls back to a normal join.
+enum FastState : uint8_t { FAST_OFF, FAST_TRYING, FAST_OK, FAST_FALLBACK };
+static const uint32_t FAST_TIMEOUT_MS = 4000; // to association, not DHCP
+static volatile uint8_t fastState = FAST_OFF;
+static volatile bool fastFailed = false;
+static volatile bool fastSavePending = false;
+// The STA config still names the cached BSSID, so the driver's own
+// reconnects would only ever try that AP. The first disconnect after a fast
+// join re-issues WiFi.begin() by SSID alone.
+static volatile bool fastPinned = false;
+static volatile bool fastUnpinPending = false;
+static uint32_t fastStartMs = 0;
 
 void wifiNoSleep() {
   WiFi.setSleep(false);
@@ -36,9 +78,66 @@ void saveWifi() {
   prefs.putUChar("w_apChan", wifiCfg.apChan);
 }
 
+static bool loadFastConnect(uint8_t bssid[6], uint8_t &chan) {
+  if (prefs.getString("w_fastSsid", "") != wifiCfg.staSsid)
+    return false;
+  chan = prefs.getUChar("w_fastChan", 0);
+  return chan && prefs.getBytes("w_fastBssid", bssid, 6) == 6;
+}
+
+// Writes only when the AP or channel changed, so a normal boot costs no
+// flash write.
+static void saveFastConnect() {
+  const uint8_t *bssid = WiFi.BSSID();
+  uint8_t chan = WiFi.channel();
+  if (!bssid || !chan)
+    return;
+  uint8_t oldBssid[6];
+  uint8_t oldChan;
+  if (loadFastConnect(oldBssid, oldChan) && oldChan == chan &&
+      !memcmp(oldBssid, bssid, 6))
+    return;
+  prefs.putString("w_fastSsid", wifiCfg.staSsid);
+  prefs.putBytes("w_fastBssid", bssid, 6);
+  prefs.putUChar("w_fastChan", chan);
+  logInfo("wifi", "fast connect cached: ch%u", chan);
+}
+
+// Runs on the Arduino event task; NVS writes and reconnects are left to
+// wifiService().
+static void onStaEvent(arduino_event_id_t event, arduino_event_info_t) {
+  switch (event) {
+  case ARDUINO_EVENT_WIFI_STA_CONNECTED:
+    bootEvent(BootEvent::StaConnected);
+    if (fastState == FAST_TRYING)
+      fastState = FAST_OK;
+    break;
+  case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+    bootEvent(BootEvent::StaIp);
+    fastSavePending = true;
+    break;
+  case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+    if (fastState == FAST_TRYING)
+      fastFailed = true;
+    else if (fastPinned)
+      fastUnpinPending = true;
+    break;
+  default:
+    break;
+  }
+}
+
 void startWiFi() {
   wifiNoSleep();
 
+  static bool handlersSet = false;
+  if (!handlersSet) {
+    WiFi.onEvent(onStaEvent, ARDUINO_EVENT_WIFI_STA_CONNECTED);
+    WiFi.onEvent(onStaEvent, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+    WiFi.onEvent(onStaEvent, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+    handlersSet = true;
+  }
+
   if (wifiCfg.mode == "sta")
     WiFi.mode(WIFI_STA);
   else if (wifiCfg.mode == "ap") {
@@ -51,93 +150,238 @@ void startWiFi() {
   if (wifiCfg.mode != "sta") {
     bool ok = WiFi.softAP(wifiCfg.apSsid.c_str(), wifiCfg.apPass.c_str(),
                           wifiCfg.apChan);
-    logAll(String("AP ") + (ok ? "started" : "failed") +
-           " SSID=" + wifiCfg.apSsid + " IP=" + WiFi.softAPIP().toString());
+    logInfo("wifi", "AP %s SSID=%s IP=%s", ok ? "started" : "failed",
+            wifiCfg.apSsid, WiFi.softAPIP());
   }
 
   if (wifiCfg.mode != "ap" && wifiCfg.staSsid.length()) {
-    WiFi.begin(wifiCfg.staSsid.c_str(), wifiCfg.staPass.c_str());
-    logAll("STA connecting: " + wifiCfg.staSsid);
+    uint8_t bssid[6];
+    uint8_t chan;
+    if (loadFastConnect(bssid, chan)) {
+      fastState = FAST_TRYING;
+      fastFailed = false;
+      fastPinned = true;
+      fastUnpinPending = false;
+      fastStartMs = millis();
+      WiFi.begin(wifiCfg.staSsid.c_str(), wifiCfg.staPass.c_str(), chan,
+                 bssid);
+      logInfo("wifi", "STA fast connecting: %s ch%u", wifiCfg.staSsid, chan);
+    } else {
+      fastState = FAST_OFF;
+      fastPinned = false;
+      WiFi.begin(wifiCfg.staSsid.c_str(), wifiCfg.staPass.c_str());
+      logInfo("wifi", "STA connecting: %s", wifiCfg.staSsid);
+    }
   } else {
     // CRITICAL: Ensure no ghost connection from SDK NVS
     WiFi.disconnect(true);
   }
 }
 
-String doScan(bool forceFresh) {
-  // 1. Cache Check
-  const uint32_t cacheMs = 15000; // 15s cache
-  if (!forceFresh && lastScanMs != 0 && (millis() - lastScanMs) < cacheMs) {
-    if (lastScanJson.indexOf("\"count\":0") < 0)
-      return lastScanJson;
+void wifiService() {
+  if (fastState == FAST_TRYING &&
+      (fastFailed || millis() - fastStartMs > FAST_TIMEOUT_MS)) {
+    // The AP moved channel or was replaced: forget it and let the driver
+    // scan for the SSID.
+    fastState = FAST_FALLBACK;
+    fastPinned = false;
+    prefs.remove("w_fastChan");
+    logWarn("wifi", "fast connect failed, scanning for %s", wifiCfg.staSsid);
+    WiFi.disconnect();
+    WiFi.begin(wifiCfg.staSsid.c_str(), wifiCfg.staPass.c_str());
   }
-
-  // 2. Prep Radio
-  wifi_mode_t oldMode = WiFi.getMode();
-  bool switched = false;
-
-  // If we are strictly AP, we need AP_STA to scan properly on many cores
-  if (oldMode == WIFI_AP) {
-    WiFi.mode(WIFI_AP_STA);
-    switched = true;
-    delay(200); // Increased delay for stability
+  if (fastUnpinPending) {
+    // Clears bssid_set: the AP we fast-joined may be the one that died.
+    fastUnpinPending = false;
+    fastPinned = false;
+    logInfo("wifi", "STA lost, rejoining %s by SSID", wifiCfg.staSsid);
+    WiFi.disconnect();
+    WiFi.begin(wifiCfg.staSsid.c_str(), wifiCfg.staPass.c_str());
+  }
+  if (fastSavePending) {
+    fastSavePending = false;
+    saveFastConnect();
   }
+}
 
-  // Ensure any previous scan is cleared
-  WiFi.scanDelete();
-  delay(100);
+const char *wifiFastConnectState() {
+  static const char *NAMES[] = {"off", "trying", "ok", "fallback"};
+  return NAMES[fastState];
+}
 
-  Serial.println("Starting WiFi Scan...");
+static void pruneScanLocked(uint32_t now) {
+  scanCache.erase(std::remove_if(scanCache.begin(), scanCache.end(),
+                                 [now](const ScanEntry &e) {
+                                   return now - e.seenMs > SCAN_MAX_AGE_MS;
+                                 }),
+                  scanCache.end());
+}
 
-  // 3. Scan
-  // scanNetworks(async, show_hidden, passive, time_per_ch)
-  // Async=false (blocking)
-  int16_t n = WiFi.scanNetworks(false, true, false, 300);
-  Serial.printf("Scan found %d networks\n", n);
+static void mergeScanResultLocked(int16_t i, uint32_t now) {
+  const uint8_t *bssid = WiFi.BSSID(i);
+  if (!bssid)
+    return;
+  ScanEntry *e = nullptr;
+  for (ScanEntry &s : scanCache)
+    if (!memcmp(s.bssid, bssid, 6)) {
+      e = &s;
+      break;
+    }
+  if (!e && scanCache.size() < SCAN_CACHE_MAX) {
+    scanCache.emplace_back();
+    e = &scanCache.back();
+  } else if (!e) {
+    // Full: reuse the entry that has gone unseen the longest.
+    e = &*std::max_element(scanCache.begin(), scanCache.end(),
+                           [now](const ScanEntry &a, const ScanEntry &b) {
+                             return now - a.seenMs < now - b.seenMs;
+                           });
+  }
+  memcpy(e->bssid, bssid, 6);
+  e->ssid = WiFi.SSID(i);
+  e->rssi = (int8_t)WiFi.RSSI(i);
+  e->chan = WiFi.channel(i);
+  e->open = WiFi.encryptionType(i) == WIFI_AUTH_OPEN;
+  e->seenMs = now;
+}
 
-  // 4. Handle Result
-  JsonDocument doc;
-  doc["count"] = (n >= 0) ? n : 0;
+// Starts the scan for the next queued channel. The Arduino core answers
+// WIFI_SCAN_RUNNING once an async scan is under way.
+static bool beginQueuedScanLocked() {
+  uint8_t chan = scanQueue.back();
+  scanQueue.pop_back();
+  return WiFi.scanNetworks(true, true, false, SCAN_MS_PER_CHAN, chan) !=
+         WIFI_SCAN_FAILED;
+}
 
-  String note = "Scan Done.";
-  if (n == WIFI_SCAN_FAILED)
-    note = "Scan Failed (-1). Try again.";
-  else if (n == WIFI_SCAN_RUNNING)
-    note = "Scan Running (-2).";
-  else if (n == 0)
-    note = "No networks found.";
+// Runs on the Arduino event task. The core has already copied the records
+// into its scan list, so read them, free them and start the next channel.
+static void onScanDone(arduino_event_id_t, arduino_event_info_t) {
+  int16_t n = WiFi.scanComplete();
+  uint32_t now = millis();
+  bool restoreAp = false;
+  uint16_t seen = 0;
+  {
+    ScanLock lock;
+    if (!scanning) {
+      WiFi.scanDelete();
+      return;
+    }
+    for (int16_t i = 0; i < n; i++)
+      mergeScanResultLocked(i, now);
+    WiFi.scanDelete();
+    if (n > 0)
+      scanSeen += n;
+    if (n >= 0 && !scanQueue.empty() && beginQueuedScanLocked())
+      return;
 
-  doc["note"] = note;
-  doc["debug_code"] = n;
+    pruneScanLocked(now);
+    scanning = false;
+    scanDoneMs = now;
+    scanQueue.clear();
+    if (n < 0)
+      scanNote = "Scan failed. Try again.";
+    else if (!scanSeen)
+      scanNote = "No networks found.";
+    else
+      scanNote = "Scan done.";
+    seen = scanSeen;
+    restoreAp = scanSwitchedMode;
+    scanSwitchedMode = false;
+  }
+  if (restoreAp)
+    WiFi.mode(WIFI_AP);
+  logInfo("wifi", "scan done: %u BSSIDs%s", seen, n < 0 ? " (failed)" : "");
+  stateNotify();
+}
 
-  JsonArray arr = doc["networks"].to<JsonArray>();
-  if (n > 0) {
-    for (int i = 0; i < n; i++) {
-      JsonObject o = arr.add<JsonObject>();
-      o["ssid"] = WiFi.SSID(i);
-      o["rssi"] = WiFi.RSSI(i);
-      o["chan"] = WiFi.channel(i);
-      o["open"] = (WiFi.encryptionType(i) == WIFI_AUTH_OPEN);
+bool startWifiScan(const std::vector<uint8_t> &channels) {
+  static bool handlerSet = false;
+  {
+    ScanLock lock;
+    if (scanning)
+      return false;
+    if (!handlerSet) {
+      WiFi.onEvent(onScanDone, ARDUINO_EVENT_WIFI_SCAN_DONE);
+      handlerSet = true;
     }
+    scanning = true;
+    scanSeen = 0;
+    scanQueue.assign(channels.rbegin(), channels.rend());
+    if (scanQueue.empty())
+      scanQueue.push_back(0);
   }
 
-  // 5. Cleanup
-  WiFi.scanDelete();
+  // Scanning needs the STA interface. AP-only goes to AP+STA until the scan
+  // is done; the AP keeps running, so its clients stay connected.
+  bool switched = WiFi.getMode() == WIFI_AP;
+  if (switched)
+    WiFi.mode(WIFI_AP_STA);
 
-  if (switched) {
-    // Return to AP-only mode if we were there
-    WiFi.mode(WIFI_AP);
+  bool ok;
+  {
+    ScanLock lock;
+    scanSwitchedMode = switched;
+    ok = beginQueuedScanLocked();
+    if (!ok) {
+      scanning = false;
+      scanSwitchedMode = false;
+      scanQueue.clear();
+      scanNote = "Scan failed to start. Try again.";
+    }
   }
+  if (!ok && switched)
+    WiFi.mode(WIFI_AP);
+  stateNotify();
+  return ok;
+}
 
-  String out;
-  serializeJson(doc, out);
-  lastScanJson = out;
-  lastScanMs = millis();
-  return lastScanJson;
+bool wifiScanRunning() {
+  ScanLock lock;
+  return scanning;
+}
+
+void wifiScanToJson(JsonDocument &doc) {
+  ScanLock lock;
+  uint32_t now = millis();
+  pruneScanLocked(now);
+  std::vector<const ScanEntry *> order;
+  order.reserve(scanCache.size());
+  for (const ScanEntry &e : scanCache)
+    order.push_back(&e);
+  std::sort(order.begin(), order.end(),
+            [](const ScanEntry *a, const ScanEntry *b) {
+              return a->rssi > b->rssi;
+            });
+
+  JsonArray arr = doc["networks"].to<JsonArray>();
+  for (const ScanEntry *e : order) {
+    char bssid[18];
+    snprintf(bssid, sizeof(bssid), "%02x:%02x:%02x:%02x:%02x:%02x",
+             e->bssid[0], e->bssid[1], e->bssid[2], e->bssid[3], e->bssid[4],
+             e->bssid[5]);
+    JsonObject o = arr.add<JsonObject>();
+    o["ssid"] = e->ssid;
+    o["bssid"] = bssid;
+    o["rssi"] = e->rssi;
+    o["chan"] = e->chan;
+    o["open"] = e->open;
+    o["ageS"] = (now - e->seenMs) / 1000;
+  }
+  doc["count"] = order.size();
+  doc["scanning"] = scanning;
+  if (scanDoneMs)
+    doc["ageMs"] = now - scanDoneMs;
+  else
+    doc["ageMs"] = nullptr;
+  doc["note"] = scanNote;
 }
 
 void bootScanTask(void *) {
-  vTaskDelay(1200 / portTICK_PERIOD_MS);
-  doScan(true);
+  // A scan takes the radio off-channel; let the STA associate first.
+  bool joining = wifiCfg.mode != "ap" && wifiCfg.staSsid.length();
+  for (int i = 0; i < 100 && joining && WiFi.status() != WL_CONNECTED; i++)
+    vTaskDelay(100 / portTICK_PERIOD_MS);
+  startWifiScan({});
   vTaskDelete(nullptr);
 }
@@ -0,0 +1,377 @@
+#include "WsBroadcast.h"
+#include "Trace.h"
+#include <deque>
+#include <freertos/queue.h>
+#include <memory>
+#include <vector>
+
+using WsPayload = std::shared_ptr<std::vector<uint8_t>>;
+
+struct WsMsg {
+  WsPayload data;
+  bool binary = false;
+  const char *key = nullptr;
+};
+
+struct WsChannel {
+  AsyncWebSocket *ws = nullptr;
+  WsPolicy policy = WsPolicy::DropOldest;
+  size_t maxMsgs = 0;
+  size_t maxBytes = 0;
+  // Totals of clients that have since gone away.
+  uint32_t clientsSeen = 0;
+  uint32_t drops = 0;
+  uint32_t coalesced = 0;
+  uint32_t kicked = 0;
+  uint64_t bytesSent = 0;
+};
+
+struct WsClientQueue {
+  WsChannel *ch = nullptr;
+  uint32_t id = 0;
+  uint32_t sinceMs = 0;
+  std::deque<WsMsg> q;
+  size_t queuedBytes = 0;
+  size_t maxDepth = 0;
+  uint32_t sent = 0;
+  uint32_t drops = 0;
+  uint32_t coalesced = 0;
+  uint64_t bytesSent = 0;
+  bool kicked = false;
+};
+
+// Connect/disconnect arrive on the async_tcp task with the library's own
+// lock held, while everyone else takes wsMutex before calling into the
+// library. So nothing there may take wsMutex: the events, and any text the
+// connect handler wants to send (wsQueueText), are only posted here and
+// applied under wsMutex by whoever sends or pumps next.
+enum class WsEventKind : uint8_t { Connect, Disconnect, Text };
+
+struct WsEvent {
+  AsyncWebSocket *ws;
+  uint32_t id;
+  WsEventKind kind;
+  std::vector<uint8_t> *text; // Text only; owned by the event
+};
+
+static std::vector<WsChannel> channels;
+static std::vector<WsClientQueue> queues;
+static QueueHandle_t wsEvents = nullptr;
+static SemaphoreHandle_t wsMutex = xSemaphoreCreateMutex();
+
+struct WsLock {
+  WsLock() { xSemaphoreTake(wsMutex, portMAX_DELAY); }
+  ~WsLock() { xSemaphoreGive(wsMutex); }
+};
+
+static WsChannel *channelFor(AsyncWebSocket *ws) {
+  for (auto &ch : channels)
+    if (ch.ws == ws)
+      return &ch;
+  return nullptr;
+}
+
+static WsClientQueue *queueFor(WsChannel *ch, uint32_t id) {
+  for (auto &q : queues)
+    if (q.ch == ch && q.id == id)
+      return &q;
+  return nullptr;
+}
+
+static WsClientQueue &addQueue(WsChannel *ch, uint32_t id) {
+  WsClientQueue q;
+  q.ch = ch;
+  q.id = id;
+  q.sinceMs = millis();
+  queues.push_back(q);
+  ch->clientsSeen++;
+  return queues.back();
+}
+
+static void retireQueue(size_t i) {
+  WsClientQueue &q = queues[i];
+  q.ch->drops += q.drops + q.q.size();
+  q.ch->coalesced += q.coalesced;
+  q.ch->bytesSent += q.bytesSent;
+  queues.erase(queues.begin() + i);
+}
+
+static void enqueueLocked(WsClientQueue &q, const WsMsg &m);
+
+// Caller holds wsMutex.
+static void applyEventsLocked() {
+  WsEvent e;
+  while (wsEvents && xQueueReceive(wsEvents, &e, 0) == pdTRUE) {
+    WsPayload text(e.text);
+    WsChannel *ch = channelFor(e.ws);
+    if (!ch)
+      continue;
+    if (e.kind == WsEventKind::Connect) {
+      if (!queueFor(ch, e.id))
+        addQueue(ch, e.id);
+      continue;
+    }
+    if (e.kind == WsEventKind::Text) {
+      // No queue means the client is already gone (or its connect was lost).
+      if (WsClientQueue *q = queueFor(ch, e.id)) {
+        WsMsg m;
+        m.data = text;
+        enqueueLocked(*q, m);
+      }
+      continue;
+    }
+    for (size_t i = 0; i < queues.size(); i++)
+      if (queues[i].ch == ch && queues[i].id == e.id) {
+        retireQueue(i);
+        break;
+      }
+  }
+}
+
+// Caller holds wsMutex. Returns false once the client is gone.
+static bool drainLocked(WsClientQueue &q) {
+  AsyncWebSocketClient *c = q.ch->ws->client(q.id);
+  if (!c)
+    return false;
+  while (!q.q.empty() && c->canSend()) {
+    WsMsg &m = q.q.front();
+    size_t len = m.data->size();
+    if (m.binary)
+      c->binary((uint8_t *)m.data->data(), len);
+    else
+      c->text((const char *)m.data->data(), len);
+    q.sent++;
+    q.bytesSent += len;
+    q.queuedBytes -= len;
+    q.q.pop_front();
+  }
+  return true;
+}
+
+// Caller holds wsMutex.
+static void enqueueLocked(WsClientQueue &q, const WsMsg &m) {
+  if (q.kicked)
+    return;
+  WsChannel &ch = *q.ch;
+  size_t len = m.data->size();
+
+  if (ch.policy == WsPolicy::Coalesce && m.key) {
+    for (auto &old : q.q) {
+      if (!old.key || strcmp(old.key, m.key) != 0)
+        continue;
+      q.queuedBytes = q.queuedBytes - old.data->size() + len;
+      old = m;
+      q.coalesced++;
+      return;
+    }
+  }
+
+  q.q.push_back(m);
+  q.queuedBytes += len;
+  if (q.q.size() > q.maxDepth)
+    q.maxDepth = q.q.size();
+
+  // Always keep the newest message, even if it alone is over maxBytes.
+  while (q.q.size() > 1 &&
+         (q.q.size() > ch.maxMsgs || q.queuedBytes > ch.maxBytes)) {
+    if (ch.policy == WsPolicy::NeverDrop) {
+      AsyncWebSocketClient *c = ch.ws->client(q.id);
+      if (c)
+        c->close(1013, "send queue full");
+      q.kicked = true;
+      ch.kicked++;
+      q.drops += q.q.size();
+      q.q.clear();
+      q.queuedBytes = 0;
+      return;
+    }
+    q.queuedBytes -= q.q.front().data->size();
+    q.q.pop_front();
+    q.drops++;
+  }
+}
+
+static WsPayload makePayload(const uint8_t *data, size_t len) {
+  return std::make_shared<std::vector<uint8_t>>(data, data + len);
+}
+
+void setupWsQueues() {
+  struct Spec {
+    AsyncWebSocket *ws;
+    WsPolicy policy;
+    size_t maxMsgs;
+    size_t maxBytes;
+  };
+  static const Spec SPECS[] = {
+      {&wsLog, WsPolicy::DropOldest, 32, 8 * 1024},
+      {&wsProxy, WsPolicy::DropOldest, 64, 16 * 1024},
+      {&wsState, WsPolicy::Coalesce, 16, 8 * 1024},
+      {&wsDisc, WsPolicy::NeverDrop, 128, 32 * 1024},
+      {&wsTerm, WsPolicy::NeverDrop, 256, 64 * 1024},
+  };
+  WsLock lock;
+  if (!wsEvents)
+    wsEvents = xQueueCreate(32, sizeof(WsEvent));
+  channels.clear();
+  channels.reserve(sizeof(SPECS) / sizeof(SPECS[0]));
+  for (const Spec &s : SPECS) {
+    WsChannel ch;
+    ch.ws = s.ws;
+    ch.policy = s.policy;
+    ch.maxMsgs = s.maxMsgs;
+    ch.maxBytes = s.maxBytes;
+    channels.push_back(ch);
+  }
+}
+
+void wsClientEvent(AsyncWebSocket &ws, AsyncWebSocketClient *c,
+                   AwsEventType t) {
+  if (!wsEvents || (t != WS_EVT_CONNECT && t != WS_EVT_DISCONNECT))
+    return;
+  WsEvent e;
+  e.ws = &ws;
+  e.id = c->id();
+  e.kind =
+      t == WS_EVT_CONNECT ? WsEventKind::Connect : WsEventKind::Disconnect;
+  e.text = nullptr;
+  // If this is full, a lost connect is made up by the first direct send and
+  // a lost disconnect by the next drain not finding the client.
+  xQueueSend(wsEvents, &e, 0);
+}
+
+void wsQueueText(AsyncWebSocket &ws, uint32_t id, const String &s) {
+  if (!wsEvents)
+    return;
+  WsEvent e;
+  e.ws = &ws;
+  e.id = id;
+  e.kind = WsEventKind::Text;
+  e.text = new std::vector<uint8_t>(s.c_str(), s.c_str() + s.length());
+  if (xQueueSend(wsEvents, &e, 0) != pdTRUE)
+    delete e.text;
+}
+
+void wsPump() {
+  WsLock lock;
+  applyEventsLocked();
+  for (size_t i = 0; i < queues.size();) {
+    if (drainLocked(queues[i]))
+      i++;
+    else
+      retireQueue(i);
+  }
+}
+
+void wsBroadcast(AsyncWebSocket &ws, const String &s, const char *key) {
+  TraceScope span("wsBroadcast");
+  WsLock lock;
+  applyEventsLocked();
+  WsChannel *ch = channelFor(&ws);
+  if (!ch) {
+    ws.textAll(s);
+    return;
+  }
+  WsMsg m;
+  m.data = makePayload((const uint8_t *)s.c_str(), s.length());
+  m.key = key;
+  for (size_t i = 0; i < queues.size();) {
+    WsClientQueue &q = queues[i];
+    if (q.ch != ch) {
+      i++;
+      continue;
+    }
+    enqueueLocked(q, m);
+    if (drainLocked(q))
+      i++;
+    else
+      retireQueue(i);
+  }
+}
+
+static void sendTo(AsyncWebSocket &ws, uint32_t id, const uint8_t *data,
+                   size_t len, bool binary) {
+  TraceScope span("wsSend");
+  WsLock lock;
+  applyEventsLocked();
+  WsChannel *ch = channelFor(&ws);
+  if (!ch) {
+    if (binary)
+      ws.binary(id, (uint8_t *)data, len);
+    else
+      ws.text(id, (const char *)data, len);
+    return;
+  }
+  WsClientQueue *q = queueFor(ch, id);
+  if (!q) {
+    // Its connect event was lost to a full event queue.
+    if (!ws.client(id))
+      return;
+    q = &addQueue(ch, id);
+  }
+  WsMsg m;
+  m.data = makePayload(data, len);
+  m.binary = binary;
+  enqueueLocked(*q, m);
+  drainLocked(*q);
+}
+
+void wsSendText(AsyncWebSocket &ws, uint32_t id, const String &s) {
+  sendTo(ws, id, (const uint8_t *)s.c_str(), s.length(), false);
+}
+
+void wsSendBinary(AsyncWebSocket &ws, uint32_t id, const uint8_t *data,
+                  size_t len) {
+  sendTo(ws, id, data, len, true);
+}
+
+static const char *policyName(WsPolicy p) {
+  switch (p) {
+  case WsPolicy::DropOldest:
+    return "drop-oldest";
+  case WsPolicy::Coalesce:
+    return "coalesce";
+  default:
+    return "never-drop";
+  }
+}
+
+void wsStatsToJson(JsonArray out) {
+  WsLock lock;
+  applyEventsLocked();
+  uint32_t now = millis();
+  for (auto &ch : channels) {
+    JsonObject o = out.add<JsonObject>();
+    o["path"] = ch.ws->url();
+    o["policy"] = policyName(ch.policy);
+    o["maxMsgs"] = ch.maxMsgs;
+    o["maxBytes"] = ch.maxBytes;
+    o["clientsSeen"] = ch.clientsSeen;
+    o["kicked"] = ch.kicked;
+
+    uint32_t drops = ch.drops, coalesced = ch.coalesced;
+    uint64_t bytesSent = ch.bytesSent;
+    JsonArray clients = o["clients"].to<JsonArray>();
+    for (auto &q : queues) {
+      if (q.ch != &ch)
+        continue;
+      JsonObject c = clients.add<JsonObject>();
+      c["id"] = q.id;
+      c["ageMs"] = now - q.sinceMs;
+      c["depth"] = q.q.size();
+      c["queuedBytes"] = q.queuedBytes;
+      c["maxDepth"] = q.maxDepth;
+      c["sent"] = q.sent;
+      c["bytesSent"] = q.bytesSent;
+      c["drops"] = q.drops;
+      c["coalesced"] = q.coalesced;
+      if (q.kicked)
+        c["kicked"] = true;
+      drops += q.drops;
+      coalesced += q.coalesced;
+      bytesSent += q.bytesSent;
+    }
+    o["drops"] = drops;
+    o["coalesced"] = coalesced;
+    o["bytesSent"] = bytesSent;
+  }
+}
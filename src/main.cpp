@@ -1,11 +1,16 @@
 #include "AVDiscovery.h"
 #include "AppConfig.h"
+#include "BootTiming.h"
 #include "CaptureProxy.h"
 #include "ConfigManager.h"
+#include "JobQueue.h"
+#include "LogStore.h"
+#include "StateChannel.h"
 #include "TerminalHandler.h"
 #include "Utils.h"
 #include "WebAPI.h"
 #include "WiFiHelper.h"
+#include "WsBroadcast.h"
 #include <ESPmDNS.h>
 #include <LittleFS.h>
 
@@ -15,54 +20,71 @@ AsyncWebSocket wsLog("/ws");
 AsyncWebSocket wsTerm("/term");
 AsyncWebSocket wsProxy("/wsproxy");
 AsyncWebSocket wsDisc("/wsdisc");
+AsyncWebSocket wsState("/wsstate");
 
 Preferences prefs;
 uint32_t bootMs;
 bool shouldReboot = false;
 
-void logAll(const String &s) {
-  Serial.println(s);
-  wsTextAll(wsLog, s);
-}
+void wsTextAll(AsyncWebSocket &ws, const String &s) { wsBroadcast(ws, s); }
+
+// Mounting LittleFS (seconds when it has to format) doesn't depend on
+// NVS, WiFi or mDNS, so it runs on the other core while those start.
+static SemaphoreHandle_t fsMounted = xSemaphoreCreateBinary();
+static bool fsOk = false;
 
-void wsTextAll(AsyncWebSocket &ws, const String &s) { ws.textAll(s); }
+static void fsMountTask(void *) {
+  fsOk = LittleFS.begin(true);
+  xSemaphoreGive(fsMounted);
+  vTaskDelete(nullptr);
+}
 
 void setup() {
   Serial.begin(115200);
-  delay(150);
   bootMs = millis();
+  setupLog();
+  xTaskCreatePinnedToCore(fsMountTask, "fsMount", 4096, nullptr, 2, nullptr,
+                          0);
 
-  if (!LittleFS.begin(true)) {
-    Serial.println("LittleFS mount failed");
-  }
-
+  // The STA associates in the background from here on, so start it first.
   prefs.begin("avtool", false);
   loadWifi();
-  loadCfg();
-
   startWiFi();
+  bootPhase("wifi");
 
-  xTaskCreatePinnedToCore(bootScanTask, "bootScan", 4096, nullptr, 1, nullptr,
-                          1);
-  startLearn();
+  loadTermCfg();
+  if (!MDNS.begin("esp32-av-tool"))
+    logWarn("app", "mDNS responder failed to start");
+  setupWsQueues();
+  setupJobs();
+  bootPhase("nvs+mdns");
 
-  if (!MDNS.begin("esp32-av-tool")) {
-    Serial.println("Error setting up MDNS responder!");
-  }
+  xSemaphoreTake(fsMounted, portMAX_DELAY);
+  if (!fsOk)
+    logError("app", "LittleFS mount failed");
+  bootPhase("fs");
+
+  setupLogStore();
+  loadCfg();
+  bootPhase("config");
 
+  startLearn();
   setupRoutes();
   server.begin();
+  bootPhase("http");
 
-  xTaskCreatePinnedToCore(termPumpTask, "termPump", 6144, nullptr, 1, nullptr,
+  xTaskCreatePinnedToCore(bootScanTask, "bootScan", 4096, nullptr, 1, nullptr,
                           1);
   xTaskCreatePinnedToCore(deviceMonitorTask, "devMon", 6144, nullptr, 1,
                           nullptr, 1);
 
-  logAll(String("Ready FW ") + FW_VERSION + " UI: /  OTA: /update");
+  logInfo("app", "Ready FW %s UI: /  OTA: /update (%u ms)", FW_VERSION,
+          millis());
 }
 
 void loop() {
   if (shouldReboot) {
+    logStoreFlush(); // a no-op after a filesystem OTA (logStoreSuspend)
     delay(500);
     ESP.restart();
   }
@@ -70,4 +92,15 @@ void loop() {
   wsTerm.cleanupClients();
   wsProxy.cleanupClients();
   wsDisc.cleanupClients();
+  wsState.cleanupClients();
+  stateService();
+  wsPump();
+  wifiService();
+
+  static uint32_t lastServiceMs = 0;
+  if (millis() - lastServiceMs > 1000) {
+    lastServiceMs = millis();
+    termService();
+    proxyService();
+  }
 }
@@ -0,0 +1,114 @@
+"""Stage data/ for the LittleFS image with precompressed, content-hashed assets.
+
+Runs as a PlatformIO pre-script (see platformio.ini), pointing the filesystem
+build at .pio/assets instead of data/. Can also be run by hand:
+
+    python tools/build_assets.py [src_dir] [out_dir]
+
+For every file it writes the original and a gzip variant (`name.gz`).
+Scripts and stylesheets are renamed to `name.<hash>.ext` and index.html is
+rewritten to reference them, so the server can mark them immutable. Brotli
+is not produced: browsers only advertise `br` over HTTPS and the device
+serves plain HTTP.
+
+/assets.json lists each URL with its file, strong ETag (content hash), MIME
+type and whether it is immutable; AssetServer.cpp serves from it.
+"""
+
+import gzip
+import hashlib
+import json
+import os
+import re
+import shutil
+import sys
+
+HASHED_EXT = (".js", ".css")
+MIME = {
+    ".html": "text/html",
+    ".js": "application/javascript",
+    ".css": "text/css",
+    ".json": "application/json",
+    ".svg": "image/svg+xml",
+    ".png": "image/png",
+    ".ico": "image/x-icon",
+}
+
+
+def content_hash(data):
+    return hashlib.sha256(data).hexdigest()[:16]
+
+
+def write(path, data):
+    with open(path, "wb") as f:
+        f.write(data)
+
+
+def stage(src, out):
+    if os.path.isdir(out):
+        shutil.rmtree(out)
+    os.makedirs(out)
+
+    names = sorted(n for n in os.listdir(src)
+                   if os.path.isfile(os.path.join(src, n)))
+    renamed = {}
+    blobs = {}
+    for name in names:
+        with open(os.path.join(src, name), "rb") as f:
+            blobs[name] = f.read()
+        stem, ext = os.path.splitext(name)
+        if ext in HASHED_EXT:
+            renamed[name] = "%s.%s%s" % (stem, content_hash(blobs[name])[:8], ext)
+
+    # Point HTML at the hashed names.
+    for name in names:
+        if name.endswith(".html"):
+            html = blobs[name].decode("utf-8")
+            for old, new in renamed.items():
+                html = re.sub(r'(src|href)="/?%s"' % re.escape(old),
+                              r'\1="%s"' % new, html)
+            blobs[name] = html.encode("utf-8")
+
+    files = []
+    total = total_gz = 0
+    for name in names:
+        data = blobs[name]
+        target = renamed.get(name, name)
+        write(os.path.join(out, target), data)
+        gz = gzip.compress(data, 9, mtime=0)
+        use_gz = len(gz) < len(data)
+        if use_gz:
+            write(os.path.join(out, target + ".gz"), gz)
+        total += len(data)
+        total_gz += len(gz) if use_gz else len(data)
+        entry = {
+            "url": "/" + target,
+            "file": "/" + target,
+            "etag": content_hash(data),
+            "type": MIME.get(os.path.splitext(name)[1], "application/octet-stream"),
+            "immutable": name in renamed,
+            "gz": use_gz,
+        }
+        files.append(entry)
+        if name == "index.html":
+            files.append(dict(entry, url="/"))
+
+    write(os.path.join(out, "assets.json"),
+          json.dumps({"files": files}, separators=(",", ":")).encode())
+    print("assets: %d files, %d -> %d bytes gzipped" % (len(names), total, total_gz))
+
+
+try:
+    Import("env")  # noqa: F821 (PlatformIO/SCons)
+except NameError:
+    env = None
+
+if env is not None:
+    src_dir = env.subst("$PROJECT_DATA_DIR")
+    out_dir = os.path.join(env.subst("$PROJECT_DIR"), ".pio", "assets")
+    stage(src_dir, out_dir)
+    env.Replace(PROJECT_DATA_DIR=out_dir)
+elif __name__ == "__main__":
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    stage(sys.argv[1] if len(sys.argv) > 1 else os.path.join(root, "data"),
+          sys.argv[2] if len(sys.argv) > 2 else os.path.join(root, ".pio", "assets"))
@@ -0,0 +1,124 @@
+"""Update the web UI on a running device file by file, without a LittleFS image.
+
+    python tools/push_assets.py <device> [src_dir]
+
+Stages src_dir (default data/) exactly as build_assets.py does for the
+filesystem image, fetches the device's /api/assets manifest and uploads only
+the files whose content hash differs, each with its SHA-256 so the device can
+check it. The device only stages them (as name.new, tagged with the new
+manifest's SHA-256). The new assets.json goes last and commits: the device
+renames the staged files into place, removes files only the old manifest
+listed and serves the new set. Logs, captures and config on the filesystem
+are left alone.
+
+Exits non-zero if any upload fails; the manifest is not pushed in that case,
+so the device keeps serving the previous UI, index.html included.
+"""
+
+import hashlib
+import json
+import os
+import shutil
+import sys
+import tempfile
+import urllib.error
+import urllib.parse
+import urllib.request
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import build_assets  # noqa: E402
+
+
+def request(base, path, data=None):
+    req = urllib.request.Request(base + path, data=data)
+    if data is not None:
+        req.add_header("Content-Type", "application/octet-stream")
+    try:
+        with urllib.request.urlopen(req, timeout=60) as r:
+            return r.status, json.loads(r.read() or b"{}")
+    except urllib.error.HTTPError as e:
+        body = e.read()
+        try:
+            return e.code, json.loads(body)
+        except ValueError:
+            return e.code, {"error": body.decode("utf-8", "replace")}
+
+
+def file_sha256(staged, name):
+    with open(os.path.join(staged, name.lstrip("/")), "rb") as f:
+        return hashlib.sha256(f.read()).hexdigest()
+
+
+def upload(base, staged, name, manifest_sha=None):
+    with open(os.path.join(staged, name.lstrip("/")), "rb") as f:
+        data = f.read()
+    params = {"path": name, "sha256": hashlib.sha256(data).hexdigest()}
+    if manifest_sha:
+        params["manifest"] = manifest_sha
+    query = urllib.parse.urlencode(params)
+    status, res = request(base, "/api/assets/file?" + query, data)
+    if status != 200:
+        print("  %-32s FAILED %d %s" % (name, status, res.get("error", "")))
+        for m in res.get("missing", []):
+            print("    missing %s" % m)
+        return None
+    print("  %-32s %7d B" % (name, len(data)))
+    return res
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__.strip())
+        return 2
+    host = sys.argv[1]
+    base = host if "://" in host else "http://" + host
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    src = sys.argv[2] if len(sys.argv) > 2 else os.path.join(root, "data")
+    staged = tempfile.mkdtemp(prefix="assets-")
+    try:
+        return push(base, src, staged)
+    finally:
+        shutil.rmtree(staged, ignore_errors=True)
+
+
+def push(base, src, staged):
+    build_assets.stage(src, staged)
+    with open(os.path.join(staged, "assets.json")) as f:
+        files = json.load(f)["files"]
+
+    status, current = request(base, "/api/assets")
+    if status != 200:
+        print("GET /api/assets failed: %d %s" % (status, current.get("error")))
+        return 1
+    have = {e["file"]: e for e in current.get("files", [])}
+
+    # Nothing goes live before the manifest commits, so order doesn't matter.
+    todo, skipped = [], 0
+    for e in {e["file"]: e for e in files}.values():
+        old = have.get(e["file"])
+        if old and old["etag"] == e["etag"] and old.get("gz") == e["gz"]:
+            skipped += 1
+            continue
+        todo.append(e["file"])
+        if e["gz"]:
+            todo.append(e["file"] + ".gz")
+
+    if not todo and current == {"files": files}:
+        print("device is up to date (%d files)" % skipped)
+        return 0
+    print("%d files to upload, %d unchanged" % (len(todo), skipped))
+    manifest_sha = file_sha256(staged, "/assets.json")
+    for name in todo:
+        if upload(base, staged, name, manifest_sha) is None:
+            return 1
+    res = upload(base, staged, "/assets.json")
+    if res is None:
+        return 1
+    print("  installed %d staged files" % res.get("installed", 0))
+    for r in res.get("removed", []):
+        print("  removed %s" % r)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())